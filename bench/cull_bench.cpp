@@ -0,0 +1,94 @@
+/* Frustum culling throughput: objects culled per millisecond for every
+ * kernel and thread count, at 100k to 1M objects.
+ *
+ * usage: bench/cull_bench [iterations] */
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../cull.h"
+#include "../frame_pacer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using std::vector;
+using std::cout; using std::endl;
+
+/* Objects scattered over a square city block seen by a camera in its
+ * middle; about a fifth of them end up visible */
+static void generate(cull_volumes_t &volumes, size_t count)
+{
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-1000.f, 1000.f);
+    std::uniform_real_distribution<float> height(0.f, 50.f);
+    std::uniform_real_distribution<float> extent(0.5f, 8.f);
+    volumes.resize(count);
+    for (size_t i = 0; i != count; i++) {
+        float c[3] = {position(rng), height(rng), position(rng)};
+        float e[3] = {extent(rng), extent(rng), extent(rng)};
+        float lo[3] = {c[0] - e[0], c[1] - e[1], c[2] - e[2]};
+        float hi[3] = {c[0] + e[0], c[1] + e[1], c[2] + e[2]};
+        volumes.set(i, lo, hi);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? std::max(1, atoi(argv[1])) : 20;
+    glm::mat4 projection = glm::perspective(glm::radians(70.f), 16.f / 9.f,
+            0.1f, 800.f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.f, 20.f, 0.f),
+            glm::vec3(100.f, 15.f, 50.f), glm::vec3(0.f, 1.f, 0.f));
+    frustum_t frustum = frustum_from_matrix(projection * view);
+
+    vector<cull_kernel_t> kernels = {CULL_KERNEL_SCALAR};
+    if (best_cull_kernel() != CULL_KERNEL_SCALAR) {
+        kernels.push_back(CULL_KERNEL_SSE);
+    }
+    if (best_cull_kernel() == CULL_KERNEL_AVX2) {
+        kernels.push_back(CULL_KERNEL_AVX2);
+    }
+    vector<uint32_t> threadCounts = {1};
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t t = 2; t <= cores; t *= 2) {
+        threadCounts.push_back(t);
+    }
+
+    cout << std::setw(8) << "objects" << std::setw(8) << "kernel"
+        << std::setw(8) << "threads" << std::setw(10) << "visible"
+        << std::setw(12) << "ms" << std::setw(16) << "objects/ms" << endl;
+    const size_t counts[] = {100000, 250000, 500000, 1000000};
+    cull_volumes_t volumes;
+    vector<uint32_t> visible;
+    for (size_t count : counts) {
+        generate(volumes, count);
+        for (cull_kernel_t kernel : kernels) {
+            for (uint32_t threads : threadCounts) {
+                /* Warm up, then keep the best run to hide scheduler noise */
+                cull_objects(volumes, frustum, visible, threads, kernel);
+                uint64_t best = (uint64_t)-1;
+                for (int i = 0; i != iterations; i++) {
+                    uint64_t start = monotonic_ns();
+                    cull_objects(volumes, frustum, visible, threads, kernel);
+                    best = std::min(best, monotonic_ns() - start);
+                }
+                double ms = (double)best / 1e6;
+                cout << std::setw(8) << count << std::setw(8)
+                    << cull_kernel_name(kernel) << std::setw(8) << threads
+                    << std::setw(10) << visible.size() << std::setw(12)
+                    << std::fixed << std::setprecision(3) << ms
+                    << std::setw(16) << std::setprecision(0)
+                    << (double)count / ms << endl;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,160 @@
+/* State-sorted draw submission: how long sorting 100k draw keys takes per
+ * thread count against std::sort, and how many binds a recorder issues
+ * and how long it takes with the draws unsorted or sorted.
+ *
+ * usage: bench/draw_sort_bench [iterations] */
+
+#include "../draw_sort.h"
+#include "../frame_pacer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using std::vector;
+using std::cout; using std::endl;
+
+const size_t DRAWS = 100000;
+const uint32_t PIPELINES = 16;
+const uint32_t DESCRIPTORS = 64;
+const uint32_t MATERIALS = 256;
+
+/* Commands of the mock command buffer the recorders write */
+enum {
+    CMD_BIND_PIPELINE,
+    CMD_BIND_DESCRIPTOR,
+    CMD_BIND_MATERIAL,
+    CMD_DRAW
+};
+
+/* Draws in the order a scene traversal would find them: state all over
+ * the place */
+static void generate(vector<draw_item_t> &items)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<uint32_t> pipeline(0, PIPELINES - 1);
+    std::uniform_int_distribution<uint32_t> descriptor(0, DESCRIPTORS - 1);
+    std::uniform_int_distribution<uint32_t> material(0, MATERIALS - 1);
+    std::uniform_real_distribution<float> depth(0.f, 1.f);
+    items.resize(DRAWS);
+    for (size_t i = 0; i != DRAWS; i++) {
+        items[i].key = make_draw_key(0, pipeline(rng), descriptor(rng),
+                material(rng), depth(rng));
+        items[i].draw = (uint32_t)i;
+    }
+}
+
+/* Record the draws, binding only what the tracker says changed. A
+ * tracker that is never consulted stands for binding everything */
+static void record(const vector<draw_item_t> &items, bool track,
+        vector<uint32_t> &commands, draw_state_tracker &tracker)
+{
+    commands.clear();
+    tracker.reset();
+    for (const draw_item_t &item : items) {
+        uint32_t binds = DRAW_BIND_PIPELINE | DRAW_BIND_DESCRIPTOR
+            | DRAW_BIND_MATERIAL;
+        if (track) {
+            binds = tracker.binds_for(item.key);
+        }
+        if (binds & DRAW_BIND_PIPELINE) {
+            commands.push_back(CMD_BIND_PIPELINE);
+            commands.push_back(draw_key_pipeline(item.key));
+        }
+        if (binds & DRAW_BIND_DESCRIPTOR) {
+            commands.push_back(CMD_BIND_DESCRIPTOR);
+            commands.push_back(draw_key_descriptor(item.key));
+        }
+        if (binds & DRAW_BIND_MATERIAL) {
+            commands.push_back(CMD_BIND_MATERIAL);
+            commands.push_back(draw_key_material(item.key));
+        }
+        commands.push_back(CMD_DRAW);
+        commands.push_back(item.draw);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? std::max(1, atoi(argv[1])) : 20;
+    vector<draw_item_t> unsorted, items, scratch;
+    generate(unsorted);
+
+    vector<uint32_t> threadCounts = {1};
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t t = 2; t <= cores; t *= 2) {
+        threadCounts.push_back(t);
+    }
+
+    cout << std::setw(12) << "sort" << std::setw(8) << "threads"
+        << std::setw(12) << "ms" << endl;
+    for (uint32_t threads : threadCounts) {
+        /* Warm up, then keep the best run to hide scheduler noise */
+        items = unsorted;
+        sort_draws(items, scratch, threads);
+        uint64_t best = (uint64_t)-1;
+        for (int i = 0; i != iterations; i++) {
+            items = unsorted;
+            uint64_t start = monotonic_ns();
+            sort_draws(items, scratch, threads);
+            best = std::min(best, monotonic_ns() - start);
+        }
+        cout << std::setw(12) << "radix" << std::setw(8) << threads
+            << std::setw(12) << std::fixed << std::setprecision(3)
+            << (double)best / 1e6 << endl;
+    }
+    uint64_t best = (uint64_t)-1;
+    vector<draw_item_t> reference;
+    for (int i = 0; i != iterations; i++) {
+        reference = unsorted;
+        uint64_t start = monotonic_ns();
+        std::stable_sort(reference.begin(), reference.end(),
+                [](const draw_item_t &a, const draw_item_t &b) {
+                    return a.key < b.key; });
+        best = std::min(best, monotonic_ns() - start);
+    }
+    cout << std::setw(12) << "std" << std::setw(8) << 1 << std::setw(12)
+        << (double)best / 1e6 << endl;
+    for (size_t i = 0; i != DRAWS; i++) {
+        if (items[i].key != reference[i].key
+                || items[i].draw != reference[i].draw) {
+            cout << "radix sort disagrees with std::stable_sort at " << i
+                << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    cout << endl << std::setw(12) << "record" << std::setw(12) << "binds"
+        << std::setw(12) << "avoided" << std::setw(12) << "ms" << endl;
+    vector<uint32_t> commands;
+    const struct {
+        const char *name;
+        const vector<draw_item_t> &draws;
+        bool track;
+    } runs[] = {
+        {"unsorted", unsorted, false},
+        {"tracked", unsorted, true},
+        {"sorted", items, true}
+    };
+    for (const auto &run : runs) {
+        draw_state_tracker tracker;
+        record(run.draws, run.track, commands, tracker);
+        uint64_t best = (uint64_t)-1;
+        for (int i = 0; i != iterations; i++) {
+            uint64_t start = monotonic_ns();
+            record(run.draws, run.track, commands, tracker);
+            best = std::min(best, monotonic_ns() - start);
+        }
+        /* Commands are two words each, one of them the draw */
+        uint64_t binds = commands.size() / 2 - DRAWS;
+        uint64_t avoided = DRAW_BIND_FIELDS * DRAWS - binds;
+        cout << std::setw(12) << run.name << std::setw(12) << binds
+            << std::setw(12) << avoided << std::setw(12)
+            << (double)best / 1e6 << endl;
+    }
+    return EXIT_SUCCESS;
+}
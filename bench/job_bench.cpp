@@ -0,0 +1,106 @@
+/* Job system: cost of scheduling an empty job, of a chain of dependent
+ * jobs, and how a parallel_for over a fixed amount of work scales with the
+ * number of workers.
+ *
+ * usage: bench/job_bench [max workers] [jobs] */
+
+#include "../job_system.h"
+#include "../frame_pacer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using std::cout; using std::endl;
+
+const int ITERATIONS = 5;
+/* Elements of the parallel_for workload, and the grain it is split in */
+const size_t WORK_ELEMENTS = 1 << 22;
+const size_t WORK_GRAIN = 1 << 12;
+const uint32_t CHAIN_LENGTH = 10000;
+
+/* Best time in ms of ITERATIONS calls of fn */
+template <typename F>
+static double best_ms(F fn)
+{
+    uint64_t best = (uint64_t)-1;
+    for (int i = 0; i != ITERATIONS; i++) {
+        uint64_t start = monotonic_ns();
+        fn();
+        best = std::min(best, monotonic_ns() - start);
+    }
+    return (double)best / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t maxWorkers = argc > 1 ? (uint32_t)atoi(argv[1]) : cores - 1;
+    size_t jobCount = argc > 2 ? (size_t)atol(argv[2]) : 100000;
+
+    std::vector<float> data(WORK_ELEMENTS);
+    for (size_t i = 0; i != data.size(); i++) {
+        data[i] = (float)(i % 1000) * 0.001f;
+    }
+
+    cout << cores << " cores" << endl;
+    cout << std::setw(8) << "workers" << std::setw(14) << "ns/empty job"
+        << std::setw(14) << "ns/chain link" << std::setw(14) << "for ms"
+        << std::setw(10) << "speedup" << endl;
+    double serialMs = 0.0;
+    for (uint32_t workers = 0; workers <= maxWorkers; workers++) {
+        job_system jobs(workers);
+
+        std::atomic<uint32_t> ran(0);
+        double submitMs = best_ms([&]() {
+            job_counter counter;
+            for (size_t j = 0; j != jobCount; j++) {
+                jobs.submit([&ran]() {
+                    ran.fetch_add(1, std::memory_order_relaxed);
+                }, &counter);
+            }
+            jobs.wait(counter);
+        });
+
+        /* Each link only becomes runnable when the previous one finished */
+        double chainMs = best_ms([&]() {
+            std::vector<job_counter> counters(CHAIN_LENGTH);
+            jobs.submit([&ran]() {
+                ran.fetch_add(1, std::memory_order_relaxed);
+            }, &counters[0]);
+            for (uint32_t link = 1; link != CHAIN_LENGTH; link++) {
+                jobs.submit_after(counters[link - 1], [&ran]() {
+                    ran.fetch_add(1, std::memory_order_relaxed);
+                }, &counters[link]);
+            }
+            jobs.wait(counters[CHAIN_LENGTH - 1]);
+        });
+
+        std::vector<float> out(data.size());
+        double forMs = best_ms([&]() {
+            jobs.parallel_for(0, data.size(), WORK_GRAIN,
+                    [&](size_t begin, size_t end) {
+                for (size_t i = begin; i != end; i++) {
+                    float x = data[i];
+                    out[i] = std::sqrt(x * x + 1.f) * std::sin(x) + std::cos(x);
+                }
+            });
+        });
+        if (workers == 0) {
+            serialMs = forMs;
+        }
+
+        cout << std::setw(8) << workers << std::fixed << std::setprecision(1)
+            << std::setw(14) << submitMs * 1e6 / (double)jobCount
+            << std::setw(14) << chainMs * 1e6 / (double)CHAIN_LENGTH
+            << std::setprecision(3) << std::setw(14) << forMs
+            << std::setprecision(2) << std::setw(10)
+            << (serialMs > 0.0 ? serialMs / forMs : 1.0) << endl;
+    }
+    return EXIT_SUCCESS;
+}
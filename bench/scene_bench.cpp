@@ -0,0 +1,73 @@
+/* Scene graph transform propagation: time per update for 500k nodes with
+ * everything, a sixteenth of the subtrees, or nothing changed.
+ *
+ * usage: bench/scene_bench [nodes] [iterations] */
+
+#include "../scene.h"
+#include "../frame_pacer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+
+using std::cout; using std::endl;
+
+/* Districts of buildings, the same shape the demo scene uses */
+const uint32_t CHILDREN_PER_GROUP = 255;
+
+static double time_update(scene_graph &scene, uint32_t groups, uint32_t stride,
+        int iterations, size_t &updated)
+{
+    uint64_t best = (uint64_t)-1;
+    for (int i = 0; i != iterations; i++) {
+        float angle = 0.01f * (float)(i + 1);
+        for (uint32_t g = 0; g < groups; g += stride) {
+            uint32_t node = g * (CHILDREN_PER_GROUP + 1);
+            scene.set_rotation(node, glm::quat(std::cos(angle), 0.f,
+                        std::sin(angle), 0.f));
+        }
+        uint64_t start = monotonic_ns();
+        updated = scene.update();
+        best = std::min(best, monotonic_ns() - start);
+    }
+    return (double)best / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    size_t nodes = argc > 1 ? (size_t)atol(argv[1]) : 500000;
+    int iterations = argc > 2 ? std::max(1, atoi(argv[2])) : 20;
+
+    scene_graph scene;
+    scene.reserve(nodes);
+    float boundsMin[3] = {-1.f, 0.f, -1.f}, boundsMax[3] = {1.f, 4.f, 1.f};
+    scene.set_local_bounds(boundsMin, boundsMax);
+    uint32_t groups = 0;
+    while (scene.size() < nodes) {
+        uint32_t group = scene.add_node(SCENE_NO_PARENT,
+                glm::vec3((float)(groups % 64) * 40.f, 0.f,
+                    (float)(groups / 64) * 40.f));
+        groups++;
+        for (uint32_t c = 0; c != CHILDREN_PER_GROUP && scene.size() < nodes; c++) {
+            scene.add_node(group, glm::vec3((float)(c % 16) * 2.5f, 0.f,
+                        (float)(c / 16) * 2.5f), glm::quat(1.f, 0.f, 0.f, 0.f),
+                    0.5f + (float)(c % 7) * 0.1f);
+        }
+    }
+    scene.update();
+
+    cout << scene.size() << " nodes in " << groups << " subtrees" << endl;
+    cout << std::setw(12) << "changed" << std::setw(12) << "updated"
+        << std::setw(12) << "ms" << endl;
+    const uint32_t strides[] = {1, 16, groups + 1};
+    const char *names[] = {"all", "1/16", "none"};
+    for (int s = 0; s != 3; s++) {
+        size_t updated = 0;
+        double ms = time_update(scene, groups, strides[s], iterations, updated);
+        cout << std::setw(12) << names[s] << std::setw(12) << updated
+            << std::setw(12) << std::fixed << std::setprecision(3) << ms << endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+using std::cout; using std::endl;
+#include <vector>
+using std::vector;
+
+#include "vulkan_application.h"
+#include "debug_print.h"
+
+/* Readback buffers cycled through. Frames in flight hold up to
+ * MAX_FRAMES_IN_FLIGHT of them, the rest give the writer slack */
+const uint32_t CAPTURE_SLOTS = 8;
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+/* Host-visible readback buffers for view 0's images, and the writer
+ * behind them. create_swapchains decided whether capture is possible */
+void vk::create_capture(void)
+{
+    TRACE_FUNC();
+    frameCaptureSlots.assign(MAX_FRAMES_IN_FLIGHT, -1);
+    if (!capturing) {
+        return;
+    }
+    const view_target_t &view = views[0];
+    uint32_t rowPitch = view.extent.width * 4;
+    captureBuffers.resize(CAPTURE_SLOTS);
+    vector<const uint8_t *> slots;
+    for (auto &buffer : captureBuffers) {
+        /* Cached, as the CPU reads every byte */
+        create_buffer((VkDeviceSize)rowPitch * view.extent.height,
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                    VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT},
+                buffer);
+        slots.push_back((const uint8_t *)buffer.mapped);
+    }
+    bool bgra = swapchainImageFormat == VK_FORMAT_B8G8R8A8_UNORM
+        || swapchainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+    /* Only the Y4M header uses it; uncapped runs are played back at 60 */
+    uint32_t fps = config.targetFps > 0.0 && !config.benchmark ?
+        (uint32_t)(config.targetFps + 0.5) : 60;
+    frameCapture.start(config.capturePath, view.extent.width,
+            view.extent.height, rowPitch, bgra, fps, slots);
+}
+
+/* Copy the image view 0 presents into the frame's readback slot, after
+ * everything else drew into it. The copy is done once the frame's fence
+ * is; see collect_capture */
+void vk::record_capture(VkCommandBuffer commandBuffer)
+{
+    int32_t slot = frameCaptureSlots[currentFrame];
+    if (slot < 0) {
+        return;
+    }
+    const view_target_t &view = views[0];
+    VkImageMemoryBarrier imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = view.images[view.imageIndex];
+    imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;     //tightly packed
+    region.bufferImageHeight = 0;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {view.extent.width, view.extent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, imageBarrier.image,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            captureBuffers[slot].buffer, 1, &region);
+
+    /* Back for presentation, and the pixels visible to the host */
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkBufferMemoryBarrier bufferBarrier = {};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = captureBuffers[slot].buffer;
+    bufferBarrier.offset = 0;
+    bufferBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, 1, &bufferBarrier, 1, &imageBarrier);
+}
+
+/* The fence of frame has been waited on, so its copy is complete: the
+ * writer thread takes the slot from here. Nothing here waits for the
+ * writer; when it falls behind, draw_frame finds no free slot and the
+ * frame goes uncaptured */
+void vk::collect_capture(uint32_t frame)
+{
+    if (frameCaptureSlots[frame] >= 0) {
+        frameCapture.submit_slot((uint32_t)frameCaptureSlots[frame]);
+        frameCaptureSlots[frame] = -1;
+    }
+}
+
+/* After the device is idle: the frames still in flight, oldest first,
+ * then everything the writer has queued */
+void vk::destroy_capture(void)
+{
+    if (!capturing) {
+        return;
+    }
+    for (uint32_t i = 0; i != MAX_FRAMES_IN_FLIGHT; i++) {
+        collect_capture((currentFrame + i) % MAX_FRAMES_IN_FLIGHT);
+    }
+    frameCapture.stop();
+    cout << "Captured " << frameCapture.frames_written() << " frames to "
+        << config.capturePath;
+    if (frameCapture.frames_dropped() != 0) {
+        cout << ", " << frameCapture.frames_dropped()
+            << " dropped while the writer was behind";
+    }
+    cout << endl;
+    for (auto &buffer : captureBuffers) {
+        destroy_buffer(buffer);
+    }
+    captureBuffers.clear();
+}
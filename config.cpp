@@ -0,0 +1,174 @@
+#include "config.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+using std::string;
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+string usage(void)
+{
+    return
+        "usage: main [options]\n"
+        "  --fps <rate>     target frame rate, 0 for uncapped (default 60)\n"
+        "  --benchmark      render as fast as possible\n"
+        "  --idle           only redraw when the window or scene changes\n"
+        "  --idle-timeout <seconds>\n"
+        "                   wake up at least this often in idle mode\n"
+        "  --render-thread  render on a separate thread from event handling\n"
+        "  --mesh <file>    draw a mesh converted with tools/meshconv\n"
+        "  --lod-error <pixels>\n"
+        "                   screen space error allowed per level of detail\n"
+        "                   (default 1)\n"
+        "  --lod <level>    always draw this level of detail\n"
+        "  --scene <nodes>  draw the mesh this many times as a city\n"
+        "  --occlusion      skip objects hidden behind others\n"
+        "  --no-sort-draws  draw instances in scene order\n"
+        "  --no-bindless    use the texture array fallback for materials\n"
+        "  --texture <file> add a KTX2 texture to the materials (repeatable,\n"
+        "                   needs descriptor indexing)\n"
+        "  --transcode      decode compressed textures on the CPU\n"
+        "  --shading <mode> lit (default), unlit, normals or toon\n"
+        "  --wireframe      draw polygon edges only\n"
+        "  --pipelines <file>\n"
+        "                   pipeline states to create at startup\n"
+        "  --headless       render off-screen, without a window\n"
+        "  --dynamic-resolution <ms>\n"
+        "                   lower the render resolution to keep GPU frame\n"
+        "                   time under this\n"
+        "  --min-scale <scale>\n"
+        "                   lowest render scale per axis (default 0.5)\n"
+        "  --post           render in HDR with bloom, tonemapping and color\n"
+        "                   grading\n"
+        "  --exposure <scale>\n"
+        "                   brightness before tonemapping (default 1)\n"
+        "  --bloom <amount> strength of the bloom (default 0.3)\n"
+        "  --capture <path> write every frame to path.y4m, or to numbered\n"
+        "                   PPM files starting with path\n"
+        "  --views <count>  open this many windows (default 1)\n"
+        "  --frames <count> quit after this many frames\n"
+        "  --stats <file>   write frame, startup and memory statistics as\n"
+        "                   JSON when quitting\n"
+        "  --system-allocator\n"
+        "                   leave Vulkan host allocations to the driver\n"
+        "  --no-timeline    track GPU progress with fences only\n"
+        "  --help           show this text\n";
+}
+
+/* Read the value following an option */
+static const char *option_value(int argc, char **argv, int &i)
+{
+    if (i + 1 >= argc) {
+        throw std::runtime_error(string("missing value for ") + argv[i]);
+    }
+    return argv[++i];
+}
+
+static double parse_number(const char *option, const char *value)
+{
+    char *end;
+    double number = strtod(value, &end);
+    if (end == value || *end != '\0' || number < 0.0) {
+        throw std::runtime_error(
+                string("invalid value for ") + option + ": " + value);
+    }
+    return number;
+}
+
+/* Shader option bits, in the order of shader_option_t */
+static uint32_t parse_shading(const char *value)
+{
+    const char *modes[] = {"lit", "unlit", "normals", "toon"};
+    for (uint32_t i = 0; i != 4; i++) {
+        if (strcmp(value, modes[i]) == 0) {
+            return i == 0 ? 0 : 1u << (i - 1);
+        }
+    }
+    throw std::runtime_error(string("invalid value for --shading: ") + value);
+}
+
+app_config_t parse_arguments(int argc, char **argv)
+{
+    app_config_t config;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--fps") == 0) {
+            config.targetFps = parse_number(arg, option_value(argc, argv, i));
+        } else if (strcmp(arg, "--benchmark") == 0) {
+            config.benchmark = true;
+        } else if (strcmp(arg, "--idle") == 0) {
+            config.idle = true;
+        } else if (strcmp(arg, "--idle-timeout") == 0) {
+            config.idleTimeout = parse_number(arg, option_value(argc, argv, i));
+        } else if (strcmp(arg, "--render-thread") == 0) {
+            config.renderThread = true;
+        } else if (strcmp(arg, "--mesh") == 0) {
+            config.meshPath = option_value(argc, argv, i);
+        } else if (strcmp(arg, "--lod-error") == 0) {
+            config.lodErrorPx = parse_number(arg, option_value(argc, argv, i));
+        } else if (strcmp(arg, "--lod") == 0) {
+            config.forcedLod = (int)parse_number(arg, option_value(argc, argv, i));
+        } else if (strcmp(arg, "--scene") == 0) {
+            config.sceneNodes = (uint32_t)parse_number(arg,
+                    option_value(argc, argv, i));
+        } else if (strcmp(arg, "--occlusion") == 0) {
+            config.occlusion = true;
+        } else if (strcmp(arg, "--no-sort-draws") == 0) {
+            config.sortDraws = false;
+        } else if (strcmp(arg, "--no-bindless") == 0) {
+            config.bindless = false;
+        } else if (strcmp(arg, "--texture") == 0) {
+            config.texturePaths.push_back(option_value(argc, argv, i));
+        } else if (strcmp(arg, "--transcode") == 0) {
+            config.forceTranscode = true;
+        } else if (strcmp(arg, "--shading") == 0) {
+            config.shaderOptions = parse_shading(option_value(argc, argv, i));
+        } else if (strcmp(arg, "--wireframe") == 0) {
+            config.wireframe = true;
+        } else if (strcmp(arg, "--pipelines") == 0) {
+            config.pipelineManifest = option_value(argc, argv, i);
+        } else if (strcmp(arg, "--headless") == 0) {
+            config.headless = true;
+        } else if (strcmp(arg, "--dynamic-resolution") == 0) {
+            config.dynamicResolutionMs = parse_number(arg,
+                    option_value(argc, argv, i));
+        } else if (strcmp(arg, "--min-scale") == 0) {
+            config.minRenderScale = std::min(1.0, std::max(0.1,
+                        parse_number(arg, option_value(argc, argv, i))));
+        } else if (strcmp(arg, "--post") == 0) {
+            config.postProcess = true;
+        } else if (strcmp(arg, "--exposure") == 0) {
+            config.exposure = std::max(0.0, parse_number(arg,
+                        option_value(argc, argv, i)));
+        } else if (strcmp(arg, "--bloom") == 0) {
+            config.bloomIntensity = std::max(0.0, parse_number(arg,
+                        option_value(argc, argv, i)));
+        } else if (strcmp(arg, "--capture") == 0) {
+            config.capturePath = option_value(argc, argv, i);
+        } else if (strcmp(arg, "--views") == 0) {
+            config.views = std::max(1u, (uint32_t)parse_number(arg,
+                        option_value(argc, argv, i)));
+        } else if (strcmp(arg, "--frames") == 0) {
+            config.frames = (uint64_t)parse_number(arg,
+                    option_value(argc, argv, i));
+        } else if (strcmp(arg, "--stats") == 0) {
+            config.statsPath = option_value(argc, argv, i);
+        } else if (strcmp(arg, "--system-allocator") == 0) {
+            config.systemAllocator = true;
+        } else if (strcmp(arg, "--no-timeline") == 0) {
+            config.timelineSemaphores = false;
+        } else if (strcmp(arg, "--help") == 0) {
+            config.help = true;
+        } else {
+            throw std::runtime_error(string("unknown option ") + arg + "\n"
+                    + usage());
+        }
+    }
+    return config;
+}
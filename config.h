@@ -0,0 +1,89 @@
+#ifndef APP_CONFIG
+#define APP_CONFIG
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Run-time options, filled in from the command line */
+typedef struct {
+    /* Frame pacing. 0 means uncapped */
+    double targetFps = 60.0;
+    /* Benchmark mode: no frame cap at all */
+    bool benchmark = false;
+    /* Only redraw when the scene or the window changed */
+    bool idle = false;
+    /* Seconds between forced wake-ups in idle mode, 0 waits indefinitely */
+    double idleTimeout = 0.0;
+    /* Acquire, submit and present on a thread of their own */
+    bool renderThread = false;
+    /* .amesh file to draw instead of the built-in shape */
+    std::string meshPath;
+    /* Largest on-screen error allowed when picking a level of detail */
+    double lodErrorPx = 1.0;
+    /* Draw this level of detail regardless of size, -1 selects per frame */
+    int forcedLod = -1;
+    /* Copies of the mesh in the demo scene, 0 draws it once, fitted */
+    uint32_t sceneNodes = 0;
+    /* Skip objects hidden behind others, tested on the GPU against the
+     * previous frame's depth. Needs a mesh */
+    bool occlusion = false;
+    /* Order each frame's instances by material and then front to back,
+     * see sort_draws */
+    bool sortDraws = true;
+    /* Index material textures from one large descriptor array when the
+     * device has VK_EXT_descriptor_indexing, otherwise from a texture
+     * array */
+    bool bindless = true;
+    /* KTX2 textures the materials use besides the built-in ones. Block
+     * compressed formats the device cannot sample are decoded on the CPU,
+     * always with forceTranscode */
+    std::vector<std::string> texturePaths;
+    bool forceTranscode = false;
+    /* Let the driver allocate host memory itself instead of through our
+     * accounting allocator */
+    bool systemAllocator = false;
+    /* Track GPU progress with a timeline semaphore when the device has
+     * VK_KHR_timeline_semaphore, otherwise with pooled fences */
+    bool timelineSemaphores = true;
+    /* Pipeline variant to draw with: 1 << shader_option_t, and lines
+     * instead of filled polygons */
+    uint32_t shaderOptions = 0;
+    bool wireframe = false;
+    /* Pipeline states to create at startup, see load_pipeline_manifest.
+     * Empty: every shading mode of the default state */
+    std::string pipelineManifest;
+    /* Render to an off-screen surface (VK_EXT_headless_surface) instead of
+     * a window. Implies the plain render loop, without idle mode */
+    bool headless = false;
+    /* Render below the output resolution whenever the GPU needs longer
+     * than this many milliseconds per frame, then upscale. 0 always
+     * renders at the output resolution */
+    double dynamicResolutionMs = 0.0;
+    /* Lowest render scale per axis it may pick */
+    double minRenderScale = 0.5;
+    /* Render the scene in HDR and run bloom, tonemapping and color
+     * grading on it with compute shaders before it is shown. exposure
+     * scales the scene before tonemapping, bloomIntensity how much of the
+     * bloom is added to it */
+    bool postProcess = false;
+    double exposure = 1.0;
+    double bloomIntensity = 0.3;
+    /* Read every frame of the first view back and write it here, see
+     * frame_capture. Empty captures nothing */
+    std::string capturePath;
+    /* Windows, or headless surfaces, all showing the scene */
+    uint32_t views = 1;
+    /* Quit after this many frames, 0 runs until the window is closed */
+    uint64_t frames = 0;
+    /* Where to write run statistics as JSON when quitting, see
+     * write_run_stats */
+    std::string statsPath;
+    bool help = false;
+} app_config_t;
+
+/* Throws std::runtime_error on unknown options or malformed values */
+app_config_t parse_arguments(int argc, char **argv);
+std::string usage(void);
+
+#endif
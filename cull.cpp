@@ -0,0 +1,305 @@
+#include "cull.h"
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CULL_X86
+#include <immintrin.h>
+#endif
+
+using std::vector;
+
+/* Below this many objects per slice, handing it to another thread costs
+ * more than it saves */
+const size_t MIN_OBJECTS_PER_THREAD = 16384;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* Every kernel culls with the same two tests: the sphere against the
+     * planes, then the box corner furthest along each plane normal */
+    inline bool visible_scalar(const cull_volumes_t &v, const frustum_t &f,
+            size_t i)
+    {
+        for (int p = 0; p != 6; p++) {
+            const float *plane = f.planes[p];
+            float distance = plane[0] * v.centerX[i] + plane[1] * v.centerY[i]
+                + plane[2] * v.centerZ[i] + plane[3];
+            if (distance < -v.radius[i]) {
+                return false;
+            }
+            float x = plane[0] >= 0.f ? v.maxX[i] : v.minX[i];
+            float y = plane[1] >= 0.f ? v.maxY[i] : v.minY[i];
+            float z = plane[2] >= 0.f ? v.maxZ[i] : v.minZ[i];
+            if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t cull_scalar(const cull_volumes_t &v, const frustum_t &f,
+            size_t begin, size_t end, uint32_t *out)
+    {
+        size_t count = 0;
+        for (size_t i = begin; i != end; i++) {
+            if (visible_scalar(v, f, i)) {
+                out[count++] = (uint32_t)i;
+            }
+        }
+        return count;
+    }
+
+#ifdef CULL_X86
+    /* Append base + the index of every set bit */
+    inline size_t emit_mask(uint32_t mask, size_t base, uint32_t *out)
+    {
+        size_t count = 0;
+        while (mask != 0) {
+            out[count++] = (uint32_t)(base + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+        return count;
+    }
+
+    size_t cull_sse(const cull_volumes_t &v, const frustum_t &f,
+            size_t begin, size_t end, uint32_t *out)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        size_t count = 0;
+        size_t i = begin;
+        for (; i + 4 <= end; i += 4) {
+            __m128 cx = _mm_loadu_ps(&v.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&v.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&v.centerZ[i]);
+            __m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(&v.radius[i]));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p != 6; p++) {
+                const float *plane = f.planes[p];
+                __m128 a = _mm_set1_ps(plane[0]), b = _mm_set1_ps(plane[1]);
+                __m128 c = _mm_set1_ps(plane[2]), d = _mm_set1_ps(plane[3]);
+                __m128 distance = _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(a, cx), _mm_mul_ps(b, cy)),
+                        _mm_add_ps(_mm_mul_ps(c, cz), d));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+            }
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            /* The plane signs are uniform across lanes, so the corner
+             * choice is a plain load of the min or max array */
+            for (int p = 0; p != 6; p++) {
+                const float *plane = f.planes[p];
+                __m128 x = _mm_loadu_ps(plane[0] >= 0.f ? &v.maxX[i] : &v.minX[i]);
+                __m128 y = _mm_loadu_ps(plane[1] >= 0.f ? &v.maxY[i] : &v.minY[i]);
+                __m128 z = _mm_loadu_ps(plane[2] >= 0.f ? &v.maxZ[i] : &v.minZ[i]);
+                __m128 distance = _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), x),
+                            _mm_mul_ps(_mm_set1_ps(plane[1]), y)),
+                        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), z),
+                            _mm_set1_ps(plane[3])));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+            }
+            count += emit_mask((uint32_t)_mm_movemask_ps(inside), i, out + count);
+        }
+        return count + cull_scalar(v, f, i, end, out + count);
+    }
+
+    __attribute__((target("avx2,fma")))
+    size_t cull_avx2(const cull_volumes_t &v, const frustum_t &f,
+            size_t begin, size_t end, uint32_t *out)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        size_t count = 0;
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 cx = _mm256_loadu_ps(&v.centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&v.centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&v.centerZ[i]);
+            __m256 negRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(&v.radius[i]));
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p != 6; p++) {
+                const float *plane = f.planes[p];
+                __m256 distance = _mm256_fmadd_ps(_mm256_set1_ps(plane[0]), cx,
+                        _mm256_fmadd_ps(_mm256_set1_ps(plane[1]), cy,
+                            _mm256_fmadd_ps(_mm256_set1_ps(plane[2]), cz,
+                                _mm256_set1_ps(plane[3]))));
+                inside = _mm256_and_ps(inside,
+                        _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+            }
+            if (_mm256_movemask_ps(inside) == 0) {
+                continue;
+            }
+            for (int p = 0; p != 6; p++) {
+                const float *plane = f.planes[p];
+                __m256 x = _mm256_loadu_ps(plane[0] >= 0.f ? &v.maxX[i] : &v.minX[i]);
+                __m256 y = _mm256_loadu_ps(plane[1] >= 0.f ? &v.maxY[i] : &v.minY[i]);
+                __m256 z = _mm256_loadu_ps(plane[2] >= 0.f ? &v.maxZ[i] : &v.minZ[i]);
+                __m256 distance = _mm256_fmadd_ps(_mm256_set1_ps(plane[0]), x,
+                        _mm256_fmadd_ps(_mm256_set1_ps(plane[1]), y,
+                            _mm256_fmadd_ps(_mm256_set1_ps(plane[2]), z,
+                                _mm256_set1_ps(plane[3]))));
+                inside = _mm256_and_ps(inside,
+                        _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+            }
+            count += emit_mask((uint32_t)_mm256_movemask_ps(inside), i,
+                    out + count);
+        }
+        return count + cull_scalar(v, f, i, end, out + count);
+    }
+#endif
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+void cull_volumes_t::resize(size_t count)
+{
+    vector<float> *arrays[] = {&centerX, &centerY, &centerZ, &radius,
+        &minX, &minY, &minZ, &maxX, &maxY, &maxZ};
+    for (auto array : arrays) {
+        array->resize(count);
+    }
+}
+
+/* Both volumes from a box; the sphere is the box's circumscribed sphere */
+void cull_volumes_t::set(size_t i, const float boundsMin[3],
+        const float boundsMax[3])
+{
+    centerX[i] = 0.5f * (boundsMin[0] + boundsMax[0]);
+    centerY[i] = 0.5f * (boundsMin[1] + boundsMax[1]);
+    centerZ[i] = 0.5f * (boundsMin[2] + boundsMax[2]);
+    float ex = boundsMax[0] - boundsMin[0];
+    float ey = boundsMax[1] - boundsMin[1];
+    float ez = boundsMax[2] - boundsMin[2];
+    radius[i] = 0.5f * std::sqrt(ex * ex + ey * ey + ez * ez);
+    minX[i] = boundsMin[0]; minY[i] = boundsMin[1]; minZ[i] = boundsMin[2];
+    maxX[i] = boundsMax[0]; maxY[i] = boundsMax[1]; maxZ[i] = boundsMax[2];
+}
+
+/* Gribb-Hartmann plane extraction. glm is column major, so row r of the
+ * matrix is (m[0][r], m[1][r], m[2][r], m[3][r]) */
+frustum_t frustum_from_matrix(const glm::mat4 &m)
+{
+    float rows[4][4];
+    for (int r = 0; r != 4; r++) {
+        for (int c = 0; c != 4; c++) {
+            rows[r][c] = m[c][r];
+        }
+    }
+    frustum_t f;
+    for (int c = 0; c != 4; c++) {
+        f.planes[0][c] = rows[3][c] + rows[0][c];   //left
+        f.planes[1][c] = rows[3][c] - rows[0][c];   //right
+        f.planes[2][c] = rows[3][c] + rows[1][c];   //top (y points down)
+        f.planes[3][c] = rows[3][c] - rows[1][c];   //bottom
+        f.planes[4][c] = rows[2][c];                //near, z >= 0
+        f.planes[5][c] = rows[3][c] - rows[2][c];   //far, z <= w
+    }
+    for (auto &plane : f.planes) {
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1]
+                + plane[2] * plane[2]);
+        if (length > 0.f) {
+            for (int c = 0; c != 4; c++) {
+                plane[c] /= length;
+            }
+        }
+    }
+    return f;
+}
+
+cull_kernel_t best_cull_kernel(void)
+{
+#ifdef CULL_X86
+    static const cull_kernel_t best = __builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("fma") ? CULL_KERNEL_AVX2 : CULL_KERNEL_SSE;
+    return best;
+#else
+    return CULL_KERNEL_SCALAR;
+#endif
+}
+
+const char *cull_kernel_name(cull_kernel_t kernel)
+{
+    switch (kernel) {
+        case CULL_KERNEL_AUTO: return cull_kernel_name(best_cull_kernel());
+        case CULL_KERNEL_SCALAR: return "scalar";
+        case CULL_KERNEL_SSE: return "sse";
+        case CULL_KERNEL_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+size_t cull_range(
+        const cull_volumes_t &volumes,
+        const frustum_t &frustum,
+        size_t begin,
+        size_t end,
+        uint32_t *out,
+        cull_kernel_t kernel)
+{
+    if (kernel == CULL_KERNEL_AUTO) {
+        kernel = best_cull_kernel();
+    }
+#ifdef CULL_X86
+    if (kernel == CULL_KERNEL_AVX2 && best_cull_kernel() == CULL_KERNEL_AVX2) {
+        return cull_avx2(volumes, frustum, begin, end, out);
+    }
+    if (kernel != CULL_KERNEL_SCALAR) {
+        return cull_sse(volumes, frustum, begin, end, out);
+    }
+#endif
+    return cull_scalar(volumes, frustum, begin, end, out);
+}
+
+/* Each job culls a contiguous slice straight into its part of the output,
+ * then the slices are packed together in order */
+void cull_objects(
+        const cull_volumes_t &volumes,
+        const frustum_t &frustum,
+        vector<uint32_t> &visible,
+        uint32_t maxThreads,
+        cull_kernel_t kernel)
+{
+    TRACE_FUNC();
+    size_t count = volumes.size();
+    visible.resize(count);
+    job_system &jobs = job_system::shared();
+    if (maxThreads == 0) {
+        maxThreads = jobs.concurrency();
+    }
+    size_t threads = std::min((size_t)maxThreads,
+            std::max((size_t)1, count / MIN_OBJECTS_PER_THREAD));
+    /* Slices are multiples of 8 so only the last one has a scalar tail */
+    size_t slice = ((count + threads - 1) / threads + 7) & ~(size_t)7;
+
+    vector<size_t> found(threads, 0);
+    auto work = [&](size_t t) {
+        TRACE_ZONE("cull_slice");
+        size_t begin = std::min(t * slice, count);
+        size_t end = std::min(begin + slice, count);
+        found[t] = cull_range(volumes, frustum, begin, end,
+                visible.data() + begin, kernel);
+    };
+    jobs.parallel_for(0, threads, 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t != end; t++) {
+            work(t);
+        }
+    });
+
+    size_t packed = found[0];
+    for (size_t t = 1; t < threads; t++) {
+        memmove(visible.data() + packed,
+                visible.data() + std::min(t * slice, count),
+                found[t] * sizeof(uint32_t));
+        packed += found[t];
+    }
+    visible.resize(packed);
+}
@@ -0,0 +1,66 @@
+#ifndef FRUSTUM_CULL
+#define FRUSTUM_CULL
+
+#include <glm/mat4x4.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* World space bounds of every object, one array per component so a kernel
+ * loads the same component of 4 (SSE) or 8 (AVX2) objects at once. All
+ * arrays have size() elements */
+typedef struct {
+    /* Bounding spheres, the cheap first test */
+    std::vector<float> centerX, centerY, centerZ, radius;
+    /* Axis aligned boxes, tighter for long or flat objects */
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    size_t size(void) const { return radius.size(); }
+    void resize(size_t count);
+    void set(size_t i, const float boundsMin[3], const float boundsMax[3]);
+} cull_volumes_t;
+
+/* Inward facing planes (a, b, c, d): a point p is inside when
+ * a*p.x + b*p.y + c*p.z + d >= 0 for all six. Normals are unit length so
+ * the distance compares directly against sphere radii */
+typedef struct {
+    float planes[6][4];
+} frustum_t;
+
+enum cull_kernel_t {
+    CULL_KERNEL_AUTO,       //widest the CPU supports
+    CULL_KERNEL_SCALAR,
+    CULL_KERNEL_SSE,
+    CULL_KERNEL_AVX2
+};
+
+/* Planes of a Vulkan clip space transform (depth in [0, 1]) */
+frustum_t frustum_from_matrix(const glm::mat4 &viewProjection);
+
+cull_kernel_t best_cull_kernel(void);
+const char *cull_kernel_name(cull_kernel_t kernel);
+
+/* Write the indices of the visible objects in [begin, end) to out, in
+ * ascending order. out needs room for end - begin indices. Returns how many
+ * were written */
+size_t cull_range(
+        const cull_volumes_t &volumes,
+        const frustum_t &frustum,
+        size_t begin,
+        size_t end,
+        uint32_t *out,
+        cull_kernel_t kernel = CULL_KERNEL_AUTO);
+
+/* Cull every object, splitting the work into up to maxThreads slices run on
+ * the shared job system (0: one per thread it has). visible is replaced by
+ * the compacted, ascending list of visible object indices */
+void cull_objects(
+        const cull_volumes_t &volumes,
+        const frustum_t &frustum,
+        std::vector<uint32_t> &visible,
+        uint32_t maxThreads = 0,
+        cull_kernel_t kernel = CULL_KERNEL_AUTO);
+
+#endif
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <iomanip>
+#include "trace.h"
 using std::string;
 using std::cout; using std::endl;
 
@@ -14,15 +15,34 @@ const string cyan("\033[0;36m");
 const string magenta("\033[0;35m");
 const string reset("\033[0m");
 
+/* Diagnostics end lines with '\n' rather than endl: flushing on every Vulkan
+ * call skews the timings we are trying to look at */
 void inline print_success(string str) {
-    cout << green << "\tsuccess\t" << reset << str << endl;
+    cout << green << "\tsuccess\t" << reset << str << '\n';
 }
 
 void inline print_failure(string str) {
-    cout << red << "\tfailure\t" << reset << str << endl;
+    cout << red << "\tfailure\t" << reset << str << '\n';
 } 
 
-#ifndef NDEBUG 
+#if defined(ENABLE_TRACE)
+
+/* With tracing compiled in every result goes to the trace as an instant
+ * event named after the calling function. Failures still go to the
+ * terminal as well; successes stay out of it, to keep the timings clean */
+#define print_func()\
+    cout <<  magenta << std::setw(40) << std::left << __func__ << reset  << '\t'
+
+#define print_result(result)\
+{\
+    TRACE_INSTANT(__func__, result);\
+    if (result != VK_SUCCESS) {\
+        print_func();\
+        cout << red   << "failure" << reset << '\n';\
+    }\
+}\
+
+#elif !defined(NDEBUG)
 
 #define print_func()\
     cout <<  magenta << std::setw(40) << std::left << __func__ << reset  << '\t'
@@ -31,9 +51,9 @@ void inline print_failure(string str) {
 {\
     print_func();\
     if (result == VK_SUCCESS) {\
-        cout << green << "success" << reset << endl;\
+        cout << green << "success" << reset << '\n';\
     } else {\
-        cout << red   << "failure" << reset << endl;\
+        cout << red   << "failure" << reset << '\n';\
     }\
 }\
 
@@ -0,0 +1,381 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+using std::cout; using std::endl;
+#include <vector>
+using std::vector;
+
+#include "vulkan_application.h"
+#include "debug_print.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+/* Demo scene: districts of buildings, each district a subtree */
+const uint32_t BUILDINGS_PER_DISTRICT = 255;
+const uint32_t BUILDINGS_PER_ROW = 16;
+/* Every SPINNING_DISTRICT-th district turns, so its subtree changes every
+ * frame while the rest stays untouched */
+const uint32_t SPINNING_DISTRICT = 16;
+const float CAMERA_FOV = 1.0472f;       //60 degrees
+const float CAMERA_ORBIT_SPEED = 0.05f; //radians per second
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+/* One node drawing the mesh at the origin, or with --scene a city of
+ * copies laid out in districts. Also sizes the per frame instance buffers
+ * for the worst case of every node being visible */
+void vk::create_scene(void)
+{
+    TRACE_FUNC();
+    if (!meshLoaded) {
+        return;
+    }
+    float extent = 0.f;
+    for (int k = 0; k != 3; k++) {
+        extent = std::max(extent, meshHeader.boundsMax[k] - meshHeader.boundsMin[k]);
+    }
+    sceneSpacing = std::max(extent, 1e-3f) * 1.5f;
+
+    uint32_t nodes = std::max(config.sceneNodes, 1u);
+    scene.reserve(nodes);
+    scene.set_local_bounds(meshHeader.boundsMin, meshHeader.boundsMax);
+    if (config.sceneNodes == 0) {
+        scene.add_node(SCENE_NO_PARENT, glm::vec3(0.f));
+    } else {
+        uint32_t districts = (nodes + BUILDINGS_PER_DISTRICT) /
+            (BUILDINGS_PER_DISTRICT + 1);
+        uint32_t side = (uint32_t)std::ceil(std::sqrt((float)districts));
+        float districtSize = (BUILDINGS_PER_ROW + 2) * sceneSpacing;
+        sceneRadius = 0.5f * side * districtSize;
+        for (uint32_t d = 0; scene.size() < nodes; d++) {
+            glm::vec3 corner((float)(d % side) * districtSize - sceneRadius, 0.f,
+                    (float)(d / side) * districtSize - sceneRadius);
+            uint32_t district = scene.add_node(SCENE_NO_PARENT,
+                    corner + glm::vec3(0.5f * districtSize, 0.f, 0.5f * districtSize));
+            if (d % SPINNING_DISTRICT == 0) {
+                spinningNodes.push_back(district);
+            }
+            for (uint32_t b = 0; b != BUILDINGS_PER_DISTRICT && scene.size() < nodes;
+                    b++) {
+                /* Cheap deterministic variation per building */
+                uint32_t hash = (d * 2654435761u) ^ (b * 40503u);
+                float x = ((float)(b % BUILDINGS_PER_ROW) + 0.5f
+                        - 0.5f * BUILDINGS_PER_ROW) * sceneSpacing;
+                float z = ((float)(b / BUILDINGS_PER_ROW) + 0.5f
+                        - 0.5f * BUILDINGS_PER_ROW) * sceneSpacing;
+                float angle = (float)(hash % 628) * 0.01f;
+                scene.add_node(district, glm::vec3(x, 0.f, z),
+                        glm::quat(std::cos(0.5f * angle), 0.f,
+                            std::sin(0.5f * angle), 0.f),
+                        0.6f + (float)(hash % 5) * 0.1f);
+            }
+        }
+    }
+    scene.update();
+    objectLods.assign(scene.size(), 0);
+    lodInstanceCounts.assign(meshLods.size(), 0);
+    lodFirstInstance.assign(meshLods.size(), 0);
+    sceneStart = monotonic_ns();
+    for (auto &view : views) {
+        view.viewProjection = glm::mat4(1.f);
+    }
+
+    /* Written by the CPU every frame and read once by the GPU, so host
+     * memory is fine; device local host visible memory is used if it has
+     * room. Occlusion culling reads them as its candidates */
+    instanceBufferUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    if (config.occlusion) {
+        instanceBufferUsage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    }
+    instanceBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    for (auto &buffer : instanceBuffers) {
+        create_buffer(
+                scene.size() * sizeof(glm::mat4),
+                instanceBufferUsage,
+                {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT},
+                buffer);
+    }
+    memoryBudget.add_eviction_handler(
+            [this](uint32_t heap, VkDeviceSize bytes) {
+        return demote_instance_buffers(heap, bytes);
+    });
+}
+
+/* Eviction handler. The instance buffers only prefer device local memory,
+ * so under pressure on its heap they move to plain host memory. Runs where
+ * the draw list is built, before it is written, so replacing them is safe;
+ * the old ones go once the frames reading them are done */
+VkDeviceSize vk::demote_instance_buffers(uint32_t heap, VkDeviceSize bytes)
+{
+    const VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    /* Nowhere to go when host memory shares the heap, as on integrated
+     * GPUs */
+    int32_t hostType = find_memory_type(~0u, host);
+    if (hostType < 0 || chosenDevice.memoryProperties
+            .memoryTypes[hostType].heapIndex == heap) {
+        return 0;
+    }
+    VkDeviceSize released = 0;
+    for (auto &buffer : instanceBuffers) {
+        if (released >= bytes) {
+            break;
+        }
+        if (buffer.heapIndex != heap || buffer.buffer == VK_NULL_HANDLE) {
+            continue;
+        }
+        VkDeviceSize size = buffer.size;
+        released += buffer.allocationSize;
+        retire_buffer(buffer);
+        create_buffer(size, instanceBufferUsage, {host}, buffer);
+    }
+    if (released != 0) {
+        TRACE_INSTANT("instance_bytes_demoted", released);
+    }
+    return released;
+}
+
+void vk::animate_scene(double seconds)
+{
+    TRACE_FUNC();
+    float angle = (float)seconds * 0.5f;
+    glm::quat spin(std::cos(0.5f * angle), 0.f, std::sin(0.5f * angle), 0.f);
+    for (uint32_t node : spinningNodes) {
+        scene.set_rotation(node, spin);
+    }
+}
+
+/* Without --scene: fit the mesh bounds into the view with an orthographic
+ * transform, y flipped to Vulkan's downward axis and z mapped into [0, 1].
+ * With a scene: a camera slowly orbiting the city */
+view_t vk::scene_view(double seconds, VkExtent2D size)
+{
+    view_t view;
+    float aspect = (float)size.width / size.height;
+    if (config.sceneNodes == 0) {
+        float center[3], extent = 0.f;
+        for (int k = 0; k != 3; k++) {
+            center[k] = 0.5f * (meshHeader.boundsMin[k] + meshHeader.boundsMax[k]);
+            extent = std::max(extent,
+                    meshHeader.boundsMax[k] - meshHeader.boundsMin[k]);
+        }
+        float scale = extent > 0.f ? 1.8f / extent : 1.f;
+        glm::mat4 m(1.f);
+        m[0][0] = scale / aspect;
+        m[1][1] = -scale;
+        m[2][2] = 0.5f * scale;
+        m[3][0] = -center[0] * scale / aspect;
+        m[3][1] = center[1] * scale;
+        m[3][2] = 0.5f - 0.5f * center[2] * scale;
+        view.viewProjection = m;
+        view.eye = glm::vec3(0.f);
+        view.perspective = false;
+        /* One object space unit covers the same number of pixels
+         * everywhere: half the viewport height times the y scale */
+        view.pixelsPerUnit = scale * 0.5f * (float)size.height;
+        return view;
+    }
+    float angle = (float)seconds * CAMERA_ORBIT_SPEED;
+    float distance = 0.6f * sceneRadius + 4.f * sceneSpacing;
+    view.eye = glm::vec3(distance * std::cos(angle), 3.f * sceneSpacing,
+            distance * std::sin(angle));
+    glm::mat4 projection = glm::perspective(CAMERA_FOV, aspect,
+            0.1f * sceneSpacing, 3.f * sceneRadius + 10.f * sceneSpacing);
+    projection[1][1] *= -1.f;
+    view.viewProjection = projection * glm::lookAt(view.eye,
+            glm::vec3(0.f, sceneSpacing, 0.f), glm::vec3(0.f, 1.f, 0.f));
+    view.perspective = true;
+    /* Pixels per unit at distance 1 */
+    view.pixelsPerUnit = 0.5f * (float)size.height
+        / std::tan(0.5f * CAMERA_FOV);
+    return view;
+}
+
+/* Runs for every frame once its fence has been waited on: update the
+ * scene, cull it, pick each visible object's level of detail and write the
+ * instances, grouped by level, into the frame's instance buffer. Within a
+ * level they go by material, so neighbouring instances sample the same
+ * textures, then front to back, so early depth testing rejects more. The
+ * command buffer then draws them with one instanced draw per level and
+ * submesh, or hands them to occlusion culling as its candidates.
+ *
+ * The views share the camera and so the draw list; each only gets a
+ * projection for its own aspect ratio. Culling and level selection use the
+ * widest view, whose frustum contains the others' */
+void vk::update_draw_list(void)
+{
+    TRACE_FUNC();
+    double seconds = (double)(monotonic_ns() - sceneStart) / 1e9;
+    animate_scene(seconds);
+    scene.update();
+    /* The camera orbits and districts spin with the clock, so a scene
+     * changes every frame; idle mode has to keep drawing it */
+    if (config.sceneNodes != 0) {
+        request_redraw();
+    }
+    for (auto &target : views) {
+        target.viewProjection =
+            scene_view(seconds, target.renderExtent).viewProjection;
+    }
+    /* Levels of detail follow the resolution actually rendered at */
+    view_t view = scene_view(seconds, views[widestView].renderExtent);
+    cull_objects(scene.bounds(), frustum_from_matrix(view.viewProjection),
+            visibleObjects);
+
+    {
+        TRACE_ZONE("select_lods");
+        const cull_volumes_t &bounds = scene.bounds();
+        std::fill(lodInstanceCounts.begin(), lodInstanceCounts.end(), 0);
+        uint32_t forced = std::min((uint32_t)std::max(config.forcedLod, 0),
+                (uint32_t)meshLods.size() - 1);
+        /* Scales distances into [0, 1] for the sort keys, see scene_view */
+        float depthScale = 1.f / (3.f * sceneRadius + 10.f * sceneSpacing);
+        drawItems.resize(visibleObjects.size());
+        for (size_t i = 0; i != visibleObjects.size(); i++) {
+            uint32_t object = visibleObjects[i];
+            float distance = 0.f;
+            if (view.perspective) {
+                float dx = bounds.centerX[object] - view.eye.x;
+                float dy = bounds.centerY[object] - view.eye.y;
+                float dz = bounds.centerZ[object] - view.eye.z;
+                distance = std::sqrt(dx * dx + dy * dy + dz * dz)
+                    - bounds.radius[object];
+            }
+            uint32_t lod = forced;
+            if (config.forcedLod < 0) {
+                float pixelsPerUnit = view.pixelsPerUnit;
+                if (view.perspective) {
+                    pixelsPerUnit /= std::max(distance, 1e-3f);
+                }
+                lod = select_lod(meshLods, pixelsPerUnit,
+                        (float)config.lodErrorPx, objectLods[object]);
+            }
+            objectLods[object] = (uint8_t)lod;
+            lodInstanceCounts[lod]++;
+            uint32_t material = (object * 2654435761u) % MATERIAL_COUNT;
+            drawItems[i].key = make_draw_key(0, 0, 0, material,
+                    distance * depthScale);
+            drawItems[i].draw = object;
+        }
+        uint32_t first = 0;
+        for (size_t l = 0; l != lodInstanceCounts.size(); l++) {
+            lodFirstInstance[l] = first;
+            first += lodInstanceCounts[l];
+        }
+    }
+
+    if (config.sortDraws) {
+        /* Placing instances by level below keeps this order within each */
+        sort_draws(drawItems, drawScratch);
+    }
+
+    {
+        /* World transforms are affine, so the bottom row is free to carry
+         * the object's material index; mesh.vert puts (0, 0, 0, 1) back.
+         * Stored as a float, whose bits survive every copy, unlike the
+         * denormals its integer bits would make */
+        TRACE_ZONE("write_instances");
+        glm::mat4 *instances =
+            (glm::mat4 *)instanceBuffers[currentFrame].mapped;
+        lodCursor.assign(lodFirstInstance.begin(), lodFirstInstance.end());
+        for (const draw_item_t &item : drawItems) {
+            uint32_t object = item.draw;
+            glm::mat4 &instance = instances[lodCursor[objectLods[object]]++];
+            memcpy(&instance, &scene.world(object), sizeof(glm::mat4));
+            instance[0][3] = (float)draw_key_material(item.key);
+        }
+    }
+    TRACE_INSTANT("visible_objects", visibleObjects.size());
+    if (config.occlusion) {
+        prepare_occlusion_draws();
+    }
+}
+
+/* With occlusion culling the instance counts come from the cull shader:
+ * each level draws indirectly from the phase's survivors. The instance
+ * buffer is bound at the level's first instance, so the indirect draws
+ * need no firstInstance (drawIndirectFirstInstance is optional).
+ *
+ * Buffers and the material set stay bound from the view drawn before
+ * unless binds asks for them, see record_view_passes */
+void vk::record_mesh_draw(VkCommandBuffer commandBuffer,
+        const view_target_t &view, uint32_t phase, uint32_t binds)
+{
+    if (binds & DRAW_BIND_DESCRIPTOR) {
+        VkBuffer buffers[] = {meshVertexBuffer.buffer,
+            instanceBuffers[currentFrame].buffer};
+        VkDeviceSize offsets[] = {0, 0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+        vkCmdBindIndexBuffer(commandBuffer, meshIndexBuffer.buffer, 0,
+                VK_INDEX_TYPE_UINT32);
+        vkCmdBindDescriptorSets(commandBuffer,
+                VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1,
+                &materialSet, 0, nullptr);
+    }
+    /* Always: the views differ, and compute passes in between may have
+     * pushed constants of their own */
+    vkCmdPushConstants(commandBuffer, graphicsPipelineLayout,
+            VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(view.viewProjection),
+            &view.viewProjection);
+    if (config.occlusion) {
+        const occlusion_frame_t &frame = occlusionFrames[currentFrame];
+        VkDeviceSize instanceBase = (VkDeviceSize)phase * frame.candidates;
+        VkDeviceSize drawBase = meshLods.size() * 4 * sizeof(uint32_t)
+            + (VkDeviceSize)phase * occlusionDraws
+            * sizeof(VkDrawIndexedIndirectCommand);
+        for (size_t l = 0; l != lodInstanceCounts.size(); l++) {
+            if (lodInstanceCounts[l] == 0) {
+                continue;
+            }
+            VkDeviceSize offset =
+                (instanceBase + lodFirstInstance[l]) * sizeof(glm::mat4);
+            vkCmdBindVertexBuffers(commandBuffer, 1, 1,
+                    &frame.instances.buffer, &offset);
+            vkCmdDrawIndexedIndirect(commandBuffer,
+                    frame.draws.buffer,
+                    drawBase + meshLods[l].firstSubmesh
+                    * sizeof(VkDrawIndexedIndirectCommand),
+                    meshLods[l].submeshCount,
+                    sizeof(VkDrawIndexedIndirectCommand));
+        }
+        return;
+    }
+    for (size_t l = 0; l != lodInstanceCounts.size(); l++) {
+        if (lodInstanceCounts[l] == 0) {
+            continue;
+        }
+        const mesh_lod_t &lod = meshLods[l];
+        for (uint32_t i = 0; i != lod.submeshCount; i++) {
+            const mesh_submesh_t &submesh = meshSubmeshes[lod.firstSubmesh + i];
+            vkCmdDrawIndexed(commandBuffer,
+                    submesh.indexCount,
+                    lodInstanceCounts[l],
+                    submesh.firstIndex,
+                    submesh.vertexOffset,
+                    lodFirstInstance[l]);
+        }
+    }
+}
+
+void vk::destroy_scene(void)
+{
+    for (auto &buffer : instanceBuffers) {
+        destroy_buffer(buffer);
+    }
+    instanceBuffers.clear();
+}
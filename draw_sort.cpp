@@ -0,0 +1,193 @@
+#include "draw_sort.h"
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+
+using std::vector;
+
+/* Below this many draws per slice, handing it to another thread costs
+ * more than it saves */
+const size_t MIN_DRAWS_PER_THREAD = 16384;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    const uint32_t RADIX_BITS = 8;
+    const uint32_t RADIX_BUCKETS = 1 << RADIX_BITS;
+    const uint32_t RADIX_PASSES = 64 / RADIX_BITS;
+
+    const uint32_t DEPTH_SHIFT = 0;
+    const uint32_t MATERIAL_SHIFT = DEPTH_SHIFT + DRAW_KEY_DEPTH_BITS;
+    const uint32_t DESCRIPTOR_SHIFT = MATERIAL_SHIFT + DRAW_KEY_MATERIAL_BITS;
+    const uint32_t PIPELINE_SHIFT = DESCRIPTOR_SHIFT
+        + DRAW_KEY_DESCRIPTOR_BITS;
+    const uint32_t LAYER_SHIFT = PIPELINE_SHIFT + DRAW_KEY_PIPELINE_BITS;
+
+    static_assert(LAYER_SHIFT + DRAW_KEY_LAYER_BITS == 64,
+            "draw key fields fill 64 bits");
+
+    inline uint64_t field(uint32_t value, uint32_t bits, uint32_t shift)
+    {
+        return ((uint64_t)value & ((1ull << bits) - 1)) << shift;
+    }
+
+    inline uint32_t extract(uint64_t key, uint32_t bits, uint32_t shift)
+    {
+        return (uint32_t)((key >> shift) & ((1ull << bits) - 1));
+    }
+
+    inline uint32_t digit(uint64_t key, uint32_t pass)
+    {
+        return (uint32_t)(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1);
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+uint64_t make_draw_key(uint32_t layer, uint32_t pipeline,
+        uint32_t descriptor, uint32_t material, float depth)
+{
+    const uint32_t depthMax = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+    float d = std::min(std::max(depth, 0.f), 1.f);
+    return field(layer, DRAW_KEY_LAYER_BITS, LAYER_SHIFT)
+        | field(pipeline, DRAW_KEY_PIPELINE_BITS, PIPELINE_SHIFT)
+        | field(descriptor, DRAW_KEY_DESCRIPTOR_BITS, DESCRIPTOR_SHIFT)
+        | field(material, DRAW_KEY_MATERIAL_BITS, MATERIAL_SHIFT)
+        | field((uint32_t)(d * (float)depthMax), DRAW_KEY_DEPTH_BITS,
+                DEPTH_SHIFT);
+}
+
+uint32_t draw_key_pipeline(uint64_t key)
+{
+    return extract(key, DRAW_KEY_PIPELINE_BITS, PIPELINE_SHIFT);
+}
+
+uint32_t draw_key_descriptor(uint64_t key)
+{
+    return extract(key, DRAW_KEY_DESCRIPTOR_BITS, DESCRIPTOR_SHIFT);
+}
+
+uint32_t draw_key_material(uint64_t key)
+{
+    return extract(key, DRAW_KEY_MATERIAL_BITS, MATERIAL_SHIFT);
+}
+
+void sort_draws(vector<draw_item_t> &items, vector<draw_item_t> &scratch,
+        uint32_t maxThreads)
+{
+    TRACE_FUNC();
+    size_t count = items.size();
+    scratch.resize(count);
+    if (count < 2) {
+        return;
+    }
+    job_system &jobs = job_system::shared();
+    if (maxThreads == 0) {
+        maxThreads = jobs.concurrency();
+    }
+    size_t threads = std::min((size_t)maxThreads,
+            std::max((size_t)1, count / MIN_DRAWS_PER_THREAD));
+    size_t slice = (count + threads - 1) / threads;
+    auto for_each_slice = [&](const std::function<void(size_t)> &work) {
+        jobs.parallel_for(0, threads, 1, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t != end; t++) {
+                work(t);
+            }
+        });
+    };
+
+    /* Per slice and pass, how many keys fall in each bucket. Counted for
+     * every pass up front to find the bytes all keys share; the counts
+     * only hold for the order the first pass sorts */
+    vector<uint32_t> counts(threads * RADIX_PASSES * RADIX_BUCKETS, 0);
+    const draw_item_t *src = items.data();
+    for_each_slice([&](size_t t) {
+        uint32_t *c = &counts[t * RADIX_PASSES * RADIX_BUCKETS];
+        size_t end = std::min((t + 1) * slice, count);
+        for (size_t i = t * slice; i < end; i++) {
+            uint64_t key = src[i].key;
+            for (uint32_t p = 0; p != RADIX_PASSES; p++) {
+                c[p * RADIX_BUCKETS + digit(key, p)]++;
+            }
+        }
+    });
+
+    draw_item_t *from = items.data();
+    draw_item_t *to = scratch.data();
+    vector<uint32_t> offsets(threads * RADIX_BUCKETS);
+    bool counted = true;
+    for (uint32_t p = 0; p != RADIX_PASSES; p++) {
+        /* The bucket of any one key holds all of them */
+        uint32_t total = 0;
+        for (size_t t = 0; t != threads; t++) {
+            total += counts[(t * RADIX_PASSES + p) * RADIX_BUCKETS
+                + digit(items[0].key, p)];
+        }
+        if (total == count) {
+            continue;
+        }
+        if (!counted) {
+            for_each_slice([&](size_t t) {
+                uint32_t *c = &counts[(t * RADIX_PASSES + p) * RADIX_BUCKETS];
+                std::fill(c, c + RADIX_BUCKETS, 0);
+                size_t end = std::min((t + 1) * slice, count);
+                for (size_t i = t * slice; i < end; i++) {
+                    c[digit(from[i].key, p)]++;
+                }
+            });
+        }
+        counted = false;
+
+        /* Bucket by bucket, and within a bucket slice by slice, keeps the
+         * sort stable */
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b != RADIX_BUCKETS; b++) {
+            for (size_t t = 0; t != threads; t++) {
+                offsets[t * RADIX_BUCKETS + b] = sum;
+                sum += counts[(t * RADIX_PASSES + p) * RADIX_BUCKETS + b];
+            }
+        }
+        for_each_slice([&](size_t t) {
+            TRACE_ZONE("radix_scatter");
+            uint32_t *o = &offsets[t * RADIX_BUCKETS];
+            size_t end = std::min((t + 1) * slice, count);
+            for (size_t i = t * slice; i < end; i++) {
+                to[o[digit(from[i].key, p)]++] = from[i];
+            }
+        });
+        std::swap(from, to);
+    }
+    if (from != items.data()) {
+        items.swap(scratch);
+    }
+}
+
+uint32_t draw_state_tracker::binds_for(uint64_t key)
+{
+    uint32_t binds = DRAW_BIND_PIPELINE | DRAW_BIND_DESCRIPTOR
+        | DRAW_BIND_MATERIAL;
+    if (bound) {
+        binds = 0;
+        if (draw_key_pipeline(key) != draw_key_pipeline(last)) {
+            binds |= DRAW_BIND_PIPELINE;
+        }
+        if (draw_key_descriptor(key) != draw_key_descriptor(last)) {
+            binds |= DRAW_BIND_DESCRIPTOR;
+        }
+        if (draw_key_material(key) != draw_key_material(last)) {
+            binds |= DRAW_BIND_MATERIAL;
+        }
+    }
+    last = key;
+    bound = true;
+    counts.draws++;
+    for (uint32_t f = 0; f != DRAW_BIND_FIELDS; f++) {
+        counts.binds[f] += (binds >> f) & 1;
+    }
+    return binds;
+}
@@ -0,0 +1,73 @@
+#ifndef DRAW_SORT
+#define DRAW_SORT
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Sort key of a draw. Fields from the most significant down: layer,
+ * pipeline, descriptor set, material and depth, so sorted draws group by
+ * the state that is most expensive to change and go front to back within
+ * a group. Bits per field: */
+const uint32_t DRAW_KEY_LAYER_BITS = 4;
+const uint32_t DRAW_KEY_PIPELINE_BITS = 12;
+const uint32_t DRAW_KEY_DESCRIPTOR_BITS = 12;
+const uint32_t DRAW_KEY_MATERIAL_BITS = 12;
+const uint32_t DRAW_KEY_DEPTH_BITS = 24;
+
+/* Fields are masked to their width; depth is clamped to [0, 1] */
+uint64_t make_draw_key(uint32_t layer, uint32_t pipeline,
+        uint32_t descriptor, uint32_t material, float depth);
+uint32_t draw_key_pipeline(uint64_t key);
+uint32_t draw_key_descriptor(uint64_t key);
+uint32_t draw_key_material(uint64_t key);
+
+/* A draw to sort: its key and whatever the caller indexes draws by */
+typedef struct {
+    uint64_t key;
+    uint32_t draw;
+} draw_item_t;
+
+/* Stable LSD radix sort by key, a byte per pass. Bytes every key has in
+ * common are skipped, so keys that only differ in a few fields take a few
+ * passes. Large lists are split into up to maxThreads slices run on the
+ * shared job system (0: one per thread it has). scratch is resized to
+ * match items and holds garbage afterwards */
+void sort_draws(std::vector<draw_item_t> &items,
+        std::vector<draw_item_t> &scratch, uint32_t maxThreads = 0);
+
+/* Which state a draw has to bind, given the draw recorded before it */
+enum draw_bind_t {
+    DRAW_BIND_PIPELINE = 1 << 0,
+    DRAW_BIND_DESCRIPTOR = 1 << 1,
+    DRAW_BIND_MATERIAL = 1 << 2
+};
+const uint32_t DRAW_BIND_FIELDS = 3;
+
+/* Binds issued per field, out of one per draw for a recorder that binds
+ * everything every time */
+typedef struct {
+    uint64_t draws = 0;
+    uint64_t binds[DRAW_BIND_FIELDS] = {};
+
+    uint64_t avoided(uint32_t field) const { return draws - binds[field]; }
+} draw_bind_stats_t;
+
+/* Drops redundant binds while a command buffer is recorded. Layers and
+ * depth never need binding */
+class draw_state_tracker {
+    public:
+        /* Start of a command buffer: nothing is bound */
+        void reset(void) { bound = false; }
+        /* DRAW_BIND_* flags of the fields key differs in from the draw
+         * before; every field for the first draw */
+        uint32_t binds_for(uint64_t key);
+        const draw_bind_stats_t &stats(void) const { return counts; }
+
+    private:
+        uint64_t last = 0;
+        bool bound = false;
+        draw_bind_stats_t counts;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "frame_capture.h"
+#include "notify.h"
+#include "trace.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+
+using std::string;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    bool ends_with(const string &s, const string &suffix)
+    {
+        return s.size() >= suffix.size()
+            && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    /* BT.601 studio range, 8 bit fixed point */
+    inline uint8_t luma(int r, int g, int b)
+    {
+        return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    }
+
+    inline uint8_t chroma_blue(int r, int g, int b)
+    {
+        return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    }
+
+    inline uint8_t chroma_red(int r, int g, int b)
+    {
+        return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+frame_capture::frame_capture(void) :
+    stopping(false), writeFailed(false), written(0)
+{
+}
+
+frame_capture::~frame_capture(void)
+{
+    stop();
+}
+
+void frame_capture::start(const string &path, uint32_t width,
+        uint32_t height, uint32_t rowPitch, bool bgra, uint32_t fps,
+        const std::vector<const uint8_t *> &slots)
+{
+    if (slots.empty() || slots.size() > CAPTURE_MAX_SLOTS) {
+        throw std::runtime_error("capture needs 1 to 16 readback slots");
+    }
+    this->path = path;
+    this->width = width;
+    this->height = height;
+    this->rowPitch = rowPitch;
+    this->bgra = bgra;
+    this->slots = slots;
+    y4m = ends_with(path, ".y4m");
+    converted.resize((size_t)width * height * 3);
+    if (y4m) {
+        stream.open(path, std::ios::binary | std::ios::trunc);
+        if (!stream.is_open()) {
+            throw std::runtime_error("could not create capture " + path);
+        }
+        stream << "YUV4MPEG2 W" << width << " H" << height << " F" << fps
+            << ":1 Ip A1:1 C444\n";
+    }
+    for (uint32_t i = 0; i != slots.size(); i++) {
+        freeSlots.try_push(i);
+    }
+    stopping.store(false);
+    writer = std::thread(&frame_capture::writer_loop, this);
+}
+
+int32_t frame_capture::acquire_slot(void)
+{
+    uint32_t slot;
+    if (!freeSlots.try_pop(slot)) {
+        dropped++;
+        return -1;
+    }
+    return (int32_t)slot;
+}
+
+void frame_capture::submit_slot(uint32_t slot)
+{
+    /* Never full: there are no more slots than it holds */
+    filled.try_push(slot);
+    notify_locked(wakeMutex, wake);
+}
+
+void frame_capture::stop(void)
+{
+    if (!writer.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping.store(true);
+    }
+    wake.notify_one();
+    writer.join();
+    stream.close();
+}
+
+/* Sleeps until a frame arrives; drains what is queued before it quits */
+void frame_capture::writer_loop(void)
+{
+    TRACE_THREAD_NAME("capture");
+    for (;;) {
+        uint32_t slot;
+        if (!filled.try_pop(slot)) {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait(lock, [this] {
+                    return stopping.load() || !filled.empty(); });
+            if (filled.empty()) {
+                return;
+            }
+            continue;
+        }
+        if (!writeFailed.load()) {
+            TRACE_ZONE("write_capture");
+            write_frame(slots[slot]);
+        }
+        freeSlots.try_push(slot);
+    }
+}
+
+void frame_capture::write_frame(const uint8_t *pixels)
+{
+    /* Channel offsets of red and blue in a pixel */
+    int r = bgra ? 2 : 0;
+    int b = bgra ? 0 : 2;
+    size_t plane = (size_t)width * height;
+    uint8_t *out = converted.data();
+    for (uint32_t y = 0; y != height; y++) {
+        const uint8_t *row = pixels + (size_t)y * rowPitch;
+        size_t o = (size_t)y * width;
+        for (uint32_t x = 0; x != width; x++) {
+            const uint8_t *p = row + 4 * x;
+            if (y4m) {
+                out[o + x] = luma(p[r], p[1], p[b]);
+                out[plane + o + x] = chroma_blue(p[r], p[1], p[b]);
+                out[2 * plane + o + x] = chroma_red(p[r], p[1], p[b]);
+            } else {
+                out[3 * (o + x)] = p[r];
+                out[3 * (o + x) + 1] = p[1];
+                out[3 * (o + x) + 2] = p[b];
+            }
+        }
+    }
+
+    uint64_t frame = written.load();
+    if (y4m) {
+        stream << "FRAME\n";
+        stream.write((const char *)out, (std::streamsize)converted.size());
+    } else {
+        char number[16];
+        snprintf(number, sizeof(number), "%06llu", (unsigned long long)frame);
+        std::ofstream file(path + number + ".ppm",
+                std::ios::binary | std::ios::trunc);
+        file << "P6\n" << width << " " << height << "\n255\n";
+        file.write((const char *)out, (std::streamsize)converted.size());
+        file.close();
+        if (!file) {
+            writeFailed.store(true);
+        }
+    }
+    if (y4m && !stream) {
+        writeFailed.store(true);
+    }
+    if (writeFailed.load()) {
+        std::cerr << "capture: could not write frame " << frame << " to "
+            << path << ", stopping" << std::endl;
+        return;
+    }
+    written.store(frame + 1);
+}
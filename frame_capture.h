@@ -0,0 +1,84 @@
+#ifndef FRAME_CAPTURE
+#define FRAME_CAPTURE
+
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Most readback slots a capture can cycle through */
+const uint32_t CAPTURE_MAX_SLOTS = 16;
+
+/* Streams captured frames to disk from a thread of its own. The renderer
+ * reads frames back into slots of memory it owns: it takes a free slot
+ * per frame, and hands it over once the copy is complete. The writer
+ * converts and writes it and puts the slot back. When no slot is free the
+ * writer is behind and the frame is dropped instead of waited for.
+ *
+ * A path ending in .y4m gets one YUV4MPEG2 stream, 4:4:4 with BT.601
+ * studio range. Any other path is the prefix of a PPM file per frame,
+ * followed by the six digit frame number */
+class frame_capture {
+    public:
+        frame_capture(void);
+        ~frame_capture(void);
+
+        /* slots point at height rows of rowPitch bytes each, of 4 byte
+         * RGBA pixels, or BGRA. Throws std::runtime_error when the output
+         * cannot be created */
+        void start(const std::string &path, uint32_t width, uint32_t height,
+                uint32_t rowPitch, bool bgra, uint32_t fps,
+                const std::vector<const uint8_t *> &slots);
+        bool running(void) const { return writer.joinable(); }
+
+        /* Render side. A free slot, or -1 when the frame has to be
+         * dropped */
+        int32_t acquire_slot(void);
+        /* The slot holds a complete frame. In the order they were
+         * acquired */
+        void submit_slot(uint32_t slot);
+
+        /* Write every submitted frame, then stop the writer */
+        void stop(void);
+
+        uint64_t frames_written(void) const { return written.load(); }
+        uint64_t frames_dropped(void) const { return dropped; }
+        bool failed(void) const { return writeFailed.load(); }
+
+    private:
+        frame_capture(const frame_capture &);
+        frame_capture &operator=(const frame_capture &);
+
+        void writer_loop(void);
+        void write_frame(const uint8_t *pixels);
+
+        std::string path;
+        bool y4m = false;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t rowPitch = 0;
+        bool bgra = false;
+        std::vector<const uint8_t *> slots;
+        /* Converted frame: RGB, or the three Y4M planes */
+        std::vector<uint8_t> converted;
+        std::ofstream stream;
+
+        /* Filled slots to the writer, free ones back */
+        spsc_queue<uint32_t, CAPTURE_MAX_SLOTS> filled;
+        spsc_queue<uint32_t, CAPTURE_MAX_SLOTS> freeSlots;
+        std::thread writer;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::atomic<bool> stopping;
+        std::atomic<bool> writeFailed;
+        std::atomic<uint64_t> written;
+        uint64_t dropped = 0;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "frame_pacer.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <thread>
+#include <time.h>
+
+using std::vector;
+
+/* Number of recent intervals kept for percentiles */
+const uint32_t RECENT_FRAMES = 1024;
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+uint64_t monotonic_ns(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void record_frame_interval(frame_stats_t &s, double ms)
+{
+    /* Welford's running mean and variance */
+    s.frames++;
+    double delta = ms - s.mean;
+    s.mean += delta / (double)s.frames;
+    s.m2 += delta * (ms - s.mean);
+    s.min = s.frames == 1 ? ms : std::min(s.min, ms);
+    s.max = std::max(s.max, ms);
+    if (s.recent.size() < RECENT_FRAMES) {
+        s.recent.push_back((float)ms);
+    } else {
+        s.recent[s.recentNext] = (float)ms;
+    }
+    s.recentNext = (s.recentNext + 1) % RECENT_FRAMES;
+}
+
+double frame_stats_t::stddev(void) const
+{
+    return frames > 1 ? std::sqrt(m2 / (double)(frames - 1)) : 0.0;
+}
+
+double frame_stats_t::percentile(double p) const
+{
+    if (recent.empty()) {
+        return 0.0;
+    }
+    vector<float> sorted(recent);
+    size_t n = (size_t)(p / 100.0 * (double)(sorted.size() - 1) + 0.5);
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    return sorted[n];
+}
+
+frame_pacer::frame_pacer(void)
+{
+    frameStats.recent.reserve(RECENT_FRAMES);
+}
+
+void frame_pacer::set_target_fps(double fps)
+{
+    periodNs = fps > 0.0 ? (uint64_t)(1e9 / fps) : 0;
+}
+
+void frame_pacer::set_vsync_period(double seconds)
+{
+    vsyncPeriodNs = seconds > 0.0 ? (uint64_t)(seconds * 1e9) : 0;
+}
+
+void frame_pacer::wait_for_next_frame(void)
+{
+    TRACE_FUNC();
+    uint64_t now = monotonic_ns();
+    lastWorkMs = lastFrame != 0 ? (double)(now - lastFrame) / 1e6 : 0.0;
+
+    /* With vsync the present already blocks once per refresh. Pacing on top
+     * of that at or above the refresh rate only causes missed vblanks, so we
+     * leave it to the swapchain. Lower rates are snapped to a whole number of
+     * refreshes (30 fps on 60 Hz is every other vblank) and we wake a quarter
+     * refresh early so the frame is queued before its vblank */
+    uint64_t period = periodNs;
+    if (period != 0 && vsyncPeriodNs != 0) {
+        if (period * 100 <= vsyncPeriodNs * 102) {
+            period = 0;
+        } else {
+            uint64_t n = (period + vsyncPeriodNs / 2) / vsyncPeriodNs;
+            period = n * vsyncPeriodNs - vsyncPeriodNs / 4;
+        }
+    }
+
+    if (period != 0) {
+        if (vsyncPeriodNs != 0) {
+            /* vblank quantizes when frames start, so pace from the actual
+             * start of the previous frame */
+            nextDeadline = lastFrame + period;
+        } else {
+            /* Fixed cadence of absolute deadlines. If we are more than a
+             * frame behind, start over instead of bursting to catch up */
+            nextDeadline += period;
+            if (nextDeadline + period < now) {
+                nextDeadline = now;
+            }
+        }
+        if (nextDeadline > now) {
+            sleep_until(nextDeadline);
+        }
+    }
+    record_interval(monotonic_ns());
+}
+
+void frame_pacer::resync(void)
+{
+    lastFrame = 0;
+    nextDeadline = 0;
+}
+
+/* Sleep until shortly before the deadline, then spin to it. The spin margin
+ * follows how late the kernel has been waking us up */
+void frame_pacer::sleep_until(uint64_t deadline)
+{
+    uint64_t margin = (uint64_t)std::min(std::max(oversleepNs * 2.0, 1e5), 2e6);
+    uint64_t now = monotonic_ns();
+    if (deadline > now + margin) {
+        uint64_t target = deadline - margin;
+        timespec ts;
+        ts.tv_sec = (time_t)(target / 1000000000ULL);
+        ts.tv_nsec = (long)(target % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr)
+                == EINTR) {
+        }
+        uint64_t woke = monotonic_ns();
+        double late = woke > target ? (double)(woke - target) : 0.0;
+        oversleepNs = 0.9 * oversleepNs + 0.1 * late;
+    }
+    while (monotonic_ns() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+void frame_pacer::record_interval(uint64_t now)
+{
+    if (lastFrame != 0) {
+        record_frame_interval(frameStats, (double)(now - lastFrame) / 1e6);
+    }
+    lastFrame = now;
+}
@@ -0,0 +1,65 @@
+#ifndef FRAME_PACER
+#define FRAME_PACER
+
+#include <stdint.h>
+#include <vector>
+
+/* Running statistics over frame-to-frame intervals, in milliseconds */
+typedef struct {
+    uint64_t frames = 0;
+    double mean = 0.0;
+    double m2 = 0.0;        //Welford sum of squared deviations
+    double min = 0.0;
+    double max = 0.0;
+    /* Recent intervals, used for percentiles */
+    std::vector<float> recent;
+    uint32_t recentNext = 0;
+
+    double stddev(void) const;
+    double percentile(double p) const;
+} frame_stats_t;
+
+/* Add one interval to the statistics */
+void record_frame_interval(frame_stats_t &stats, double ms);
+
+/* Paces the render loop to a target frame rate. Instead of sleeping a fixed
+ * amount per frame it keeps an absolute deadline per frame, sleeps until
+ * shortly before it and spins the rest, so the interval does not depend on
+ * how long the frame itself took. */
+class frame_pacer {
+    public:
+        frame_pacer(void);
+        /* 0 disables the cap (benchmark mode) */
+        void set_target_fps(double fps);
+        /* Refresh period of the display when presentation itself blocks on
+         * vblank (FIFO), 0 when it does not */
+        void set_vsync_period(double seconds);
+        /* Call once per frame after present. Blocks until the next frame is
+         * due and records the interval since the previous call */
+        void wait_for_next_frame(void);
+        /* Forget the previous frame, e.g. after idling, so the gap is neither
+         * recorded as an interval nor used to schedule the next deadline */
+        void resync(void);
+        const frame_stats_t &stats(void) const { return frameStats; }
+        /* Milliseconds of the latest frame spent before waiting */
+        double last_work_ms(void) const { return lastWorkMs; }
+
+    private:
+        void sleep_until(uint64_t deadline);
+        void record_interval(uint64_t now);
+
+        uint64_t periodNs = 0;      //0: uncapped
+        uint64_t vsyncPeriodNs = 0;
+        uint64_t nextDeadline = 0;
+        uint64_t lastFrame = 0;
+        /* Moving average of how late the OS wakes us from sleep. We stop
+         * sleeping that long before the deadline and spin the remainder */
+        double oversleepNs = 500000.0;
+        double lastWorkMs = 0.0;
+        frame_stats_t frameStats;
+};
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t monotonic_ns(void);
+
+#endif
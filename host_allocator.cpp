@@ -0,0 +1,297 @@
+#include "host_allocator.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+/* Arena chunks are carved into blocks of one size class each */
+const size_t HOST_CHUNK_SIZE = 256 << 10;
+/* Free blocks a thread keeps per scope and size class before handing half
+ * of them back, and how many it takes from the arena at once */
+const uint32_t HOST_CACHE_LIMIT = 64;
+const uint32_t HOST_REFILL_BATCH = 16;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* In front of every pointer handed out. 16 bytes keep the default
+     * alignment of the blocks behind it */
+    typedef struct {
+        uint64_t size;          //as requested
+        uint32_t offset;        //from the start of the block
+        uint8_t scope;
+        uint8_t sizeClass;      //HOST_SIZE_CLASSES: from malloc
+        uint8_t reserved[2];
+    } block_header_t;
+    static_assert(sizeof(block_header_t) == 16, "block header layout");
+
+    /* Free lists of the calling thread, for whichever allocator last used
+     * it. Plain data, so it needs no destructor when the thread ends; the
+     * blocks it held stay in their arena until the allocator goes */
+    typedef struct {
+        uint64_t owner;
+        void *blocks[HOST_SCOPES][HOST_SIZE_CLASSES];
+        uint32_t counts[HOST_SCOPES][HOST_SIZE_CLASSES];
+    } thread_cache_t;
+    thread_local thread_cache_t threadCache;
+
+    std::atomic<uint64_t> nextAllocatorId(1);
+
+    inline void *&next_block(void *block)
+    {
+        return *(void **)block;
+    }
+
+    inline size_t class_size(uint32_t sizeClass)
+    {
+        return (size_t)16 << sizeClass;
+    }
+
+    void raise_peak(std::atomic<uint64_t> &peak, uint64_t value)
+    {
+        uint64_t current = peak.load(std::memory_order_relaxed);
+        while (value > current && !peak.compare_exchange_weak(current, value,
+                    std::memory_order_relaxed)) {
+        }
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+host_allocator::host_allocator(void)
+    : id(nextAllocatorId.fetch_add(1)), liveBytes(0), peakBytes(0)
+{
+    vkCallbacks.pUserData = this;
+    vkCallbacks.pfnAllocation = vk_allocate;
+    vkCallbacks.pfnReallocation = vk_reallocate;
+    vkCallbacks.pfnFree = vk_free;
+    vkCallbacks.pfnInternalAllocation = vk_internal_allocation;
+    vkCallbacks.pfnInternalFree = vk_internal_free;
+    for (auto &c : counters) {
+        c.allocations = 0;
+        c.live = 0;
+        c.liveBytes = 0;
+        c.peakBytes = 0;
+        c.internalBytes = 0;
+    }
+}
+
+host_allocator::~host_allocator(void)
+{
+    for (auto &a : arenas) {
+        for (void *chunk : a.chunks) {
+            ::free(chunk);
+        }
+    }
+}
+
+host_scope_stats_t host_allocator::scope_stats(VkSystemAllocationScope scope) const
+{
+    const scope_counters &c = counters[std::min((uint32_t)scope, HOST_SCOPES - 1)];
+    host_scope_stats_t stats;
+    stats.allocations = c.allocations.load();
+    stats.live = c.live.load();
+    stats.liveBytes = c.liveBytes.load();
+    stats.peakBytes = c.peakBytes.load();
+    stats.internalBytes = c.internalBytes.load();
+    return stats;
+}
+
+void *host_allocator::allocate(size_t size, size_t alignment, uint32_t scope)
+{
+    if (size == 0) {
+        return nullptr;
+    }
+    alignment = std::max(alignment, (size_t)16);
+    /* Blocks start 16 byte aligned, so this always fits the header and
+     * the padding up to the alignment */
+    size_t needed = size + alignment;
+    uint32_t sizeClass = 0;
+    while (sizeClass != HOST_SIZE_CLASSES && class_size(sizeClass) < needed) {
+        sizeClass++;
+    }
+    uint8_t *block = sizeClass == HOST_SIZE_CLASSES ?
+        (uint8_t *)malloc(needed) : (uint8_t *)take_block(scope, sizeClass);
+    if (block == nullptr) {
+        return nullptr;
+    }
+    uintptr_t user = ((uintptr_t)block + sizeof(block_header_t) + alignment - 1)
+        & ~(uintptr_t)(alignment - 1);
+    block_header_t *header = (block_header_t *)user - 1;
+    header->size = size;
+    header->offset = (uint32_t)(user - (uintptr_t)block);
+    header->scope = (uint8_t)scope;
+    header->sizeClass = (uint8_t)sizeClass;
+    count(scope, (int64_t)size);
+    return (void *)user;
+}
+
+/* Vulkan's rules: no original is an allocation, size 0 a free, and on
+ * failure the original stays valid */
+void *host_allocator::reallocate(void *original, size_t size, size_t alignment,
+        uint32_t scope)
+{
+    if (original == nullptr) {
+        return allocate(size, alignment, scope);
+    }
+    if (size == 0) {
+        free(original);
+        return nullptr;
+    }
+    const block_header_t *header = (const block_header_t *)original - 1;
+    void *memory = allocate(size, alignment, scope);
+    if (memory != nullptr) {
+        memcpy(memory, original, std::min((size_t)header->size, size));
+        free(original);
+    }
+    return memory;
+}
+
+void host_allocator::free(void *memory)
+{
+    if (memory == nullptr) {
+        return;
+    }
+    const block_header_t *header = (const block_header_t *)memory - 1;
+    uint8_t *block = (uint8_t *)memory - header->offset;
+    uint32_t scope = header->scope, sizeClass = header->sizeClass;
+    count(scope, -(int64_t)header->size);
+    if (sizeClass == HOST_SIZE_CLASSES) {
+        ::free(block);
+    } else {
+        give_block(scope, sizeClass, block);
+    }
+}
+
+void *host_allocator::take_block(uint32_t scope, uint32_t sizeClass)
+{
+    thread_cache_t &cache = threadCache;
+    if (cache.owner != id) {
+        memset(&cache, 0, sizeof(cache));
+        cache.owner = id;
+    }
+    if (cache.blocks[scope][sizeClass] == nullptr) {
+        refill(scope, sizeClass);
+        if (cache.blocks[scope][sizeClass] == nullptr) {
+            return nullptr;
+        }
+    }
+    void *block = cache.blocks[scope][sizeClass];
+    cache.blocks[scope][sizeClass] = next_block(block);
+    cache.counts[scope][sizeClass]--;
+    return block;
+}
+
+/* Blocks may be freed on another thread than they were allocated on; they
+ * simply join that thread's cache */
+void host_allocator::give_block(uint32_t scope, uint32_t sizeClass, void *block)
+{
+    thread_cache_t &cache = threadCache;
+    if (cache.owner != id) {
+        memset(&cache, 0, sizeof(cache));
+        cache.owner = id;
+    }
+    next_block(block) = cache.blocks[scope][sizeClass];
+    cache.blocks[scope][sizeClass] = block;
+    if (++cache.counts[scope][sizeClass] <= HOST_CACHE_LIMIT) {
+        return;
+    }
+    arena &a = arenas[scope];
+    std::lock_guard<std::mutex> lock(a.mutex);
+    for (uint32_t i = 0; i != HOST_CACHE_LIMIT / 2; i++) {
+        void *b = cache.blocks[scope][sizeClass];
+        cache.blocks[scope][sizeClass] = next_block(b);
+        next_block(b) = a.freeLists[sizeClass];
+        a.freeLists[sizeClass] = b;
+    }
+    cache.counts[scope][sizeClass] -= HOST_CACHE_LIMIT / 2;
+}
+
+/* Moves a batch of blocks into the calling thread's cache: freed ones
+ * first, then new ones from the current chunk */
+void host_allocator::refill(uint32_t scope, uint32_t sizeClass)
+{
+    thread_cache_t &cache = threadCache;
+    arena &a = arenas[scope];
+    size_t size = class_size(sizeClass);
+    std::lock_guard<std::mutex> lock(a.mutex);
+    for (uint32_t i = 0; i != HOST_REFILL_BATCH; i++) {
+        void *block = a.freeLists[sizeClass];
+        if (block != nullptr) {
+            a.freeLists[sizeClass] = next_block(block);
+        } else {
+            if (a.cursor == nullptr || a.cursor + size > a.chunkEnd) {
+                void *chunk = malloc(HOST_CHUNK_SIZE);
+                if (chunk == nullptr) {
+                    return;
+                }
+                a.chunks.push_back(chunk);
+                a.cursor = (uint8_t *)chunk;
+                a.chunkEnd = a.cursor + HOST_CHUNK_SIZE;
+            }
+            block = a.cursor;
+            a.cursor += size;
+        }
+        next_block(block) = cache.blocks[scope][sizeClass];
+        cache.blocks[scope][sizeClass] = block;
+        cache.counts[scope][sizeClass]++;
+    }
+}
+
+void host_allocator::count(uint32_t scope, int64_t bytes)
+{
+    scope_counters &c = counters[scope];
+    if (bytes > 0) {
+        c.allocations.fetch_add(1, std::memory_order_relaxed);
+        c.live.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        c.live.fetch_sub(1, std::memory_order_relaxed);
+    }
+    uint64_t scopeBytes = c.liveBytes.fetch_add((uint64_t)bytes,
+            std::memory_order_relaxed) + (uint64_t)bytes;
+    uint64_t totalBytes = liveBytes.fetch_add((uint64_t)bytes,
+            std::memory_order_relaxed) + (uint64_t)bytes;
+    if (bytes > 0) {
+        raise_peak(c.peakBytes, scopeBytes);
+        raise_peak(peakBytes, totalBytes);
+    }
+}
+
+void *VKAPI_CALL host_allocator::vk_allocate(void *user, size_t size,
+        size_t alignment, VkSystemAllocationScope scope)
+{
+    return ((host_allocator *)user)->allocate(size, alignment,
+            std::min((uint32_t)scope, HOST_SCOPES - 1));
+}
+
+void *VKAPI_CALL host_allocator::vk_reallocate(void *user, void *original,
+        size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    return ((host_allocator *)user)->reallocate(original, size, alignment,
+            std::min((uint32_t)scope, HOST_SCOPES - 1));
+}
+
+void VKAPI_CALL host_allocator::vk_free(void *user, void *memory)
+{
+    ((host_allocator *)user)->free(memory);
+}
+
+void VKAPI_CALL host_allocator::vk_internal_allocation(void *user, size_t size,
+        VkInternalAllocationType, VkSystemAllocationScope scope)
+{
+    host_allocator *self = (host_allocator *)user;
+    self->counters[std::min((uint32_t)scope, HOST_SCOPES - 1)].internalBytes
+        .fetch_add(size, std::memory_order_relaxed);
+}
+
+void VKAPI_CALL host_allocator::vk_internal_free(void *user, size_t size,
+        VkInternalAllocationType, VkSystemAllocationScope scope)
+{
+    host_allocator *self = (host_allocator *)user;
+    self->counters[std::min((uint32_t)scope, HOST_SCOPES - 1)].internalBytes
+        .fetch_sub(size, std::memory_order_relaxed);
+}
@@ -0,0 +1,98 @@
+#ifndef HOST_ALLOCATOR
+#define HOST_ALLOCATOR
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* VkSystemAllocationScope COMMAND through INSTANCE */
+const uint32_t HOST_SCOPES = 5;
+/* Blocks of 16 << c bytes for c below HOST_SIZE_CLASSES; anything larger
+ * goes to malloc */
+const uint32_t HOST_SIZE_CLASSES = 9;
+
+typedef struct {
+    uint64_t allocations;   //total since creation
+    uint64_t live;          //allocations not freed yet
+    uint64_t liveBytes;
+    uint64_t peakBytes;
+    /* Driver allocations made outside the callbacks, reported through
+     * pfnInternalAllocation */
+    uint64_t internalBytes;
+} host_scope_stats_t;
+
+/* Host memory the driver allocates through us. Small blocks come from an
+ * arena per allocation scope, so short-lived command scope memory does not
+ * fragment the chunks long-lived object memory sits in, and each thread
+ * keeps a few free blocks per size class to reuse without taking a lock.
+ * Every allocation is counted by scope; the sizes are what the driver asked
+ * for, not what the blocks cost. */
+class host_allocator {
+    public:
+        host_allocator(void);
+        ~host_allocator(void);
+
+        /* Pass as pAllocator to the create and destroy calls */
+        const VkAllocationCallbacks *callbacks(void) const { return &vkCallbacks; }
+
+        host_scope_stats_t scope_stats(VkSystemAllocationScope scope) const;
+        uint64_t live_bytes(void) const { return liveBytes.load(); }
+        uint64_t peak_bytes(void) const { return peakBytes.load(); }
+
+    private:
+        /* Blocks of one scope. Chunks are carved front to back and only
+         * returned to the system when the allocator goes away; free blocks
+         * are linked through their first bytes */
+        struct arena {
+            std::mutex mutex;
+            std::vector<void *> chunks;
+            uint8_t *cursor = nullptr;
+            uint8_t *chunkEnd = nullptr;
+            void *freeLists[HOST_SIZE_CLASSES] = {};
+        };
+
+        struct scope_counters {
+            std::atomic<uint64_t> allocations;
+            std::atomic<uint64_t> live;
+            std::atomic<uint64_t> liveBytes;
+            std::atomic<uint64_t> peakBytes;
+            std::atomic<uint64_t> internalBytes;
+        };
+
+        host_allocator(const host_allocator &);
+        host_allocator &operator=(const host_allocator &);
+
+        void *allocate(size_t size, size_t alignment, uint32_t scope);
+        void *reallocate(void *original, size_t size, size_t alignment,
+                uint32_t scope);
+        void free(void *memory);
+        void *take_block(uint32_t scope, uint32_t sizeClass);
+        void give_block(uint32_t scope, uint32_t sizeClass, void *block);
+        void refill(uint32_t scope, uint32_t sizeClass);
+        void count(uint32_t scope, int64_t bytes);
+
+        static void *VKAPI_CALL vk_allocate(void *user, size_t size,
+                size_t alignment, VkSystemAllocationScope scope);
+        static void *VKAPI_CALL vk_reallocate(void *user, void *original,
+                size_t size, size_t alignment, VkSystemAllocationScope scope);
+        static void VKAPI_CALL vk_free(void *user, void *memory);
+        static void VKAPI_CALL vk_internal_allocation(void *user, size_t size,
+                VkInternalAllocationType type, VkSystemAllocationScope scope);
+        static void VKAPI_CALL vk_internal_free(void *user, size_t size,
+                VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+        VkAllocationCallbacks vkCallbacks;
+        /* Tells this allocator's thread caches apart from those of one
+         * that was destroyed */
+        uint64_t id;
+        arena arenas[HOST_SCOPES];
+        scope_counters counters[HOST_SCOPES];
+        std::atomic<uint64_t> liveBytes;
+        std::atomic<uint64_t> peakBytes;
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include "job_system.h"
+#include "notify.h"
+#include "trace.h"
+
+#include <algorithm>
+
+using std::vector;
+
+/* Failed steal rounds before an idle worker goes to sleep */
+const uint32_t IDLE_SPINS = 64;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* Index of the calling thread's queue: its own for workers, the shared
+     * one for everybody else. Set per worker when it starts */
+    thread_local uint32_t localQueue = 0xffffffff;
+    thread_local const void *localSystem = nullptr;
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+job_system::job_system(uint32_t workers)
+    : mainThread(std::this_thread::get_id()), queued(0), sleeping(0)
+{
+    if (workers == JOB_WORKERS_AUTO) {
+        uint32_t cores = std::thread::hardware_concurrency();
+        workers = cores > 1 ? cores - 1 : 0;
+    }
+    for (uint32_t i = 0; i != workers + 1; i++) {
+        queues.emplace_back(new job_queue);
+    }
+    for (uint32_t i = 0; i != workers; i++) {
+        threads.emplace_back(&job_system::worker_loop, this, i);
+    }
+}
+
+job_system::~job_system(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+job_system &job_system::shared(void)
+{
+    static job_system instance;
+    return instance;
+}
+
+void job_system::submit(job_fn fn, job_counter *counter)
+{
+    if (counter != nullptr) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+    job_t job = {std::move(fn), counter};
+    push(std::move(job));
+}
+
+void job_system::submit_after(job_counter &dependency, job_fn fn,
+        job_counter *counter)
+{
+    if (counter != nullptr) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+    {
+        /* finish() empties the list under the same lock once the count is
+         * zero, so the job is either queued here or picked up there */
+        std::lock_guard<std::mutex> lock(dependency.continuationMutex);
+        if (!dependency.done()) {
+            dependency.continuations.push_back(std::make_pair(std::move(fn), counter));
+            return;
+        }
+    }
+    job_t job = {std::move(fn), counter};
+    push(std::move(job));
+}
+
+void job_system::submit_main(job_fn fn, job_counter *counter)
+{
+    if (counter != nullptr) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(mainQueue.mutex);
+    job_t job = {std::move(fn), counter};
+    mainQueue.jobs.push_back(std::move(job));
+}
+
+void job_system::run_main_jobs(void)
+{
+    job_t job;
+    while (pop_main(job)) {
+        run(job);
+    }
+}
+
+void job_system::push(job_t job)
+{
+    uint32_t index = localSystem == this ? localQueue : (uint32_t)queues.size() - 1;
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->jobs.push_back(std::move(job));
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    if (sleeping.load(std::memory_order_acquire) != 0) {
+        notify_locked(sleepMutex, wake);
+    }
+}
+
+bool job_system::pop_own(job_t &job)
+{
+    uint32_t index = localSystem == this ? localQueue : (uint32_t)queues.size() - 1;
+    job_queue &q = *queues[index];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.jobs.empty()) {
+        return false;
+    }
+    /* Workers take their newest job, the shared queue is first in first out */
+    if (index + 1 == queues.size()) {
+        job = std::move(q.jobs.front());
+        q.jobs.pop_front();
+    } else {
+        job = std::move(q.jobs.back());
+        q.jobs.pop_back();
+    }
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+/* Oldest job of some other queue, starting at a different victim per
+ * thread so thieves spread out */
+bool job_system::steal(job_t &job, uint32_t start)
+{
+    uint32_t count = (uint32_t)queues.size();
+    for (uint32_t n = 0; n != count; n++) {
+        job_queue &q = *queues[(start + n) % count];
+        if (!q.mutex.try_lock()) {
+            continue;
+        }
+        if (!q.jobs.empty()) {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front();
+            q.mutex.unlock();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        q.mutex.unlock();
+    }
+    return false;
+}
+
+bool job_system::pop_main(job_t &job)
+{
+    if (std::this_thread::get_id() != mainThread) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mainQueue.mutex);
+    if (mainQueue.jobs.empty()) {
+        return false;
+    }
+    job = std::move(mainQueue.jobs.front());
+    mainQueue.jobs.pop_front();
+    return true;
+}
+
+bool job_system::try_run_one(void)
+{
+    job_t job;
+    uint32_t self = localSystem == this ? localQueue : (uint32_t)queues.size() - 1;
+    if (pop_own(job) || steal(job, self + 1) || pop_main(job)) {
+        run(job);
+        return true;
+    }
+    return false;
+}
+
+void job_system::run(job_t &job)
+{
+    job.fn();
+    finish(job.counter);
+}
+
+void job_system::finish(job_counter *counter)
+{
+    if (counter == nullptr) {
+        return;
+    }
+    /* Decremented under the lock: once a waiter has seen zero and taken the
+     * lock itself, nothing here touches the counter any more */
+    vector<std::pair<job_fn, job_counter *>> ready;
+    {
+        std::lock_guard<std::mutex> lock(counter->continuationMutex);
+        if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        ready.swap(counter->continuations);
+    }
+    for (auto &next : ready) {
+        job_t job = {std::move(next.first), next.second};
+        push(std::move(job));
+    }
+}
+
+void job_system::wait(job_counter &counter)
+{
+    TRACE_FUNC();
+    while (!counter.done()) {
+        if (!try_run_one()) {
+            std::this_thread::yield();
+        }
+    }
+    /* The last finish() may still hold the lock; the counter is the
+     * caller's to reuse or destroy once we have had it */
+    std::lock_guard<std::mutex> lock(counter.continuationMutex);
+}
+
+void job_system::parallel_for(size_t begin, size_t end, size_t grain,
+        const range_fn &fn)
+{
+    if (begin >= end) {
+        return;
+    }
+    size_t count = end - begin;
+    grain = std::max(grain, (size_t)1);
+    /* A few chunks per thread balance uneven chunks without drowning the
+     * queues in tiny jobs */
+    size_t chunks = std::min((count + grain - 1) / grain, (size_t)concurrency() * 4);
+    if (chunks <= 1) {
+        fn(begin, end);
+        return;
+    }
+    size_t size = (count + chunks - 1) / chunks;
+    job_counter counter;
+    for (size_t b = begin + size; b < end; b += size) {
+        size_t e = std::min(b + size, end);
+        submit([&fn, b, e]() { fn(b, e); }, &counter);
+    }
+    fn(begin, std::min(begin + size, end));
+    wait(counter);
+}
+
+void job_system::worker_loop(uint32_t index)
+{
+    localQueue = index;
+    localSystem = this;
+    TRACE_THREAD_NAME("job worker");
+    uint32_t idle = 0;
+    for (;;) {
+        if (try_run_one()) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < IDLE_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleeping.fetch_add(1, std::memory_order_acq_rel);
+        wake.wait(lock, [this]() {
+            return stopping || queued.load(std::memory_order_acquire) != 0;
+        });
+        sleeping.fetch_sub(1, std::memory_order_acq_rel);
+        if (stopping) {
+            return;
+        }
+        idle = 0;
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef JOB_SYSTEM
+#define JOB_SYSTEM
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+/* Worker count meaning one less than the number of cores */
+const uint32_t JOB_WORKERS_AUTO = 0xffffffff;
+
+typedef std::function<void(void)> job_fn;
+typedef std::function<void(size_t begin, size_t end)> range_fn;
+
+/* Number of unfinished jobs submitted against it. Jobs submitted with
+ * submit_after run once it drops to zero. A counter can be reused or
+ * destroyed once job_system::wait has returned for it */
+class job_counter {
+    public:
+        job_counter(void) : pending(0) {}
+        bool done(void) const { return pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class job_system;
+        job_counter(const job_counter &);
+        job_counter &operator=(const job_counter &);
+
+        std::atomic<uint32_t> pending;
+        std::mutex continuationMutex;
+        std::vector<std::pair<job_fn, job_counter *>> continuations;
+};
+
+/* Work-stealing scheduler. Every worker owns a deque: it pushes and pops
+ * its own jobs at the back (most recent first, still in cache) and steals
+ * from the front of the others when it runs dry. Threads that are not
+ * workers, like the main or render thread, submit through a shared queue
+ * and help execute jobs while they wait, so a process-wide instance with
+ * one worker less than there are cores keeps every core busy without
+ * oversubscribing them. */
+class job_system {
+    public:
+        /* With 0 workers every job runs on the threads that wait */
+        explicit job_system(uint32_t workers = JOB_WORKERS_AUTO);
+        ~job_system(void);
+
+        /* The instance every stage shares */
+        static job_system &shared(void);
+
+        uint32_t worker_count(void) const { return (uint32_t)threads.size(); }
+        /* Workers plus the calling thread */
+        uint32_t concurrency(void) const { return worker_count() + 1; }
+
+        /* counter, if any, is incremented now and decremented once fn ran */
+        void submit(job_fn fn, job_counter *counter = nullptr);
+        /* Run fn once dependency has dropped to zero */
+        void submit_after(job_counter &dependency, job_fn fn,
+                job_counter *counter = nullptr);
+        /* Run fn on the main thread, the next time it calls run_main_jobs or
+         * waits. For APIs that are only allowed there, such as GLFW */
+        void submit_main(job_fn fn, job_counter *counter = nullptr);
+        /* Main thread only; the thread that created the instance */
+        void run_main_jobs(void);
+
+        /* Execute jobs until the counter drops to zero */
+        void wait(job_counter &counter);
+        /* Call fn over [begin, end) in chunks of at least grain elements and
+         * return when all are done. The calling thread takes part */
+        void parallel_for(size_t begin, size_t end, size_t grain,
+                const range_fn &fn);
+
+    private:
+        typedef struct {
+            job_fn fn;
+            job_counter *counter;
+        } job_t;
+
+        /* Separately allocated and padded, so a thief locking one queue
+         * does not invalidate the line its neighbour's owner works on */
+        struct job_queue {
+            std::mutex mutex;
+            std::deque<job_t> jobs;
+            char padding[64];
+        };
+
+        job_system(const job_system &);
+        job_system &operator=(const job_system &);
+
+        void push(job_t job);
+        bool try_run_one(void);
+        bool pop_own(job_t &job);
+        bool steal(job_t &job, uint32_t start);
+        bool pop_main(job_t &job);
+        void run(job_t &job);
+        void finish(job_counter *counter);
+        void worker_loop(uint32_t index);
+
+        /* queues[i] belongs to worker i; the last one is shared by every
+         * other thread */
+        std::vector<std::unique_ptr<job_queue>> queues;
+        job_queue mainQueue;
+        std::thread::id mainThread;
+        std::vector<std::thread> threads;
+
+        /* Jobs sitting in any queue; idle workers sleep while it is 0 */
+        std::atomic<uint32_t> queued;
+        std::atomic<uint32_t> sleeping;
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "lod.h"
+
+using std::vector;
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+/* Levels are ordered by increasing error. Refining only starts once the
+ * current level is clearly too coarse, and coarsening only moves to levels
+ * that are clearly fine */
+uint32_t select_lod(
+        const vector<mesh_lod_t> &lods,
+        float pixelsPerUnit,
+        float maxErrorPx,
+        uint32_t current)
+{
+    if (lods.empty()) {
+        return 0;
+    }
+    uint32_t level = current < lods.size() ? current : (uint32_t)lods.size() - 1;
+    if (lods[level].error * pixelsPerUnit > maxErrorPx * (1.f + LOD_HYSTERESIS)) {
+        while (level > 0 && lods[level].error * pixelsPerUnit > maxErrorPx) {
+            level--;
+        }
+    } else {
+        while (level + 1 < lods.size() && lods[level + 1].error * pixelsPerUnit
+                <= maxErrorPx * (1.f - LOD_HYSTERESIS)) {
+            level++;
+        }
+    }
+    return level;
+}
@@ -0,0 +1,22 @@
+#ifndef MESH_LOD
+#define MESH_LOD
+
+#include "mesh_format.h"
+
+#include <vector>
+
+/* How far the projected error has to move past the threshold before the
+ * level changes, as a fraction of the threshold. Keeps objects that sit
+ * near a switching distance from alternating between two levels */
+const float LOD_HYSTERESIS = 0.25f;
+
+/* Pick the coarsest level whose error, projected to the screen, stays below
+ * maxErrorPx. pixelsPerUnit is how many pixels one object space unit covers
+ * where the object is drawn; current is the level used last frame */
+uint32_t select_lod(
+        const std::vector<mesh_lod_t> &lods,
+        float pixelsPerUnit,
+        float maxErrorPx,
+        uint32_t current);
+
+#endif
@@ -6,12 +6,23 @@
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp> 
 #include "vulkan_application.h" 
+#include "trace.h"
+#include "job_system.h"
 #include <iostream> 
 using std::cout; using std::endl; 
 
-int main() { 
+int main(int argc, char **argv) { 
     try {
+        app_config_t config = parse_arguments(argc, argv);
+        if (config.help) {
+            cout << usage();
+            return EXIT_SUCCESS;
+        }
+        /* Created here so the main thread is the one main thread jobs
+         * run on */
+        job_system::shared();
         vk vulkan; 
+        vulkan.configure(config);
         vulkan.glfw_init();
         vulkan.init();
         vulkan.run();
@@ -19,5 +30,7 @@ int main() {
         std::cerr << e.what() << endl;
         return EXIT_FAILURE;
     } 
+    /* Open in chrome://tracing or ui.perfetto.dev */
+    TRACE_WRITE("trace.json");
     return EXIT_SUCCESS;
 }
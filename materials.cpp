@@ -0,0 +1,361 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+using std::cout; using std::endl;
+#include <vector>
+using std::vector;
+
+#include "vulkan_application.h"
+#include "debug_print.h"
+#include "texture_file.h"
+
+#include <string.h>
+
+#include <string>
+using std::string;
+
+/* Capacity of the bindless texture array. Devices with descriptor
+ * indexing allow at least 500000 update after bind samplers per stage */
+const uint32_t MAX_BINDLESS_TEXTURES = 4096;
+/* Procedural textures the materials pick from, all the same size */
+const uint32_t MATERIAL_TEXTURES = 8;
+const uint32_t MATERIAL_TEXTURE_SIZE = 64;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    uint32_t hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+        return x;
+    }
+
+    /* Grey level of texel (x, y) of pattern p: checkers, stripes both
+     * ways, diagonals, dots, bricks, a grid and noise */
+    uint8_t pattern_texel(uint32_t p, uint32_t x, uint32_t y)
+    {
+        bool on = false;
+        switch (p) {
+            case 0: on = ((x / 8) ^ (y / 8)) & 1; break;
+            case 1: on = (y / 4) & 1; break;
+            case 2: on = (x / 4) & 1; break;
+            case 3: on = ((x + y) / 6) & 1; break;
+            case 4: {
+                int dx = (int)(x % 16) - 8;
+                int dy = (int)(y % 16) - 8;
+                on = dx * dx + dy * dy < 20;
+                break;
+            }
+            case 5: {
+                uint32_t shift = (y / 8) & 1 ? 8 : 0;
+                on = y % 8 != 0 && (x + shift) % 16 != 0;
+                break;
+            }
+            case 6: on = x % 16 != 0 && y % 16 != 0; break;
+            default: return (uint8_t)(160 + hash(y * 64 + x) % 96);
+        }
+        return on ? 255 : 150;
+    }
+
+    VkDescriptorSetLayoutBinding fragment_binding(uint32_t binding,
+            VkDescriptorType type, uint32_t count)
+    {
+        VkDescriptorSetLayoutBinding b = {};
+        b.binding = binding;
+        b.descriptorType = type;
+        b.descriptorCount = count;
+        b.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        return b;
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+/* Set 0 of the mesh shaders: the materials at binding 0 and their textures
+ * at binding 1. With descriptor indexing binding 1 is an array of up to
+ * MAX_BINDLESS_TEXTURES that may have holes, is sized when the set is
+ * allocated and can be written while the set is bound; without it binding
+ * 1 is a single texture array and materials index its layers */
+void vk::create_material_layout(void)
+{
+    TRACE_FUNC();
+    VkDescriptorSetLayoutBinding bindings[] = {
+        fragment_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
+        fragment_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                descriptorIndexingExtension ? MAX_BINDLESS_TEXTURES : 1)};
+    VkDescriptorSetLayoutCreateInfo lci = {};
+    lci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    lci.bindingCount = 2;
+    lci.pBindings = bindings;
+#ifdef VK_EXT_descriptor_indexing
+    VkDescriptorBindingFlagsEXT bindingFlags[] = {0,
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT};
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo = {};
+    flagsInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    flagsInfo.bindingCount = 2;
+    flagsInfo.pBindingFlags = bindingFlags;
+    if (descriptorIndexingExtension) {
+        lci.pNext = &flagsInfo;
+        lci.flags =
+            VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    }
+#endif
+    VkResult result = vkCreateDescriptorSetLayout(device, &lci, allocator,
+            materialSetLayout.replace(device, allocator));
+    print_result(result);
+}
+
+/* MATERIAL_COUNT procedural materials over MATERIAL_TEXTURES procedural
+ * textures, and the descriptor set the mesh draws bind */
+void vk::create_materials(void)
+{
+    TRACE_FUNC();
+    if (!meshLoaded) {
+        return;
+    }
+
+    ////
+    /* DESCRIPTOR SET */
+    VkDescriptorPoolSize sizes[] = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            descriptorIndexingExtension ? MAX_BINDLESS_TEXTURES : 1}};
+    VkDescriptorPoolCreateInfo pci = {};
+    pci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pci.maxSets = 1;
+    pci.poolSizeCount = 2;
+    pci.pPoolSizes = sizes;
+    VkDescriptorSetLayout layout = materialSetLayout;
+    VkDescriptorSetAllocateInfo ai = {};
+    ai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    ai.descriptorSetCount = 1;
+    ai.pSetLayouts = &layout;
+#ifdef VK_EXT_descriptor_indexing
+    VkDescriptorSetVariableDescriptorCountAllocateInfoEXT countInfo = {};
+    countInfo.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+    countInfo.descriptorSetCount = 1;
+    countInfo.pDescriptorCounts = &MAX_BINDLESS_TEXTURES;
+    if (descriptorIndexingExtension) {
+        pci.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+        ai.pNext = &countInfo;
+    }
+#endif
+    VkResult result = vkCreateDescriptorPool(device, &pci, allocator,
+            materialDescriptorPool.replace(device, allocator));
+    print_result(result);
+    ai.descriptorPool = materialDescriptorPool;
+    result = vkAllocateDescriptorSets(device, &ai, &materialSet);
+    print_result(result);
+
+    VkSamplerCreateInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    si.magFilter = VK_FILTER_NEAREST;
+    si.minFilter = VK_FILTER_LINEAR;
+    si.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    si.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    si.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    si.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    si.minLod = 0.f;
+    si.maxLod = VK_LOD_CLAMP_NONE;  //loaded textures bring their mips
+    result = vkCreateSampler(device, &si, allocator,
+            materialSampler.replace(device, allocator));
+    print_result(result);
+
+    ////
+    /* TEXTURES */
+    const uint32_t texels = MATERIAL_TEXTURE_SIZE * MATERIAL_TEXTURE_SIZE;
+    vector<uint8_t> pixels(MATERIAL_TEXTURES * texels * 4);
+    for (uint32_t t = 0; t != MATERIAL_TEXTURES; t++) {
+        for (uint32_t i = 0; i != texels; i++) {
+            uint8_t grey = pattern_texel(t, i % MATERIAL_TEXTURE_SIZE,
+                    i / MATERIAL_TEXTURE_SIZE);
+            memset(&pixels[(t * texels + i) * 4], grey, 3);
+            pixels[(t * texels + i) * 4 + 3] = 255;
+        }
+    }
+    VkExtent2D extent = {MATERIAL_TEXTURE_SIZE, MATERIAL_TEXTURE_SIZE};
+    VkImageUsageFlags usage =
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    vector<uint32_t> textureIndices(MATERIAL_TEXTURES);
+    if (descriptorIndexingExtension) {
+        materialTextures.resize(MATERIAL_TEXTURES);
+        for (uint32_t t = 0; t != MATERIAL_TEXTURES; t++) {
+            create_image(extent, 1, VK_FORMAT_R8G8B8A8_UNORM, usage,
+                    VK_IMAGE_ASPECT_COLOR_BIT, materialTextures[t]);
+            upload_image(materialTextures[t], &pixels[t * texels * 4],
+                    texels * 4);
+            textureIndices[t] = add_bindless_texture(materialTextures[t]);
+        }
+    } else {
+        materialTextures.resize(1);
+        create_image(extent, 1, VK_FORMAT_R8G8B8A8_UNORM, usage,
+                VK_IMAGE_ASPECT_COLOR_BIT, materialTextures[0],
+                MATERIAL_TEXTURES);
+        upload_image(materialTextures[0], pixels.data(), pixels.size());
+        for (uint32_t t = 0; t != MATERIAL_TEXTURES; t++) {
+            textureIndices[t] = t;
+        }
+    }
+    if (descriptorIndexingExtension) {
+        for (auto &path : config.texturePaths) {
+            textureIndices.push_back(load_texture(path));
+        }
+    } else if (!config.texturePaths.empty()) {
+        cout << "Loading textures needs descriptor indexing, "
+            "ignoring --texture" << endl;
+    }
+
+    ////
+    /* MATERIALS */
+    //Written once, so read straight from host memory if need be
+    create_buffer(MATERIAL_COUNT * sizeof(material_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT},
+            materialBuffer);
+    material_t *materials = (material_t *)materialBuffer.mapped;
+    for (uint32_t m = 0; m != MATERIAL_COUNT; m++) {
+        uint32_t h = hash(m + 1);
+        for (uint32_t c = 0; c != 3; c++) {
+            materials[m].color[c] =
+                0.35f + 0.65f * (float)((h >> (8 * c)) & 255) / 255.f;
+        }
+        materials[m].color[3] = 1.f;
+        materials[m].texture = textureIndices[m % textureIndices.size()];
+        materials[m].uvScale = (float)(1 + (h >> 24) % 4);
+        materials[m].pad[0] = materials[m].pad[1] = 0;
+    }
+
+    VkDescriptorBufferInfo bufferInfo = {materialBuffer.buffer, 0,
+        VK_WHOLE_SIZE};
+    VkDescriptorImageInfo imageInfo = {materialSampler,
+        materialTextures[0].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkWriteDescriptorSet writes[2] = {};
+    for (uint32_t i = 0; i != 2; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = materialSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[0].pBufferInfo = &bufferInfo;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[1].pImageInfo = &imageInfo;
+    //The bindless textures are in place already
+    vkUpdateDescriptorSets(device, descriptorIndexingExtension ? 1 : 2,
+            writes, 0, nullptr);
+    cout << "Materials: " << MATERIAL_COUNT << " over "
+        << textureIndices.size()
+        << (descriptorIndexingExtension ? " bindless textures" :
+                " texture array layers") << endl;
+}
+
+/* Write the image into the next free slot of the bindless array and return
+ * the slot, which is what materials store. The slot was never used, so
+ * this is fine while the set is bound, as long as no frame in flight can
+ * index it yet */
+uint32_t vk::add_bindless_texture(const device_image_t &image)
+{
+    if (bindlessTextures == MAX_BINDLESS_TEXTURES) {
+        throw std::runtime_error("bindless texture array is full");
+    }
+    VkDescriptorImageInfo imageInfo = {materialSampler, image.view,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = materialSet;
+    write.dstBinding = 1;
+    write.dstArrayElement = bindlessTextures;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    return bindlessTextures++;
+}
+
+/* Upload a KTX2 texture into the next bindless slot and return the slot.
+ * Block compressed data goes up as is, at a quarter to an eighth of the
+ * memory of RGBA8, whenever the device can sample its format; otherwise
+ * BC1-BC5 are decoded to RGBA8 on the worker threads first */
+uint32_t vk::load_texture(const string &path)
+{
+    TRACE_FUNC();
+    texture_file_t file;
+    load_ktx2(path, file);
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(chosenDevice.physicalDevice,
+            file.format, &properties);
+    bool native = (properties.optimalTilingFeatures
+            & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+    bool transcode = (!native || config.forceTranscode)
+        && can_transcode(file.format);
+    if (!native && !transcode) {
+        throw std::runtime_error("texture format "
+                + std::to_string(file.format)
+                + " is not supported by the device: " + path);
+    }
+    texture_file_t transcoded;
+    const texture_file_t *texture = &file;
+    if (transcode) {
+        transcode_texture(file, transcoded);
+        texture = &transcoded;
+    }
+
+    vector<VkDeviceSize> offsets;
+    for (auto &level : texture->levels) {
+        offsets.push_back(level.offset);
+    }
+    device_image_t image;
+    create_image({texture->width, texture->height},
+            (uint32_t)texture->levels.size(), texture->format,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            VK_IMAGE_ASPECT_COLOR_BIT, image);
+    /* Levels may be stored smallest first, so upload through the last
+     * byte any of them uses */
+    uint64_t end = 0;
+    for (auto &level : texture->levels) {
+        end = std::max(end, level.offset + level.size);
+    }
+    upload_image(image, texture->data.data(), end, offsets);
+    materialTextures.push_back(image);
+    cout << "Texture " << path << ": " << texture->width << "x"
+        << texture->height << ", " << texture->levels.size() << " levels, "
+        << (transcode ? "transcoded to RGBA8" :
+                is_block_compressed(file.format) ? "block compressed" :
+                "RGBA8") << ", " << image.allocationSize / 1024 << " KiB"
+        << endl;
+    return add_bindless_texture(image);
+}
+
+void vk::destroy_materials(void)
+{
+    for (auto &texture : materialTextures) {
+        destroy_image(texture);
+    }
+    materialTextures.clear();
+    bindlessTextures = 0;
+    if (materialBuffer.buffer != VK_NULL_HANDLE) {
+        destroy_buffer(materialBuffer);
+    }
+    /* Frees the set */
+    materialDescriptorPool.reset();
+    materialSet = VK_NULL_HANDLE;
+    materialSampler.reset();
+    materialSetLayout.reset();
+}
@@ -0,0 +1,125 @@
+#include "memory_budget.h"
+#include "trace.h"
+
+#include <algorithm>
+
+using std::vector;
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+void memory_budget::init(VkInstance instance, VkPhysicalDevice physicalDevice,
+        const VkPhysicalDeviceMemoryProperties &properties, bool useExtension)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->physicalDevice = physicalDevice;
+    heapBudgets.assign(properties.memoryHeapCount, heap_budget_t());
+    for (uint32_t i = 0; i != properties.memoryHeapCount; i++) {
+        heap_budget_t &heap = heapBudgets[i];
+        heap.size = properties.memoryHeaps[i].size;
+        heap.budget = (VkDeviceSize)((double)heap.size * FALLBACK_BUDGET_SHARE);
+        heap.usage = 0;
+        heap.allocated = 0;
+    }
+    getProperties2 = nullptr;
+#ifdef VK_EXT_memory_budget
+    if (useExtension) {
+        getProperties2 = vkGetInstanceProcAddr(instance,
+                "vkGetPhysicalDeviceMemoryProperties2KHR");
+    }
+#else
+    (void)instance;
+    (void)useExtension;
+#endif
+}
+
+void memory_budget::allocated(uint32_t heap, VkDeviceSize size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    heapBudgets[heap].allocated += size;
+    heapBudgets[heap].usage += size;
+}
+
+void memory_budget::freed(uint32_t heap, VkDeviceSize size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    heapBudgets[heap].allocated -= size;
+    heapBudgets[heap].usage -= std::min(size, heapBudgets[heap].usage);
+}
+
+void memory_budget::update(void)
+{
+#ifdef VK_EXT_memory_budget
+    if (getProperties2 == nullptr) {
+        return;
+    }
+    TRACE_FUNC();
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    VkPhysicalDeviceMemoryProperties2KHR properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    properties.pNext = &budget;
+    ((PFN_vkGetPhysicalDeviceMemoryProperties2KHR)getProperties2)(
+            physicalDevice, &properties);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i = 0; i != heapBudgets.size(); i++) {
+        heapBudgets[i].budget = budget.heapBudget[i];
+        heapBudgets[i].usage = budget.heapUsage[i];
+    }
+#endif
+}
+
+bool memory_budget::fits(uint32_t heap, VkDeviceSize size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return heapBudgets[heap].usage + size <= heapBudgets[heap].budget;
+}
+
+void memory_budget::add_eviction_handler(eviction_fn handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    handlers.push_back(std::move(handler));
+}
+
+VkDeviceSize memory_budget::relieve_pressure(void)
+{
+    if (relieving.exchange(true)) {
+        return 0;
+    }
+    VkDeviceSize released = 0;
+    vector<eviction_fn> current;
+    vector<VkDeviceSize> excess;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = handlers;
+        for (auto &heap : heapBudgets) {
+            VkDeviceSize limit =
+                (VkDeviceSize)((double)heap.budget * EVICTION_THRESHOLD);
+            excess.push_back(heap.usage > limit ? heap.usage - limit : 0);
+        }
+    }
+    for (uint32_t heap = 0; heap != excess.size(); heap++) {
+        if (excess[heap] == 0) {
+            continue;
+        }
+        TRACE_INSTANT("memory_pressure_heap", heap);
+        VkDeviceSize heapReleased = 0;
+        for (auto &handler : current) {
+            if (heapReleased >= excess[heap]) {
+                break;
+            }
+            heapReleased += handler(heap, excess[heap] - heapReleased);
+        }
+        released += heapReleased;
+    }
+    relieving.store(false);
+    return released;
+}
+
+vector<heap_budget_t> memory_budget::heaps(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return heapBudgets;
+}
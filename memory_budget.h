@@ -0,0 +1,81 @@
+#ifndef MEMORY_BUDGET
+#define MEMORY_BUDGET
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+/* Share of a heap we allow ourselves when the driver cannot tell us our
+ * budget */
+const double FALLBACK_BUDGET_SHARE = 0.8;
+/* Eviction handlers run once usage passes this share of the budget */
+const double EVICTION_THRESHOLD = 0.9;
+
+/* One memory heap, in bytes */
+typedef struct {
+    VkDeviceSize size;
+    /* What this process can use before allocations start failing or the
+     * driver starts paging */
+    VkDeviceSize budget;
+    /* By this process, as of the last update plus what we allocated or
+     * freed since */
+    VkDeviceSize usage;
+    /* Through memory_budget::allocated, i.e. by us */
+    VkDeviceSize allocated;
+} heap_budget_t;
+
+/* Device memory budget and usage per heap. With VK_EXT_memory_budget both
+ * come from the driver, which also counts what it allocates implicitly
+ * (swapchain images, internal buffers) and what other processes leave us.
+ * Without it the budget is a fixed share of each heap and usage is what we
+ * allocated ourselves.
+ *
+ * Thread safe. Eviction handlers run on whichever thread calls
+ * relieve_pressure, without any lock held, so they may free and allocate */
+class memory_budget {
+    public:
+        /* Called with a heap over the eviction threshold and how many bytes
+         * would bring it back under. Returns how many it released; memory
+         * that was only retired counts, it goes within a few frames */
+        typedef std::function<VkDeviceSize(uint32_t heap, VkDeviceSize bytes)>
+            eviction_fn;
+
+        /* useExtension: VK_EXT_memory_budget and
+         * VK_KHR_get_physical_device_properties2 are both enabled */
+        void init(VkInstance instance, VkPhysicalDevice physicalDevice,
+                const VkPhysicalDeviceMemoryProperties &properties,
+                bool useExtension);
+        bool uses_extension(void) const { return getProperties2 != nullptr; }
+
+        void allocated(uint32_t heap, VkDeviceSize size);
+        void freed(uint32_t heap, VkDeviceSize size);
+
+        /* Query the driver again. Without the extension there is nothing
+         * to query and usage is always current */
+        void update(void);
+        /* Whether size more bytes on heap stay within its budget */
+        bool fits(uint32_t heap, VkDeviceSize size);
+
+        void add_eviction_handler(eviction_fn handler);
+        /* Run the handlers for every heap over the eviction threshold until
+         * it is back under or they are out of things to release. Returns
+         * the bytes released. Returns 0 right away while another call is
+         * running, e.g. from inside a handler */
+        VkDeviceSize relieve_pressure(void);
+
+        std::vector<heap_budget_t> heaps(void);
+
+    private:
+        std::mutex mutex;
+        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+        PFN_vkVoidFunction getProperties2 = nullptr;
+        std::vector<heap_budget_t> heapBudgets;
+        std::vector<eviction_fn> handlers;
+        std::atomic<bool> relieving{false};
+};
+
+#endif
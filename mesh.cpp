@@ -0,0 +1,251 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <iostream> 
+using std::cout; using std::endl;
+#include <vector>
+using std::vector;
+
+#include "vulkan_application.h"
+#include "debug_print.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+/* Bytes streamed per staging slot. Two slots let the memcpy out of the
+ * mapped file overlap with the GPU copy of the previous slot */
+const VkDeviceSize STAGING_SLOT_SIZE = 32 << 20;
+const uint32_t STAGING_SLOTS = 2;
+/* Smallest piece of a copy worth handing to another thread */
+const size_t COPY_GRAIN = 1 << 20;
+/* Indices range checked per job */
+const size_t INDEX_CHECK_GRAIN = 1 << 18;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* Copying out of the mapped file is mostly page faults and cache
+     * misses, which spread over cores like any other work */
+    void parallel_copy(void *dst, const void *src, size_t size)
+    {
+        job_system::shared().parallel_for(0, size, COPY_GRAIN,
+                [dst, src](size_t begin, size_t end) {
+            memcpy((uint8_t *)dst + begin, (const uint8_t *)src + begin,
+                    end - begin);
+        });
+    }
+
+    /* Whether every vertex the submesh's indices reach, offset included,
+     * is in the vertex stream */
+    bool indices_in_range(const uint32_t *indices,
+            const mesh_submesh_t &submesh, uint64_t vertexCount)
+    {
+        std::atomic<bool> valid{true};
+        job_system::shared().parallel_for(submesh.firstIndex,
+                (size_t)submesh.firstIndex + submesh.indexCount,
+                INDEX_CHECK_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i != end; i++) {
+                int64_t vertex = (int64_t)indices[i] + submesh.vertexOffset;
+                if (vertex < 0 || (uint64_t)vertex >= vertexCount) {
+                    valid.store(false);
+                    return;
+                }
+            }
+        });
+        return valid.load();
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+/* Map the .amesh file and upload its vertex and index streams. The data is
+ * never parsed or copied into an intermediate buffer: it goes from the page
+ * cache straight into Vulkan memory */
+void vk::load_mesh(void)
+{
+    TRACE_FUNC();
+    if (config.meshPath.empty()) {
+        return;
+    }
+    mapped_mesh mesh;
+    mesh.open(config.meshPath);
+    const mesh_chunk_t *vertices = mesh.find_chunk(MESH_CHUNK_VERTICES);
+    const mesh_chunk_t *indices = mesh.find_chunk(MESH_CHUNK_INDICES);
+    const mesh_chunk_t *submeshes = mesh.find_chunk(MESH_CHUNK_SUBMESHES);
+    if (vertices == nullptr || indices == nullptr || indices->count == 0 ||
+            vertices->stride != sizeof(mesh_vertex_t) ||
+            indices->stride != sizeof(uint32_t)) {
+        throw std::runtime_error("mesh has no usable geometry: "
+                + config.meshPath);
+    }
+    meshHeader = mesh.header();
+
+    /* Submeshes are tiny; without any, draw the whole index stream */
+    if (submeshes != nullptr && submeshes->stride == sizeof(mesh_submesh_t)) {
+        const mesh_submesh_t *s = (const mesh_submesh_t *)mesh.chunk_data(*submeshes);
+        meshSubmeshes.assign(s, s + submeshes->count);
+    } else {
+        mesh_submesh_t whole = {0, (uint32_t)indices->count, 0, 0};
+        meshSubmeshes.assign(1, whole);
+    }
+    for (auto &submesh : meshSubmeshes) {
+        if (submesh.firstIndex > indices->count
+                || submesh.indexCount > indices->count - submesh.firstIndex) {
+            throw std::runtime_error("submesh out of range: " + config.meshPath);
+        }
+    }
+    /* An index past the vertex stream would have the GPU read out of
+     * bounds; all of them are checked before anything is uploaded */
+    const uint32_t *indexData = (const uint32_t *)mesh.chunk_data(*indices);
+    for (auto &submesh : meshSubmeshes) {
+        if (!indices_in_range(indexData, submesh, vertices->count)) {
+            throw std::runtime_error("mesh index out of range: "
+                    + config.meshPath);
+        }
+    }
+
+    /* Files without a LOD chunk are a single level */
+    const mesh_chunk_t *lods = mesh.find_chunk(MESH_CHUNK_LODS);
+    if (lods != nullptr && lods->stride == sizeof(mesh_lod_t) && lods->count != 0) {
+        const mesh_lod_t *l = (const mesh_lod_t *)mesh.chunk_data(*lods);
+        meshLods.assign(l, l + lods->count);
+    } else {
+        mesh_lod_t whole = {0, (uint32_t)meshSubmeshes.size(), 0.f, 0};
+        meshLods.assign(1, whole);
+    }
+    for (auto &l : meshLods) {
+        if (l.firstSubmesh > meshSubmeshes.size()
+                || l.submeshCount > meshSubmeshes.size() - l.firstSubmesh) {
+            throw std::runtime_error("level of detail out of range: "
+                    + config.meshPath);
+        }
+    }
+
+    /* Staging ring, only used if the buffers end up outside host memory */
+    vector<staging_slot_t> staging(STAGING_SLOTS);
+    VkCommandBufferAllocateInfo ai = {};
+    ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    ai.pNext = nullptr;
+    ai.commandPool = commandPool;
+    ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    ai.commandBufferCount = 1;
+    for (auto &slot : staging) {
+        slot.buffer = device_buffer_t();
+        slot.copied = 0;
+        VkResult result = vkAllocateCommandBuffers(
+                device, &ai, &slot.commandBuffer);
+        print_result(result);
+    }
+
+    upload_mesh_chunk(mesh, *vertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            staging, meshVertexBuffer);
+    upload_mesh_chunk(mesh, *indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+            staging, meshIndexBuffer);
+
+    for (auto &slot : staging) {
+        graphicsTimeline.wait(slot.copied);
+        vkFreeCommandBuffers(device, commandPool, 1, &slot.commandBuffer);
+        if (slot.buffer.buffer != VK_NULL_HANDLE) {
+            destroy_buffer(slot.buffer);
+        }
+    }
+    meshLoaded = true;
+}
+
+/* Copy one chunk of the mapped file into a new device buffer. Memory that is
+ * both device local and host visible (integrated GPUs, resizable BAR) is
+ * written directly; otherwise the chunk is streamed through the staging
+ * ring in STAGING_SLOT_SIZE pieces */
+void vk::upload_mesh_chunk(
+        const mapped_mesh &mesh,
+        const mesh_chunk_t &chunk,
+        VkBufferUsageFlags usage,
+        vector<staging_slot_t> &staging,
+        device_buffer_t &dst)
+{
+    TRACE_FUNC();
+    const uint8_t *src = (const uint8_t *)mesh.chunk_data(chunk);
+    create_buffer(
+            chunk.size,
+            usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT},
+            dst);
+
+    if (dst.mapped != nullptr) {
+        TRACE_ZONE("direct_copy");
+        mesh.prefetch(chunk.offset, chunk.size);
+        parallel_copy(dst.mapped, src, chunk.size);
+        mesh.release(chunk.offset, chunk.size);
+        return;
+    }
+
+    uint32_t slotIndex = 0;
+    mesh.prefetch(chunk.offset, std::min(chunk.size, STAGING_SLOT_SIZE));
+    for (VkDeviceSize done = 0; done < chunk.size;) {
+        VkDeviceSize piece = std::min(STAGING_SLOT_SIZE, chunk.size - done);
+        staging_slot_t &slot = staging[slotIndex];
+        slotIndex = (slotIndex + 1) % staging.size();
+
+        /* Wait until the GPU has consumed what this slot held before */
+        graphicsTimeline.wait(slot.copied);
+        if (slot.buffer.buffer == VK_NULL_HANDLE) {
+            create_buffer(
+                    STAGING_SLOT_SIZE,
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                    {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT},
+                    slot.buffer);
+        }
+
+        /* Read the next piece in while this one is copied */
+        if (done + piece < chunk.size) {
+            mesh.prefetch(chunk.offset + done + piece,
+                    std::min(STAGING_SLOT_SIZE, chunk.size - done - piece));
+        }
+        {
+            TRACE_ZONE("staging_copy");
+            parallel_copy(slot.buffer.mapped, src + done, piece);
+        }
+        mesh.release(chunk.offset + done, piece);
+
+        VkCommandBufferBeginInfo bi = {};
+        bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(slot.commandBuffer, &bi);
+        VkBufferCopy region = {0, done, piece};
+        vkCmdCopyBuffer(slot.commandBuffer, slot.buffer.buffer, dst.buffer,
+                1, &region);
+        vkEndCommandBuffer(slot.commandBuffer);
+
+        VkSubmitInfo si = {};
+        si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        si.commandBufferCount = 1;
+        si.pCommandBuffers = &slot.commandBuffer;
+        slot.copied = graphicsTimeline.submit(graphicsQueue, si);
+        done += piece;
+    }
+}
+
+void vk::destroy_mesh(void)
+{
+    if (!meshLoaded) {
+        return;
+    }
+    destroy_buffer(meshVertexBuffer);
+    destroy_buffer(meshIndexBuffer);
+    meshLoaded = false;
+}
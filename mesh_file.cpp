@@ -0,0 +1,137 @@
+#include "mesh_file.h"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+using std::string;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* madvise wants a page aligned start. Pages may be larger than
+     * MESH_CHUNK_ALIGNMENT, e.g. 16K or 64K on some ARM systems */
+    uint64_t page_start(uint64_t offset)
+    {
+        static const uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+        return offset & ~(pageSize - 1);
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+mapped_mesh::~mapped_mesh(void)
+{
+    close();
+}
+
+void mapped_mesh::open(const string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open mesh " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(mesh_file_header_t)) {
+        ::close(fd);
+        throw std::runtime_error("mesh file too small: " + path);
+    }
+    void *mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+            fd, 0);
+    /* The mapping keeps its own reference to the file */
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("failed to map mesh " + path);
+    }
+    data = (const uint8_t *)mapping;
+    size = (size_t)st.st_size;
+    try {
+        validate(path);
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+void mapped_mesh::close(void)
+{
+    if (data != nullptr) {
+        munmap((void *)data, size);
+        data = nullptr;
+        size = 0;
+    }
+}
+
+/* Check everything we later index with, so a truncated or corrupt file fails
+ * here rather than with a fault in the middle of an upload */
+void mapped_mesh::validate(const string &path) const
+{
+    const mesh_file_header_t &h = header();
+    if (h.magic != MESH_MAGIC) {
+        throw std::runtime_error("not a mesh file: " + path);
+    }
+    if (h.version != MESH_VERSION) {
+        throw std::runtime_error("unsupported mesh version: " + path);
+    }
+    uint64_t tableEnd = sizeof(mesh_file_header_t)
+        + (uint64_t)h.chunkCount * sizeof(mesh_chunk_t);
+    if (h.fileSize != size || tableEnd > size) {
+        throw std::runtime_error("truncated mesh file: " + path);
+    }
+    for (uint32_t i = 0; i != h.chunkCount; i++) {
+        const mesh_chunk_t &c = chunks()[i];
+        if (c.offset % MESH_CHUNK_ALIGNMENT != 0 || c.offset < tableEnd ||
+                c.offset > size || c.size > size - c.offset ||
+                c.size != (uint64_t)c.stride * c.count) {
+            throw std::runtime_error("corrupt mesh chunk table: " + path);
+        }
+    }
+}
+
+const mesh_file_header_t &mapped_mesh::header(void) const
+{
+    return *(const mesh_file_header_t *)data;
+}
+
+const mesh_chunk_t *mapped_mesh::chunks(void) const
+{
+    return (const mesh_chunk_t *)(data + sizeof(mesh_file_header_t));
+}
+
+const mesh_chunk_t *mapped_mesh::find_chunk(uint32_t type) const
+{
+    for (uint32_t i = 0; i != header().chunkCount; i++) {
+        if (chunks()[i].type == type) {
+            return &chunks()[i];
+        }
+    }
+    return nullptr;
+}
+
+const void *mapped_mesh::chunk_data(const mesh_chunk_t &chunk) const
+{
+    return data + chunk.offset;
+}
+
+void mapped_mesh::prefetch(uint64_t offset, uint64_t size) const
+{
+    uint64_t start = page_start(offset);
+    madvise((void *)(data + start), (size_t)(offset + size - start),
+            MADV_WILLNEED);
+}
+
+void mapped_mesh::release(uint64_t offset, uint64_t size) const
+{
+    uint64_t start = page_start(offset);
+    madvise((void *)(data + start), (size_t)(offset + size - start),
+            MADV_DONTNEED);
+}
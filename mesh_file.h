@@ -0,0 +1,38 @@
+#ifndef MESH_FILE
+#define MESH_FILE
+
+#include "mesh_format.h"
+
+#include <stddef.h>
+#include <string>
+
+/* Read-only memory mapping of an .amesh file. Loading copies nothing: pages
+ * are faulted in as the upload reads them, straight out of the page cache */
+class mapped_mesh {
+    public:
+        mapped_mesh(void) {}
+        ~mapped_mesh(void);
+        /* Throws std::runtime_error on I/O errors or a malformed file */
+        void open(const std::string &path);
+        void close(void);
+
+        const mesh_file_header_t &header(void) const;
+        const mesh_chunk_t *chunks(void) const;
+        /* nullptr when the file has no chunk of that type */
+        const mesh_chunk_t *find_chunk(uint32_t type) const;
+        const void *chunk_data(const mesh_chunk_t &chunk) const;
+        /* Ask the kernel to read a byte range in ahead of the copy */
+        void prefetch(uint64_t offset, uint64_t size) const;
+        /* The range has been uploaded; its pages may be dropped */
+        void release(uint64_t offset, uint64_t size) const;
+
+    private:
+        mapped_mesh(const mapped_mesh &);
+        mapped_mesh &operator=(const mapped_mesh &);
+        void validate(const std::string &path) const;
+
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+};
+
+#endif
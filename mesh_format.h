@@ -0,0 +1,78 @@
+#ifndef MESH_FORMAT
+#define MESH_FORMAT
+
+#include <stdint.h>
+
+/* Binary mesh container (.amesh), written by tools/meshconv.
+ *
+ *   mesh_file_header_t
+ *   mesh_chunk_t[chunkCount]     chunk table
+ *   chunk payloads               each starting on a MESH_CHUNK_ALIGNMENT
+ *                                boundary
+ *
+ * Payloads are page aligned so the file can be mmapped and every stream
+ * copied straight from the mapped pages into Vulkan memory. All values are
+ * little endian. */
+
+const uint32_t MESH_MAGIC = 0x48534d41;    //"AMSH"
+const uint32_t MESH_VERSION = 1;
+const uint64_t MESH_CHUNK_ALIGNMENT = 4096;
+
+enum mesh_chunk_type_t {
+    MESH_CHUNK_VERTICES = 1,    //mesh_vertex_t[count]
+    MESH_CHUNK_INDICES = 2,     //uint32_t[count], triangle list
+    MESH_CHUNK_SUBMESHES = 3,   //mesh_submesh_t[count]
+    MESH_CHUNK_LODS = 4         //mesh_lod_t[count], optional
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunkCount;
+    uint32_t flags;             //reserved, 0
+    uint64_t fileSize;
+    /* Object space bounding box of all vertices */
+    float boundsMin[3];
+    float boundsMax[3];
+} mesh_file_header_t;
+
+typedef struct {
+    uint32_t type;              //mesh_chunk_type_t
+    uint32_t stride;            //bytes per element
+    uint64_t offset;            //from the start of the file
+    uint64_t size;              //bytes
+    uint64_t count;             //elements
+} mesh_chunk_t;
+
+typedef struct {
+    float position[3];
+    float normal[3];
+    float uv[2];
+} mesh_vertex_t;
+
+/* A range of the index stream drawn with one material */
+typedef struct {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    uint32_t materialIndex;
+} mesh_submesh_t;
+
+/* One level of detail: a run of submeshes, finest first. Every level
+ * indexes the same vertex stream; coarser levels only have fewer
+ * triangles. Without a LOD chunk all submeshes form a single level */
+typedef struct {
+    uint32_t firstSubmesh;
+    uint32_t submeshCount;
+    /* Estimated object space deviation from the full detail mesh */
+    float error;
+    uint32_t reserved;          //0
+} mesh_lod_t;
+
+static_assert(sizeof(mesh_file_header_t) == 48, "mesh header layout");
+static_assert(sizeof(mesh_chunk_t) == 32, "mesh chunk layout");
+static_assert(sizeof(mesh_vertex_t) == 32, "mesh vertex layout");
+static_assert(sizeof(mesh_submesh_t) == 16, "mesh submesh layout");
+static_assert(sizeof(mesh_lod_t) == 16, "mesh lod layout");
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef NOTIFY
+#define NOTIFY
+
+#include <condition_variable>
+#include <mutex>
+
+/* Wake one waiter on cv after publishing a change it checks under mutex.
+ * The change itself may be lock-free: taking the lock, even empty, orders
+ * it before a waiter that has checked and is about to wait, so the
+ * notification cannot be lost */
+inline void notify_locked(std::mutex &mutex, std::condition_variable &cv)
+{
+    { std::lock_guard<std::mutex> lock(mutex); }
+    cv.notify_one();
+}
+
+#endif
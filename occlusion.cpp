@@ -0,0 +1,524 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <iostream>
+using std::cout; using std::endl;
+#include <vector>
+using std::vector;
+
+#include "vulkan_application.h"
+#include "debug_print.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#include <string>
+using std::string;
+
+/* Workgroup sizes of the compute shaders */
+const uint32_t PYRAMID_GROUP_SIZE = 8;      //8x8 texels
+const uint32_t CULL_GROUP_SIZE = 64;        //candidates
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* Push constants of shaders/depth_pyramid.comp */
+    typedef struct {
+        int32_t srcSize[2];
+        int32_t dstSize[2];
+    } pyramid_push_t;
+
+    /* Push constants of shaders/occlusion_cull.comp, std430 layout */
+    typedef struct {
+        glm::mat4 viewProjection;
+        glm::vec4 sphere;           //object space center and radius
+        float pyramidSize[2];
+        uint32_t candidateCount;
+        uint32_t lodCount;
+        uint32_t drawBase;          //first draw of the phase, in uints
+        uint32_t instanceBase;      //first instance of the phase
+        uint32_t phase;
+        uint32_t testOcclusion;     //0: the pyramid is not valid yet
+    } cull_push_t;
+
+    static_assert(sizeof(cull_push_t) == 112, "cull push constant layout");
+
+    /* Largest power of two not above n, n > 0 */
+    uint32_t previous_pow2(uint32_t n)
+    {
+        uint32_t p = 1;
+        while (p * 2 <= n) {
+            p *= 2;
+        }
+        return p;
+    }
+
+    VkDescriptorSetLayoutBinding compute_binding(uint32_t binding,
+            VkDescriptorType type)
+    {
+        VkDescriptorSetLayoutBinding b = {};
+        b.binding = binding;
+        b.descriptorType = type;
+        b.descriptorCount = 1;
+        b.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        return b;
+    }
+
+    /* Compute shader writes to the next compute dispatch, or with
+     * dstStage/dstAccess to whatever reads them */
+    void compute_barrier(VkCommandBuffer commandBuffer,
+            VkPipelineStageFlags dstStage =
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT)
+    {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0,
+                1, &barrier, 0, nullptr, 0, nullptr);
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+/* Everything --occlusion needs besides the depth buffers and the second
+ * render pass: the depth pyramid, both compute pipelines and, per frame in
+ * flight, the indirect draws, the surviving instances and the visibility
+ * of every candidate */
+void vk::create_occlusion_culling(void)
+{
+    TRACE_FUNC();
+    if (!config.occlusion) {
+        return;
+    }
+    create_depth_pyramid();
+
+    ////
+    /* DESCRIPTOR SET LAYOUTS */
+    //Pyramid: the level below (or the depth buffer) in, one level out
+    VkDescriptorSetLayoutBinding pyramidBindings[] = {
+        compute_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+        compute_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE)};
+    //Cull: pyramid, candidates, survivors, draws, visibility
+    VkDescriptorSetLayoutBinding cullBindings[] = {
+        compute_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+        compute_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+        compute_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+        compute_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+        compute_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)};
+    VkDescriptorSetLayoutCreateInfo lci = {};
+    lci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    lci.bindingCount = 2;
+    lci.pBindings = pyramidBindings;
+    VkResult result = vkCreateDescriptorSetLayout(device, &lci, allocator,
+            pyramidSetLayout.replace(device, allocator));
+    print_result(result);
+    lci.bindingCount = 5;
+    lci.pBindings = cullBindings;
+    result = vkCreateDescriptorSetLayout(device, &lci, allocator,
+            cullSetLayout.replace(device, allocator));
+    print_result(result);
+
+    ////
+    /* DESCRIPTOR SETS */
+    //One per pyramid level, one per frame in flight for culling
+    uint32_t levels = depthPyramid.levels;
+    VkDescriptorPoolSize sizes[] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            levels + MAX_FRAMES_IN_FLIGHT},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, levels},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * MAX_FRAMES_IN_FLIGHT}};
+    VkDescriptorPoolCreateInfo pci = {};
+    pci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pci.maxSets = levels + MAX_FRAMES_IN_FLIGHT;
+    pci.poolSizeCount = 3;
+    pci.pPoolSizes = sizes;
+    result = vkCreateDescriptorPool(device, &pci, allocator,
+            occlusionDescriptorPool.replace(device, allocator));
+    print_result(result);
+
+    vector<VkDescriptorSetLayout> setLayouts(levels, pyramidSetLayout);
+    pyramidSets.resize(levels);
+    VkDescriptorSetAllocateInfo ai = {};
+    ai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    ai.descriptorPool = occlusionDescriptorPool;
+    ai.descriptorSetCount = levels;
+    ai.pSetLayouts = setLayouts.data();
+    result = vkAllocateDescriptorSets(device, &ai, pyramidSets.data());
+    print_result(result);
+
+    /* Level 0 reduces the widest view's depth buffer, every other level
+     * the level below it */
+    for (uint32_t l = 0; l != levels; l++) {
+        VkDescriptorImageInfo src = {};
+        src.sampler = depthPyramidSampler;
+        if (l == 0) {
+            src.imageView = views[widestView].depth.view;
+            src.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        } else {
+            src.imageView = depthPyramidLevels[l - 1];
+            src.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        }
+        VkDescriptorImageInfo dst = {};
+        dst.imageView = depthPyramidLevels[l];
+        dst.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        VkWriteDescriptorSet writes[2] = {};
+        for (uint32_t i = 0; i != 2; i++) {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = pyramidSets[l];
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = pyramidBindings[i].descriptorType;
+        }
+        writes[0].pImageInfo = &src;
+        writes[1].pImageInfo = &dst;
+        vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+    }
+
+    ////
+    /* PIPELINES */
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.offset = 0;
+    VkPipelineLayoutCreateInfo pl_ci = {};
+    pl_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pl_ci.setLayoutCount = 1;
+    pl_ci.pushConstantRangeCount = 1;
+    pl_ci.pPushConstantRanges = &pushRange;
+
+    VkDescriptorSetLayout layout = pyramidSetLayout;
+    pl_ci.pSetLayouts = &layout;
+    pushRange.size = sizeof(pyramid_push_t);
+    result = vkCreatePipelineLayout(device, &pl_ci, allocator,
+            pyramidPipelineLayout.replace(device, allocator));
+    print_result(result);
+    layout = cullSetLayout;
+    pushRange.size = sizeof(cull_push_t);
+    result = vkCreatePipelineLayout(device, &pl_ci, allocator,
+            cullPipelineLayout.replace(device, allocator));
+    print_result(result);
+    create_compute_pipeline("shaders/depth_pyramid.comp.spv",
+            pyramidPipelineLayout, pyramidPipeline);
+    create_compute_pipeline("shaders/occlusion_cull.comp.spv",
+            cullPipelineLayout, cullPipeline);
+
+    ////
+    /* PER FRAME */
+    occlusionDraws = (uint32_t)meshSubmeshes.size();
+    VkDeviceSize drawBytes = meshLods.size() * 4 * sizeof(uint32_t)
+        + 2 * occlusionDraws * sizeof(VkDrawIndexedIndirectCommand);
+    setLayouts.assign(MAX_FRAMES_IN_FLIGHT, cullSetLayout);
+    vector<VkDescriptorSet> cullSets(MAX_FRAMES_IN_FLIGHT);
+    ai.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    ai.pSetLayouts = setLayouts.data();
+    result = vkAllocateDescriptorSets(device, &ai, cullSets.data());
+    print_result(result);
+
+    occlusionFrames.resize(MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i != MAX_FRAMES_IN_FLIGHT; i++) {
+        occlusion_frame_t &frame = occlusionFrames[i];
+        /* Reset by the CPU every frame, counted up by the GPU */
+        create_buffer(drawBytes,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT},
+                frame.draws);
+        /* Only ever touched by the GPU */
+        create_buffer(2 * scene.size() * sizeof(glm::mat4),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0},
+                frame.instances);
+        create_buffer(scene.size() * sizeof(uint32_t),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0},
+                frame.visible);
+        frame.descriptorSet = cullSets[i];
+        frame.candidates = 0;
+    }
+}
+
+/* Max depth pyramid of the widest view's depth buffer. Level 0 is the
+ * largest power of two size that fits in it, so every level halves the one
+ * below exactly; level 0 covers the depth texels it spans conservatively */
+void vk::create_depth_pyramid(void)
+{
+    VkExtent2D depth = views[widestView].extent;
+    VkExtent2D extent = {previous_pow2(depth.width),
+        previous_pow2(depth.height)};
+    uint32_t levels = 1;
+    while ((std::max(extent.width, extent.height) >> levels) != 0) {
+        levels++;
+    }
+    create_image(extent, levels, VK_FORMAT_R32_SFLOAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            VK_IMAGE_ASPECT_COLOR_BIT, depthPyramid);
+
+    /* One view per level, written as a storage image and read by the
+     * next level */
+    VkImageViewCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    ci.image = depthPyramid.image;
+    ci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    ci.format = VK_FORMAT_R32_SFLOAT;
+    depthPyramidLevels.resize(levels);
+    for (uint32_t l = 0; l != levels; l++) {
+        ci.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, l, 1, 0, 1};
+        VkResult result = vkCreateImageView(device, &ci, allocator,
+                depthPyramidLevels[l].replace(device, allocator));
+        print_result(result);
+    }
+
+    /* Texel fetches only; culling picks the level itself */
+    VkSamplerCreateInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    si.magFilter = VK_FILTER_NEAREST;
+    si.minFilter = VK_FILTER_NEAREST;
+    si.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    si.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    si.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    si.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    si.minLod = 0.f;
+    si.maxLod = (float)levels;
+    VkResult result = vkCreateSampler(device, &si, allocator,
+            depthPyramidSampler.replace(device, allocator));
+    print_result(result);
+    depthPyramidValid = false;
+}
+
+void vk::create_compute_pipeline(const string &path, VkPipelineLayout layout,
+        unique_pipeline &pipeline)
+{
+    TRACE_FUNC();
+    unique_shader_module module;
+    create_shader_module(read_file(path), module);
+    VkComputePipelineCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    ci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    ci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    ci.stage.module = module;
+    ci.stage.pName = "main";
+    ci.layout = layout;
+    ci.basePipelineIndex = -1;
+    VkResult result = vkCreateComputePipelines(device, pipelineCache, 1, &ci,
+            allocator, pipeline.replace(device, allocator));
+    print_result(result);
+    //The module is only needed while the pipeline is created
+}
+
+/* After the draw list is written: count what the frame slot drew last
+ * time, reset its indirect draws and point its descriptors at this
+ * frame's candidates, which the eviction handler may have moved */
+void vk::prepare_occlusion_draws(void)
+{
+    TRACE_FUNC();
+    occlusion_frame_t &frame = occlusionFrames[currentFrame];
+    uint32_t lodCount = (uint32_t)meshLods.size();
+    uint32_t *table = (uint32_t *)frame.draws.mapped;
+    VkDrawIndexedIndirectCommand *draws =
+        (VkDrawIndexedIndirectCommand *)(table + 4 * lodCount);
+
+    /* The fence has been waited on, so the counts are final. Every
+     * submesh of a level draws the same instances; count its first */
+    if (frame.candidates != 0) {
+        occlusionStats.frames++;
+        occlusionStats.candidates += frame.candidates;
+        for (uint32_t phase = 0; phase != 2; phase++) {
+            for (uint32_t l = 0; l != lodCount; l++) {
+                occlusionStats.drawn[phase] += draws[phase * occlusionDraws
+                    + meshLods[l].firstSubmesh].instanceCount;
+            }
+        }
+    }
+
+    for (uint32_t l = 0; l != lodCount; l++) {
+        table[4 * l] = lodFirstInstance[l];
+        table[4 * l + 1] = meshLods[l].firstSubmesh;
+        table[4 * l + 2] = meshLods[l].submeshCount;
+        table[4 * l + 3] = 0;
+    }
+    for (uint32_t phase = 0; phase != 2; phase++) {
+        for (uint32_t i = 0; i != occlusionDraws; i++) {
+            VkDrawIndexedIndirectCommand &draw =
+                draws[phase * occlusionDraws + i];
+            draw.indexCount = meshSubmeshes[i].indexCount;
+            draw.instanceCount = 0;
+            draw.firstIndex = meshSubmeshes[i].firstIndex;
+            draw.vertexOffset = meshSubmeshes[i].vertexOffset;
+            draw.firstInstance = 0;
+        }
+    }
+    frame.candidates = (uint32_t)visibleObjects.size();
+
+    VkDescriptorImageInfo pyramid = {};
+    pyramid.sampler = depthPyramidSampler;
+    pyramid.imageView = depthPyramid.view;
+    pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    VkDescriptorBufferInfo buffers[4] = {
+        {instanceBuffers[currentFrame].buffer, 0, VK_WHOLE_SIZE},
+        {frame.instances.buffer, 0, VK_WHOLE_SIZE},
+        {frame.draws.buffer, 0, VK_WHOLE_SIZE},
+        {frame.visible.buffer, 0, VK_WHOLE_SIZE}};
+    VkWriteDescriptorSet writes[5] = {};
+    for (uint32_t i = 0; i != 5; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = frame.descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = i == 0 ? nullptr : &buffers[i - 1];
+    }
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[0].pImageInfo = &pyramid;
+    vkUpdateDescriptorSets(device, 5, writes, 0, nullptr);
+}
+
+/* Test the frame's candidates against the depth pyramid. Phase 0 uses the
+ * pyramid of the previous frame, projected with the matrix it was rendered
+ * with, and records which candidates it drew; phase 1 tests the others
+ * against the pyramid just built from phase 0's depth. Survivors are
+ * appended to the phase's instances and counted into its indirect draws */
+void vk::record_occlusion_cull(VkCommandBuffer commandBuffer, uint32_t phase)
+{
+    TRACE_FUNC();
+    const occlusion_frame_t &frame = occlusionFrames[currentFrame];
+    if (phase == 0 && !depthPyramidValid) {
+        /* Nothing to test against yet: everything passes phase 0. The
+         * pyramid stays in the general layout from here on */
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = depthPyramid.image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+            depthPyramid.levels, 0, 1};
+        vkCmdPipelineBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    if (frame.candidates == 0) {
+        return;
+    }
+
+    cull_push_t push;
+    push.viewProjection = phase == 0 ? depthPyramidViewProjection
+        : views[widestView].viewProjection;
+    /* Bounding sphere of the mesh; the shader scales it per instance */
+    float center[3], radius2 = 0.f;
+    for (int k = 0; k != 3; k++) {
+        center[k] = 0.5f * (meshHeader.boundsMin[k] + meshHeader.boundsMax[k]);
+        float half = 0.5f * (meshHeader.boundsMax[k] - meshHeader.boundsMin[k]);
+        radius2 += half * half;
+    }
+    push.sphere = glm::vec4(center[0], center[1], center[2],
+            std::sqrt(radius2));
+    push.pyramidSize[0] = (float)depthPyramid.extent.width;
+    push.pyramidSize[1] = (float)depthPyramid.extent.height;
+    push.candidateCount = frame.candidates;
+    push.lodCount = (uint32_t)meshLods.size();
+    push.drawBase = push.lodCount * 4 + phase * occlusionDraws
+        * (uint32_t)(sizeof(VkDrawIndexedIndirectCommand) / sizeof(uint32_t));
+    push.instanceBase = phase * frame.candidates;
+    push.phase = phase;
+    push.testOcclusion = phase == 1 || depthPyramidValid ? 1 : 0;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+            cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+            cullPipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout,
+            VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(commandBuffer,
+            (frame.candidates + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    /* The draws read the counts as indirect parameters and the
+     * survivors as instance attributes */
+    compute_barrier(commandBuffer,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
+
+/* Rebuild the pyramid from the widest view's depth after phase 0. It
+ * always spans the whole view, whatever resolution it was drawn at. The
+ * render pass's dependency makes the depth writes visible; each level
+ * waits for the one below */
+void vk::record_depth_pyramid(VkCommandBuffer commandBuffer)
+{
+    TRACE_FUNC();
+    /* Phase 0 is still reading the previous pyramid */
+    vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 0, nullptr);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+            pyramidPipeline);
+    /* Only the part of the depth buffer rendered this frame */
+    VkExtent2D src = views[widestView].renderExtent;
+    for (uint32_t l = 0; l != depthPyramid.levels; l++) {
+        VkExtent2D dst = {std::max(depthPyramid.extent.width >> l, 1u),
+            std::max(depthPyramid.extent.height >> l, 1u)};
+        pyramid_push_t push = {{(int32_t)src.width, (int32_t)src.height},
+            {(int32_t)dst.width, (int32_t)dst.height}};
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                pyramidPipelineLayout, 0, 1, &pyramidSets[l], 0, nullptr);
+        vkCmdPushConstants(commandBuffer, pyramidPipelineLayout,
+                VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(commandBuffer,
+                (dst.width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                (dst.height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                1);
+        /* Also orders phase 0's visibility flags before phase 1 */
+        compute_barrier(commandBuffer);
+        src = dst;
+    }
+    depthPyramidValid = true;
+    depthPyramidViewProjection = views[widestView].viewProjection;
+}
+
+void vk::destroy_occlusion_culling(void)
+{
+    if (!config.occlusion) {
+        return;
+    }
+    for (auto &frame : occlusionFrames) {
+        destroy_buffer(frame.draws);
+        destroy_buffer(frame.instances);
+        destroy_buffer(frame.visible);
+    }
+    occlusionFrames.clear();
+    cullPipeline.reset();
+    pyramidPipeline.reset();
+    cullPipelineLayout.reset();
+    pyramidPipelineLayout.reset();
+    /* Frees the sets */
+    occlusionDescriptorPool.reset();
+    pyramidSets.clear();
+    cullSetLayout.reset();
+    pyramidSetLayout.reset();
+    depthPyramidSampler.reset();
+    depthPyramidLevels.clear();
+    destroy_image(depthPyramid);
+}
@@ -0,0 +1,484 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <iostream>
+using std::cout; using std::endl;
+#include <vector>
+using std::vector;
+
+#include "vulkan_application.h"
+#include "debug_print.h"
+#include "job_system.h"
+
+#include <fstream>
+#include <sstream>
+#include <stddef.h>
+#include <string.h>
+
+#include <string>
+using std::string;
+
+/* Pipelines per vkCreateGraphicsPipelines call during warm-up. Big enough
+ * for the driver to spread one call over its own threads, small enough to
+ * leave every worker some */
+const size_t PIPELINE_BATCH = 4;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* Unique per key; each field gets the bits its enum needs */
+    uint64_t pack_key(const pipeline_key_t &key)
+    {
+        return (uint64_t)key.topology
+            | (uint64_t)key.polygonMode << 4
+            | (uint64_t)key.cullMode << 6
+            | (uint64_t)(key.blend ? 1 : 0) << 8
+            | (uint64_t)key.shaderOptions << 9;
+    }
+
+    /* Index of word in names, or -1 */
+    int find_name(const string &word, const char *const *names, int count)
+    {
+        for (int i = 0; i != count; i++) {
+            if (word == names[i]) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    const char *const TOPOLOGY_NAMES[] = {"point_list", "line_list",
+        "line_strip", "triangle_list", "triangle_strip", "triangle_fan"};
+    const char *const POLYGON_NAMES[] = {"fill", "line", "point"};
+    const char *const CULL_NAMES[] = {"none", "front", "back"};
+    const char *const BLEND_NAMES[] = {"opaque", "blend"};
+    /* Shader options by shader_option_t; lit is all of them off */
+    const char *const OPTION_NAMES[] = {"unlit", "normals", "toon"};
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+bool operator==(const pipeline_key_t &a, const pipeline_key_t &b)
+{
+    return pack_key(a) == pack_key(b);
+}
+
+/* The state the parent pipeline is built with; also what is drawn unless
+ * the command line picks a variant */
+pipeline_key_t vk::default_pipeline_key(void)
+{
+    pipeline_key_t key;
+    if (config.meshPath.empty()) {
+        key.topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
+        //Cull polygons facing away. This only affects polygons, not lines
+        //or points
+        key.cullMode = VK_CULL_MODE_BACK_BIT;
+    } else {
+        key.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        //Mesh winding depends on the exporter, draw both sides
+        key.cullMode = VK_CULL_MODE_NONE;
+    }
+    key.polygonMode = VK_POLYGON_MODE_FILL;
+    key.blend = false;
+    key.shaderOptions = 0;
+    return key;
+}
+
+/* Fill in everything vkCreateGraphicsPipelines needs for one variant. All
+ * pointers point into desc itself, so it must not move afterwards. With a
+ * parent the variant is created as its derivative, otherwise it allows
+ * derivatives of its own */
+void vk::describe_pipeline(const pipeline_key_t &key, VkPipeline parent,
+        pipeline_desc_t &desc)
+{
+    memset(&desc, 0, sizeof(desc));
+
+    ////
+    /* SPECIALIZATION */
+    //Bit i of the key's shader options is specialization constant i, a bool
+    for (uint32_t i = 0; i != SHADER_OPTION_COUNT; i++) {
+        desc.specData[i] = (key.shaderOptions >> i) & 1 ? VK_TRUE : VK_FALSE;
+        desc.specEntries[i].constantID = i;
+        desc.specEntries[i].offset = i * sizeof(VkBool32);
+        desc.specEntries[i].size = sizeof(VkBool32);
+    }
+    desc.specInfo.mapEntryCount = SHADER_OPTION_COUNT;
+    desc.specInfo.pMapEntries = desc.specEntries;
+    desc.specInfo.dataSize = sizeof(desc.specData);
+    desc.specInfo.pData = desc.specData;
+
+    ////
+    /* SHADER STAGES */
+    //Constants a shader does not declare are ignored, so both stages get
+    //the same map
+    VkShaderModule modules[] = {vertShaderModule, fragShaderModule};
+    VkShaderStageFlagBits stages[] = {VK_SHADER_STAGE_VERTEX_BIT,
+        VK_SHADER_STAGE_FRAGMENT_BIT};
+    for (int i = 0; i != 2; i++) {
+        desc.stages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        desc.stages[i].stage = stages[i];
+        desc.stages[i].module = modules[i]; //Code wrapper
+        desc.stages[i].pName = "main"; //function to invoke in the shader program
+        desc.stages[i].pSpecializationInfo = &desc.specInfo;
+    }
+
+    ////
+    /* VERTEX SETUP */
+    //The built-in shape is hardcoded into the shader, so there is no data
+    //to load. Meshes read interleaved mesh_vertex_t from binding 0 and a
+    //world matrix per instance, one column per location, from binding 1
+    VkPipelineVertexInputStateCreateInfo &vert_ci = desc.vertexInput;
+    vert_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    if (!config.meshPath.empty()) {
+        desc.bindings[0] = {0, sizeof(mesh_vertex_t), VK_VERTEX_INPUT_RATE_VERTEX};
+        desc.bindings[1] = {1, sizeof(glm::mat4), VK_VERTEX_INPUT_RATE_INSTANCE};
+        desc.attributes[0] = {0, 0, VK_FORMAT_R32G32B32_SFLOAT,
+            offsetof(mesh_vertex_t, position)};
+        desc.attributes[1] = {1, 0, VK_FORMAT_R32G32B32_SFLOAT,
+            offsetof(mesh_vertex_t, normal)};
+        desc.attributes[2] = {2, 0, VK_FORMAT_R32G32_SFLOAT,
+            offsetof(mesh_vertex_t, uv)};
+        for (uint32_t c = 0; c != 4; c++) {
+            desc.attributes[3 + c] = {3 + c, 1, VK_FORMAT_R32G32B32A32_SFLOAT,
+                c * 16};
+        }
+        vert_ci.vertexBindingDescriptionCount = 2;
+        vert_ci.pVertexBindingDescriptions = desc.bindings;
+        vert_ci.vertexAttributeDescriptionCount = 7;
+        vert_ci.pVertexAttributeDescriptions = desc.attributes;
+    }
+
+    ////
+    /* INPUT ASSEMBLY */
+    //This stage groups vertex data into primitives
+    desc.inputAssembly.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    desc.inputAssembly.topology = key.topology;
+    desc.inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    ////
+    /* VIEWPORT */
+    //The final coordinate transform before rasterization, from normalized
+    //device coordinates into window coordinates
+    desc.viewport.x = 0.0f;
+    desc.viewport.y = 0.0f;
+    //Set per view when recording, see the dynamic state below
+    desc.viewport.width = (float)views[0].extent.width;
+    desc.viewport.height = (float)views[0].extent.height;
+    desc.viewport.minDepth = 0.0f;
+    desc.viewport.maxDepth = 1.0f;
+    desc.scissor.offset = {0, 0};
+    desc.scissor.extent = views[0].extent; //Draw whole image
+    desc.viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    desc.viewportState.viewportCount = 1;
+    desc.viewportState.pViewports = &desc.viewport;
+    desc.viewportState.scissorCount = 1;
+    desc.viewportState.pScissors = &desc.scissor;
+
+    ////
+    /* RASTERIZER */
+    //Primitives represented by vertices are now turned into streams of
+    //fragments ready to be shaded by the fragment shader
+    VkPipelineRasterizationStateCreateInfo &ra_ci = desc.rasterization;
+    ra_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    ra_ci.depthClampEnable = VK_FALSE;
+    ra_ci.rasterizerDiscardEnable = VK_FALSE;
+    ra_ci.polygonMode = key.polygonMode;
+    ra_ci.cullMode = key.cullMode;
+    //Determine which vertix winding order is front or back
+    ra_ci.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    ra_ci.depthBiasEnable = VK_FALSE;
+    ra_ci.lineWidth = 1.0f; //Width of primitives in pixels
+
+    ////
+    /* MULTISAMPLE STATE */
+    desc.multisample.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    desc.multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    desc.multisample.sampleShadingEnable = VK_FALSE;
+    desc.multisample.minSampleShading = 1.f;
+
+    ////
+    /* DEPTH AND/OR STENCIL BUFFER */
+    //Nearer fragments win. Blended variants test but leave depth alone,
+    //so what is behind them still shows through
+    VkPipelineDepthStencilStateCreateInfo &ds = desc.depthStencil;
+    ds.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    ds.depthTestEnable = VK_TRUE;
+    ds.depthWriteEnable = key.blend ? VK_FALSE : VK_TRUE;
+    ds.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    ds.depthBoundsTestEnable = VK_FALSE;
+    ds.stencilTestEnable = VK_FALSE;
+
+    ////
+    /* COLOR BLEND STATE */
+    VkPipelineColorBlendAttachmentState &cb = desc.blendAttachment;
+    cb.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    cb.blendEnable = key.blend ? VK_TRUE : VK_FALSE;
+    if (key.blend) {
+        //Straight alpha: src * a + dst * (1 - a)
+        cb.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        cb.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    } else {
+        cb.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+        cb.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    }
+    cb.colorBlendOp = VK_BLEND_OP_ADD;
+    cb.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    cb.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    cb.alphaBlendOp = VK_BLEND_OP_ADD;
+    desc.colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    desc.colorBlend.logicOpEnable = VK_FALSE;
+    desc.colorBlend.logicOp = VK_LOGIC_OP_COPY;
+    desc.colorBlend.attachmentCount = 1;
+    desc.colorBlend.pAttachments = &desc.blendAttachment;
+
+    ////
+    /* DYNAMIC STATE */
+    //Views differ in size, so viewport and scissor are set when recording
+    //and one pipeline serves all of them
+    desc.dynamicStates[0] = VK_DYNAMIC_STATE_VIEWPORT;
+    desc.dynamicStates[1] = VK_DYNAMIC_STATE_SCISSOR;
+    desc.dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    desc.dynamicState.dynamicStateCount = 2;
+    desc.dynamicState.pDynamicStates = desc.dynamicStates;
+
+    ////
+    /* GRAPHICS PIPELINE */
+    VkGraphicsPipelineCreateInfo &ci = desc.info;
+    ci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    ci.stageCount = 2; //Two shader stages
+    ci.pStages = desc.stages;
+    ci.pVertexInputState = &desc.vertexInput;
+    ci.pInputAssemblyState = &desc.inputAssembly;
+    ci.pViewportState = &desc.viewportState;
+    ci.pRasterizationState = &desc.rasterization;
+    ci.pMultisampleState = &desc.multisample;
+    ci.pDepthStencilState = &desc.depthStencil;
+    ci.pColorBlendState = &desc.colorBlend;
+    ci.pDynamicState = &desc.dynamicState;
+    ci.layout = graphicsPipelineLayout;
+    ci.renderPass = renderPass;
+    ci.subpass = 0;
+    //Derivatives tell the driver most of the state matches the parent,
+    //which it can use to share work and memory between them
+    if (parent != VK_NULL_HANDLE) {
+        ci.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+        ci.basePipelineHandle = parent;
+    } else {
+        ci.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+        ci.basePipelineHandle = VK_NULL_HANDLE;
+    }
+    ci.basePipelineIndex = -1;
+}
+
+/* The pipeline for a key, created on first use as a derivative of the
+ * parent and cached from then on. Safe to call from any thread */
+VkPipeline vk::get_pipeline(const pipeline_key_t &key)
+{
+    if (key == graphicsPipelineKey) {
+        return graphicsPipeline;
+    }
+    std::lock_guard<std::mutex> lock(pipelineMutex);
+    auto found = pipelineVariants.find(pack_key(key));
+    if (found != pipelineVariants.end()) {
+        return found->second;
+    }
+    TRACE_ZONE("create_pipeline_variant");
+    pipeline_desc_t desc;
+    describe_pipeline(key, graphicsPipeline, desc);
+    unique_pipeline pipeline;
+    VkResult result = vkCreateGraphicsPipelines(
+            device,
+            pipelineCache,
+            1,
+            &desc.info,
+            allocator,
+            pipeline.replace(device, allocator));
+    print_result(result);
+    VkPipeline handle = pipeline;
+    pipelineVariants[pack_key(key)] = std::move(pipeline);
+    return handle;
+}
+
+/* One pipeline state per line:
+ *     <topology> <polygon mode> <cull mode> <opaque|blend> [options]
+ * with the names above, e.g. "triangle_list fill none opaque toon". Options
+ * are any of unlit, normals and toon, or lit for none. # starts a comment */
+vector<pipeline_key_t> vk::load_pipeline_manifest(const string &path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open pipeline manifest " + path);
+    }
+    vector<pipeline_key_t> keys;
+    string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        string topology, polygon, cull, blend, option;
+        if (!(words >> topology)) {
+            continue;
+        }
+        words >> polygon >> cull >> blend;
+        pipeline_key_t key;
+        int t = find_name(topology, TOPOLOGY_NAMES, 6);
+        int p = find_name(polygon, POLYGON_NAMES, 3);
+        int c = find_name(cull, CULL_NAMES, 3);
+        int b = find_name(blend, BLEND_NAMES, 2);
+        if (t < 0 || p < 0 || c < 0 || b < 0) {
+            throw std::runtime_error(path + ":" + std::to_string(number)
+                    + ": invalid pipeline state");
+        }
+        key.topology = (VkPrimitiveTopology)t;
+        key.polygonMode = (VkPolygonMode)p;
+        key.cullMode = (VkCullModeFlags)c;
+        key.blend = b == 1;
+        key.shaderOptions = 0;
+        while (words >> option) {
+            int o = find_name(option, OPTION_NAMES, SHADER_OPTION_COUNT);
+            if (o >= 0) {
+                key.shaderOptions |= 1u << o;
+            } else if (option != "lit") {
+                throw std::runtime_error(path + ":" + std::to_string(number)
+                        + ": unknown shader option " + option);
+            }
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+/* Without a manifest: every shading mode, opaque and blended, filled and,
+ * where the device can, as wireframe, all on the default state */
+vector<pipeline_key_t> vk::default_pipeline_manifest(void)
+{
+    vector<pipeline_key_t> keys;
+    pipeline_key_t key = default_pipeline_key();
+    uint32_t modes = chosenDevice.features.fillModeNonSolid ? 2 : 1;
+    for (uint32_t mode = 0; mode != modes; mode++) {
+        key.polygonMode = mode == 0
+            ? VK_POLYGON_MODE_FILL : VK_POLYGON_MODE_LINE;
+        for (uint32_t blend = 0; blend != 2; blend++) {
+            key.blend = blend != 0;
+            key.shaderOptions = 0;
+            keys.push_back(key);
+            for (uint32_t o = 0; o != SHADER_OPTION_COUNT; o++) {
+                key.shaderOptions = 1u << o;
+                keys.push_back(key);
+            }
+        }
+    }
+    return keys;
+}
+
+/* Create every pipeline of the manifest before the first frame, so none
+ * is compiled mid-frame by get_pipeline. The keys are split over the job
+ * system; each job creates its share in batches into a pipeline cache of
+ * its own, since a cache may only be used by one thread at a time, and the
+ * caches are merged into the main one at the end */
+void vk::warm_up_pipelines(void)
+{
+    TRACE_FUNC();
+    uint64_t start = monotonic_ns();
+    vector<pipeline_key_t> manifest = config.pipelineManifest.empty() ?
+        default_pipeline_manifest()
+        : load_pipeline_manifest(config.pipelineManifest);
+    vector<pipeline_key_t> keys;
+    for (auto &key : manifest) {
+        bool known = key == graphicsPipelineKey
+            || pipelineVariants.count(pack_key(key)) != 0;
+        for (auto &k : keys) {
+            known = known || k == key;
+        }
+        if (!known) {
+            keys.push_back(key);
+        }
+    }
+    if (keys.empty()) {
+        return;
+    }
+
+    job_system &jobs = job_system::shared();
+    vector<VkPipeline> pipelines(keys.size(), VK_NULL_HANDLE);
+    vector<VkPipelineCache> caches;
+    std::mutex cachesMutex;
+    VkResult failure = VK_SUCCESS;
+    jobs.parallel_for(0, keys.size(), PIPELINE_BATCH,
+            [&](size_t begin, size_t end) {
+        TRACE_ZONE("create_pipelines");
+        VkPipelineCacheCreateInfo cci = {};
+        cci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        VkPipelineCache cache;
+        VkResult result = vkCreatePipelineCache(device, &cci, allocator,
+                &cache);
+        if (result != VK_SUCCESS) {
+            cache = VK_NULL_HANDLE;
+        }
+        vector<pipeline_desc_t> descs(PIPELINE_BATCH);
+        vector<VkGraphicsPipelineCreateInfo> infos(PIPELINE_BATCH);
+        for (size_t b = begin; b < end && result == VK_SUCCESS;
+                b += PIPELINE_BATCH) {
+            uint32_t count = (uint32_t)std::min(PIPELINE_BATCH, end - b);
+            for (uint32_t i = 0; i != count; i++) {
+                describe_pipeline(keys[b + i], graphicsPipeline, descs[i]);
+                infos[i] = descs[i].info;
+            }
+            result = vkCreateGraphicsPipelines(device, cache, count,
+                    infos.data(), allocator, &pipelines[b]);
+        }
+        std::lock_guard<std::mutex> lock(cachesMutex);
+        if (cache != VK_NULL_HANDLE) {
+            caches.push_back(cache);
+        }
+        if (result != VK_SUCCESS) {
+            failure = result;
+        }
+    });
+
+    {
+        TRACE_ZONE("merge_pipeline_caches");
+        if (!caches.empty()) {
+            VkResult result = vkMergePipelineCaches(device, pipelineCache,
+                    (uint32_t)caches.size(), caches.data());
+            print_result(result);
+        }
+        for (VkPipelineCache cache : caches) {
+            vkDestroyPipelineCache(device, cache, allocator);
+        }
+    }
+    size_t created = 0;
+    {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        for (size_t i = 0; i != keys.size(); i++) {
+            if (pipelines[i] != VK_NULL_HANDLE) {
+                pipelineVariants[pack_key(keys[i])] =
+                    unique_pipeline(device, pipelines[i], allocator);
+                created++;
+            }
+        }
+    }
+    print_result(failure);
+    double ms = (double)(monotonic_ns() - start) / 1e6;
+    cout << "Pipeline warm-up: " << created << " pipelines in " << ms
+        << " ms on " << jobs.concurrency() << " threads" << endl;
+    TRACE_INSTANT("warm_up_pipelines", created);
+}
+
+/* Drops every variant; they are rebuilt on demand. The parent stays */
+void vk::destroy_pipeline_variants(void)
+{
+    std::lock_guard<std::mutex> lock(pipelineMutex);
+    pipelineVariants.clear();
+}
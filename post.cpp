@@ -0,0 +1,430 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+using std::cout; using std::endl;
+#include <vector>
+using std::vector;
+
+#include "vulkan_application.h"
+#include "debug_print.h"
+
+#include <algorithm>
+
+/* Texels of the first level a downsample or upsample workgroup writes, per
+ * axis, and the workgroup size of the composite */
+const uint32_t BLOOM_TILE = 16;
+const uint32_t COMPOSITE_GROUP_SIZE = 8;
+
+/* What the bright pass lets through, and the grading applied after
+ * tonemapping: a little more saturation and contrast, slightly warm */
+const float BLOOM_THRESHOLD = 0.8f;
+const float BLOOM_KNEE = 0.3f;
+const float GRADE_SATURATION = 1.1f;
+const float GRADE_CONTRAST = 1.05f;
+const float GRADE_GAIN[4] = {1.f, 0.98f, 0.94f, 1.f};
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* The chain's dispatches per view, in the order they are recorded.
+     * Each has a descriptor set of its own */
+    enum post_set_t {
+        DOWNSAMPLE_SCENE,   //scene to bloom levels 0-2
+        DOWNSAMPLE_BLOOM,   //level 2 to levels 3-5
+        UPSAMPLE_COARSE,    //levels 5 and 4 into 3
+        UPSAMPLE_FINE,      //levels 3 and 2 into 1
+        COMPOSITE,          //levels 1 and 0 into the scene
+        POST_SET_COUNT
+    };
+
+    /* Push constants of shaders/bloom_downsample.comp */
+    typedef struct {
+        float srcMax[2];
+        int32_t srcLod;
+        float threshold;
+        float knee;
+    } downsample_push_t;
+
+    /* Push constants of shaders/bloom_upsample.comp */
+    typedef struct {
+        int32_t coarseSize[2];
+        int32_t midSize[2];
+        int32_t fineSize[2];
+    } upsample_push_t;
+
+    /* Push constants of shaders/post_composite.comp, std430 layout */
+    typedef struct {
+        float gain[4];
+        float invExtent[2];
+        float bloomMax0[2];
+        float bloomMax1[2];
+        int32_t renderSize[2];
+        float exposure;
+        float bloomIntensity;
+        float saturation;
+        float contrast;
+    } composite_push_t;
+
+    static_assert(sizeof(composite_push_t) == 64,
+            "composite push constant layout");
+
+    uint32_t group_count(uint32_t texels, uint32_t groupSize)
+    {
+        return (texels + groupSize - 1) / groupSize;
+    }
+
+    /* Compute shader writes to the next dispatch, or to whatever reads
+     * them at dstStage */
+    void shader_write_barrier(VkCommandBuffer commandBuffer,
+            VkPipelineStageFlags dstStage =
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VkAccessFlags dstAccess = VK_ACCESS_SHADER_READ_BIT)
+    {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = dstAccess;
+        vkCmdPipelineBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0,
+                1, &barrier, 0, nullptr, 0, nullptr);
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+/* Bloom levels and descriptor sets per view, and the three compute
+ * pipelines of the post chain. Each view's color image is the HDR scene,
+ * see create_render_targets */
+void vk::create_post_processing(void)
+{
+    TRACE_FUNC();
+    if (!postProcess) {
+        return;
+    }
+
+    VkSamplerCreateInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    si.magFilter = VK_FILTER_LINEAR;
+    si.minFilter = VK_FILTER_LINEAR;
+    si.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    si.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    si.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    si.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    si.minLod = 0.f;
+    si.maxLod = (float)BLOOM_LEVELS;
+    VkResult result = vkCreateSampler(device, &si, allocator,
+            postSampler.replace(device, allocator));
+    print_result(result);
+
+    ////
+    /* DESCRIPTOR SET LAYOUTS */
+    //Downsample: the source, three levels out
+    //Upsample: the two levels above, the level added to
+    //Composite: the scene, the bloom levels
+    VkDescriptorType types[][4] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            VK_DESCRIPTOR_TYPE_STORAGE_IMAGE},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER}};
+    uint32_t bindingCounts[] = {4, 3, 2};
+    unique_descriptor_set_layout *setLayouts[] = {&downsampleSetLayout,
+        &upsampleSetLayout, &compositeSetLayout};
+    for (uint32_t i = 0; i != 3; i++) {
+        VkDescriptorSetLayoutBinding bindings[4] = {};
+        for (uint32_t b = 0; b != bindingCounts[i]; b++) {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = types[i][b];
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        VkDescriptorSetLayoutCreateInfo lci = {};
+        lci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        lci.bindingCount = bindingCounts[i];
+        lci.pBindings = bindings;
+        result = vkCreateDescriptorSetLayout(device, &lci, allocator,
+                setLayouts[i]->replace(device, allocator));
+        print_result(result);
+    }
+
+    ////
+    /* DESCRIPTOR SETS */
+    uint32_t viewCount = (uint32_t)views.size();
+    VkDescriptorPoolSize sizes[] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3 * viewCount},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 13 * viewCount}};
+    VkDescriptorPoolCreateInfo pci = {};
+    pci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pci.maxSets = POST_SET_COUNT * viewCount;
+    pci.poolSizeCount = 2;
+    pci.pPoolSizes = sizes;
+    result = vkCreateDescriptorPool(device, &pci, allocator,
+            postDescriptorPool.replace(device, allocator));
+    print_result(result);
+
+    VkDescriptorSetLayout postLayouts[POST_SET_COUNT] = {
+        downsampleSetLayout, downsampleSetLayout,
+        upsampleSetLayout, upsampleSetLayout, compositeSetLayout};
+    for (auto &view : views) {
+        /* Level 0 is half the view's size, like every level after it of
+         * the one before */
+        VkExtent2D extent = {std::max(view.extent.width >> 1, 1u),
+            std::max(view.extent.height >> 1, 1u)};
+        create_image(extent, BLOOM_LEVELS, HDR_FORMAT,
+                VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_IMAGE_ASPECT_COLOR_BIT, view.bloom);
+        VkImageViewCreateInfo ci = {};
+        ci.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        ci.image = view.bloom.image;
+        ci.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        ci.format = HDR_FORMAT;
+        view.bloomLevels.resize(BLOOM_LEVELS);
+        for (uint32_t l = 0; l != BLOOM_LEVELS; l++) {
+            ci.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, l, 1, 0, 1};
+            result = vkCreateImageView(device, &ci, allocator,
+                    view.bloomLevels[l].replace(device, allocator));
+            print_result(result);
+        }
+
+        view.postSets.resize(POST_SET_COUNT);
+        VkDescriptorSetAllocateInfo ai = {};
+        ai.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        ai.descriptorPool = postDescriptorPool;
+        ai.descriptorSetCount = POST_SET_COUNT;
+        ai.pSetLayouts = postLayouts;
+        result = vkAllocateDescriptorSets(device, &ai, view.postSets.data());
+        print_result(result);
+
+        /* Everything stays in the general layout. Images of each set's
+         * bindings in order; the sampled ones are the scene and the whole
+         * bloom chain */
+        VkImageView scene = view.color.view;
+        VkImageView chain = view.bloom.view;
+        const unique_image_view *level = view.bloomLevels.data();
+        VkImageView images[POST_SET_COUNT][4] = {
+            {scene, level[0], level[1], level[2]},
+            {chain, level[3], level[4], level[5]},
+            {level[5], level[4], level[3]},
+            {level[3], level[2], level[1]},
+            {scene, chain}};
+        for (uint32_t s = 0; s != POST_SET_COUNT; s++) {
+            uint32_t layout = s == COMPOSITE ? 2 : s / 2;
+            VkDescriptorImageInfo infos[4] = {};
+            VkWriteDescriptorSet writes[4] = {};
+            for (uint32_t b = 0; b != bindingCounts[layout]; b++) {
+                infos[b].sampler = postSampler;
+                infos[b].imageView = images[s][b];
+                infos[b].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+                writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[b].dstSet = view.postSets[s];
+                writes[b].dstBinding = b;
+                writes[b].descriptorCount = 1;
+                writes[b].descriptorType = types[layout][b];
+                writes[b].pImageInfo = &infos[b];
+            }
+            vkUpdateDescriptorSets(device, bindingCounts[layout], writes,
+                    0, nullptr);
+        }
+    }
+
+    ////
+    /* PIPELINES */
+    VkPushConstantRange pushRange = {};
+    pushRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushRange.offset = 0;
+    VkPipelineLayoutCreateInfo pl_ci = {};
+    pl_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pl_ci.setLayoutCount = 1;
+    pl_ci.pushConstantRangeCount = 1;
+    pl_ci.pPushConstantRanges = &pushRange;
+
+    VkDescriptorSetLayout layout = downsampleSetLayout;
+    pl_ci.pSetLayouts = &layout;
+    pushRange.size = sizeof(downsample_push_t);
+    result = vkCreatePipelineLayout(device, &pl_ci, allocator,
+            downsamplePipelineLayout.replace(device, allocator));
+    print_result(result);
+    layout = upsampleSetLayout;
+    pushRange.size = sizeof(upsample_push_t);
+    result = vkCreatePipelineLayout(device, &pl_ci, allocator,
+            upsamplePipelineLayout.replace(device, allocator));
+    print_result(result);
+    layout = compositeSetLayout;
+    pushRange.size = sizeof(composite_push_t);
+    result = vkCreatePipelineLayout(device, &pl_ci, allocator,
+            compositePipelineLayout.replace(device, allocator));
+    print_result(result);
+    create_compute_pipeline("shaders/bloom_downsample.comp.spv",
+            downsamplePipelineLayout, downsamplePipeline);
+    create_compute_pipeline("shaders/bloom_upsample.comp.spv",
+            upsamplePipelineLayout, upsamplePipeline);
+    create_compute_pipeline("shaders/post_composite.comp.spv",
+            compositePipelineLayout, compositePipeline);
+}
+
+/* After the render passes, whose dependency makes the scene visible to
+ * compute shaders: bloom down the chain and back up, then tonemapping and
+ * grading, five dispatches per view. All views run each step before one
+ * barrier. Only the part of every level covering renderExtent is computed
+ * and read */
+void vk::record_post_processing(VkCommandBuffer commandBuffer)
+{
+    TRACE_FUNC();
+    /* The previous frame's chain is done with the bloom levels, and
+     * nothing of it is kept */
+    vector<VkImageMemoryBarrier> barriers(views.size());
+    for (uint32_t v = 0; v != views.size(); v++) {
+        VkImageMemoryBarrier &barrier = barriers[v];
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = views[v].bloom.image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+            BLOOM_LEVELS, 0, 1};
+    }
+    vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr,
+            (uint32_t)barriers.size(), barriers.data());
+
+    /* Per view, the scene and then every bloom level: its size, and the
+     * part of it drawn this frame */
+    vector<VkExtent2D> sizes(views.size() * (BLOOM_LEVELS + 1));
+    vector<VkExtent2D> drawn(sizes.size());
+    for (uint32_t v = 0; v != views.size(); v++) {
+        VkExtent2D *size = &sizes[v * (BLOOM_LEVELS + 1)];
+        VkExtent2D *part = &drawn[v * (BLOOM_LEVELS + 1)];
+        size[0] = views[v].extent;
+        part[0] = views[v].renderExtent;
+        for (uint32_t l = 1; l <= BLOOM_LEVELS; l++) {
+            size[l] = {std::max(views[v].extent.width >> l, 1u),
+                std::max(views[v].extent.height >> l, 1u)};
+            part[l] = {std::min(size[l].width, (part[l - 1].width + 1) / 2),
+                std::min(size[l].height, (part[l - 1].height + 1) / 2)};
+        }
+    }
+
+    /* Down: the scene into levels 0-2, level 2 into levels 3-5 */
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+            downsamplePipeline);
+    for (uint32_t step = 0; step != 2; step++) {
+        uint32_t src = step * 3;    //in sizes, 0 being the scene
+        for (uint32_t v = 0; v != views.size(); v++) {
+            const VkExtent2D *size = &sizes[v * (BLOOM_LEVELS + 1)];
+            const VkExtent2D *part = &drawn[v * (BLOOM_LEVELS + 1)];
+            downsample_push_t push;
+            push.srcMax[0] = (part[src].width - 0.5f) / size[src].width;
+            push.srcMax[1] = (part[src].height - 0.5f) / size[src].height;
+            push.srcLod = step == 0 ? 0 : (int32_t)src - 1;
+            push.threshold = step == 0 ? BLOOM_THRESHOLD : -1.f;
+            push.knee = BLOOM_KNEE;
+            VkDescriptorSet set = views[v].postSets[DOWNSAMPLE_SCENE + step];
+            vkCmdBindDescriptorSets(commandBuffer,
+                    VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipelineLayout,
+                    0, 1, &set, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, downsamplePipelineLayout,
+                    VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+            vkCmdDispatch(commandBuffer,
+                    group_count(part[src + 1].width, BLOOM_TILE),
+                    group_count(part[src + 1].height, BLOOM_TILE), 1);
+        }
+        shader_write_barrier(commandBuffer);
+    }
+
+    /* Up: levels 5 and 4 into level 3, levels 3 and 2 into level 1 */
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+            upsamplePipeline);
+    for (uint32_t step = 0; step != 2; step++) {
+        uint32_t fine = step == 0 ? 4 : 2;  //in sizes
+        for (uint32_t v = 0; v != views.size(); v++) {
+            const VkExtent2D *part = &drawn[v * (BLOOM_LEVELS + 1)];
+            upsample_push_t push = {
+                {(int32_t)part[fine + 2].width, (int32_t)part[fine + 2].height},
+                {(int32_t)part[fine + 1].width, (int32_t)part[fine + 1].height},
+                {(int32_t)part[fine].width, (int32_t)part[fine].height}};
+            VkDescriptorSet set = views[v].postSets[UPSAMPLE_COARSE + step];
+            vkCmdBindDescriptorSets(commandBuffer,
+                    VK_PIPELINE_BIND_POINT_COMPUTE, upsamplePipelineLayout,
+                    0, 1, &set, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, upsamplePipelineLayout,
+                    VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+            vkCmdDispatch(commandBuffer,
+                    group_count(part[fine].width, BLOOM_TILE),
+                    group_count(part[fine].height, BLOOM_TILE), 1);
+        }
+        shader_write_barrier(commandBuffer);
+    }
+
+    /* The last step up, tonemapping and grading, in place */
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+            compositePipeline);
+    for (uint32_t v = 0; v != views.size(); v++) {
+        const VkExtent2D *size = &sizes[v * (BLOOM_LEVELS + 1)];
+        const VkExtent2D *part = &drawn[v * (BLOOM_LEVELS + 1)];
+        composite_push_t push;
+        std::copy(GRADE_GAIN, GRADE_GAIN + 4, push.gain);
+        push.invExtent[0] = 1.f / size[0].width;
+        push.invExtent[1] = 1.f / size[0].height;
+        push.bloomMax0[0] = (part[1].width - 0.5f) / size[1].width;
+        push.bloomMax0[1] = (part[1].height - 0.5f) / size[1].height;
+        push.bloomMax1[0] = (part[2].width - 0.5f) / size[2].width;
+        push.bloomMax1[1] = (part[2].height - 0.5f) / size[2].height;
+        push.renderSize[0] = (int32_t)part[0].width;
+        push.renderSize[1] = (int32_t)part[0].height;
+        push.exposure = (float)config.exposure;
+        /* The levels add up going up the chain */
+        push.bloomIntensity = (float)config.bloomIntensity / BLOOM_LEVELS;
+        push.saturation = GRADE_SATURATION;
+        push.contrast = GRADE_CONTRAST;
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                compositePipelineLayout, 0, 1, &views[v].postSets[COMPOSITE],
+                0, nullptr);
+        vkCmdPushConstants(commandBuffer, compositePipelineLayout,
+                VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+        vkCmdDispatch(commandBuffer,
+                group_count(part[0].width, COMPOSITE_GROUP_SIZE),
+                group_count(part[0].height, COMPOSITE_GROUP_SIZE), 1);
+    }
+    /* The blit to the swapchain images reads the result */
+    shader_write_barrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_TRANSFER_READ_BIT);
+}
+
+void vk::destroy_post_processing(void)
+{
+    if (!postProcess) {
+        return;
+    }
+    compositePipeline.reset();
+    upsamplePipeline.reset();
+    downsamplePipeline.reset();
+    compositePipelineLayout.reset();
+    upsamplePipelineLayout.reset();
+    downsamplePipelineLayout.reset();
+    for (auto &view : views) {
+        view.postSets.clear();
+        view.bloomLevels.clear();
+        destroy_image(view.bloom);
+    }
+    /* Frees the sets */
+    postDescriptorPool.reset();
+    compositeSetLayout.reset();
+    upsampleSetLayout.reset();
+    downsampleSetLayout.reset();
+    postSampler.reset();
+}
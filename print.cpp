@@ -20,6 +20,8 @@ using std::vector;
 #include <string>
 using std::string;
 #include <string.h>
+#include <fstream>
+#include <sys/resource.h>
 
 
 void vk::print_queue_family_properties(void)
@@ -172,12 +174,20 @@ void vk::print_device_info(device_holder_t dev)
 } 
 
 void vk::print_swapchain_support_details(void)
+{
+    for (auto &view : views) {
+        print_swapchain_support_details(view.supportDetails);
+    }
+}
+
+void vk::print_swapchain_support_details(
+        const swapchain_support_details_t &details)
 {
     cout << "===================================" << endl;
     cout << "Printing swapchain support details:" << endl;
     /* Surface capabilities */
     cout << "SURFACE CAPABILITIES" << endl; 
-    VkSurfaceCapabilitiesKHR &c = swapchainSupportDetails.capabilities;
+    const VkSurfaceCapabilitiesKHR &c = details.capabilities;
     cout << "minImageCount:\t" << c.minImageCount << endl;
     cout << "maxImageCount:\t" << c.maxImageCount << endl;
     cout << "currentExtent:\t" <<
@@ -195,7 +205,7 @@ void vk::print_swapchain_support_details(void)
     /* Formats */
     uint32_t i = 0;
     cout << "FORMATS" << endl;
-    for (auto &d : swapchainSupportDetails.formats) {
+    for (auto &d : details.formats) {
         cout << "formats index: " << i << '\t';
         cout << "Format flag: " << d.format << '\t'; 
         cout << "Colorspace flag: " << d.colorSpace << endl; 
@@ -205,7 +215,7 @@ void vk::print_swapchain_support_details(void)
     /* Present modes */
     cout << "PRESENT MODES" << endl;
     i = 0;
-    for (auto &e : swapchainSupportDetails.presentModes) {
+    for (auto &e : details.presentModes) {
         cout << "present mode index: " << i << '\t';
         switch (e) {
             case VK_PRESENT_MODE_IMMEDIATE_KHR:
@@ -225,3 +235,201 @@ void vk::print_swapchain_support_details(void)
         i++;
     } 
 }
+
+/* Summary of frame-to-frame intervals, printed when the main loop exits */
+void vk::print_frame_stats(void)
+{
+    const frame_stats_t &s = framePacer.stats();
+    cout << "============================" << endl;
+    cout << "Frame statistics:" << endl;
+    if (s.frames == 0) {
+        cout << "no frames rendered" << endl;
+        return;
+    }
+    cout << std::fixed << std::setprecision(3);
+    cout << std::setw(20) << std::left << "frames: " << s.frames << endl;
+    cout << std::setw(20) << std::left << "average fps: "
+        << 1000.0 / s.mean << endl;
+    cout << std::setw(20) << std::left << "interval ms: "
+        << "mean " << s.mean << " stddev " << s.stddev()
+        << " min " << s.min << " max " << s.max << endl;
+    cout << std::setw(20) << std::left << "recent ms: "
+        << "p50 " << s.percentile(50.0) << " p99 " << s.percentile(99.0)
+        << endl;
+    if (gpuFrameStats.frames != 0) {
+        cout << std::setw(20) << std::left << "gpu ms: "
+            << "mean " << gpuFrameStats.mean
+            << " p99 " << gpuFrameStats.percentile(99.0) << endl;
+    }
+    const draw_bind_stats_t &binds = drawState.stats();
+    if (binds.draws != 0) {
+        cout << std::setw(20) << std::left << "binds avoided: "
+            << "pipeline " << binds.avoided(0) << " buffers "
+            << binds.avoided(1) << " of " << binds.draws << endl;
+    }
+    if (dynamicResolution) {
+        cout << std::setw(20) << std::left << "render scale: "
+            << resolutionScaler.scale() << " (target "
+            << resolutionScaler.target_ms() << " ms)" << endl;
+    }
+    if (views.size() == 1) {
+        return;
+    }
+    /* Milliseconds each view's acquire blocked; a view on a slower display
+     * or with fewer images stands out here */
+    for (uint32_t i = 0; i != views.size(); i++) {
+        const frame_stats_t &p = views[i].acquireStats;
+        cout << "view " << std::setw(15) << std::left
+            << (std::to_string(i) + ":") << views[i].extent.width << "x"
+            << views[i].extent.height << " acquire mean " << p.mean
+            << " p99 " << p.percentile(99.0) << " max " << p.max
+            << " present errors " << views[i].presentErrors << endl;
+    }
+}
+
+/* Pipeline statistics per frame, all views together. Many fragment
+ * invocations per vertex invocation point at overdraw or fill rate, few at
+ * geometry */
+void vk::print_pipeline_statistics(void)
+{
+    if (statisticsQueryPool == VK_NULL_HANDLE) {
+        return;
+    }
+    const char *names[STATISTIC_COUNT] = {"input vertices: ",
+        "input primitives: ", "vertex shaders: ", "clipped primitives: ",
+        "fragment shaders: "};
+    cout << "============================" << endl;
+    cout << "Pipeline statistics per frame:" << endl;
+    const pipeline_stats_t &s = pipelineStats;
+    if (s.frames == 0) {
+        cout << "no results read back" << endl;
+        return;
+    }
+    cout << std::fixed << std::setprecision(1);
+    for (uint32_t i = 0; i != STATISTIC_COUNT; i++) {
+        cout << std::setw(20) << std::left << names[i]
+            << (double)s.counters[i] / s.frames << endl;
+    }
+    uint64_t vertices = s.counters[STATISTIC_VERTEX_INVOCATIONS];
+    if (vertices != 0) {
+        cout << std::setw(20) << std::left << "fragments/vertex: "
+            << std::setprecision(3)
+            << (double)s.counters[STATISTIC_FRAGMENT_INVOCATIONS] / vertices
+            << endl;
+    }
+}
+
+/* How much of what survived frustum culling occlusion culling drew, per
+ * frame, and how much of it only phase 1 found */
+void vk::print_occlusion_stats(void)
+{
+    if (!config.occlusion) {
+        return;
+    }
+    const occlusion_stats_t &s = occlusionStats;
+    cout << "============================" << endl;
+    cout << "Occlusion culling per frame:" << endl;
+    if (s.frames == 0) {
+        cout << "no frames culled" << endl;
+        return;
+    }
+    cout << std::fixed << std::setprecision(1);
+    cout << std::setw(20) << std::left << "candidates: "
+        << (double)s.candidates / s.frames << endl;
+    cout << std::setw(20) << std::left << "drawn in phase 0: "
+        << (double)s.drawn[0] / s.frames << endl;
+    cout << std::setw(20) << std::left << "drawn in phase 1: "
+        << (double)s.drawn[1] / s.frames << endl;
+    if (s.candidates != 0) {
+        cout << std::setw(20) << std::left << "occluded: "
+            << 100.0 * (double)(s.candidates - s.drawn[0] - s.drawn[1])
+            / s.candidates << "%" << endl;
+    }
+}
+
+/* Host memory attributed to Vulkan while everything is still alive: what
+ * the driver allocated through our callbacks, per allocation scope */
+void vk::print_host_memory_stats(void)
+{
+    if (allocator == nullptr) {
+        return;
+    }
+    const char *names[HOST_SCOPES] = {"command", "object", "cache", "device",
+        "instance"};
+    cout << "============================" << endl;
+    cout << "Vulkan host memory:" << endl;
+    cout << std::setw(12) << std::left << "scope"
+        << std::setw(14) << std::right << "allocations"
+        << std::setw(10) << "live" << std::setw(14) << "live bytes"
+        << std::setw(14) << "peak bytes" << std::setw(14) << "internal"
+        << endl;
+    for (uint32_t s = 0; s != HOST_SCOPES; s++) {
+        host_scope_stats_t stats =
+            hostAllocator.scope_stats((VkSystemAllocationScope)s);
+        cout << std::setw(12) << std::left << names[s] << std::right
+            << std::setw(14) << stats.allocations
+            << std::setw(10) << stats.live
+            << std::setw(14) << stats.liveBytes
+            << std::setw(14) << stats.peakBytes
+            << std::setw(14) << stats.internalBytes << endl;
+    }
+    cout << std::left << std::setw(20) << "live bytes: "
+        << hostAllocator.live_bytes() << endl;
+    cout << std::setw(20) << "peak bytes: " << hostAllocator.peak_bytes()
+        << endl;
+}
+
+/* Everything the regression gate (tools/perf_gate) compares, as one flat
+ * JSON object. Times in milliseconds, memory in bytes */
+void vk::write_run_stats(const string &path)
+{
+    const frame_stats_t &s = framePacer.stats();
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "could not write statistics to " << path << endl;
+        return;
+    }
+    file << std::fixed << std::setprecision(4);
+    file << "{\n"
+        << "  \"frames\": " << s.frames << ",\n"
+        << "  \"frame_ms_mean\": " << s.mean << ",\n"
+        << "  \"frame_ms_p50\": " << s.percentile(50.0) << ",\n"
+        << "  \"frame_ms_p99\": " << s.percentile(99.0) << ",\n"
+        << "  \"gpu_ms_mean\": " << gpuFrameStats.mean << ",\n"
+        << "  \"gpu_ms_p99\": " << gpuFrameStats.percentile(99.0) << ",\n"
+        << "  \"startup_ms\": " << startupMs << ",\n"
+        << "  \"host_peak_bytes\": " << hostAllocator.peak_bytes() << ",\n"
+        /* ru_maxrss is in kilobytes on Linux */
+        << "  \"peak_rss_bytes\": " << (uint64_t)usage.ru_maxrss * 1024
+        << "\n}\n";
+}
+
+/* Device memory per heap, and how much room is left before the budget */
+void vk::print_memory_budget(void)
+{
+    memoryBudget.update();
+    vector<heap_budget_t> heaps = memoryBudget.heaps();
+    cout << "============================" << endl;
+    cout << "Device memory budget ("
+        << (memoryBudget.uses_extension() ? "VK_EXT_memory_budget"
+                : "own allocations") << "):" << endl;
+    cout << std::setw(6) << std::left << "heap" << std::right
+        << std::setw(12) << "size MB" << std::setw(12) << "budget MB"
+        << std::setw(12) << "usage MB" << std::setw(12) << "ours MB"
+        << std::setw(12) << "headroom" << endl;
+    const double MB = 1024.0 * 1024.0;
+    for (uint32_t i = 0; i != heaps.size(); i++) {
+        const heap_budget_t &h = heaps[i];
+        double headroom = h.budget > h.usage ?
+            (double)(h.budget - h.usage) / (double)h.budget * 100.0 : 0.0;
+        cout << std::setw(6) << std::left << i << std::right << std::fixed
+            << std::setprecision(1)
+            << std::setw(12) << (double)h.size / MB
+            << std::setw(12) << (double)h.budget / MB
+            << std::setw(12) << (double)h.usage / MB
+            << std::setw(12) << (double)h.allocated / MB
+            << std::setw(11) << headroom << "%" << endl;
+    }
+}
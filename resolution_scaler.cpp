@@ -0,0 +1,42 @@
+#include "resolution_scaler.h"
+
+#include <algorithm>
+#include <cmath>
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+void resolution_scaler::set_target_ms(double ms)
+{
+    targetMs = std::max(ms, 0.0);
+    if (targetMs == 0.0) {
+        currentScale = maxScale;
+    }
+}
+
+void resolution_scaler::set_range(double minScale, double maxScale)
+{
+    this->maxScale = std::max(maxScale, 1e-3);
+    this->minScale = std::min(std::max(minScale, 1e-3), this->maxScale);
+    currentScale = std::min(std::max(currentScale, this->minScale),
+            this->maxScale);
+}
+
+void resolution_scaler::update(double gpuMs, double renderedScale)
+{
+    if (targetMs == 0.0 || gpuMs <= 0.0 || renderedScale <= 0.0) {
+        return;
+    }
+    /* What the frame would have cost at the current scale */
+    double ratio = currentScale / renderedScale;
+    double ms = gpuMs * ratio * ratio;
+    double ideal = currentScale
+        * std::sqrt(targetMs * RESOLUTION_HEADROOM / ms);
+    if (ideal < currentScale) {
+        currentScale = ideal;
+    } else {
+        currentScale += (ideal - currentScale) * RESOLUTION_RECOVERY;
+    }
+    currentScale = std::min(std::max(currentScale, minScale), maxScale);
+}
@@ -0,0 +1,34 @@
+#ifndef RESOLUTION_SCALER
+#define RESOLUTION_SCALER
+
+/* Share of the target the controller aims for, leaving room for spikes */
+const double RESOLUTION_HEADROOM = 0.9;
+/* Share of the way to the ideal scale taken per frame when scaling up */
+const double RESOLUTION_RECOVERY = 0.1;
+
+/* Picks the render scale, per axis of the output, that holds GPU frame
+ * time at a target. Cost is taken to follow the pixel count, so the ideal
+ * scale moves with the square root of target over measured time. Above the
+ * target the scale drops to it at once, so a load spike costs only the
+ * frames already in flight; below it the scale climbs back gradually, so a
+ * single cheap frame does not make it oscillate */
+class resolution_scaler {
+    public:
+        /* 0 turns the controller off and the scale back to maxScale */
+        void set_target_ms(double ms);
+        void set_range(double minScale, double maxScale);
+        /* GPU time of a finished frame and the scale it was rendered at.
+         * Frames complete a few frames after they were recorded, so the
+         * scale may have moved since */
+        void update(double gpuMs, double renderedScale);
+        double scale(void) const { return currentScale; }
+        double target_ms(void) const { return targetMs; }
+
+    private:
+        double targetMs = 0.0;
+        double minScale = 0.5;
+        double maxScale = 1.0;
+        double currentScale = 1.0;
+};
+
+#endif
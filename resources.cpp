@@ -27,6 +27,7 @@ using std::string;
 
 void vk::load_queues(void)
 {
+    TRACE_FUNC();
     vkGetDeviceQueue(
             device,
             chosenDevice.get_graphics_queue_index(),
@@ -39,65 +40,71 @@ void vk::load_queues(void)
             &presentQueue);
 } 
 
-/* Fill out the swapchainSupportDetails structure 
+/* Fill out each view's supportDetails structure 
  * The objects contained in the structure are
  * VkSurfaceCapabilitiesKHR
  * vector<VkSurfaceFormatKHR>
  * vector<VkPresentModeKHR>*/ 
 void vk::load_swapchain_support_details(void)
 {
-    /* Determine support cabailities */
-    uint32_t result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR( 
-            chosenDevice.physicalDevice,
-            surface,
-            &swapchainSupportDetails.capabilities);
-
-    /* Query supported surface formats */
-    uint32_t formatCount;
-    result *= vkGetPhysicalDeviceSurfaceFormatsKHR(
-            chosenDevice.physicalDevice,
-            surface,
-            &formatCount,
-            nullptr);
-    swapchainSupportDetails.formats.resize(formatCount);
-    result *= vkGetPhysicalDeviceSurfaceFormatsKHR(
-            chosenDevice.physicalDevice,
-            surface,
-            &formatCount,
-            swapchainSupportDetails.formats.data());
-    /* Query supported presentation modes */
-    uint32_t presentModeCount;
-    result *= vkGetPhysicalDeviceSurfacePresentModesKHR(
-            chosenDevice.physicalDevice,
-            surface,
-            &presentModeCount,
-            nullptr);
-    swapchainSupportDetails.presentModes.resize(presentModeCount);
-    result *= vkGetPhysicalDeviceSurfacePresentModesKHR(
-            chosenDevice.physicalDevice,
-            surface,
-            &presentModeCount,
-            swapchainSupportDetails.presentModes.data()); 
-    print_result(result);
+    TRACE_FUNC();
+    for (auto &view : views) {
+        swapchain_support_details_t &details = view.supportDetails;
+        /* Determine support cabailities */
+        uint32_t result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR( 
+                chosenDevice.physicalDevice,
+                view.surface,
+                &details.capabilities);
+
+        /* Query supported surface formats */
+        uint32_t formatCount;
+        result *= vkGetPhysicalDeviceSurfaceFormatsKHR(
+                chosenDevice.physicalDevice,
+                view.surface,
+                &formatCount,
+                nullptr);
+        details.formats.resize(formatCount);
+        result *= vkGetPhysicalDeviceSurfaceFormatsKHR(
+                chosenDevice.physicalDevice,
+                view.surface,
+                &formatCount,
+                details.formats.data());
+        /* Query supported presentation modes */
+        uint32_t presentModeCount;
+        result *= vkGetPhysicalDeviceSurfacePresentModesKHR(
+                chosenDevice.physicalDevice,
+                view.surface,
+                &presentModeCount,
+                nullptr);
+        details.presentModes.resize(presentModeCount);
+        result *= vkGetPhysicalDeviceSurfacePresentModesKHR(
+                chosenDevice.physicalDevice,
+                view.surface,
+                &presentModeCount,
+                details.presentModes.data()); 
+        print_result(result);
+    }
 } 
 
 /* Try to get VK_FORMAT_B8G8R8A8_UNORM */
-VkSurfaceFormatKHR vk::get_suitable_swapchain_surface_format(void)
+VkSurfaceFormatKHR vk::get_suitable_swapchain_surface_format(
+        const view_target_t &view)
 {
-    for (const auto& format : swapchainSupportDetails.formats) {
+    for (const auto& format : view.supportDetails.formats) {
         if (format.format == VK_FORMAT_B8G8R8A8_UNORM) { 
             return format; 
         }
     } 
     //Return the first format whatever it might be
-    return swapchainSupportDetails.formats[0];
+    return view.supportDetails.formats[0];
 }
 
 /* Try to get mailbox mode, then immediate mode and lastly FIFO mode */
-VkPresentModeKHR vk::get_suitable_swapchain_present_mode(void)
+VkPresentModeKHR vk::get_suitable_swapchain_present_mode(
+        const view_target_t &view)
 {
     VkPresentModeKHR currentBestMode = VK_PRESENT_MODE_FIFO_KHR; 
-    for (const auto& mode : swapchainSupportDetails.presentModes) {
+    for (const auto& mode : view.supportDetails.presentModes) {
         if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {     
             return mode;
         } else if (mode == VK_PRESENT_MODE_IMMEDIATE_KHR) {
@@ -107,15 +114,15 @@ VkPresentModeKHR vk::get_suitable_swapchain_present_mode(void)
     return currentBestMode; 
 } 
 
-VkExtent2D vk::get_swapchain_extent(void)
+VkExtent2D vk::get_swapchain_extent(const view_target_t &view)
 { 
     //Short hand variable for capabilities
-    VkSurfaceCapabilitiesKHR &c = swapchainSupportDetails.capabilities;
+    const VkSurfaceCapabilitiesKHR &c = view.supportDetails.capabilities;
 
     /* If the width equals the maximum uint32_t then it means that we must
      * choose the resolution ourselves which best matches the window otherwise
      * we can just use the current values */ 
-    if (c.currentExtent.width == (uint32_t)-1) {//Trick to get maximum uint32
+    if (c.currentExtent.width != (uint32_t)-1) {//Trick to get maximum uint32
         return c.currentExtent;
     } else {
         VkExtent2D actualExtent = {WIDTH, HEIGHT}; 
@@ -131,29 +138,127 @@ VkExtent2D vk::get_swapchain_extent(void)
 
 void vk::create_swapchains(void)
 {
-    VkSurfaceFormatKHR format = get_suitable_swapchain_surface_format();
-    VkPresentModeKHR presentMode = get_suitable_swapchain_present_mode();
-    VkExtent2D extent = get_swapchain_extent();
+    TRACE_FUNC();
+    /* The views share one render pass, so the first view's format has to
+     * do for all of them */
+    VkSurfaceFormatKHR format = get_suitable_swapchain_surface_format(views[0]);
+
+    /* Dynamic resolution and post-processing draw the scene into an image
+     * of its own and blit it into the swapchain images */
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(chosenDevice.physicalDevice,
+            format.format, &properties);
+    VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT
+        | VK_FORMAT_FEATURE_BLIT_DST_BIT
+        | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    bool blitSupported = (properties.optimalTilingFeatures & blit) == blit;
+    for (const auto &view : views) {
+        blitSupported = blitSupported
+            && (view.supportDetails.capabilities.supportedUsageFlags
+                    & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    }
+
+    /* Dynamic resolution also steers by GPU timestamps */
+    dynamicResolution = false;
+    if (config.dynamicResolutionMs > 0.0) {
+        dynamicResolution = blitSupported
+            && chosenDevice.queueFamilyProperties[
+                chosenDevice.get_graphics_queue_index()].timestampValidBits
+                != 0;
+        if (!dynamicResolution) {
+            cout << "Dynamic resolution needs swapchain blits and GPU "
+                "timestamps, rendering at full resolution" << endl;
+        }
+    }
+
+    /* Post-processing renders in HDR, and every bloom level has to be at
+     * least a texel */
+    postProcess = false;
+    if (config.postProcess) {
+        vkGetPhysicalDeviceFormatProperties(chosenDevice.physicalDevice,
+                HDR_FORMAT, &properties);
+        VkFormatFeatureFlags hdr = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
+            | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT
+            | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+            | VK_FORMAT_FEATURE_BLIT_SRC_BIT;
+        postProcess = blitSupported
+            && (properties.optimalTilingFeatures & hdr) == hdr;
+        for (auto &view : views) {
+            VkExtent2D extent = get_swapchain_extent(view);
+            postProcess = postProcess
+                && std::max(extent.width, extent.height)
+                    >= (1u << BLOOM_LEVELS);
+        }
+        if (!postProcess) {
+            cout << "Post-processing needs HDR storage images, swapchain "
+                "blits and windows of at least " << (1u << BLOOM_LEVELS)
+                << " pixels, showing the scene as drawn" << endl;
+        }
+    }
+    sceneOffscreen = dynamicResolution || postProcess;
+
+    /* Capture copies view 0's images out as 8 bit RGB */
+    capturing = false;
+    if (!config.capturePath.empty()) {
+        capturing = (format.format == VK_FORMAT_B8G8R8A8_UNORM
+                || format.format == VK_FORMAT_B8G8R8A8_SRGB
+                || format.format == VK_FORMAT_R8G8B8A8_UNORM
+                || format.format == VK_FORMAT_R8G8B8A8_SRGB)
+            && (views[0].supportDetails.capabilities.supportedUsageFlags
+                    & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+        if (!capturing) {
+            cout << "Capture needs 8 bit swapchain images that can be "
+                "copied from, not capturing" << endl;
+        }
+    }
+    sceneFormat = postProcess ? HDR_FORMAT : format.format;
+
+    for (auto &view : views) {
+        bool formatSupported = false;
+        for (const auto &f : view.supportDetails.formats) {
+            formatSupported = formatSupported || (f.format == format.format
+                    && f.colorSpace == format.colorSpace);
+        }
+        VkBool32 presentSupported = VK_FALSE;
+        vkGetPhysicalDeviceSurfaceSupportKHR(
+                chosenDevice.physicalDevice,
+                (uint32_t)chosenDevice.get_present_queue_index(),
+                view.surface,
+                &presentSupported);
+        if (!formatSupported || !presentSupported) {
+            throw std::runtime_error(
+                    "views need the same surface format and present queue");
+        }
+        VkPresentModeKHR presentMode = get_suitable_swapchain_present_mode(view);
+        VkExtent2D extent = get_swapchain_extent(view);
 
         /* Create info structure */
         VkSwapchainCreateInfoKHR ci {}; //createInfo
         ci.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
         ci.pNext = nullptr;
         ci.flags = 0U;
-        ci.surface = surface; 
+        ci.surface = view.surface; 
         ci.minImageCount = 3U; //To allow tripple-buffering
         ci.imageFormat = format.format;
         ci.imageColorSpace = format.colorSpace;
         ci.imageExtent = extent;
         ci.imageArrayLayers = 1; //non-stereoscopic
         
-        //Direct render target (without post-processing)
+        //Direct render target, or the destination of the blit
         ci.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        if (sceneOffscreen) {
+            ci.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+        if (capturing && &view == &views[0]) {
+            ci.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
 
         /* Here we distinguish if the presentqueue is different from the
          * graphics queue */
-        if (chosenDevice.get_graphics_queue_index() ==
-                chosenDevice.get_present_queue_index()) {
+        uint32_t queueFamilyIndices[] = {
+            (uint32_t)chosenDevice.get_graphics_queue_index(),
+            (uint32_t)chosenDevice.get_present_queue_index()};
+        if (queueFamilyIndices[0] == queueFamilyIndices[1]) {
             ci.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
             /* These commented fields are ignored in exclusive mode */
             //ci.queueFamilyIndexCount = 0U;
@@ -161,14 +266,11 @@ void vk::create_swapchains(void)
         } else {
             ci.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
             ci.queueFamilyIndexCount = 2U;
-            uint32_t queueFamilyIndices[] = {
-                (uint32_t)chosenDevice.get_graphics_queue_index(),
-                (uint32_t)chosenDevice.get_present_queue_index()};
             ci.pQueueFamilyIndices = queueFamilyIndices; 
         }
 
         /* No transformation, of which can be e.g. 90 degree rotation */
-        ci.preTransform = swapchainSupportDetails.capabilities.currentTransform;
+        ci.preTransform = view.supportDetails.capabilities.currentTransform;
 
         /* No blending with other windows */
         ci.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -186,38 +288,65 @@ void vk::create_swapchains(void)
         VkResult result = vkCreateSwapchainKHR(
                 device,                           
                 &ci, //createInfo
-                nullptr,                         
-                &swapchain);                    
+                allocator,                       
+                &view.swapchain);                    
         print_result(result); 
 
-        /* Load properties into global object */
-        swapchainImageFormat = format.format;
-        swapchainExtent = extent;
+        /* Load properties into the view */
+        view.presentMode = presentMode;
+        view.extent = extent;
+        view.renderExtent = extent;
+    }
+    swapchainImageFormat = format.format;
+
+    /* Per frame arrays with one entry per view */
+    frameWaitSemaphores.resize(views.size());
+    frameWaitStages.assign(views.size(), sceneOffscreen ?
+            VK_PIPELINE_STAGE_TRANSFER_BIT :
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    presentSwapchains.resize(views.size());
+    presentImageIndices.resize(views.size());
+    presentResults.resize(views.size());
+    /* The views share the camera; the widest one sees everything the
+     * others do */
+    widestView = 0;
+    for (uint32_t i = 0; i != views.size(); i++) {
+        presentSwapchains[i] = views[i].swapchain;
+        VkExtent2D e = views[i].extent;
+        VkExtent2D w = views[widestView].extent;
+        if ((uint64_t)e.width * w.height > (uint64_t)w.width * e.height) {
+            widestView = i;
+        }
+    }
 }
 
-/* Load the handles that are used to access the swapchain's images. After this
- * function they are accessible in the global object "swapchainImages" */
+/* Load the handles that are used to access the swapchains' images. After this
+ * function they are accessible in each view's "images" */
 void vk::load_swapchain_image_handles(void)
 {
-    //Get vector size
-    uint32_t imageCount;
-    vkGetSwapchainImagesKHR(
-            device,
-            swapchain,
-            &imageCount,
-            nullptr);
-    swapchainImages.resize(imageCount);
-    VkResult result = vkGetSwapchainImagesKHR( 
-            device,
-            swapchain,
-            &imageCount,
-            swapchainImages.data());
-    print_result(result);
+    TRACE_FUNC();
+    for (auto &view : views) {
+        //Get vector size
+        uint32_t imageCount;
+        vkGetSwapchainImagesKHR(
+                device,
+                view.swapchain,
+                &imageCount,
+                nullptr);
+        view.images.resize(imageCount);
+        VkResult result = vkGetSwapchainImagesKHR( 
+                device,
+                view.swapchain,
+                &imageCount,
+                view.images.data());
+        print_result(result);
+    }
 }
 
 /* Wrap the swapchain images */
 void vk::create_swapchain_image_views(void)
 {
+    TRACE_FUNC();
     /* This object is used to map channels, e.g. we can interpret the red
      * channel in one image and use that to fill in the green channel.
      * Initializeng the object to zero puts all components to zero which is
@@ -248,20 +377,74 @@ void vk::create_swapchain_image_views(void)
     /* The child image can be a subset of the parent image */
     ci.subresourceRange = subresourceRange; 
 
-    swapchainImageViews.resize(swapchainImages.size());
-    for (uint32_t i = 0; i != swapchainImages.size(); i++) {
-        ci.image = swapchainImages[i];
-        VkResult result =  vkCreateImageView(
-                device,
-                &ci,
-                nullptr,
-                &swapchainImageViews[i]); 
-        print_result(result);
-    } 
+    for (auto &view : views) {
+        view.imageViews.resize(view.images.size());
+        for (uint32_t i = 0; i != view.images.size(); i++) {
+            ci.image = view.images[i];
+            VkResult result =  vkCreateImageView(
+                    device,
+                    &ci,
+                    allocator,
+                    view.imageViews[i].replace(device, allocator)); 
+            print_result(result);
+        } 
+    }
+}
+
+/* First format that can be a depth attachment, and be sampled when the
+ * depth pyramid is built from it */
+VkFormat vk::find_depth_format(void)
+{
+    VkFormatFeatureFlags needed =
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    if (config.occlusion) {
+        needed |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+    }
+    const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM};
+    for (VkFormat format : candidates) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(
+                chosenDevice.physicalDevice, format, &properties);
+        if ((properties.optimalTilingFeatures & needed) == needed) {
+            return format;
+        }
+    }
+    throw std::runtime_error("no suitable depth format");
+}
+
+/* One depth buffer per view, the size of its swapchain images, and with
+ * dynamic resolution or post-processing a color image of the same size to
+ * draw the scene in. Post-processing samples it and writes the result
+ * back into it */
+void vk::create_render_targets(void)
+{
+    TRACE_FUNC();
+    depthFormat = find_depth_format();
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    if (config.occlusion) {
+        usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    }
+    for (auto &view : views) {
+        create_image(view.extent, 1, depthFormat, usage,
+                VK_IMAGE_ASPECT_DEPTH_BIT, view.depth);
+        if (sceneOffscreen) {
+            VkImageUsageFlags colorUsage =
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            if (postProcess) {
+                colorUsage |= VK_IMAGE_USAGE_SAMPLED_BIT |
+                    VK_IMAGE_USAGE_STORAGE_BIT;
+            }
+            create_image(view.extent, 1, sceneFormat, colorUsage,
+                    VK_IMAGE_ASPECT_COLOR_BIT, view.color);
+        }
+    }
 }
 
 void vk::create_renderpass(void)
 {
+    TRACE_FUNC();
     /* ATTACHMENT */
     /* Create an attachment. An attachment is a single image that is used as
      * input, output or both within one or more subpasses in the renderpass */
@@ -269,7 +452,7 @@ void vk::create_renderpass(void)
     /* An input attachment are attachments from which subpasses can read data */
     VkAttachmentDescription colorAttachment = {};
     colorAttachment.flags = 0;
-    colorAttachment.format = swapchainImageFormat;
+    colorAttachment.format = sceneFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT; //No multisampling
     /* These next four fields specify what to do with the colorAttachment at the
      * beginning and end of the renderpass */ 
@@ -283,6 +466,38 @@ void vk::create_renderpass(void)
     // We want this format to be presented to the swapchain after the renderpass
     colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; 
 
+    /* Depth is only kept when occlusion culling builds its pyramid from
+     * it, in a layout compute shaders can sample */
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.flags = 0;
+    depthAttachment.format = depthFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = config.occlusion ?
+        VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = config.occlusion ?
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL :
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    /* The blit copies from the scene image instead of presenting it,
+     * after post-processing has read and written it in the general
+     * layout */
+    VkImageLayout colorFinalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    if (postProcess) {
+        colorFinalLayout = VK_IMAGE_LAYOUT_GENERAL;
+    } else if (dynamicResolution) {
+        colorFinalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
+    colorAttachment.finalLayout = colorFinalLayout;
+    /* Phase 0 of occlusion culling leaves the color image to phase 1 */
+    if (config.occlusion) {
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+    VkAttachmentDescription attachments[] = {colorAttachment,
+        depthAttachment};
+
     /* ATTACHMENT REFERENCE */
     /* This reference is a simple structure containing the index into an array
      * of attachments (if there are multiple) */
@@ -291,6 +506,10 @@ void vk::create_renderpass(void)
     colorAttachmentReference.attachment = 0; //Index 0
     /* Color buffer */
     colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; 
+    VkAttachmentReference depthAttachmentReference = {};
+    depthAttachmentReference.attachment = 1;
+    depthAttachmentReference.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     /* SUBPASS */
     VkSubpassDescription subpass = {}; 
@@ -303,81 +522,167 @@ void vk::create_renderpass(void)
     subpass.pColorAttachments = &colorAttachmentReference;
     //Last fields we don't care about
     subpass.pResolveAttachments = nullptr; //For multisampled images
-    subpass.pDepthStencilAttachment = nullptr;
+    subpass.pDepthStencilAttachment = &depthAttachmentReference;
     subpass.preserveAttachmentCount = 0; //No attachments we want to store
     subpass.pPreserveAttachments = 0; 
 
+    /* DEPENDENCIES */
+    /* The depth buffer is shared by the frames in flight: the previous
+     * pass, or the depth pyramid build reading it, must be done before it
+     * is cleared. The pyramid build in turn waits for the depth writes.
+     * The scene image of dynamic resolution and post-processing is shared
+     * the same way: written by the previous post-processing, read by the
+     * previous blit, and read by the next two after the pass */
+    VkSubpassDependency dependencies[2] = {};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+        | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (sceneOffscreen) {
+        dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    if (postProcess) {
+        dependencies[0].srcAccessMask |= VK_ACCESS_SHADER_WRITE_BIT;
+    }
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+        | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+        | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    if (sceneOffscreen) {
+        dependencies[1].srcStageMask |=
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[1].dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+    }
+    if (postProcess) {
+        dependencies[1].dstAccessMask |= VK_ACCESS_SHADER_WRITE_BIT;
+    }
+
     /* Create info */
     VkRenderPassCreateInfo ci = {
         VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
         nullptr,                                    //pNext
         0,                                          //flags
-        1,                                          //attachmentCount
-        &colorAttachment,                         //pAttachments
+        2,                                          //attachmentCount
+        attachments,                                //pAttachments
         1,                                          //subpassCount
         &subpass,                                   //pSubpasses
-        0,                                          //dependencyCount
-        nullptr};                                   //pDependencies 
+        2,                                          //dependencyCount
+        dependencies};                              //pDependencies 
 
     /* Create the renderpass */
     VkResult result = vkCreateRenderPass(
             device,
             &ci,
-            nullptr,
-            &renderPass);
+            allocator,
+            renderPass.replace(device, allocator));
+    print_result(result);
+    if (!config.occlusion) {
+        return;
+    }
+
+    /* Phase 1 of occlusion culling draws on top of phase 0. Only load
+     * operations and layouts differ, so the two passes are compatible and
+     * share framebuffers and pipelines */
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachments[0].finalLayout = colorFinalLayout;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    result = vkCreateRenderPass(
+            device,
+            &ci,
+            allocator,
+            reloadRenderPass.replace(device, allocator));
     print_result(result);
 }
 
 /* Create framebuffers for the render pass */
 void vk::create_framebuffers(void)
 {
+    TRACE_FUNC();
     VkFramebufferCreateInfo ci = {};
     ci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
     ci.pNext = nullptr;
     ci.flags = 0;
     ci.renderPass = renderPass;
-    ci.attachmentCount = 1;
+    ci.attachmentCount = 2;
     //ci.pAttachments ! this field occurs in the loop
-    ci.width = swapchainExtent.width;
-    ci.height = swapchainExtent.height;
     ci.layers = 1; 
 
-    swapchainFramebuffers.resize(swapchainImages.size());
-
-    for (uint32_t i = 0; i != swapchainImages.size(); i++) { 
-        ci.pAttachments = &swapchainImageViews[i]; 
-        VkResult result = vkCreateFramebuffer(
-                device,
-                &ci,
-                nullptr,
-                &swapchainFramebuffers[i]);
-        print_result(result);
+    /* Drawn offscreen every frame draws into the view's scene image, so
+     * one framebuffer does */
+    for (auto &view : views) {
+        ci.width = view.extent.width;
+        ci.height = view.extent.height;
+        view.framebuffers.resize(sceneOffscreen ? 1 : view.images.size());
+        for (uint32_t i = 0; i != view.framebuffers.size(); i++) {
+            VkImageView attachments[] = {sceneOffscreen ?
+                view.color.view : view.imageViews[i], view.depth.view};
+            ci.pAttachments = attachments;
+            VkResult result = vkCreateFramebuffer(
+                    device,
+                    &ci,
+                    allocator,
+                    view.framebuffers[i].replace(device, allocator));
+            print_result(result);
+        }
     }
 }
 
 void vk::create_graphics_pipeline_layout(void)
 { 
+    TRACE_FUNC();
     /* PIPELINE LAYOUT */
     VkPipelineLayoutCreateInfo pl_ci = {};
     pl_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pl_ci.setLayoutCount = 0; //Optional
     pl_ci.pSetLayouts = nullptr; //Optional
-    pl_ci.pushConstantRangeCount = 0; //Optional
-    pl_ci.pPushConstantRanges = 0; //Optional 
+    /* Meshes read their materials from set 0 */
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    if (!config.meshPath.empty()) {
+        create_material_layout();
+        setLayout = materialSetLayout;
+        pl_ci.setLayoutCount = 1;
+        pl_ci.pSetLayouts = &setLayout;
+    }
+    /* Object to clip space transform used by the mesh shaders */
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(glm::mat4);
+    pl_ci.pushConstantRangeCount = 1;
+    pl_ci.pPushConstantRanges = &pushConstantRange;
 
     VkResult result = vkCreatePipelineLayout(
             device,
             &pl_ci,
-            nullptr,
-            &graphicsPipelineLayout); 
+            allocator,
+            graphicsPipelineLayout.replace(device, allocator)); 
     print_result(result);
 }
 
 vector<char> vk::read_file(const string& filename) {
+    TRACE_FUNC();
     /* Read file stating at end (ate) and as binary data */
     std::ifstream file(filename, std::ios::ate | std::ios::binary); 
     if (!file.is_open()) {
-        throw std::runtime_error("failed to open file!");
+        throw std::runtime_error("failed to open file " + filename);
     }
     /* Since we started reading at the end we can tell the filesize from
      * the read position */
@@ -395,7 +700,8 @@ vector<char> vk::read_file(const string& filename) {
  * be useful */
 void vk::create_shader_module(
         const vector<char> &code,
-        VkShaderModule &shaderModule) { 
+        unique_shader_module &shaderModule) { 
+    TRACE_FUNC();
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     createInfo.codeSize = code.size();
@@ -406,242 +712,67 @@ void vk::create_shader_module(
     createInfo.pCode = codeAligned.data(); 
 
     VkResult result = vkCreateShaderModule(
-            device, &createInfo, nullptr, &shaderModule); 
+            device, &createInfo, allocator,
+            shaderModule.replace(device, allocator)); 
     print_result(result);
 } 
 
+/* Builds the parent pipeline from the default key and warms up the
+ * manifest's variants, then picks the variant the command line asks for.
+ * Anything else derives from the parent on demand, see get_pipeline */
 void vk::create_graphics_pipeline(void)
 {
+    TRACE_FUNC();
     ////
     /* CODE WRAPPERS */
-    //Code to compile
-    auto vertShaderCode = read_file("shaders/vert.spv");
-    auto fragShaderCode = read_file("shaders/frag.spv");
-    //Objets to hold the shader modules
-    VkShaderModule vertShaderModule;
-    VkShaderModule fragShaderModule;
-    //Create the shader modules
+    //Code to compile. Meshes use their own shaders (make shaders), the
+    //fragment shader in the flavour matching the material layout. The
+    //modules are kept for the variants created later on
+    auto vertShaderCode = read_file(config.meshPath.empty() ?
+            "shaders/vert.spv" : "shaders/mesh.vert.spv");
+    auto fragShaderCode = read_file(config.meshPath.empty() ?
+            "shaders/frag.spv" : descriptorIndexingExtension ?
+            "shaders/mesh_bindless.frag.spv" : "shaders/mesh.frag.spv");
     create_shader_module(vertShaderCode, vertShaderModule);
     create_shader_module(fragShaderCode, fragShaderModule);
 
-    ////
-    /* SHADER STAGES */
-    //Vertex shader
-    VkPipelineShaderStageCreateInfo vertShader_ci = {};
-    vertShader_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShader_ci.pNext = nullptr;
-    vertShader_ci.flags = 0;
-    vertShader_ci.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShader_ci.module = vertShaderModule; //Code wrapper
-    vertShader_ci.pName = "main"; //function to invoke in the shader program
-    vertShader_ci.pSpecializationInfo = nullptr; //For optimization
-
-    //Fragment shader
-    VkPipelineShaderStageCreateInfo fragShader_ci = {};
-    fragShader_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShader_ci.pNext = nullptr;
-    fragShader_ci.flags = 0;
-    fragShader_ci.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShader_ci.module = fragShaderModule; //Code wrapper
-    fragShader_ci.pName = "main"; //function to invoke in the shader program
-    fragShader_ci.pSpecializationInfo = nullptr; //For optimization 
-
-    //Shader stages
-    VkPipelineShaderStageCreateInfo shaderStages[] = 
-    {vertShader_ci, fragShader_ci};
-
-    ////
-    /* VERTEX SETUP */
-    //We specify there is no data to load as we will hardcode the data directly
-    //into the shader
-    VkPipelineVertexInputStateCreateInfo vert_ci = {};
-    vert_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vert_ci.pNext = nullptr;
-    vert_ci.flags = 0;
-    //These fields describe buffers containing vertex data and how the data is
-    //orederd, since we hardcode the vertex we don't use any of these
-    vert_ci.vertexBindingDescriptionCount = 0;
-    vert_ci.pVertexBindingDescriptions = nullptr;
-    vert_ci.vertexAttributeDescriptionCount = 0;
-    vert_ci.pVertexAttributeDescriptions = nullptr;
-
-    ////
-    /* INPUT ASSEMBLY */
-    //This stage groups vertex data into primitives
-    VkPipelineInputAssemblyStateCreateInfo asmb_ci = {};
-    asmb_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    asmb_ci.pNext = nullptr;
-    asmb_ci.flags = 0; 
-
-    //Try any of these primitives!
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; 
-    asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
-    //These topologies are often used when a geoetry shader is enabled, this is
-    //because some vertices only contain adjacency information and will not
-    //produce any interesting result if not a shader is present
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY;
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY;
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY;
-    //asmb_ci.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP_WITH_ADJACENCY;
-
-    asmb_ci.primitiveRestartEnable = VK_FALSE;
-
-    ////
-    /* VIEWPORT */
-    //The final coordinate transform before rasterization, from normalized
-    //device coordinates into window coordinates
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swapchainExtent.width;
-    viewport.height = (float)swapchainExtent.height;
-    viewport.minDepth = 1.0f;
-    viewport.maxDepth = 1.0f;
-    //Scissor
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = swapchainExtent; //Draw whole image
-
-    VkPipelineViewportStateCreateInfo vp_ci;
-    vp_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    vp_ci.pNext = nullptr;
-    vp_ci.flags = 0;
-    vp_ci.viewportCount = 1;
-    vp_ci.pViewports = &viewport;
-    vp_ci.scissorCount = 1;
-    vp_ci.pScissors = &scissor;
-
-    ////
-    /* RASTERIZER */
-    //Primitives represented by vertices are now turned into streams of
-    //fragments ready to be shaded by the fragment shader
-    VkPipelineRasterizationStateCreateInfo ra_ci;
-    ra_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    ra_ci.pNext = nullptr;
-    ra_ci.flags = 0;
-    ra_ci.depthClampEnable = VK_FALSE;
-    ra_ci.rasterizerDiscardEnable = VK_FALSE;
-
-    //Try these three different polygon modes!
-    ra_ci.polygonMode = VK_POLYGON_MODE_FILL;
-    //ra_ci.polygonMode = VK_POLYGON_MODE_LINE;
-    //ra_ci.polygonMode = VK_POLYGON_MODE_POINT;
-
-    //Cull polygons facing away. This only affects polygons, not lines or points
-    ra_ci.cullMode = VK_CULL_MODE_BACK_BIT;
-    //Determine which vertix winding order is front or back
-    ra_ci.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    ra_ci.depthBiasEnable = VK_FALSE;
-    ra_ci.depthBiasConstantFactor = 0.0f;
-    ra_ci.depthBiasClamp = 0.0f;
-    ra_ci.depthBiasSlopeFactor = 0.0f;
-    ra_ci.lineWidth = 1.0f; //Width of primitives in pixels
-
-    ////
-    /* MULTISAMPLE STATE */
-    VkPipelineMultisampleStateCreateInfo ms_ci = {};
-    ms_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    ms_ci.pNext = nullptr;
-    ms_ci.flags = 0;
-    ms_ci.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    ms_ci.sampleShadingEnable = VK_FALSE;
-    ms_ci.minSampleShading = 1.f;
-    ms_ci.pSampleMask = nullptr;
-    ms_ci.alphaToCoverageEnable = VK_FALSE;
-    ms_ci.alphaToOneEnable = VK_FALSE;
-
-    ////
-    /* DEPTH AND/OR STENCIL BUFFER */
-    //not used, pass nullptr instead
-
-    ////
-    /* COLOR BLEND STATE */
-    VkPipelineColorBlendAttachmentState cbAttachmentState;
-    //Ignore all blending parameters
-    cbAttachmentState.blendEnable = VK_FALSE;
-    cbAttachmentState.colorWriteMask = 
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    // Following are all optional settings
-    cbAttachmentState.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    cbAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-    cbAttachmentState.colorBlendOp = VK_BLEND_OP_ADD;
-    cbAttachmentState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    cbAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    cbAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD; 
-
-    VkPipelineColorBlendStateCreateInfo cb_ci;
-    cb_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    cb_ci.pNext = nullptr;
-    cb_ci.flags = 0;
-    cb_ci.logicOpEnable = VK_FALSE;
-    cb_ci.logicOp = VK_LOGIC_OP_COPY;
-    cb_ci.attachmentCount = 1;
-    cb_ci.pAttachments = &cbAttachmentState; 
-    cb_ci.blendConstants[0] = 0.0f; //Optional
-    cb_ci.blendConstants[1] = 0.0f; //Optional
-    cb_ci.blendConstants[2] = 0.0f; //Optional
-    cb_ci.blendConstants[3] = 0.0f; //Optional 
-
-    ////
-    /* DYNAMIC STATE */
-    VkDynamicState dynamicStates[] = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_LINE_WIDTH
-    };
-    VkPipelineDynamicStateCreateInfo ds_ci = {};
-    ds_ci.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    ds_ci.dynamicStateCount = 2;
-    ds_ci.pDynamicStates = dynamicStates;
-    (void)ds_ci; //Unused as of now
+    VkPipelineCacheCreateInfo cci = {};
+    cci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    VkResult result = vkCreatePipelineCache(device, &cci, allocator,
+            pipelineCache.replace(device, allocator));
+    print_result(result);
 
     ////
     /* GRAPHICS PIPELINE */
-    VkGraphicsPipelineCreateInfo ci = {};
-    ci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    ci.pNext = nullptr;
-    ci.flags = 0;
-    ci.stageCount = 2; //Two shader stages
-    ci.pStages = shaderStages;
-    ci.pVertexInputState = &vert_ci;
-    ci.pInputAssemblyState = &asmb_ci;
-    ci.pViewportState = &vp_ci;
-    ci.pRasterizationState = &ra_ci;
-    ci.pMultisampleState = &ms_ci;
-    ci.pDepthStencilState = nullptr;
-    ci.pColorBlendState = &cb_ci;
-    ci.pDynamicState = nullptr;//&ds_ci;
-    ci.layout = graphicsPipelineLayout;
-    ci.renderPass = renderPass;
-    ci.subpass = 0;
-    ci.basePipelineHandle = VK_NULL_HANDLE; //Optional
-    ci.basePipelineIndex = -1; //Optional 
-
-    VkResult result = vkCreateGraphicsPipelines(
+    graphicsPipelineKey = default_pipeline_key();
+    pipeline_desc_t desc;
+    describe_pipeline(graphicsPipelineKey, VK_NULL_HANDLE, desc);
+    result = vkCreateGraphicsPipelines(
             device,             //device
-            VK_NULL_HANDLE,     //pipelineCache
+            pipelineCache,      //pipelineCache
             1,                  //createInfoCount
-            &ci,                //pCreateInfos
-            nullptr,            //pAllocator
-            &graphicsPipeline); //pPipelines
+            &desc.info,         //pCreateInfos
+            allocator,          //pAllocator
+            graphicsPipeline.replace(device, allocator)); //pPipelines
     print_result(result);
 
-    ////
-    /* Cleanup */
-    //Destroy pipeline layout
-    vkDestroyPipelineLayout(device, graphicsPipelineLayout, nullptr);
-    //Destroy shaders
-    vkDestroyShaderModule(device, vertShaderModule, nullptr);
-    vkDestroyShaderModule(device, fragShaderModule, nullptr); 
+    warm_up_pipelines();
+    pipeline_key_t key = graphicsPipelineKey;
+    key.shaderOptions = config.shaderOptions;
+    if (config.wireframe) {
+        if (chosenDevice.features.fillModeNonSolid) {
+            key.polygonMode = VK_POLYGON_MODE_LINE;
+        } else {
+            cout << "Wireframe needs fillModeNonSolid, drawing filled" << endl;
+        }
+    }
+    activePipeline = get_pipeline(key);
+    //The pipeline layout stays alive for vkCmdPushConstants, see cleanup
 }
 
 void vk::create_command_pool(void)
 {
+    TRACE_FUNC();
     /* Short lived command buffers + individual reset */
     uint32_t flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
         | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; 
@@ -655,14 +786,15 @@ void vk::create_command_pool(void)
     VkResult result = vkCreateCommandPool(
             device,
             &createInfo,
-            nullptr,
+            allocator,
             &commandPool);
     print_result(result);
 }
 
 void vk::allocate_command_buffers(void)
 {
-    commandBuffers.resize(swapchainFramebuffers.size());
+    TRACE_FUNC();
+    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
     VkCommandBufferAllocateInfo ai = {};
     ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     ai.pNext = nullptr;
@@ -677,111 +809,744 @@ void vk::allocate_command_buffers(void)
     print_result(result);
 } 
 
-void vk::record_command_buffers(void)
+/* Recorded every frame, once the frame's fence has been waited on, since
+ * the image each view acquired changes from frame to frame. The pool allows
+ * individual resets */
+void vk::record_command_buffer(uint32_t frame)
 {
-    /* Record all the command buffers */
-    for (uint32_t i = 0; i != commandBuffers.size(); i++) {
-        ////
-        /* BEGIN COMMAND BUFFER */ 
-        VkCommandBufferBeginInfo bi = {};
-        bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        bi.pNext = nullptr;
-        bi.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-        bi.pInheritanceInfo = nullptr;
-        //Begin the command buffer (resetting it to an initial state) 
-        vkBeginCommandBuffer(commandBuffers[i], &bi); 
+    VkCommandBuffer commandBuffer = commandBuffers[frame];
+    ////
+    /* BEGIN COMMAND BUFFER */ 
+    VkCommandBufferBeginInfo bi = {};
+    bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bi.pNext = nullptr;
+    bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    bi.pInheritanceInfo = nullptr;
+    //Begin the command buffer (resetting it to an initial state) 
+    vkBeginCommandBuffer(commandBuffer, &bi); 
+    //Nothing is bound in a fresh command buffer
+    drawState.reset();
+
+    uint32_t passes = (uint32_t)views.size() * renderPhases;
+    uint32_t firstQuery = frame * passes;
+    if (statisticsQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, statisticsQueryPool, firstQuery,
+                passes);
+    }
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPool, frame * 2, 2);
+        vkCmdWriteTimestamp(commandBuffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool,
+                frame * 2);
+    }
 
+    /* With occlusion culling: cull against the previous frame's depth,
+     * draw, rebuild the pyramid from the new depth and draw what turned
+     * out to be visible after all */
+    bool occlusion = config.occlusion && meshLoaded;
+    if (occlusion) {
+        record_occlusion_cull(commandBuffer, 0);
+    }
+    record_view_passes(commandBuffer, 0, firstQuery);
+    if (occlusion) {
+        record_depth_pyramid(commandBuffer);
+        record_occlusion_cull(commandBuffer, 1);
+        record_view_passes(commandBuffer, 1,
+                firstQuery + (uint32_t)views.size());
+    }
+    if (postProcess) {
+        record_post_processing(commandBuffer);
+    }
+    if (sceneOffscreen) {
+        record_upscale(commandBuffer);
+    }
+    record_capture(commandBuffer);
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(commandBuffer,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool,
+                frame * 2 + 1);
+    }
+    VkResult result = vkEndCommandBuffer(commandBuffer);
+    print_result(result); 
+}
+
+/* One render pass per view, into the image acquired for it or, drawn
+ * offscreen, the top left renderExtent of its scene image. Phase
+ * 1 only happens with occlusion culling and continues phase 0's images.
+ *
+ * Bindings outlive render passes, and the compute passes in between bind
+ * to the compute bind point, so whatever a view bound stays bound for the
+ * next one; drawState drops those binds */
+void vk::record_view_passes(VkCommandBuffer commandBuffer, uint32_t phase,
+        uint32_t firstQuery)
+{
+    for (uint32_t v = 0; v != views.size(); v++) {
+        const view_target_t &view = views[v];
+        /* Around the whole render pass, so the counts are the view's */
+        if (statisticsQueryPool != VK_NULL_HANDLE) {
+            vkCmdBeginQuery(commandBuffer, statisticsQueryPool,
+                    firstQuery + v, 0);
+        }
         ////
         /* BEGIN RENDER PASS */
         VkRenderPassBeginInfo rpi = {};
         rpi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
         rpi.pNext = nullptr;
-        rpi.renderPass = renderPass;
-        rpi.framebuffer = swapchainFramebuffers[i];
-        //Render onto the whole rendering area of the framebuffer
+        rpi.renderPass = phase == 0 ? renderPass : reloadRenderPass;
+        rpi.framebuffer =
+            view.framebuffers[sceneOffscreen ? 0 : view.imageIndex];
+        //Render onto the part of the framebuffer this frame renders at
         rpi.renderArea.offset = {0, 0};
-        rpi.renderArea.extent = swapchainExtent;
-        // Clear color: black with 100% opacity 
-        VkClearValue clearColor = {0.f, 0.f, 0.f, 0.f};
-        rpi.clearValueCount = 1;
-        rpi.pClearValues = &clearColor;
+        rpi.renderArea.extent = view.renderExtent;
+        // Clear color: black with 100% opacity, depth: the far plane
+        VkClearValue clearValues[2] = {};
+        clearValues[0].color = {{0.f, 0.f, 0.f, 0.f}};
+        clearValues[1].depthStencil = {1.f, 0};
+        rpi.clearValueCount = 2;
+        rpi.pClearValues = clearValues;
         //Inline: commands embedded directly into the primary command buffer
         vkCmdBeginRenderPass(
-                commandBuffers[i],
+                commandBuffer,
                 &rpi,
                 VK_SUBPASS_CONTENTS_INLINE);
 
         /* DRAW */
-        vkCmdBindPipeline(
-                commandBuffers[i],
-                VK_PIPELINE_BIND_POINT_GRAPHICS, //graphics pipeline
-                graphicsPipeline);
-        vkCmdDraw(commandBuffers[i],
-                4, //vertexCount 3
-                1, //instanceCount 1: no instancing
-                0, //firstVertex 0
-                0);//firstInstance 0
+        //Every view draws with the same pipeline and buffers
+        uint32_t binds = drawState.binds_for(make_draw_key(phase, 0, 0, 0,
+                    0.f));
+        if (binds & DRAW_BIND_PIPELINE) {
+            vkCmdBindPipeline(
+                    commandBuffer,
+                    VK_PIPELINE_BIND_POINT_GRAPHICS, //graphics pipeline
+                    activePipeline);
+        }
+        //Viewport and scissor are dynamic state, the views differ in size
+        VkViewport viewport = {0.f, 0.f, (float)view.renderExtent.width,
+            (float)view.renderExtent.height, 0.f, 1.f};
+        VkRect2D scissor = {{0, 0}, view.renderExtent};
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        if (meshLoaded) {
+            record_mesh_draw(commandBuffer, view, phase, binds);
+        } else {
+            vkCmdDraw(commandBuffer,
+                    4, //vertexCount 3
+                    1, //instanceCount 1: no instancing
+                    0, //firstVertex 0
+                    0);//firstInstance 0
+        }
         /* END RENDER PASS */
-        vkCmdEndRenderPass(commandBuffers[i]);
-        VkResult result = vkEndCommandBuffer(commandBuffers[i]);
-        print_result(result); 
+        vkCmdEndRenderPass(commandBuffer);
+        if (statisticsQueryPool != VK_NULL_HANDLE) {
+            vkCmdEndQuery(commandBuffer, statisticsQueryPool, firstQuery + v);
+        }
     }
 }
 
+/* Stretch every view's scene over the whole image it acquired. The render
+ * pass, or post-processing in the general layout, left the scene with its
+ * writes visible to transfers; the acquire semaphore is waited on at the
+ * transfer stage */
+void vk::record_upscale(VkCommandBuffer commandBuffer)
+{
+    for (const auto &view : views) {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = view.images[view.imageIndex];
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        vkCmdPipelineBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkImageBlit blit = {};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        blit.srcOffsets[1] = {(int32_t)view.renderExtent.width,
+            (int32_t)view.renderExtent.height, 1};
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        blit.dstOffsets[1] = {(int32_t)view.extent.width,
+            (int32_t)view.extent.height, 1};
+        vkCmdBlitImage(commandBuffer,
+                view.color.image, postProcess ? VK_IMAGE_LAYOUT_GENERAL
+                    : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                barrier.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                1, &blit, VK_FILTER_LINEAR);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        vkCmdPipelineBarrier(commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+}
+/* Semaphores per frame in flight, so a frame never waits on or signals a
+ * semaphore the GPU is still using for the previous one: one per view for
+ * its acquire, one for the present of all views */
 void vk::create_semaphores(void)
 {
-    VkSemaphoreCreateInfo ci = {};
-    ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    TRACE_FUNC();
+    for (auto &view : views) {
+        view.imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+        for (uint32_t i = 0; i != MAX_FRAMES_IN_FLIGHT; i++) {
+            view.imageAvailableSemaphores[i] = semaphorePool.acquire();
+        }
+    }
+    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t i = 0; i != MAX_FRAMES_IN_FLIGHT; i++) {
+        renderFinishedSemaphores[i] = semaphorePool.acquire();
+    }
+}
+
+/* Before anything is submitted: uploads wait on the timeline too. The
+ * timeline bounds how far the CPU runs ahead; a frame in flight that
+ * submitted nothing yet reaches 0, which needs no waiting */
+void vk::create_sync_pools(void)
+{
+    TRACE_FUNC();
+    fencePool.init(device, allocator);
+    semaphorePool.init(device, allocator);
+    graphicsTimeline.init(device, allocator, timelineSemaphoreExtension,
+            fencePool);
+    frameTimelineValues.assign(MAX_FRAMES_IN_FLIGHT, 0);
+    cout << "Tracking GPU progress with "
+        << (graphicsTimeline.uses_semaphore() ? "a timeline semaphore" :
+                "pooled fences") << endl;
+}
+
+/* Input assembly, vertex, clipping and fragment counts tell vertex-bound
+ * frames from fragment overdraw. Only when the device supports them; the
+ * feature is enabled with everything else the device reports. One query
+ * per render pass: per view, and per phase with occlusion culling */
+void vk::create_statistics_query_pool(void)
+{
+    TRACE_FUNC();
+    if (!chosenDevice.features.pipelineStatisticsQuery) {
+        return;
+    }
+    VkQueryPoolCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
     ci.pNext = nullptr;
     ci.flags = 0;
-
-    VkResult result = vkCreateSemaphore(
+    ci.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    ci.queryCount =
+        MAX_FRAMES_IN_FLIGHT * (uint32_t)views.size() * renderPhases;
+    /* Keep in step with pipeline_statistic_t */
+    ci.pipelineStatistics =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    VkResult result = vkCreateQueryPool(
             device,
             &ci,
-            nullptr,
-            &imageAvailableSemaphore);
+            allocator,
+            &statisticsQueryPool);
     print_result(result);
+    if (result != VK_SUCCESS) {
+        statisticsQueryPool = VK_NULL_HANDLE;
+    }
+    statisticsPending.assign(MAX_FRAMES_IN_FLIGHT, false);
+}
 
-    result = vkCreateSemaphore(
+/* Called after the frame's fence, so the results are normally there; they
+ * are never waited for, a frame that is not ready is skipped */
+void vk::read_pipeline_statistics(uint32_t frame)
+{
+    if (statisticsQueryPool == VK_NULL_HANDLE || !statisticsPending[frame]) {
+        return;
+    }
+    statisticsPending[frame] = false;
+    uint32_t count = (uint32_t)views.size() * renderPhases;
+    std::vector<uint64_t> &results = statisticsResults;
+    results.resize((size_t)count * STATISTIC_COUNT);
+    VkResult result = vkGetQueryPoolResults(
             device,
-            &ci,
-            nullptr,
-            &renderFinishedSemaphore);
-    print_result(result); 
+            statisticsQueryPool,
+            frame * count,
+            count,
+            results.size() * sizeof(uint64_t),
+            results.data(),
+            STATISTIC_COUNT * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return;
+    }
+    for (uint32_t q = 0; q != count; q++) {
+        for (uint32_t i = 0; i != STATISTIC_COUNT; i++) {
+            pipelineStats.counters[i] += results[q * STATISTIC_COUNT + i];
+        }
+    }
+    pipelineStats.frames++;
 }
 
-void vk::draw_frame(void)
+/* Two timestamps per frame in flight, when the graphics queue has them */
+void vk::create_timestamp_query_pool(void)
+{
+    TRACE_FUNC();
+    uint32_t validBits = chosenDevice.queueFamilyProperties[
+        chosenDevice.get_graphics_queue_index()].timestampValidBits;
+    if (validBits == 0) {
+        return;
+    }
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    timestampPeriodNs = chosenDevice.properties.limits.timestampPeriod;
+    VkQueryPoolCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    ci.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    ci.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+    VkResult result = vkCreateQueryPool(device, &ci, allocator,
+            &timestampQueryPool);
+    print_result(result);
+    if (result != VK_SUCCESS) {
+        timestampQueryPool = VK_NULL_HANDLE;
+    }
+    timestampsPending.assign(MAX_FRAMES_IN_FLIGHT, false);
+    frameRenderScales.assign(MAX_FRAMES_IN_FLIGHT, 1.0);
+}
+
+/* Like read_pipeline_statistics. The GPU time also drives the dynamic
+ * resolution controller */
+void vk::read_gpu_frame_time(uint32_t frame)
 {
-    /* Acquire an image from the swapchain */
-    uint32_t imageIndex;
-    vkAcquireNextImageKHR(
+    if (timestampQueryPool == VK_NULL_HANDLE || !timestampsPending[frame]) {
+        return;
+    }
+    timestampsPending[frame] = false;
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(
             device,
-            swapchain,
-            (uint64_t)-1,
-            imageAvailableSemaphore,
-            VK_NULL_HANDLE,
-            &imageIndex);
+            timestampQueryPool,
+            frame * 2,
+            2,
+            sizeof(timestamps),
+            timestamps,
+            sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return;
+    }
+    double ms = (double)((timestamps[1] - timestamps[0]) & timestampMask)
+        * timestampPeriodNs / 1e6;
+    record_frame_interval(gpuFrameStats, ms);
+    TRACE_INSTANT("gpu_frame_us", (uint64_t)(ms * 1000.0));
+    if (dynamicResolution) {
+        resolutionScaler.update(ms, frameRenderScales[frame]);
+    }
+}
+
+/* Index of a memory type allowed by typeBits that has all the requested
+ * properties, -1 if there is none. minHeapSize skips types whose heap is too
+ * small to be worth using, e.g. a 256 MB BAR window for a large upload */
+int32_t vk::find_memory_type(
+        uint32_t typeBits,
+        VkMemoryPropertyFlags properties,
+        VkDeviceSize minHeapSize)
+{
+    const VkPhysicalDeviceMemoryProperties &mp = chosenDevice.memoryProperties;
+    for (uint32_t i = 0; i != mp.memoryTypeCount; i++) {
+        if ((typeBits & (1U << i)) &&
+                (mp.memoryTypes[i].propertyFlags & properties) == properties &&
+                mp.memoryHeaps[mp.memoryTypes[i].heapIndex].size
+                >= minHeapSize) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+void vk::init_memory_budget(void)
+{
+    TRACE_FUNC();
+    memoryBudget.init(instance, chosenDevice.physicalDevice,
+            chosenDevice.memoryProperties, memoryBudgetExtension);
+    memoryBudget.update();
+}
+
+/* Create a buffer and back it with the first entry of preferences that some
+ * memory type satisfies and whose heap has room in its budget. Host visible
+ * memory is mapped for the buffer's whole lifetime */
+void vk::create_buffer(
+        VkDeviceSize size,
+        VkBufferUsageFlags usage,
+        const vector<VkMemoryPropertyFlags> &preferences,
+        device_buffer_t &buffer)
+{
+    VkBufferCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    ci.pNext = nullptr;
+    ci.flags = 0;
+    ci.size = size;
+    ci.usage = usage;
+    ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkResult result = vkCreateBuffer(device, &ci, allocator, &buffer.buffer);
+    print_result(result);
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, buffer.buffer, &requirements);
+
+    /* A preferred type is skipped if the buffer would take more than half of
+     * its heap or go over the heap's budget; the last preference is the
+     * fallback and always allowed */
+    const VkPhysicalDeviceMemoryProperties &mp = chosenDevice.memoryProperties;
+    int32_t typeIndex = -1;
+    for (uint32_t i = 0; i != preferences.size() && typeIndex < 0; i++) {
+        bool last = i + 1 == preferences.size();
+        VkDeviceSize minHeapSize = last ? 0 : requirements.size * 2;
+        typeIndex = find_memory_type(
+                requirements.memoryTypeBits, preferences[i], minHeapSize);
+        buffer.properties = preferences[i];
+        if (typeIndex >= 0 && !last && !memoryBudget.fits(
+                    mp.memoryTypes[typeIndex].heapIndex, requirements.size)) {
+            typeIndex = -1;
+        }
+    }
+    if (typeIndex < 0) {
+        vkDestroyBuffer(device, buffer.buffer, allocator);
+        buffer.buffer = VK_NULL_HANDLE;
+        throw std::runtime_error("no suitable memory type for buffer");
+    }
+
+    VkMemoryAllocateInfo ai = {};
+    ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    ai.pNext = nullptr;
+    ai.allocationSize = requirements.size;
+    ai.memoryTypeIndex = (uint32_t)typeIndex;
+    buffer.heapIndex = mp.memoryTypes[typeIndex].heapIndex;
+    buffer.allocationSize = requirements.size;
+    /* Going over the budget is what ends in VK_ERROR_DEVICE_LOST on some
+     * drivers rather than a failed allocation; make room first, and make
+     * it loud if there is none */
+    if (!memoryBudget.fits(buffer.heapIndex, requirements.size)) {
+        memoryBudget.relieve_pressure();
+        if (!memoryBudget.fits(buffer.heapIndex, requirements.size)) {
+            std::cerr << "Allocating " << requirements.size
+                << " bytes over the budget of memory heap "
+                << buffer.heapIndex << endl;
+        }
+    }
+    result = vkAllocateMemory(device, &ai, allocator, &buffer.memory);
+    print_result(result);
+    if (result != VK_SUCCESS) {
+        vkDestroyBuffer(device, buffer.buffer, allocator);
+        buffer.buffer = VK_NULL_HANDLE;
+        throw std::runtime_error("failed to allocate buffer memory");
+    }
+    memoryBudget.allocated(buffer.heapIndex, buffer.allocationSize);
+    vkBindBufferMemory(device, buffer.buffer, buffer.memory, 0);
+    buffer.size = size;
+
+    if (buffer.properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(
+                device, buffer.memory, 0, VK_WHOLE_SIZE, 0, &buffer.mapped);
+        print_result(result);
+    }
+}
+
+void vk::destroy_buffer(device_buffer_t &buffer)
+{
+    if (buffer.mapped != nullptr) {
+        vkUnmapMemory(device, buffer.memory);
+    }
+    vkDestroyBuffer(device, buffer.buffer, allocator);
+    if (buffer.memory != VK_NULL_HANDLE) {
+        vkFreeMemory(device, buffer.memory, allocator);
+        memoryBudget.freed(buffer.heapIndex, buffer.allocationSize);
+    }
+    buffer = device_buffer_t();
+}
+
+/* A 2D image in device local memory, optimal tiling, and a view of all
+ * its levels and layers. The budget is handled as in create_buffer, except
+ * that there is no fallback to host memory */
+void vk::create_image(
+        VkExtent2D extent,
+        uint32_t levels,
+        VkFormat format,
+        VkImageUsageFlags usage,
+        VkImageAspectFlags aspect,
+        device_image_t &image,
+        uint32_t layers)
+{
+    VkImageCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    ci.pNext = nullptr;
+    ci.flags = 0;
+    ci.imageType = VK_IMAGE_TYPE_2D;
+    ci.format = format;
+    ci.extent = {extent.width, extent.height, 1};
+    ci.mipLevels = levels;
+    ci.arrayLayers = layers;
+    ci.samples = VK_SAMPLE_COUNT_1_BIT;
+    ci.tiling = VK_IMAGE_TILING_OPTIMAL;
+    ci.usage = usage;
+    ci.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    ci.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(device, &ci, allocator, &image.image);
+    print_result(result);
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device, image.image, &requirements);
+    int32_t typeIndex = find_memory_type(requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (typeIndex < 0) {
+        vkDestroyImage(device, image.image, allocator);
+        image.image = VK_NULL_HANDLE;
+        throw std::runtime_error("no suitable memory type for image");
+    }
+
+    VkMemoryAllocateInfo ai = {};
+    ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    ai.pNext = nullptr;
+    ai.allocationSize = requirements.size;
+    ai.memoryTypeIndex = (uint32_t)typeIndex;
+    image.heapIndex =
+        chosenDevice.memoryProperties.memoryTypes[typeIndex].heapIndex;
+    image.allocationSize = requirements.size;
+    if (!memoryBudget.fits(image.heapIndex, requirements.size)) {
+        memoryBudget.relieve_pressure();
+    }
+    result = vkAllocateMemory(device, &ai, allocator, &image.memory);
+    print_result(result);
+    if (result != VK_SUCCESS) {
+        vkDestroyImage(device, image.image, allocator);
+        image.image = VK_NULL_HANDLE;
+        throw std::runtime_error("failed to allocate image memory");
+    }
+    memoryBudget.allocated(image.heapIndex, image.allocationSize);
+    vkBindImageMemory(device, image.image, image.memory, 0);
+    image.format = format;
+    image.extent = extent;
+    image.levels = levels;
+    image.layers = layers;
+
+    VkImageViewCreateInfo vi = {};
+    vi.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    vi.pNext = nullptr;
+    vi.flags = 0;
+    vi.image = image.image;
+    vi.viewType = layers > 1 ?
+        VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+    vi.format = format;
+    vi.subresourceRange = {aspect, 0, levels, 0, layers};
+    result = vkCreateImageView(device, &vi, allocator, &image.view);
+    print_result(result);
+}
+
+/* Fill a color image from tightly packed pixels, each level with all its
+ * layers one after another, and leave it ready for sampling. levelOffsets
+ * holds where each level starts in pixels; without it there is only level
+ * 0. Compressed formats are copied in whole blocks. Waits for the copy, so
+ * it is meant for load time */
+void vk::upload_image(device_image_t &image, const void *pixels,
+        VkDeviceSize size, const vector<VkDeviceSize> &levelOffsets)
+{
+    TRACE_FUNC();
+    device_buffer_t staging;
+    create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT},
+            staging);
+    memcpy(staging.mapped, pixels, size);
+
+    VkCommandBufferAllocateInfo ai = {};
+    ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    ai.commandPool = commandPool;
+    ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    ai.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    VkResult result = vkAllocateCommandBuffers(device, &ai, &commandBuffer);
+    print_result(result);
+    VkCommandBufferBeginInfo bi = {};
+    bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    bi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &bi);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image.image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, image.levels,
+        0, image.layers};
+    vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    vector<VkBufferImageCopy> regions(
+            std::max(levelOffsets.size(), (size_t)1));
+    for (uint32_t l = 0; l != regions.size(); l++) {
+        VkBufferImageCopy &region = regions[l];
+        region.bufferOffset = levelOffsets.empty() ? 0 : levelOffsets[l];
+        region.bufferRowLength = 0;     //tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource =
+            {VK_IMAGE_ASPECT_COLOR_BIT, l, 0, image.layers};
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {std::max(image.extent.width >> l, 1u),
+            std::max(image.extent.height >> l, 1u), 1};
+    }
+    vkCmdCopyBufferToImage(commandBuffer, staging.buffer, image.image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(),
+            regions.data());
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+    vkEndCommandBuffer(commandBuffer);
 
-    /* Submitting the command buffer */
     VkSubmitInfo si = {};
-    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; 
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    si.commandBufferCount = 1;
+    si.pCommandBuffers = &commandBuffer;
+    graphicsTimeline.wait(graphicsTimeline.submit(graphicsQueue, si));
+
+    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    destroy_buffer(staging);
+}
+
+void vk::destroy_image(device_image_t &image)
+{
+    vkDestroyImageView(device, image.view, allocator);
+    vkDestroyImage(device, image.image, allocator);
+    if (image.memory != VK_NULL_HANDLE) {
+        vkFreeMemory(device, image.memory, allocator);
+        memoryBudget.freed(image.heapIndex, image.allocationSize);
+    }
+    image = device_image_t();
+}
+
+/* Tagged with the frame being prepared: it may already have recorded the
+ * object, so the object lives until that frame's fence has been waited on */
+void vk::retire(std::function<void(void)> destroy)
+{
+    deletionQueue.push(frameNumber.load(), std::move(destroy));
+}
 
-    VkSemaphore waitSemaphores[] = {imageAvailableSemaphore}; 
-    si.waitSemaphoreCount = 1;
-    si.pWaitSemaphores = waitSemaphores;
+/* The caller's buffer is cleared right away and can be created anew while
+ * the old one waits */
+void vk::retire_buffer(device_buffer_t &buffer)
+{
+    device_buffer_t old = buffer;
+    buffer = device_buffer_t();
+    retire([this, old]() mutable { destroy_buffer(old); });
+}
 
-    VkPipelineStageFlags waitStages[] =
-    {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT}; 
-    si.pWaitDstStageMask = waitStages;
+void vk::draw_frame(void)
+{
+    /* Wait until the GPU is done with this frame's semaphores */
+    {
+        TRACE_ZONE("wait_frame_fence");
+        graphicsTimeline.wait(frameTimelineValues[currentFrame]);
+    }
+    /* The value belonged to the frame MAX_FRAMES_IN_FLIGHT back; it and
+     * every frame before it are done with whatever was retired meanwhile */
+    uint64_t frame = frameNumber.load();
+    if (frame >= MAX_FRAMES_IN_FLIGHT) {
+        size_t destroyed = deletionQueue.collect(frame - MAX_FRAMES_IN_FLIGHT);
+        if (destroyed != 0) {
+            TRACE_INSTANT("retired_objects_destroyed", destroyed);
+        }
+    }
+    read_pipeline_statistics(currentFrame);
+    read_gpu_frame_time(currentFrame);
+    collect_capture(currentFrame);
+    if (frame % BUDGET_UPDATE_FRAMES == 0) {
+        memoryBudget.update();
+        memoryBudget.relieve_pressure();
+    }
+
+    /* Acquire an image from every view's swapchain */
+    {
+        TRACE_ZONE("acquire");
+        for (uint32_t v = 0; v != views.size(); v++) {
+            view_target_t &view = views[v];
+            /* Views are presented together, so what sets them apart is
+             * how long each swapchain keeps us waiting for an image */
+            uint64_t acquireStart = monotonic_ns();
+            vkAcquireNextImageKHR(
+                    device,
+                    view.swapchain,
+                    (uint64_t)-1,
+                    view.imageAvailableSemaphores[currentFrame],
+                    VK_NULL_HANDLE,
+                    &view.imageIndex);
+            record_frame_interval(view.acquireStats,
+                    (double)(monotonic_ns() - acquireStart) / 1e6);
+            frameWaitSemaphores[v] =
+                view.imageAvailableSemaphores[currentFrame];
+            presentImageIndices[v] = view.imageIndex;
+        }
+    }
+    /* Render at the scale the controller settled on so far */
+    double scale = resolutionScaler.scale();
+    for (auto &view : views) {
+        view.renderExtent = view.extent;
+        if (dynamicResolution) {
+            view.renderExtent.width = std::max(1u,
+                    (uint32_t)(view.extent.width * scale + 0.5));
+            view.renderExtent.height = std::max(1u,
+                    (uint32_t)(view.extent.height * scale + 0.5));
+        }
+    }
+    if (meshLoaded) {
+        update_draw_list();
+    }
+    if (capturing) {
+        frameCaptureSlots[currentFrame] = frameCapture.acquire_slot();
+    }
+    record_command_buffer(currentFrame);
+    if (statisticsQueryPool != VK_NULL_HANDLE) {
+        statisticsPending[currentFrame] = true;
+    }
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        timestampsPending[currentFrame] = true;
+        frameRenderScales[currentFrame] = scale;
+    }
+
+    /* Submitting the command buffer, once every view's image is ready */
+    VkSubmitInfo si = {};
+    si.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO; 
+
+    si.waitSemaphoreCount = (uint32_t)frameWaitSemaphores.size();
+    si.pWaitSemaphores = frameWaitSemaphores.data();
+    si.pWaitDstStageMask = frameWaitStages.data();
 
     si.commandBufferCount = 1;
-    si.pCommandBuffers = &commandBuffers[imageIndex]; 
+    si.pCommandBuffers = &commandBuffers[currentFrame]; 
 
-    VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
+    VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
     si.signalSemaphoreCount = 1;
     si.pSignalSemaphores = signalSemaphores;
 
-    vkQueueSubmit(graphicsQueue, 1, &si, VK_NULL_HANDLE);
+    {
+        TRACE_ZONE("submit");
+        frameTimelineValues[currentFrame] =
+            graphicsTimeline.submit(graphicsQueue, si);
+    }
+    frameNumber.fetch_add(1);
 
     /* Presentaton */
     VkPresentInfoKHR pi = {};
@@ -789,10 +1554,25 @@ void vk::draw_frame(void)
     pi.waitSemaphoreCount = 1;
     pi.pWaitSemaphores = signalSemaphores;
 
-    VkSwapchainKHR swapchains[] = {swapchain};
-    pi.swapchainCount = 1;
-    pi.pSwapchains = swapchains;
-    pi.pImageIndices = &imageIndex;
-    pi.pResults = nullptr;
-    vkQueuePresentKHR(presentQueue, &pi);
+    /* Every view in one call, so the presentation engine gets them
+     * together instead of one queue operation per window */
+    pi.swapchainCount = (uint32_t)presentSwapchains.size();
+    pi.pSwapchains = presentSwapchains.data();
+    pi.pImageIndices = presentImageIndices.data();
+    pi.pResults = presentResults.data();
+    {
+        TRACE_ZONE("present");
+        vkQueuePresentKHR(presentQueue, &pi);
+    }
+    for (uint32_t v = 0; v != views.size(); v++) {
+        if (presentResults[v] != VK_SUCCESS) {
+            views[v].presentErrors++;
+        }
+    }
+    if (frame == 0) {
+        startupMs = (double)(monotonic_ns() - startNs) / 1e6;
+        TRACE_INSTANT("startup_ms", (uint64_t)startupMs);
+    }
+
+    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
@@ -13,9 +13,11 @@ using std::vector;
 
 #include "vulkan_application.h"
 #include "debug_print.h"
+#include "job_system.h"
+#include "notify.h"
 
 #include <algorithm>
-#include <unistd.h>
+#include <thread>
 
 #include <string>
 using std::string;
@@ -25,6 +27,26 @@ using std::string;
 /* FUNCTIONS */
 /*************/
 
+void vk::configure(const app_config_t &config)
+{
+    this->config = config;
+    if (config.headless) {
+        /* Nothing to wait for events from */
+        this->config.idle = false;
+        this->config.renderThread = false;
+    }
+    if (config.occlusion && config.meshPath.empty()) {
+        cout << "Occlusion culling needs a mesh, drawing everything" << endl;
+        this->config.occlusion = false;
+    }
+    renderPhases = this->config.occlusion ? 2 : 1;
+    resolutionScaler.set_range(config.minRenderScale, 1.0);
+    resolutionScaler.set_target_ms(config.dynamicResolutionMs);
+    startNs = monotonic_ns();
+    views.resize(this->config.views);
+    allocator = config.systemAllocator ? nullptr : hostAllocator.callbacks();
+}
+
 void vk::run(void)
 {
     main_loop();
@@ -32,28 +54,256 @@ void vk::run(void)
 
 void vk::main_loop(void)
 { 
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents(); 
-        draw_frame(); 
-        usleep(10000);
-    } 
+    if (config.renderThread) {
+        event_loop();
+    } else {
+        while (!should_close()) {
+            TRACE_ZONE("frame");
+            if (config.idle) {
+                if (!wait_for_redraw()) {
+                    continue;
+                }
+            } else if (!config.headless) {
+                TRACE_ZONE("poll_events");
+                glfwPollEvents();
+            }
+            job_system::shared().run_main_jobs();
+            draw_frame();
+            framePacer.wait_for_next_frame();
+        }
+    }
+    print_frame_stats();
+    print_pipeline_statistics();
+    print_occlusion_stats();
+    print_host_memory_stats();
+    print_memory_budget();
+    if (!config.statsPath.empty()) {
+        write_run_stats(config.statsPath);
+    }
     cleanup();
 }
 
+/* A window was closed or the frame count given with --frames has been
+ * submitted. Safe to call from any thread */
+bool vk::should_close(void)
+{
+    if (config.frames != 0 && frameNumber.load() >= config.frames) {
+        return true;
+    }
+    for (const auto &view : views) {
+        if (view.window != nullptr && glfwWindowShouldClose(view.window)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* With --render-thread the calling thread only pumps GLFW events (GLFW
+ * requires that to happen on the main thread). Each batch of events becomes a
+ * frame packet for the render thread, so neither a slow acquire or present
+ * nor a burst of input holds up the other side */
+void vk::event_loop(void)
+{
+    TRACE_THREAD_NAME("events");
+    std::thread renderThread(&vk::render_loop, this);
+
+    frame_packet_t packet = {};
+    packet.redraw = true;
+    bool pending = true;
+    while (!should_close()) {
+        if (pending) {
+            /* The render thread has not caught up with the last packet;
+             * check back shortly instead of blocking on events */
+            glfwWaitEventsTimeout(0.001);
+        } else if (config.idle && config.idleTimeout > 0.0) {
+            TRACE_ZONE("wait_events");
+            glfwWaitEventsTimeout(config.idleTimeout);
+            sceneDirty.store(true);
+        } else {
+            TRACE_ZONE("wait_events");
+            glfwWaitEvents();
+        }
+        /* Whoever posts a main thread job wakes us with glfwPostEmptyEvent */
+        job_system::shared().run_main_jobs();
+
+        /* Flags from packets that did not fit are merged into this one */
+        packet.sequence++;
+        packet.timestampNs = monotonic_ns();
+        packet.redraw = packet.redraw || sceneDirty.exchange(false);
+        packet.iconified = windowIconified;
+        pending = !packetQueue.try_push(packet);
+        if (!pending) {
+            packet.redraw = false;
+            wake_render_thread();
+        }
+    }
+
+    packet.quit = true;
+    while (!packetQueue.try_push(packet)) {
+        std::this_thread::yield();
+    }
+    wake_render_thread();
+    renderThread.join();
+}
+
+void vk::wake_render_thread(void)
+{
+    notify_locked(renderWakeMutex, renderWake);
+}
+
+/* Consumes frame packets and does acquire, submit and present. Outside idle
+ * mode it keeps drawing whether or not new packets arrived */
+void vk::render_loop(void)
+{
+    TRACE_THREAD_NAME("render");
+    bool redraw = true;
+    bool iconified = false;
+    for (;;) {
+        TRACE_ZONE("frame");
+        if (iconified || (config.idle && !redraw)) {
+            TRACE_ZONE("wait_packet");
+            std::unique_lock<std::mutex> lock(renderWakeMutex);
+            renderWake.wait(lock, [this] { return !packetQueue.empty(); });
+            framePacer.resync();
+        }
+
+        bool quit = false;
+        frame_packet_t packet;
+        while (packetQueue.try_pop(packet)) {
+            TRACE_INSTANT("packet_latency_us",
+                    (monotonic_ns() - packet.timestampNs) / 1000);
+            redraw = redraw || packet.redraw;
+            iconified = packet.iconified;
+            quit = quit || packet.quit;
+        }
+        if (quit) {
+            break;
+        }
+        if (iconified || (config.idle && !redraw)) {
+            continue;
+        }
+        redraw = false;
+        draw_frame();
+        framePacer.wait_for_next_frame();
+        if (should_close()) {
+            /* --frames reached; get the event loop out of its wait */
+            glfwPostEmptyEvent();
+        }
+    }
+}
+
+/* Idle mode: block in GLFW until something may have changed what is on
+ * screen. Returns true when a frame should be drawn */
+bool vk::wait_for_redraw(void)
+{
+    if (!sceneDirty.load() || windowIconified) {
+        TRACE_ZONE("wait_events");
+        if (config.idleTimeout > 0.0) {
+            glfwWaitEventsTimeout(config.idleTimeout);
+            /* The timeout is a heartbeat: redraw even without an event */
+            sceneDirty.store(true);
+        } else {
+            glfwWaitEvents();
+        }
+        /* The gap we just slept through is not a frame interval */
+        framePacer.resync();
+    } else {
+        TRACE_ZONE("poll_events");
+        glfwPollEvents();
+    }
+    if (windowIconified) {
+        return false;
+    }
+    return sceneDirty.exchange(false);
+}
+
+void vk::request_redraw(void)
+{
+    sceneDirty.store(true);
+    /* Wake the event loop if it is blocked in glfwWaitEvents */
+    if (!config.headless) {
+        glfwPostEmptyEvent();
+    }
+}
+
+/* The window system lost the contents, e.g. the window was uncovered */
+void vk::window_refresh_callback(GLFWwindow *window)
+{
+    vk *app = (vk *)glfwGetWindowUserPointer(window);
+    app->request_redraw();
+}
+
+void vk::window_focus_callback(GLFWwindow *window, int focused)
+{
+    (void)focused;
+    vk *app = (vk *)glfwGetWindowUserPointer(window);
+    app->request_redraw();
+}
+
+/* Drawing stops only once every window is iconified */
+void vk::window_iconify_callback(GLFWwindow *window, int iconified)
+{
+    vk *app = (vk *)glfwGetWindowUserPointer(window);
+    bool all = true;
+    for (auto &view : app->views) {
+        if (view.window == window) {
+            view.iconified = iconified == GLFW_TRUE;
+        }
+        all = all && view.iconified;
+    }
+    app->windowIconified = all;
+    app->request_redraw();
+}
+
+/* Hand the target rate and the display's refresh period to the pacer. The
+ * refresh period only matters when the present mode waits for vblank. With
+ * several views the first one paces; they are presented together */
+void vk::configure_frame_pacing(void)
+{
+    framePacer.set_target_fps(config.benchmark ? 0.0 : config.targetFps);
+
+    double vsyncPeriod = 0.0;
+    VkPresentModeKHR presentMode = views[0].presentMode;
+    if (!config.headless && (presentMode == VK_PRESENT_MODE_FIFO_KHR ||
+            presentMode == VK_PRESENT_MODE_FIFO_RELAXED_KHR)) {
+        const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        if (mode != nullptr && mode->refreshRate > 0) {
+            vsyncPeriod = 1.0 / mode->refreshRate;
+        }
+    }
+    framePacer.set_vsync_period(vsyncPeriod);
+}
+
 void vk::glfw_init(void)
 { 
+    TRACE_FUNC();
+    if (config.headless) {
+        /* No window, and no display server needed */
+        return;
+    }
     /* Initialize the GLFW library */
     glfwInit();
     /* Do not use a OpenGL context, disable resizing */
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE); 
-    /* Create the window */
-    window = glfwCreateWindow(
-            WIDTH, HEIGHT, "Vulkan", nullptr, nullptr); 
+    /* Create the windows */
+    for (uint32_t i = 0; i != views.size(); i++) {
+        string title = views.size() == 1 ? "Vulkan" : "Vulkan "
+            + std::to_string(i + 1) + "/" + std::to_string(views.size());
+        GLFWwindow *window = glfwCreateWindow(
+                WIDTH, HEIGHT, title.c_str(), nullptr, nullptr); 
+        /* Window changes mark the scene dirty for idle mode */
+        glfwSetWindowUserPointer(window, this);
+        glfwSetWindowRefreshCallback(window, window_refresh_callback);
+        glfwSetWindowFocusCallback(window, window_focus_callback);
+        glfwSetWindowIconifyCallback(window, window_iconify_callback);
+        views[i].window = window;
+    }
 } 
 
 void vk::init(void)
 { 
+    TRACE_FUNC();
     load_available_instance_extensions();
     //print_available_instance_extensions(); 
     load_required_instance_extensions();
@@ -72,28 +322,61 @@ void vk::init(void)
     //print_layer_properties(); 
     //print_device_info(chosenDevice);
     load_queues(); 
+    init_memory_budget();
     load_swapchain_support_details();
     //print_swapchain_support_details(); 
     create_swapchains();
     load_swapchain_image_handles();
     create_swapchain_image_views();
+    create_render_targets();
     create_renderpass();
     create_framebuffers();
     create_graphics_pipeline_layout();
     create_graphics_pipeline();
     create_command_pool();
+    create_sync_pools();
+    load_mesh();
+    create_materials();
+    create_scene();
+    create_occlusion_culling();
+    create_post_processing();
+    create_capture();
     allocate_command_buffers();
-    record_command_buffers();
     create_semaphores();
+    create_statistics_query_pool();
+    create_timestamp_query_pool();
+    configure_frame_pacing();
 }
 
 void vk::cleanup(void)
 {
+    TRACE_FUNC();
     vkDeviceWaitIdle(device); 
+    /* Nothing is in flight any more */
+    deletionQueue.flush();
 
-    /* Destroy semaphores */
-    vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
-    vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
+    /* Destroy semaphores and fences */
+    for (auto &view : views) {
+        for (VkSemaphore semaphore : view.imageAvailableSemaphores) {
+            semaphorePool.release(semaphore);
+        }
+        view.imageAvailableSemaphores.clear();
+    }
+    for (VkSemaphore semaphore : renderFinishedSemaphores) {
+        semaphorePool.release(semaphore);
+    }
+    renderFinishedSemaphores.clear();
+    graphicsTimeline.destroy();
+    semaphorePool.destroy();
+    fencePool.destroy();
+
+    destroy_capture();
+    if (statisticsQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, statisticsQueryPool, allocator);
+    }
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, timestampQueryPool, allocator);
+    }
 
     /* Free command buffers */
     vkFreeCommandBuffers(
@@ -101,29 +384,53 @@ void vk::cleanup(void)
             commandPool,
             (uint32_t)commandBuffers.size(),
             commandBuffers.data());
-    /* Destroy graphics pipeline */
-    vkDestroyPipeline(device, graphicsPipeline, nullptr);
-    /* Destroy framebuffers */
-    for (auto &i : swapchainFramebuffers) {
-        vkDestroyFramebuffer(device, i, nullptr);
+    /* Destroy mesh and instance buffers */
+    destroy_post_processing();
+    destroy_occlusion_culling();
+    destroy_scene();
+    destroy_materials();
+    destroy_mesh();
+    /* Destroy graphics pipeline and its layout */
+    destroy_pipeline_variants();
+    graphicsPipeline.reset();
+    graphicsPipelineLayout.reset();
+    pipelineCache.reset();
+    vertShaderModule.reset();
+    fragShaderModule.reset();
+    for (auto &view : views) {
+        /* Destroy framebuffers */
+        view.framebuffers.clear();
+        /* Destroy swapchain imageviews */
+        view.imageViews.clear();
+        destroy_image(view.depth);
+        if (view.color.image != VK_NULL_HANDLE) {
+            destroy_image(view.color);
+        }
+        /* Destroy swapchains */
+        vkDestroySwapchainKHR(device, view.swapchain, allocator);
     }
     /* Destroy renderpass */
-    vkDestroyRenderPass(device, renderPass, nullptr);
-    /* Destroy swapchain imageviews */
-    for (auto &i : swapchainImageViews) {
-        vkDestroyImageView(device, i, nullptr);
-    }
-    /* Destroy swapchains */
-    vkDestroySwapchainKHR(device, swapchain, nullptr);
+    renderPass.reset();
+    reloadRenderPass.reset();
     /* Destroy command pool */
-    vkDestroyCommandPool(device, commandPool, nullptr);
-    /* Destroy surface */
-    vkDestroySurfaceKHR(instance, surface, nullptr); 
+    vkDestroyCommandPool(device, commandPool, allocator);
+    /* Destroy surfaces */
+    for (auto &view : views) {
+        vkDestroySurfaceKHR(instance, view.surface, allocator); 
+    }
     /* Destroy logical device */ 
-    vkDestroyDevice(device, nullptr); 
+    vkDestroyDevice(device, allocator); 
     /* Destroy instance */
-    vkDestroyInstance(instance, nullptr); 
-    /* Terminate window */
-    glfwDestroyWindow(window);
-    glfwTerminate(); 
+    vkDestroyInstance(instance, allocator); 
+    if (allocator != nullptr && hostAllocator.live_bytes() != 0) {
+        std::cerr << "Vulkan still holds " << hostAllocator.live_bytes()
+            << " bytes of host memory after vkDestroyInstance" << endl;
+    }
+    /* Terminate windows */
+    if (!config.headless) {
+        for (auto &view : views) {
+            glfwDestroyWindow(view.window);
+        }
+        glfwTerminate();
+    }
 }
@@ -0,0 +1,288 @@
+#include "scene.h"
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+/* -DSCENE_SCALAR builds the portable path on x86 too */
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(SCENE_SCALAR)
+#define SCENE_SSE
+#include <xmmintrin.h>
+#endif
+
+using std::vector;
+
+/* Subtree ranges are handed to the job system in batches of at least this
+ * many nodes, enough to outweigh scheduling a job */
+const size_t MIN_NODES_PER_JOB = 4096;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* out = parent * local. glm stores columns contiguously, so every
+     * result column is a combination of the four parent columns. out must
+     * not alias either input */
+    inline void multiply(const float *parent, const float *local, float *out)
+    {
+#ifdef SCENE_SSE
+        __m128 c0 = _mm_loadu_ps(parent), c1 = _mm_loadu_ps(parent + 4);
+        __m128 c2 = _mm_loadu_ps(parent + 8), c3 = _mm_loadu_ps(parent + 12);
+        for (int j = 0; j != 4; j++) {
+            __m128 r = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(local[4 * j])),
+                        _mm_mul_ps(c1, _mm_set1_ps(local[4 * j + 1]))),
+                    _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(local[4 * j + 2])),
+                        _mm_mul_ps(c3, _mm_set1_ps(local[4 * j + 3]))));
+            _mm_storeu_ps(out + 4 * j, r);
+        }
+#else
+        for (int j = 0; j != 4; j++) {
+            for (int r = 0; r != 4; r++) {
+                out[4 * j + r] = parent[r] * local[4 * j]
+                    + parent[4 + r] * local[4 * j + 1]
+                    + parent[8 + r] * local[4 * j + 2]
+                    + parent[12 + r] * local[4 * j + 3];
+            }
+        }
+#endif
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+void scene_graph::reserve(size_t nodes)
+{
+    vector<float> *arrays[] = {&positionX, &positionY, &positionZ,
+        &rotationX, &rotationY, &rotationZ, &rotationW, &scales};
+    for (auto array : arrays) {
+        array->reserve(nodes);
+    }
+    parents.reserve(nodes);
+    subtreeEnd.reserve(nodes);
+    dirty.reserve(nodes);
+    worlds.reserve(nodes);
+}
+
+uint32_t scene_graph::add_node(uint32_t parent, const glm::vec3 &position,
+        const glm::quat &rotation, float scale)
+{
+    uint32_t node = (uint32_t)parents.size();
+    if (parent != SCENE_NO_PARENT && parent >= node) {
+        parent = SCENE_NO_PARENT;
+    }
+    /* Still depth first if the parent's subtree ends right here; then it
+     * and every ancestor ending here grow by one */
+    if (parent != SCENE_NO_PARENT && subtreeEnd[parent] != node) {
+        depthFirst = false;
+    }
+    for (uint32_t a = parent; a != SCENE_NO_PARENT && subtreeEnd[a] == node;
+            a = parents[a]) {
+        subtreeEnd[a] = node + 1;
+    }
+    parents.push_back(parent);
+    subtreeEnd.push_back(node + 1);
+    positionX.push_back(position.x);
+    positionY.push_back(position.y);
+    positionZ.push_back(position.z);
+    glm::quat q = glm::normalize(rotation);
+    rotationX.push_back(q.x);
+    rotationY.push_back(q.y);
+    rotationZ.push_back(q.z);
+    rotationW.push_back(q.w);
+    scales.push_back(scale);
+    dirty.push_back(0);
+    worlds.push_back(glm::mat4(1.f));
+    worldBounds.resize(parents.size());
+    mark(node);
+    return node;
+}
+
+void scene_graph::mark(uint32_t node)
+{
+    if (!dirty[node]) {
+        dirty[node] = 1;
+        marked.push_back(node);
+    }
+}
+
+void scene_graph::set_position(uint32_t node, const glm::vec3 &position)
+{
+    positionX[node] = position.x;
+    positionY[node] = position.y;
+    positionZ[node] = position.z;
+    mark(node);
+}
+
+void scene_graph::set_rotation(uint32_t node, const glm::quat &rotation)
+{
+    glm::quat q = glm::normalize(rotation);
+    rotationX[node] = q.x;
+    rotationY[node] = q.y;
+    rotationZ[node] = q.z;
+    rotationW[node] = q.w;
+    mark(node);
+}
+
+void scene_graph::set_scale(uint32_t node, float scale)
+{
+    scales[node] = scale;
+    mark(node);
+}
+
+void scene_graph::set_local_bounds(const float boundsMin[3],
+        const float boundsMax[3])
+{
+    float r2 = 0.f;
+    for (int k = 0; k != 3; k++) {
+        localCenter[k] = 0.5f * (boundsMin[k] + boundsMax[k]);
+        localExtent[k] = 0.5f * (boundsMax[k] - boundsMin[k]);
+        r2 += localExtent[k] * localExtent[k];
+    }
+    localRadius = std::sqrt(r2);
+    allMarked = true;
+}
+
+/* Depth first graphs update each changed subtree as one range, skipping
+ * ranges nested in one already done; a full update splits into the top level
+ * subtrees. The ranges are disjoint and none contains an ancestor of
+ * another, so they run in parallel. Other orders fall back to a scan from
+ * the first changed node that carries the flags down to children */
+size_t scene_graph::update(void)
+{
+    TRACE_FUNC();
+    size_t count = parents.size();
+    size_t updated = 0;
+    ranges.clear();
+    if (allMarked && depthFirst) {
+        for (uint32_t node = 0; node != count; node = subtreeEnd[node]) {
+            ranges.push_back(std::make_pair(node, subtreeEnd[node]));
+        }
+    } else if (allMarked) {
+        update_range(0, count);
+        updated = count;
+    } else if (depthFirst) {
+        std::sort(marked.begin(), marked.end());
+        uint32_t done = 0;
+        for (uint32_t node : marked) {
+            if (node < done) {
+                continue;
+            }
+            done = subtreeEnd[node];
+            ranges.push_back(std::make_pair(node, done));
+        }
+    } else if (!marked.empty()) {
+        size_t first = *std::min_element(marked.begin(), marked.end());
+        for (size_t i = first; i != count; i++) {
+            uint32_t p = parents[i];
+            if (dirty[i] || (p != SCENE_NO_PARENT && dirty[p])) {
+                dirty[i] = 1;
+                update_range(i, i + 1);
+                updated++;
+            }
+        }
+        std::fill(dirty.begin() + first, dirty.end(), 0);
+    }
+    updated += update_ranges();
+    for (uint32_t node : marked) {
+        dirty[node] = 0;
+    }
+    marked.clear();
+    allMarked = false;
+    return updated;
+}
+
+/* Groups consecutive ranges into batches worth a job each */
+size_t scene_graph::update_ranges(void)
+{
+    size_t nodes = 0, batchNodes = 0;
+    batches.clear();
+    for (size_t r = 0; r != ranges.size(); r++) {
+        if (batchNodes == 0) {
+            batches.push_back(r);
+        }
+        size_t n = ranges[r].second - ranges[r].first;
+        nodes += n;
+        batchNodes += n;
+        if (batchNodes >= MIN_NODES_PER_JOB) {
+            batchNodes = 0;
+        }
+    }
+    batches.push_back(ranges.size());
+    job_system::shared().parallel_for(0, batches.size() - 1, 1,
+            [this](size_t begin, size_t end) {
+        for (size_t r = batches[begin]; r != batches[end]; r++) {
+            update_range(ranges[r].first, ranges[r].second);
+        }
+    });
+    return nodes;
+}
+
+/* Local matrix from the component arrays (rotation from the unit
+ * quaternion, scaled, plus translation), times the parent's world matrix,
+ * then the world bounds from the result while it is still in registers.
+ * The world box of the local box follows Arvo: transform the center, sum
+ * the absolute rotation terms for the half extent. Scale is uniform, so the
+ * length of any basis column scales the radius. Every array is read through
+ * a local pointer so the stores do not force reloads */
+void scene_graph::update_range(size_t begin, size_t end)
+{
+    const uint32_t *parent = parents.data();
+    const float *px = positionX.data(), *py = positionY.data(),
+          *pz = positionZ.data();
+    const float *qx = rotationX.data(), *qy = rotationY.data(),
+          *qz = rotationZ.data(), *qw = rotationW.data();
+    const float *scale = scales.data();
+    float *world = &worlds[0][0][0];
+    float *cx = worldBounds.centerX.data(), *cy = worldBounds.centerY.data(),
+          *cz = worldBounds.centerZ.data(), *radius = worldBounds.radius.data();
+    float *minX = worldBounds.minX.data(), *minY = worldBounds.minY.data(),
+          *minZ = worldBounds.minZ.data();
+    float *maxX = worldBounds.maxX.data(), *maxY = worldBounds.maxY.data(),
+          *maxZ = worldBounds.maxZ.data();
+    const float lc[3] = {localCenter[0], localCenter[1], localCenter[2]};
+    const float le[3] = {localExtent[0], localExtent[1], localExtent[2]};
+    const float lr = localRadius;
+
+    for (size_t i = begin; i != end; i++) {
+        float s = scale[i];
+        float xx = qx[i] * qx[i], yy = qy[i] * qy[i], zz = qz[i] * qz[i];
+        float xy = qx[i] * qy[i], xz = qx[i] * qz[i], yz = qy[i] * qz[i];
+        float wx = qw[i] * qx[i], wy = qw[i] * qy[i], wz = qw[i] * qz[i];
+        float l[16] = {
+            s * (1.f - 2.f * (yy + zz)), s * 2.f * (xy + wz), s * 2.f * (xz - wy), 0.f,
+            s * 2.f * (xy - wz), s * (1.f - 2.f * (xx + zz)), s * 2.f * (yz + wx), 0.f,
+            s * 2.f * (xz + wy), s * 2.f * (yz - wx), s * (1.f - 2.f * (xx + yy)), 0.f,
+            px[i], py[i], pz[i], 1.f};
+        /* Straight into the node's slot: multiply must not write over
+         * the matrix it reads */
+        float *m = world + 16 * i;
+        if (parent[i] != SCENE_NO_PARENT) {
+            multiply(world + 16 * (size_t)parent[i], l, m);
+        } else {
+            memcpy(m, l, sizeof(l));
+        }
+
+        float c[3], e[3];
+        for (int r = 0; r != 3; r++) {
+            c[r] = m[r] * lc[0] + m[4 + r] * lc[1] + m[8 + r] * lc[2] + m[12 + r];
+            e[r] = std::fabs(m[r]) * le[0] + std::fabs(m[4 + r]) * le[1]
+                + std::fabs(m[8 + r]) * le[2];
+        }
+        cx[i] = c[0];
+        cy[i] = c[1];
+        cz[i] = c[2];
+        radius[i] = lr * std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+        minX[i] = c[0] - e[0];
+        minY[i] = c[1] - e[1];
+        minZ[i] = c[2] - e[2];
+        maxX[i] = c[0] + e[0];
+        maxY[i] = c[1] + e[1];
+        maxZ[i] = c[2] + e[2];
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef SCENE_GRAPH
+#define SCENE_GRAPH
+
+#include "cull.h"
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/* Parent of top level nodes */
+const uint32_t SCENE_NO_PARENT = 0xffffffff;
+
+/* Transform hierarchy stored as structure of arrays. Nodes are only ever
+ * appended and a parent has to exist before its children, so the arrays are
+ * always in hierarchy order: a forward pass sees every parent's world matrix
+ * before any of its children need it. When children are added right after
+ * their parent (depth first), every subtree is also one contiguous range and
+ * an update only touches the ranges below changed nodes. Scale is uniform,
+ * which keeps normals and bounding spheres valid without an inverse
+ * transpose. */
+class scene_graph {
+    public:
+        uint32_t add_node(uint32_t parent, const glm::vec3 &position,
+                const glm::quat &rotation = glm::quat(1.f, 0.f, 0.f, 0.f),
+                float scale = 1.f);
+        void reserve(size_t nodes);
+
+        /* Setters only mark the node; world data changes on update */
+        void set_position(uint32_t node, const glm::vec3 &position);
+        void set_rotation(uint32_t node, const glm::quat &rotation);
+        void set_scale(uint32_t node, float scale);
+
+        /* Object space box of the geometry every node draws */
+        void set_local_bounds(const float boundsMin[3], const float boundsMax[3]);
+
+        /* Recompute world matrices and bounds of the marked nodes and their
+         * descendants. Returns how many nodes were recomputed */
+        size_t update(void);
+
+        size_t size(void) const { return parents.size(); }
+        uint32_t parent(uint32_t node) const { return parents[node]; }
+        const glm::mat4 &world(uint32_t node) const { return worlds[node]; }
+        const std::vector<glm::mat4> &world_matrices(void) const { return worlds; }
+        /* World space bounds, ready for cull_objects */
+        const cull_volumes_t &bounds(void) const { return worldBounds; }
+
+    private:
+        void mark(uint32_t node);
+        size_t update_ranges(void);
+        void update_range(size_t begin, size_t end);
+
+        std::vector<uint32_t> parents;
+        /* Local transform */
+        std::vector<float> positionX, positionY, positionZ;
+        std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+        std::vector<float> scales;
+        /* One past the last node of each subtree, valid while depthFirst */
+        std::vector<uint32_t> subtreeEnd;
+        bool depthFirst = true;
+        /* Nodes changed since the last update, unsorted. The flags keep
+         * each in the list once */
+        std::vector<uint32_t> marked;
+        std::vector<uint8_t> dirty;
+        bool allMarked = false;
+        /* Subtree ranges of the current update and where each batch of
+         * them starts, kept to reuse the allocations */
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        std::vector<size_t> batches;
+
+        std::vector<glm::mat4> worlds;
+        cull_volumes_t worldBounds;
+        float localCenter[3] = {0.f, 0.f, 0.f};
+        float localExtent[3] = {0.f, 0.f, 0.f};
+        float localRadius = 0.f;
+};
+
+#endif
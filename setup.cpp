@@ -21,6 +21,46 @@ using std::vector;
 using std::string;
 #include <string.h>
 
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    bool has_extension(const vector<VkExtensionProperties> &extensions,
+            const char *name)
+    {
+        for (auto &extension : extensions) {
+            if (strcmp(extension.extensionName, name) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* vkGetPhysicalDeviceFeatures2KHR, filling in the feature structs
+     * chained to pNext. False, leaving them as they are, when the instance
+     * does not provide it */
+    bool query_features2(VkInstance instance, VkPhysicalDevice device,
+            void *pNext)
+    {
+#ifdef VK_KHR_get_physical_device_properties2
+        auto get = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+                instance, "vkGetPhysicalDeviceFeatures2KHR");
+        if (get == nullptr) {
+            return false;
+        }
+        VkPhysicalDeviceFeatures2KHR supported = {};
+        supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        supported.pNext = pNext;
+        get(device, &supported);
+        return true;
+#else
+        (void)instance; (void)device; (void)pNext;
+        return false;
+#endif
+    }
+}
+
 /*************/
 /* FUNCTIONS */
 /*************/ 
@@ -28,6 +68,7 @@ using std::string;
 /* Create a Vulkan instance */
 void vk::create_instance(void)
 { 
+    TRACE_FUNC();
     /* Application Info */ 
     const VkApplicationInfo appInfo = {
         VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -52,12 +93,13 @@ void vk::create_instance(void)
         instanceExtensions.data()           //ppEnabledExtensionNames 
     }; 
 
-    VkResult result = vkCreateInstance(&createInfo, nullptr, &instance); 
+    VkResult result = vkCreateInstance(&createInfo, allocator, &instance); 
     print_result(result);
 } 
 
 void vk::load_devices(void) 
 {
+    TRACE_FUNC();
     vector<VkPhysicalDevice> physicalDevices; 
     uint32_t deviceCount;
     //Get number of devieces
@@ -77,6 +119,7 @@ void vk::load_devices(void)
 
 void vk::load_features(void)
 { 
+    TRACE_FUNC();
     for (uint32_t i = 0; i != devices.size(); i++) { 
         vkGetPhysicalDeviceFeatures(
                 devices[i].physicalDevice, &devices[i].features);
@@ -85,6 +128,7 @@ void vk::load_features(void)
 
 void vk::load_memory_properties(void) 
 { 
+    TRACE_FUNC();
     for (uint32_t i = 0; i != devices.size(); i++) { 
         vkGetPhysicalDeviceMemoryProperties(
                 devices[i].physicalDevice, &devices[i].memoryProperties); 
@@ -93,6 +137,7 @@ void vk::load_memory_properties(void)
 
 void vk::load_queue_family_properties(void) 
 { 
+    TRACE_FUNC();
     uint32_t queueFamilyCount; 
     for (auto &device : devices) { 
         //Read number of queues
@@ -114,11 +159,12 @@ void vk::load_queue_family_properties(void)
                     & VK_QUEUE_GRAPHICS_BIT) {
                 device.queueFamilyIndices.graphicsIndex = j;
             }
-            //Check if present supported
+            //Check if present supported, on the first view; the others
+            //are checked when their swapchains are created
             vkGetPhysicalDeviceSurfaceSupportKHR(
                     device.physicalDevice, 
                     j,
-                    surface,
+                    views[0].surface,
                     &presentSupport); 
             if (presentSupport) {
                 device.queueFamilyIndices.presentIndex = j;
@@ -131,6 +177,7 @@ void vk::load_queue_family_properties(void)
 /* Looks for and returns an index to a device with a graphics queue family */
 int32_t vk::find_suitable_device(void)
 { 
+    TRACE_FUNC();
     uint32_t extensions_found = 0; 
     for (uint32_t i = 0; i != devices.size(); i++) {
         // Check if a graphics queue is supported
@@ -163,6 +210,7 @@ int32_t vk::find_suitable_device(void)
 
 void vk::create_logical_device() 
 { 
+    TRACE_FUNC();
     int32_t deviceIndex = find_suitable_device(); 
     chosenDevice = devices[deviceIndex];
     vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
@@ -190,17 +238,94 @@ void vk::create_logical_device()
         deviceQueueCreateInfos.push_back(deviceQueueCreateInfo);
     } 
 
+    /* Optional extensions, enabled when the device has them */
+    vector<const char *> extensions(requiredDeviceExtensions);
+#ifdef VK_EXT_memory_budget
+    /* The instance enabled properties2 whenever it was available */
+    memoryBudgetExtension = has_extension(
+            devices[deviceIndex].deviceExtensionProperties,
+            VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)
+        && has_extension(instanceExtensionProperties,
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if (memoryBudgetExtension) {
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+#endif
+    /* Bindless materials need non-uniform indexing into a partially bound,
+     * variable sized array that can be updated while in use */
+    void *features = nullptr;
+#ifdef VK_EXT_descriptor_indexing
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = {};
+    indexing.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    descriptorIndexingExtension = config.bindless
+        && has_extension(devices[deviceIndex].deviceExtensionProperties,
+                VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)
+        && has_extension(devices[deviceIndex].deviceExtensionProperties,
+                VK_KHR_MAINTENANCE3_EXTENSION_NAME)
+        && has_extension(instanceExtensionProperties,
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if (descriptorIndexingExtension) {
+        /* Without the query the materials fall back to the texture array */
+        descriptorIndexingExtension = query_features2(instance,
+                devices[deviceIndex].physicalDevice, &indexing)
+            && indexing.shaderSampledImageArrayNonUniformIndexing
+            && indexing.descriptorBindingSampledImageUpdateAfterBind
+            && indexing.descriptorBindingPartiallyBound
+            && indexing.descriptorBindingVariableDescriptorCount
+            && indexing.runtimeDescriptorArray;
+    }
+    if (descriptorIndexingExtension) {
+        /* Only what we use */
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabled = {};
+        enabled.sType = indexing.sType;
+        enabled.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        enabled.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        enabled.descriptorBindingPartiallyBound = VK_TRUE;
+        enabled.descriptorBindingVariableDescriptorCount = VK_TRUE;
+        enabled.runtimeDescriptorArray = VK_TRUE;
+        indexing = enabled;
+        features = &indexing;
+        extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    }
+#endif
+    /* GPU progress as one counter per queue instead of a fence per
+     * submission, see gpu_timeline */
+#ifdef VK_KHR_timeline_semaphore
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline = {};
+    timeline.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineSemaphoreExtension = config.timelineSemaphores
+        && has_extension(devices[deviceIndex].deviceExtensionProperties,
+                VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)
+        && has_extension(instanceExtensionProperties,
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    if (timelineSemaphoreExtension) {
+        /* Without the query the timeline falls back to fences */
+        timelineSemaphoreExtension = query_features2(instance,
+                devices[deviceIndex].physicalDevice, &timeline)
+            && timeline.timelineSemaphore;
+    }
+    if (timelineSemaphoreExtension) {
+        //Ahead of the indexing features, if any
+        timeline.pNext = features;
+        features = &timeline;
+        extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+#endif
+
     /* Fill out create info structures */
     const VkDeviceCreateInfo createInfo = {
         VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        nullptr,                              //pNext
+        features,                             //pNext
         0,                                    //flags
         (uint32_t)deviceQueueCreateInfos.size(),//queueCreateInfoCount
         deviceQueueCreateInfos.data(),        //pQueueCreateInfos
         (uint32_t)layers.size(),              //enaledLayerCount
         layers.data(),                        //ppEnabledLayerNames,
-        (uint32_t)requiredDeviceExtensions.size(),  //enabledExtensionCount,
-        requiredDeviceExtensions.data(),      //ppEnabledExtensionNames
+        (uint32_t)extensions.size(),          //enabledExtensionCount,
+        extensions.data(),                    //ppEnabledExtensionNames
         &devices[deviceIndex].features        //pEnabledFeatures 
     }; 
 
@@ -209,7 +334,7 @@ void vk::create_logical_device()
     result = vkCreateDevice(
             devices[deviceIndex].physicalDevice, 
             &createInfo, 
-            nullptr, 
+            allocator, 
             &device);
 
     print_result(result); 
@@ -217,6 +342,7 @@ void vk::create_logical_device()
 
 void vk::load_layer_properties(void) 
 {
+    TRACE_FUNC();
     uint32_t propertyCount;
     //Get vector size
     vkEnumerateInstanceLayerProperties(&propertyCount, nullptr);
@@ -242,6 +368,7 @@ void vk::load_layer_properties(void)
 
 void vk::load_available_instance_extensions(void)
 { 
+    TRACE_FUNC();
     uint32_t propertyCount;
     //Get vector size
     vkEnumerateInstanceExtensionProperties(
@@ -260,6 +387,7 @@ void vk::load_available_instance_extensions(void)
 
 void vk::load_device_extensions(void)
 {
+    TRACE_FUNC();
     uint32_t propertyCount;
     for (auto &dev : devices) {
         //get vector size
@@ -283,13 +411,39 @@ void vk::load_device_extensions(void)
 
 void vk::load_required_instance_extensions(void)
 { 
-    uint32_t extensionCount = 0; 
-    const char** glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&extensionCount); 
-
-    for (uint32_t i = 0; i != extensionCount; i++) {
-        instanceExtensions.push_back(glfwExtensions[i]);
-    } 
+    TRACE_FUNC();
+    if (config.headless) {
+        /* Checked here: creating the instance with an extension the loader
+         * lacks only fails with VK_ERROR_EXTENSION_NOT_PRESENT */
+#ifdef VK_EXT_headless_surface
+        if (!has_extension(instanceExtensionProperties,
+                    VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME)) {
+            throw std::runtime_error("VK_EXT_headless_surface is not "
+                    "supported, --headless needs it");
+        }
+        instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        instanceExtensions.push_back(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+#else
+        throw std::runtime_error("built without VK_EXT_headless_surface");
+#endif
+    } else {
+        uint32_t extensionCount = 0;
+        const char** glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&extensionCount);
+
+        for (uint32_t i = 0; i != extensionCount; i++) {
+            instanceExtensions.push_back(glfwExtensions[i]);
+        }
+    }
+#ifdef VK_KHR_get_physical_device_properties2
+    /* Needed to query memory budgets, see init_memory_budget, and the
+     * features of optional device extensions, see create_logical_device */
+    if (has_extension(instanceExtensionProperties,
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+        instanceExtensions.push_back(
+                VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+#endif
     /* If in debug mode then add the debug extension as well */
 #ifndef NDEBUG
     instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
@@ -298,8 +452,31 @@ void vk::load_required_instance_extensions(void)
 
 void vk::create_surface(void)
 {
-    auto result = glfwCreateWindowSurface(
-            instance, window, nullptr, &surface);
-    print_result(result);
+    TRACE_FUNC();
+    if (!config.headless) {
+        for (auto &view : views) {
+            auto result = glfwCreateWindowSurface(
+                    instance, view.window, allocator, &view.surface);
+            print_result(result);
+        }
+        return;
+    }
+    /* Presents to nowhere, but behaves like a window surface otherwise:
+     * the swapchain and present path are the same ones that run on screen */
+#ifdef VK_EXT_headless_surface
+    auto create = (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(
+            instance, "vkCreateHeadlessSurfaceEXT");
+    if (create == nullptr) {
+        throw std::runtime_error("VK_EXT_headless_surface is not supported");
+    }
+    VkHeadlessSurfaceCreateInfoEXT ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+    for (auto &view : views) {
+        auto result = create(instance, &ci, allocator, &view.surface);
+        print_result(result);
+    }
+#else
+    throw std::runtime_error("built without VK_EXT_headless_surface");
+#endif
 }
 
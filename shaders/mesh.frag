@@ -0,0 +1,63 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+/* Shader options, one pipeline variant per combination. Set through
+ * specialization constants (shader_option_t), so every variant shares this
+ * SPIR-V and the compiler drops the branches that are off */
+layout(constant_id = 0) const bool UNLIT = false;
+layout(constant_id = 1) const bool SHOW_NORMALS = false;
+layout(constant_id = 2) const bool TOON = false;
+
+/* material_t */
+struct Material {
+    vec4 color;
+    uint texture;
+    float uvScale;
+    uint pad0;
+    uint pad1;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Materials {
+    Material materials[];
+};
+/* Built with -DBINDLESS when the device has descriptor indexing: one
+ * texture per slot, indexed by a value that differs between instances.
+ * Otherwise the textures are the layers of one array */
+#ifdef BINDLESS
+layout(set = 0, binding = 1) uniform sampler2D textures[];
+#else
+layout(set = 0, binding = 1) uniform sampler2DArray textures;
+#endif
+
+layout(location = 0) in vec3 fragNormal;
+layout(location = 1) in vec2 fragUv;
+layout(location = 2) flat in uint fragMaterial;
+
+layout(location = 0) out vec4 outColor;
+
+const vec3 lightDir = normalize(vec3(0.4, 0.6, 0.7));
+const float TOON_BANDS = 4.0;
+
+void main() {
+    vec3 normal = normalize(fragNormal);
+    if (SHOW_NORMALS) {
+        outColor = vec4(normal * 0.5 + 0.5, 1.0);
+        return;
+    }
+    Material material = materials[fragMaterial];
+    vec2 uv = fragUv * material.uvScale;
+#ifdef BINDLESS
+    vec4 albedo = texture(textures[nonuniformEXT(material.texture)], uv);
+#else
+    vec4 albedo = texture(textures, vec3(uv, float(material.texture)));
+#endif
+    albedo *= material.color;
+    float diffuse = UNLIT ? 1.0 : max(dot(normal, lightDir), 0.0);
+    if (TOON) {
+        diffuse = floor(diffuse * TOON_BANDS + 0.5) / TOON_BANDS;
+    }
+    outColor = vec4(albedo.rgb * (0.15 + 0.85 * diffuse), albedo.a);
+}
@@ -0,0 +1,33 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+} pc;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inUv;
+/* Per instance world matrix, uniform scale only. Its bottom row holds the
+ * material index in place of (0, 0, 0, 1) */
+layout(location = 3) in mat4 inWorld;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec2 fragUv;
+layout(location = 2) flat out uint fragMaterial;
+
+void main() {
+    mat4 world = inWorld;
+    world[0][3] = 0.0;
+    world[1][3] = 0.0;
+    world[2][3] = 0.0;
+    world[3][3] = 1.0;
+    gl_Position = pc.viewProjection * world * vec4(inPosition, 1.0);
+    fragNormal = mat3(world) * inNormal;
+    fragUv = inUv;
+    fragMaterial = uint(inWorld[0][3]);
+}
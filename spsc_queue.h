@@ -0,0 +1,65 @@
+#ifndef SPSC_QUEUE
+#define SPSC_QUEUE
+
+#include <atomic>
+#include <stdint.h>
+
+/* Bounded lock-free queue for exactly one producer and one consumer thread.
+ * Each side owns one index and keeps a cached copy of the other one, so the
+ * shared cache lines are only read when the cached view says the queue is
+ * full (producer) or empty (consumer). */
+template <typename T, uint32_t CAPACITY>
+class spsc_queue {
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+            "spsc_queue capacity must be a power of two");
+    public:
+        spsc_queue(void) : head(0), tailCache(0), tail(0), headCache(0) {}
+
+        /* Producer side. Returns false when the queue is full */
+        bool try_push(const T &item) {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t - headCache == CAPACITY) {
+                headCache = head.load(std::memory_order_acquire);
+                if (t - headCache == CAPACITY) {
+                    return false;
+                }
+            }
+            slots[t & (CAPACITY - 1)] = item;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /* Consumer side. Returns false when the queue is empty */
+        bool try_pop(T &item) {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            if (h == tailCache) {
+                tailCache = tail.load(std::memory_order_acquire);
+                if (h == tailCache) {
+                    return false;
+                }
+            }
+            item = slots[h & (CAPACITY - 1)];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        /* Either side; only a snapshot */
+        bool empty(void) const {
+            return head.load(std::memory_order_acquire) ==
+                tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        spsc_queue(const spsc_queue &);
+        spsc_queue &operator=(const spsc_queue &);
+
+        /* Consumer-owned line */
+        alignas(64) std::atomic<uint32_t> head;
+        uint32_t tailCache;
+        /* Producer-owned line */
+        alignas(64) std::atomic<uint32_t> tail;
+        uint32_t headCache;
+        alignas(64) T slots[CAPACITY];
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "sync_pool.h"
+#include "trace.h"
+
+#include <stdexcept>
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+void fence_pool::init(VkDevice device, const VkAllocationCallbacks *allocator)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->device = device;
+    this->allocator = allocator;
+}
+
+void fence_pool::destroy(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (VkFence fence : fences) {
+        vkDestroyFence(device, fence, allocator);
+    }
+    fences.clear();
+    ready.clear();
+    released.clear();
+}
+
+VkFence fence_pool::acquire(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ready.empty() && !released.empty()) {
+        /* One reset for everything released since the last one */
+        VkResult result = vkResetFences(device, (uint32_t)released.size(),
+                released.data());
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("could not reset pooled fences");
+        }
+        ready.insert(ready.end(), released.begin(), released.end());
+        released.clear();
+    }
+    if (!ready.empty()) {
+        VkFence fence = ready.back();
+        ready.pop_back();
+        return fence;
+    }
+    VkFenceCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence;
+    VkResult result = vkCreateFence(device, &ci, allocator, &fence);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("could not create fence");
+    }
+    fences.push_back(fence);
+    TRACE_INSTANT("pooled_fences", fences.size());
+    return fence;
+}
+
+void fence_pool::release(VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    released.push_back(fence);
+}
+
+void semaphore_pool::init(VkDevice device,
+        const VkAllocationCallbacks *allocator)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->device = device;
+    this->allocator = allocator;
+}
+
+void semaphore_pool::destroy(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (VkSemaphore semaphore : semaphores) {
+        vkDestroySemaphore(device, semaphore, allocator);
+    }
+    semaphores.clear();
+    ready.clear();
+}
+
+VkSemaphore semaphore_pool::acquire(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!ready.empty()) {
+        VkSemaphore semaphore = ready.back();
+        ready.pop_back();
+        return semaphore;
+    }
+    VkSemaphoreCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkSemaphore semaphore;
+    VkResult result = vkCreateSemaphore(device, &ci, allocator, &semaphore);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("could not create semaphore");
+    }
+    semaphores.push_back(semaphore);
+    TRACE_INSTANT("pooled_semaphores", semaphores.size());
+    return semaphore;
+}
+
+void semaphore_pool::release(VkSemaphore semaphore)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ready.push_back(semaphore);
+}
+
+void gpu_timeline::init(VkDevice device,
+        const VkAllocationCallbacks *allocator, bool useSemaphore,
+        fence_pool &fences)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->fences = &fences;
+    last = 0;
+    reachedValue = 0;
+    if (!useSemaphore) {
+        return;
+    }
+#ifdef VK_KHR_timeline_semaphore
+    getCounterValue =
+        vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+    waitSemaphores = vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+    if (getCounterValue == nullptr || waitSemaphores == nullptr) {
+        throw std::runtime_error("VK_KHR_timeline_semaphore is missing "
+                "its functions");
+    }
+    VkSemaphoreTypeCreateInfoKHR type = {};
+    type.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    type.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    type.initialValue = 0;
+    VkSemaphoreCreateInfo ci = {};
+    ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    ci.pNext = &type;
+    VkResult result = vkCreateSemaphore(device, &ci, allocator, &semaphore);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("could not create timeline semaphore");
+    }
+#endif
+}
+
+void gpu_timeline::destroy(void)
+{
+    for (const pending_fence_t &p : pending) {
+        fences->release(p.fence);
+    }
+    pending.clear();
+    if (semaphore != VK_NULL_HANDLE) {
+        vkDestroySemaphore(device, semaphore, allocator);
+        semaphore = VK_NULL_HANDLE;
+    }
+}
+
+uint64_t gpu_timeline::submit(VkQueue queue, const VkSubmitInfo &si,
+        const uint64_t *waitValues)
+{
+    uint64_t value = last + 1;
+    VkResult result;
+    if (semaphore == VK_NULL_HANDLE) {
+        VkFence fence = fences->acquire();
+        result = vkQueueSubmit(queue, 1, &si, fence);
+        if (result != VK_SUCCESS) {
+            fences->release(fence);
+        } else {
+            pending.push_back({value, fence});
+        }
+    } else {
+#ifdef VK_KHR_timeline_semaphore
+        /* The values of binary semaphores are ignored */
+        signalSemaphores.assign(si.pSignalSemaphores,
+                si.pSignalSemaphores + si.signalSemaphoreCount);
+        signalSemaphores.push_back(semaphore);
+        signalValues.assign(si.signalSemaphoreCount, 0);
+        signalValues.push_back(value);
+        VkTimelineSemaphoreSubmitInfoKHR ti = {};
+        ti.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        ti.pNext = si.pNext;
+        ti.waitSemaphoreValueCount = waitValues ? si.waitSemaphoreCount : 0;
+        ti.pWaitSemaphoreValues = waitValues;
+        ti.signalSemaphoreValueCount = (uint32_t)signalValues.size();
+        ti.pSignalSemaphoreValues = signalValues.data();
+        VkSubmitInfo timelineSubmit = si;
+        timelineSubmit.pNext = &ti;
+        timelineSubmit.signalSemaphoreCount =
+            (uint32_t)signalSemaphores.size();
+        timelineSubmit.pSignalSemaphores = signalSemaphores.data();
+        result = vkQueueSubmit(queue, 1, &timelineSubmit, VK_NULL_HANDLE);
+#else
+        result = VK_ERROR_FEATURE_NOT_PRESENT;
+#endif
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("queue submission failed");
+    }
+    last = value;
+    return value;
+}
+
+uint64_t gpu_timeline::completed(void)
+{
+    if (semaphore != VK_NULL_HANDLE) {
+#ifdef VK_KHR_timeline_semaphore
+        uint64_t value;
+        if (((PFN_vkGetSemaphoreCounterValueKHR)getCounterValue)(device,
+                    semaphore, &value) == VK_SUCCESS) {
+            reachedValue = value;
+        }
+#endif
+        return reachedValue;
+    }
+    size_t done = 0;
+    while (done != pending.size()
+            && vkGetFenceStatus(device, pending[done].fence) == VK_SUCCESS) {
+        reachedValue = pending[done].value;
+        fences->release(pending[done].fence);
+        done++;
+    }
+    pending.erase(pending.begin(), pending.begin() + done);
+    return reachedValue;
+}
+
+void gpu_timeline::wait(uint64_t value)
+{
+    if (value <= reachedValue || value > last) {
+        return;
+    }
+    TRACE_FUNC();
+    if (semaphore != VK_NULL_HANDLE) {
+#ifdef VK_KHR_timeline_semaphore
+        VkSemaphoreWaitInfoKHR wi = {};
+        wi.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        wi.semaphoreCount = 1;
+        wi.pSemaphores = &semaphore;
+        wi.pValues = &value;
+        if (((PFN_vkWaitSemaphoresKHR)waitSemaphores)(device, &wi,
+                    (uint64_t)-1) == VK_SUCCESS) {
+            reachedValue = value;
+        }
+#endif
+        return;
+    }
+    /* Every fence up to the value, so completed can recycle them all */
+    waitFences.clear();
+    for (const pending_fence_t &p : pending) {
+        if (p.value > value) {
+            break;
+        }
+        waitFences.push_back(p.fence);
+    }
+    if (!waitFences.empty()) {
+        vkWaitForFences(device, (uint32_t)waitFences.size(),
+                waitFences.data(), VK_TRUE, (uint64_t)-1);
+    }
+    completed();
+}
@@ -0,0 +1,118 @@
+#ifndef SYNC_POOL
+#define SYNC_POOL
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+/* Fences handed out and taken back instead of created and destroyed per
+ * submission. acquire returns an unsignaled fence; release takes back one
+ * whose submission is known to be complete. Released fences are reset
+ * together the next time the pool runs dry, so once it has grown to the
+ * number in use at once nothing is created, allocated or reset one by one.
+ * Thread safe */
+class fence_pool {
+    public:
+        void init(VkDevice device, const VkAllocationCallbacks *allocator);
+        /* Every fence, acquired or not. The device must be idle */
+        void destroy(void);
+
+        VkFence acquire(void);
+        void release(VkFence fence);
+        uint32_t created(void) const { return (uint32_t)fences.size(); }
+
+    private:
+        std::mutex mutex;
+        VkDevice device = VK_NULL_HANDLE;
+        const VkAllocationCallbacks *allocator = nullptr;
+        std::vector<VkFence> fences;
+        std::vector<VkFence> ready;     //unsignaled
+        std::vector<VkFence> released;  //signaled, reset on demand
+};
+
+/* Binary semaphores, the same way. A semaphore may be released once no
+ * signal or wait on it is pending any more, i.e. the submission that
+ * waited on it completed. Thread safe */
+class semaphore_pool {
+    public:
+        void init(VkDevice device, const VkAllocationCallbacks *allocator);
+        void destroy(void);
+
+        VkSemaphore acquire(void);
+        void release(VkSemaphore semaphore);
+        uint32_t created(void) const { return (uint32_t)semaphores.size(); }
+
+    private:
+        std::mutex mutex;
+        VkDevice device = VK_NULL_HANDLE;
+        const VkAllocationCallbacks *allocator = nullptr;
+        std::vector<VkSemaphore> semaphores;
+        std::vector<VkSemaphore> ready;
+};
+
+/* Progress of the work submitted to one queue as a single increasing
+ * value. submit returns the value the queue reaches once that submission
+ * completes; whoever holds it can check whether it was reached or wait
+ * for it, and a later submission can wait for it on the GPU.
+ *
+ * With VK_KHR_timeline_semaphore the value is the counter of a timeline
+ * semaphore every submission signals. Without it each submission gets a
+ * fence from the pool, returned once it is seen signaled; a fence signals
+ * only after all earlier submissions to the queue are done, so its value
+ * covers theirs. Used from one thread at a time */
+class gpu_timeline {
+    public:
+        /* useSemaphore: the extension is enabled along with its
+         * timelineSemaphore feature. Throws std::runtime_error when the
+         * semaphore cannot be created */
+        void init(VkDevice device, const VkAllocationCallbacks *allocator,
+                bool useSemaphore, fence_pool &fences);
+        /* The device must be idle */
+        void destroy(void);
+        bool uses_semaphore(void) const { return semaphore != VK_NULL_HANDLE; }
+
+        /* Submit si, which keeps its own semaphores, and signal the next
+         * value when it completes. waitValues, if given, holds a value per
+         * wait semaphore of si; only read for timeline semaphores, and
+         * only with the extension. Returns the value. Throws
+         * std::runtime_error when the queue rejects the submission */
+        uint64_t submit(VkQueue queue, const VkSubmitInfo &si,
+                const uint64_t *waitValues = nullptr);
+        uint64_t submitted(void) const { return last; }
+        /* Highest value reached, without blocking */
+        uint64_t completed(void);
+        bool reached(uint64_t value) { return value <= completed(); }
+        /* Block until value is reached. Values never submitted return
+         * right away */
+        void wait(uint64_t value);
+        /* What other submissions wait on for a value of this one; null
+         * without the extension, where they go through wait instead */
+        VkSemaphore handle(void) const { return semaphore; }
+
+    private:
+        typedef struct {
+            uint64_t value;
+            VkFence fence;
+        } pending_fence_t;
+
+        VkDevice device = VK_NULL_HANDLE;
+        const VkAllocationCallbacks *allocator = nullptr;
+        fence_pool *fences = nullptr;
+        uint64_t last = 0;
+        uint64_t reachedValue = 0;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        /* vkGetSemaphoreCounterValueKHR and vkWaitSemaphoresKHR, typed
+         * where the headers have them */
+        PFN_vkVoidFunction getCounterValue = nullptr;
+        PFN_vkVoidFunction waitSemaphores = nullptr;
+        /* Fallback: submissions not seen complete yet, oldest first */
+        std::vector<pending_fence_t> pending;
+        /* Per submission, kept to avoid allocating */
+        std::vector<VkSemaphore> signalSemaphores;
+        std::vector<uint64_t> signalValues;
+        std::vector<VkFence> waitFences;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/* World transforms of a small hierarchy under rotated, scaled parents,
+ * checked against products worked out by hand. Built once with the SSE
+ * path and once with -DSCENE_SCALAR, see make check.
+ *
+ * usage: tests/scene_test */
+
+#include "../scene.h"
+
+#include <cmath>
+#include <iostream>
+#include <stdlib.h>
+
+using std::cout; using std::endl;
+
+static int failures = 0;
+
+static void expect_translation(const scene_graph &scene, uint32_t node,
+        float x, float y, float z)
+{
+    const glm::mat4 &m = scene.world(node);
+    if (std::fabs(m[3][0] - x) > 1e-4f || std::fabs(m[3][1] - y) > 1e-4f
+            || std::fabs(m[3][2] - z) > 1e-4f) {
+        cout << "node " << node << ": translation (" << m[3][0] << ", "
+            << m[3][1] << ", " << m[3][2] << "), expected (" << x << ", "
+            << y << ", " << z << ")" << endl;
+        failures++;
+    }
+}
+
+/* Column c of the node's world matrix, the image of axis c */
+static void expect_axis(const scene_graph &scene, uint32_t node, int c,
+        float x, float y, float z)
+{
+    const glm::mat4 &m = scene.world(node);
+    if (std::fabs(m[c][0] - x) > 1e-4f || std::fabs(m[c][1] - y) > 1e-4f
+            || std::fabs(m[c][2] - z) > 1e-4f) {
+        cout << "node " << node << ": axis " << c << " (" << m[c][0]
+            << ", " << m[c][1] << ", " << m[c][2] << "), expected (" << x
+            << ", " << y << ", " << z << ")" << endl;
+        failures++;
+    }
+}
+
+int main(void)
+{
+    /* A quarter turn about y: x goes to -z, z to x */
+    const float h = std::sqrt(0.5f);
+    const glm::quat quarterY(h, 0.f, h, 0.f);
+
+    scene_graph scene;
+    float boundsMin[3] = {-1.f, -1.f, -1.f}, boundsMax[3] = {1.f, 1.f, 1.f};
+    scene.set_local_bounds(boundsMin, boundsMax);
+    uint32_t root = scene.add_node(SCENE_NO_PARENT, glm::vec3(1.f, 2.f, 3.f),
+            quarterY, 2.f);
+    uint32_t child = scene.add_node(root, glm::vec3(3.f, 0.f, 0.f),
+            quarterY, 1.f);
+    uint32_t grandchild = scene.add_node(child, glm::vec3(0.f, 0.f, 1.f));
+    scene.update();
+
+    expect_translation(scene, root, 1.f, 2.f, 3.f);
+    /* root + 2 * quarterY(3, 0, 0) */
+    expect_translation(scene, child, 1.f, 2.f, -3.f);
+    /* Half a turn and scale 2: x to -2x, z to -2z */
+    expect_axis(scene, child, 0, -2.f, 0.f, 0.f);
+    expect_axis(scene, child, 2, 0.f, 0.f, -2.f);
+    /* child + 2 * halfTurn(0, 0, 1) */
+    expect_translation(scene, grandchild, 1.f, 2.f, -5.f);
+
+    /* Again after only the root changed */
+    scene.set_position(root, glm::vec3(0.f));
+    scene.update();
+    expect_translation(scene, child, 0.f, 0.f, -6.f);
+    expect_translation(scene, grandchild, 0.f, 0.f, -8.f);
+
+    if (failures != 0) {
+        cout << failures << " checks failed" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "scene transforms ok" << endl;
+    return EXIT_SUCCESS;
+}
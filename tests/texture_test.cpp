@@ -0,0 +1,179 @@
+/* BC1-BC5 blocks decoded by transcode_texture, checked against palettes
+ * worked out by hand from the block endpoints, and KTX2 headers load_ktx2
+ * has to refuse. Built once with the SSE path and once with
+ * -DTEXTURE_SCALAR, see make check.
+ *
+ * usage: tests/texture_test */
+
+#include "../texture_file.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using std::cout; using std::endl;
+
+/* Color indices 0, 1, 2, 3 along every row */
+#define COLOR_RAMP 0xe4, 0xe4, 0xe4, 0xe4
+/* Channel indices 0 to 7, twice */
+#define CHANNEL_RAMP 0x88, 0xc6, 0xfa, 0x88, 0xc6, 0xfa
+
+/* One 4x4 texture of a single block. Texel i decodes to
+ * texels[i % period] */
+typedef struct {
+    const char *name;
+    VkFormat format;
+    uint32_t bytes;             //8 or 16 per block
+    uint8_t block[16];
+    uint32_t period;
+    uint8_t texels[8][4];
+} block_case_t;
+
+const block_case_t CASES[] = {
+    /* Red to blue, c0 > c1: four colors */
+    {"bc1 four colors", VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 8,
+        {0x00, 0xf8, 0x1f, 0x00, COLOR_RAMP}, 4,
+        {{255, 0, 0, 255}, {0, 0, 255, 255}, {170, 0, 85, 255},
+            {85, 0, 170, 255}}},
+    /* Endpoints that are not all ones or zeros, for the bit expansion and
+     * the rounding of the thirds */
+    {"bc1 rounding", VK_FORMAT_BC1_RGB_UNORM_BLOCK, 8,
+        {0x08, 0x84, 0x00, 0x00, COLOR_RAMP}, 4,
+        {{132, 130, 66, 255}, {0, 0, 0, 255}, {88, 87, 44, 255},
+            {44, 43, 22, 255}}},
+    /* Blue to red, c0 <= c1: three colors and transparent black */
+    {"bc1 three colors", VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 8,
+        {0x1f, 0x00, 0x00, 0xf8, COLOR_RAMP}, 4,
+        {{0, 0, 255, 255}, {255, 0, 0, 255}, {128, 0, 128, 255},
+            {0, 0, 0, 0}}},
+    /* The same without alpha: opaque black */
+    {"bc1 opaque", VK_FORMAT_BC1_RGB_SRGB_BLOCK, 8,
+        {0x1f, 0x00, 0x00, 0xf8, COLOR_RAMP}, 4,
+        {{0, 0, 255, 255}, {255, 0, 0, 255}, {128, 0, 128, 255},
+            {0, 0, 0, 255}}},
+    /* Explicit alpha 0, 5, 10, 15; colors always four, even for c0 <= c1 */
+    {"bc2", VK_FORMAT_BC2_UNORM_BLOCK, 16,
+        {0x50, 0xfa, 0x50, 0xfa, 0x50, 0xfa, 0x50, 0xfa,
+            0x1f, 0x00, 0x00, 0xf8, COLOR_RAMP}, 4,
+        {{0, 0, 255, 0}, {255, 0, 0, 85}, {85, 0, 170, 170},
+            {170, 0, 85, 255}}},
+    /* Alpha 200 down to 100 in sevenths */
+    {"bc3", VK_FORMAT_BC3_UNORM_BLOCK, 16,
+        {200, 100, CHANNEL_RAMP, 0x00, 0xf8, 0x1f, 0x00, COLOR_RAMP}, 8,
+        {{255, 0, 0, 200}, {0, 0, 255, 100}, {170, 0, 85, 186},
+            {85, 0, 170, 171}, {255, 0, 0, 157}, {0, 0, 255, 143},
+            {170, 0, 85, 129}, {85, 0, 170, 114}}},
+    /* 50 up to 250 in fifths, then 0 and 255 */
+    {"bc4", VK_FORMAT_BC4_UNORM_BLOCK, 8,
+        {50, 250, CHANNEL_RAMP}, 8,
+        {{50, 0, 0, 255}, {250, 0, 0, 255}, {90, 0, 0, 255},
+            {130, 0, 0, 255}, {170, 0, 0, 255}, {210, 0, 0, 255},
+            {0, 0, 0, 255}, {255, 0, 0, 255}}},
+    {"bc5", VK_FORMAT_BC5_UNORM_BLOCK, 16,
+        {200, 100, CHANNEL_RAMP, 50, 250, CHANNEL_RAMP}, 8,
+        {{200, 50, 0, 255}, {100, 250, 0, 255}, {186, 90, 0, 255},
+            {171, 130, 0, 255}, {157, 170, 0, 255}, {143, 210, 0, 255},
+            {129, 0, 0, 255}, {114, 255, 0, 255}}}
+};
+
+static int failures = 0;
+
+static void check_case(const block_case_t &c)
+{
+    texture_file_t src, dst;
+    src.format = c.format;
+    src.width = src.height = 4;
+    src.data.assign(c.block, c.block + c.bytes);
+    src.levels.push_back({0, c.bytes});
+    transcode_texture(src, dst);
+    if (dst.data.size() != 16 * 4) {
+        cout << c.name << ": " << dst.data.size() << " bytes decoded"
+            << endl;
+        failures++;
+        return;
+    }
+    for (uint32_t i = 0; i != 16; i++) {
+        const uint8_t *texel = dst.data.data() + 4 * i;
+        const uint8_t *expected = c.texels[i % c.period];
+        if (memcmp(texel, expected, 4) != 0) {
+            cout << c.name << ": texel " << i << " ("
+                << (int)texel[0] << ", " << (int)texel[1] << ", "
+                << (int)texel[2] << ", " << (int)texel[3] << "), expected ("
+                << (int)expected[0] << ", " << (int)expected[1] << ", "
+                << (int)expected[2] << ", " << (int)expected[3] << ")"
+                << endl;
+            failures++;
+        }
+    }
+}
+
+/* A BC1 KTX2 file, width by 4 texels, with levelCount levels of one
+ * 8-byte block each, written to a temporary file; whether it loads */
+static bool ktx2_loads(uint32_t width, uint32_t levelCount)
+{
+    const uint8_t identifier[12] = {
+        0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+    uint32_t header[17] = {};
+    header[0] = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    header[1] = 1;              //typeSize
+    header[2] = width;
+    header[3] = 4;              //pixelHeight
+    header[6] = 1;              //faceCount
+    header[7] = levelCount;
+    std::string bytes((const char *)identifier, sizeof(identifier));
+    bytes.append((const char *)header, sizeof(header));
+    uint64_t dataStart = bytes.size() + 24 * (uint64_t)levelCount;
+    for (uint32_t l = 0; l != levelCount; l++) {
+        uint64_t level[3] = {dataStart + 8 * l, 8, 8};
+        bytes.append((const char *)level, sizeof(level));
+    }
+    bytes.append(8 * levelCount, '\0');
+
+    char path[] = "/tmp/texture_test_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        cout << "could not create a temporary file" << endl;
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    std::ofstream(path, std::ios::binary) << bytes;
+    bool loaded = true;
+    try {
+        texture_file_t texture;
+        load_ktx2(path, texture);
+    } catch (const std::runtime_error &) {
+        loaded = false;
+    }
+    unlink(path);
+    return loaded;
+}
+
+static void expect_load(const char *name, bool loaded, bool expected)
+{
+    if (loaded != expected) {
+        cout << name << ": " << (loaded ? "loaded" : "refused")
+            << ", expected otherwise" << endl;
+        failures++;
+    }
+}
+
+int main(void)
+{
+    for (const block_case_t &c : CASES) {
+        check_case(c);
+    }
+    /* 4x4 has three levels: 4x4, 2x2 and 1x1 */
+    expect_load("full chain", ktx2_loads(4, 3), true);
+    expect_load("level past 1x1", ktx2_loads(4, 4), false);
+    expect_load("40 levels", ktx2_loads(4, 40), false);
+    expect_load("zero width", ktx2_loads(0, 1), false);
+    if (failures != 0) {
+        cout << failures << " checks failed" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "texture blocks ok" << endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,447 @@
+#include "texture_file.h"
+#include "job_system.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string.h>
+
+/* -DTEXTURE_SCALAR builds the portable path on x86 too */
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(TEXTURE_SCALAR)
+#define TEXTURE_SSE
+#include <emmintrin.h>
+#endif
+
+using std::string;
+using std::vector;
+
+/* Block rows decoded per job; a row of a 4096 texel wide BC1 level is
+ * 1024 blocks */
+const size_t BLOCK_ROWS_PER_JOB = 16;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    const uint8_t KTX2_IDENTIFIER[12] = {
+        0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+
+    /* File header and index, little endian */
+    typedef struct {
+        uint8_t identifier[12];
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        uint64_t sgdByteOffset;
+        uint64_t sgdByteLength;
+    } ktx2_header_t;
+
+    typedef struct {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    } ktx2_level_t;
+
+    static_assert(sizeof(ktx2_header_t) == 80, "KTX2 header layout");
+
+    /* Texel block of a format: size in texels and bytes. 0 bytes for
+     * formats we do not take */
+    typedef struct {
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytes;
+    } block_t;
+
+    block_t format_block(VkFormat format)
+    {
+        /* ASTC formats come in UNORM, SRGB pairs */
+        static const uint8_t astc[][2] = {{4, 4}, {5, 4}, {5, 5}, {6, 5},
+            {6, 6}, {8, 5}, {8, 6}, {8, 8}, {10, 5}, {10, 6}, {10, 8},
+            {10, 10}, {12, 10}, {12, 12}};
+        switch (format) {
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+                return {1, 1, 4};
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            case VK_FORMAT_BC4_UNORM_BLOCK:
+            case VK_FORMAT_BC4_SNORM_BLOCK:
+                return {4, 4, 8};
+            case VK_FORMAT_BC2_UNORM_BLOCK:
+            case VK_FORMAT_BC2_SRGB_BLOCK:
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+            case VK_FORMAT_BC5_SNORM_BLOCK:
+            case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+            case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+            case VK_FORMAT_BC7_UNORM_BLOCK:
+            case VK_FORMAT_BC7_SRGB_BLOCK:
+                return {4, 4, 16};
+            default:
+                break;
+        }
+        if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK
+                && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+            const uint8_t *size =
+                astc[(format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2];
+            return {size[0], size[1], 16};
+        }
+        return {0, 0, 0};
+    }
+
+    uint64_t level_size(const block_t &block, uint32_t width, uint32_t height)
+    {
+        return (uint64_t)((width + block.width - 1) / block.width)
+            * ((height + block.height - 1) / block.height) * block.bytes;
+    }
+
+    /* Expand 5 or 6 bits to 8 by repeating the top bits */
+    inline uint8_t expand5(uint32_t v) { return (uint8_t)(v << 3 | v >> 2); }
+    inline uint8_t expand6(uint32_t v) { return (uint8_t)(v << 2 | v >> 4); }
+
+#ifndef TEXTURE_SSE
+    /* The four RGBA colors a BC1 block picks from: both endpoints, then two
+     * interpolated between them, or with threeColor their midpoint and
+     * transparent black */
+    void bc1_palette(uint16_t c0, uint16_t c1, bool threeColor,
+            uint8_t palette[4][4])
+    {
+        uint8_t e[2][3] = {
+            {expand5(c0 >> 11), expand6((c0 >> 5) & 63), expand5(c0 & 31)},
+            {expand5(c1 >> 11), expand6((c1 >> 5) & 63), expand5(c1 & 31)}};
+        for (int c = 0; c != 3; c++) {
+            palette[0][c] = e[0][c];
+            palette[1][c] = e[1][c];
+            if (threeColor) {
+                palette[2][c] = (uint8_t)((e[0][c] + e[1][c] + 1) >> 1);
+                palette[3][c] = 0;
+            } else {
+                palette[2][c] = (uint8_t)((2 * e[0][c] + e[1][c] + 1) / 3);
+                palette[3][c] = (uint8_t)((e[0][c] + 2 * e[1][c] + 1) / 3);
+            }
+        }
+        palette[0][3] = palette[1][3] = palette[2][3] = 255;
+        palette[3][3] = threeColor ? 0 : 255;
+    }
+
+    /* The 16 texels of a color block, each picking a palette entry by its
+     * 2-bit index */
+    void color_texels(const uint8_t palette[4][4], uint32_t indices,
+            uint8_t rgba[16][4])
+    {
+        for (int i = 0; i != 16; i++) {
+            memcpy(rgba[i], palette[(indices >> (2 * i)) & 3], 4);
+        }
+    }
+#else
+    /* Same as the scalar bc1_palette, both interpolated colors at once in
+     * 16-bit lanes. x / 3 is (x * 21846) >> 16 for the x <= 766 we get */
+    void bc1_palette(uint16_t c0, uint16_t c1, bool threeColor,
+            uint8_t palette[4][4])
+    {
+        __m128i e = _mm_setr_epi16(
+                expand5(c0 >> 11), expand6((c0 >> 5) & 63), expand5(c0 & 31),
+                255,
+                expand5(c1 >> 11), expand6((c1 >> 5) & 63), expand5(c1 & 31),
+                255);
+        __m128i swapped = _mm_shuffle_epi32(e, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128i one = _mm_set1_epi16(1);
+        __m128i mid;
+        if (threeColor) {
+            mid = _mm_srli_epi16(
+                    _mm_add_epi16(_mm_add_epi16(e, swapped), one), 1);
+        } else {
+            __m128i sum = _mm_add_epi16(_mm_add_epi16(e, e), swapped);
+            mid = _mm_mulhi_epu16(_mm_add_epi16(sum, one),
+                    _mm_set1_epi16(21846));
+        }
+        _mm_storeu_si128((__m128i *)palette, _mm_packus_epi16(e, mid));
+        if (threeColor) {
+            memset(palette[3], 0, 4);
+        }
+    }
+
+    /* Same as the scalar color_texels, a row of four texels at a time:
+     * every lane compares its index against all four entries and keeps
+     * the one that matches */
+    void color_texels(const uint8_t palette[4][4], uint32_t indices,
+            uint8_t rgba[16][4])
+    {
+        __m128i p = _mm_loadu_si128((const __m128i *)palette);
+        __m128i entry[4] = {
+            _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 0, 0, 0)),
+            _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 1, 1, 1)),
+            _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 2, 2)),
+            _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3))};
+        __m128i mask = _mm_set1_epi32(3);
+        for (int row = 0; row != 4; row++) {
+            int r = (int)(indices >> (8 * row));
+            __m128i index = _mm_and_si128(
+                    _mm_setr_epi32(r, r >> 2, r >> 4, r >> 6), mask);
+            __m128i texels = _mm_setzero_si128();
+            for (int e = 0; e != 4; e++) {
+                __m128i match = _mm_cmpeq_epi32(index, _mm_set1_epi32(e));
+                texels = _mm_or_si128(texels,
+                        _mm_and_si128(match, entry[e]));
+            }
+            _mm_storeu_si128((__m128i *)rgba[4 * row], texels);
+        }
+    }
+#endif
+
+    /* Color block of BC1-BC3 into rgba. BC2 and BC3 always use four
+     * colors; opaque BC1 has black instead of transparent black */
+    void decode_color_block(const uint8_t *block, bool bc1, bool opaque,
+            uint8_t rgba[16][4])
+    {
+        uint16_t c0 = (uint16_t)(block[0] | block[1] << 8);
+        uint16_t c1 = (uint16_t)(block[2] | block[3] << 8);
+        bool threeColor = bc1 && c0 <= c1;
+        uint8_t palette[4][4];
+        bc1_palette(c0, c1, threeColor, palette);
+        if (opaque) {
+            palette[3][3] = 255;
+        }
+        uint32_t indices;
+        memcpy(&indices, block + 4, sizeof(indices));
+        color_texels(palette, indices, rgba);
+    }
+
+    /* BC4 block, also the alpha of BC3 and either channel of BC5, into
+     * channel c of rgba */
+    void decode_channel_block(const uint8_t *block, int c,
+            uint8_t rgba[16][4])
+    {
+        uint32_t a0 = block[0], a1 = block[1];
+        uint8_t palette[8] = {(uint8_t)a0, (uint8_t)a1, 0, 0, 0, 0, 0, 255};
+        if (a0 > a1) {
+            for (uint32_t i = 1; i != 7; i++) {
+                palette[i + 1] = (uint8_t)(((7 - i) * a0 + i * a1 + 3) / 7);
+            }
+        } else {
+            for (uint32_t i = 1; i != 5; i++) {
+                palette[i + 1] = (uint8_t)(((5 - i) * a0 + i * a1 + 2) / 5);
+            }
+        }
+        uint64_t indices = 0;
+        for (int i = 0; i != 6; i++) {
+            indices |= (uint64_t)block[2 + i] << (8 * i);
+        }
+        for (int i = 0; i != 16; i++) {
+            rgba[i][c] = palette[(indices >> (3 * i)) & 7];
+        }
+    }
+
+    void decode_block(VkFormat format, const uint8_t *block,
+            uint8_t rgba[16][4])
+    {
+        switch (format) {
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                decode_color_block(block, true, true, rgba);
+                break;
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                decode_color_block(block, true, false, rgba);
+                break;
+            case VK_FORMAT_BC2_UNORM_BLOCK:
+            case VK_FORMAT_BC2_SRGB_BLOCK:
+                decode_color_block(block + 8, false, true, rgba);
+                /* Explicit 4-bit alpha */
+                for (int i = 0; i != 16; i++) {
+                    rgba[i][3] = (uint8_t)(((block[i / 2] >> (4 * (i & 1)))
+                                & 15) * 17);
+                }
+                break;
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+                decode_color_block(block + 8, false, true, rgba);
+                decode_channel_block(block, 3, rgba);
+                break;
+            /* As sampled from the native format: missing channels are 0,
+             * alpha is 1 */
+            case VK_FORMAT_BC4_UNORM_BLOCK:
+                memset(rgba, 0, 16 * 4);
+                decode_channel_block(block, 0, rgba);
+                for (int i = 0; i != 16; i++) {
+                    rgba[i][3] = 255;
+                }
+                break;
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+                memset(rgba, 0, 16 * 4);
+                decode_channel_block(block, 0, rgba);
+                decode_channel_block(block + 8, 1, rgba);
+                for (int i = 0; i != 16; i++) {
+                    rgba[i][3] = 255;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+void load_ktx2(const string &path, texture_file_t &texture)
+{
+    TRACE_FUNC();
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open texture " + path);
+    }
+    vector<uint8_t> bytes((size_t)file.tellg());
+    file.seekg(0);
+    file.read((char *)bytes.data(), bytes.size());
+    if (!file || bytes.size() < sizeof(ktx2_header_t)) {
+        throw std::runtime_error("texture file too small: " + path);
+    }
+
+    ktx2_header_t header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (memcmp(header.identifier, KTX2_IDENTIFIER,
+                sizeof(KTX2_IDENTIFIER)) != 0) {
+        throw std::runtime_error("not a KTX2 file: " + path);
+    }
+    if (header.pixelDepth > 1 || header.layerCount > 1
+            || header.faceCount != 1 || header.pixelWidth == 0
+            || header.pixelHeight == 0) {
+        throw std::runtime_error("only 2D textures are supported: " + path);
+    }
+    if (header.supercompressionScheme != 0) {
+        throw std::runtime_error("supercompressed textures are not "
+                "supported: " + path);
+    }
+    VkFormat format = (VkFormat)header.vkFormat;
+    block_t block = format_block(format);
+    if (block.bytes == 0) {
+        throw std::runtime_error("unsupported texture format "
+                + std::to_string(header.vkFormat) + ": " + path);
+    }
+
+    /* 0 levels asks the loader to generate them; we just take level 0.
+     * More than a full chain would shift the size by 32 bits or more */
+    uint32_t levelCount = std::max(header.levelCount, 1u);
+    uint32_t fullChain = 1;
+    for (uint32_t size = std::max(header.pixelWidth, header.pixelHeight);
+            size > 1; size >>= 1) {
+        fullChain++;
+    }
+    if (levelCount > fullChain) {
+        throw std::runtime_error("more mip levels than the texture size "
+                "allows: " + path);
+    }
+    if (sizeof(header) + levelCount * sizeof(ktx2_level_t) > bytes.size()) {
+        throw std::runtime_error("truncated texture file: " + path);
+    }
+    texture.format = format;
+    texture.width = header.pixelWidth;
+    texture.height = header.pixelHeight;
+    texture.levels.resize(levelCount);
+    texture.data.swap(bytes);
+    for (uint32_t l = 0; l != levelCount; l++) {
+        ktx2_level_t level;
+        memcpy(&level, texture.data.data() + sizeof(header)
+                + l * sizeof(level), sizeof(level));
+        uint64_t expected = level_size(block,
+                std::max(texture.width >> l, 1u),
+                std::max(texture.height >> l, 1u));
+        if (level.byteLength != expected
+                || level.byteOffset > texture.data.size()
+                || level.byteLength > texture.data.size() - level.byteOffset) {
+            throw std::runtime_error("malformed texture level "
+                    + std::to_string(l) + ": " + path);
+        }
+        texture.levels[l] = {level.byteOffset, level.byteLength};
+    }
+}
+
+bool is_block_compressed(VkFormat format)
+{
+    return format_block(format).width > 1;
+}
+
+bool can_transcode(VkFormat format)
+{
+    return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK
+        && format <= VK_FORMAT_BC5_UNORM_BLOCK
+        && format != VK_FORMAT_BC4_SNORM_BLOCK;
+}
+
+VkFormat transcode_format(VkFormat format)
+{
+    switch (format) {
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC2_SRGB_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+            return VK_FORMAT_R8G8B8A8_SRGB;
+        default:
+            return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+void transcode_texture(const texture_file_t &src, texture_file_t &dst)
+{
+    TRACE_FUNC();
+    if (!can_transcode(src.format)) {
+        throw std::runtime_error("cannot transcode texture format "
+                + std::to_string(src.format));
+    }
+    dst.format = transcode_format(src.format);
+    dst.width = src.width;
+    dst.height = src.height;
+    dst.levels.resize(src.levels.size());
+    uint64_t offset = 0;
+    for (size_t l = 0; l != src.levels.size(); l++) {
+        uint64_t size = (uint64_t)std::max(src.width >> l, 1u)
+            * std::max(src.height >> l, 1u) * 4;
+        dst.levels[l] = {offset, size};
+        offset += size;
+    }
+    dst.data.resize(offset);
+
+    const uint32_t blockBytes = format_block(src.format).bytes;
+    for (size_t l = 0; l != src.levels.size(); l++) {
+        uint32_t width = std::max(src.width >> l, 1u);
+        uint32_t height = std::max(src.height >> l, 1u);
+        uint32_t blocksX = (width + 3) / 4;
+        uint32_t blocksY = (height + 3) / 4;
+        const uint8_t *in = src.data.data() + src.levels[l].offset;
+        uint8_t *out = dst.data.data() + dst.levels[l].offset;
+        job_system::shared().parallel_for(0, blocksY, BLOCK_ROWS_PER_JOB,
+                [&](size_t begin, size_t end) {
+            uint8_t rgba[16][4];
+            for (size_t by = begin; by != end; by++) {
+                for (uint32_t bx = 0; bx != blocksX; bx++) {
+                    decode_block(src.format,
+                            in + (by * blocksX + bx) * blockBytes, rgba);
+                    /* Edge blocks hang over the level */
+                    uint32_t w = std::min(4u, width - bx * 4);
+                    uint32_t h = std::min(4u, height - (uint32_t)by * 4);
+                    for (uint32_t y = 0; y != h; y++) {
+                        memcpy(out + ((by * 4 + y) * width + bx * 4) * 4,
+                                rgba[y * 4], w * 4);
+                    }
+                }
+            }
+        });
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef TEXTURE_FILE
+#define TEXTURE_FILE
+
+#include <vulkan/vulkan.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* One mip level, a byte range of texture_file_t::data */
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} texture_level_t;
+
+/* A 2D texture with its mip chain, largest level first, in a format the
+ * renderer can upload as is: BC1-BC7, ASTC or R8G8B8A8 */
+typedef struct {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<texture_level_t> levels;
+    std::vector<uint8_t> data;
+} texture_file_t;
+
+/* Read a KTX2 file. Throws std::runtime_error on I/O errors, a malformed
+ * file, array, cube or 3D textures, supercompression (Basis, zstd) and
+ * formats other than the ones above */
+void load_ktx2(const std::string &path, texture_file_t &texture);
+
+bool is_block_compressed(VkFormat format);
+/* Whether transcode_texture can decode it: BC1-BC5. BC6H, BC7 and ASTC
+ * need a device that samples them */
+bool can_transcode(VkFormat format);
+/* What transcode_texture produces: R8G8B8A8, sRGB when the source is */
+VkFormat transcode_format(VkFormat format);
+/* Decode every level of src into dst, splitting the block rows across the
+ * shared job system */
+void transcode_texture(const texture_file_t &src, texture_file_t &dst);
+
+#endif
@@ -0,0 +1,437 @@
+#include "mesh_simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <string.h>
+#include <unordered_map>
+
+using std::vector;
+
+/* Weight of the planes that pin open and material borders in place,
+ * relative to the face planes */
+const double BORDER_WEIGHT = 10.0;
+/* A collapse may not turn any remaining triangle further than this (cosine
+ * between its old and new normal) */
+const double MIN_NORMAL_DOT = 0.2;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* Symmetric 4x4 matrix summing squared distances to a set of planes:
+     * a2 ab ac ad b2 bc bd c2 cd d2 */
+    typedef struct {
+        double q[10];
+    } quadric_t;
+
+    typedef struct {
+        double x, y, z;
+    } vec3_t;
+
+    vec3_t sub(const vec3_t &a, const vec3_t &b)
+    {
+        vec3_t r = {a.x - b.x, a.y - b.y, a.z - b.z};
+        return r;
+    }
+
+    vec3_t cross(const vec3_t &a, const vec3_t &b)
+    {
+        vec3_t r = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x};
+        return r;
+    }
+
+    double dot(const vec3_t &a, const vec3_t &b)
+    {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    double length(const vec3_t &a)
+    {
+        return std::sqrt(dot(a, a));
+    }
+
+    void add_plane(quadric_t &Q, const vec3_t &n, double d, double w)
+    {
+        double *q = Q.q;
+        q[0] += w * n.x * n.x; q[1] += w * n.x * n.y; q[2] += w * n.x * n.z;
+        q[3] += w * n.x * d;   q[4] += w * n.y * n.y; q[5] += w * n.y * n.z;
+        q[6] += w * n.y * d;   q[7] += w * n.z * n.z; q[8] += w * n.z * d;
+        q[9] += w * d * d;
+    }
+
+    void add_quadric(quadric_t &a, const quadric_t &b)
+    {
+        for (int i = 0; i != 10; i++) {
+            a.q[i] += b.q[i];
+        }
+    }
+
+    double evaluate(const quadric_t &Q, const vec3_t &p)
+    {
+        const double *q = Q.q;
+        double e = q[0] * p.x * p.x + 2 * q[1] * p.x * p.y
+            + 2 * q[2] * p.x * p.z + 2 * q[3] * p.x
+            + q[4] * p.y * p.y + 2 * q[5] * p.y * p.z + 2 * q[6] * p.y
+            + q[7] * p.z * p.z + 2 * q[8] * p.z + q[9];
+        return std::max(e, 0.0);
+    }
+
+    typedef struct {
+        uint32_t v[3];          //vertex indices
+        uint32_t material;
+        bool removed;
+    } triangle_t;
+
+    /* Candidate collapse of position `from` onto position `to`. Entries go
+     * stale when either end changes; the stamps detect that */
+    typedef struct {
+        double cost;
+        uint32_t from, to;
+        uint32_t fromStamp, toStamp;
+    } collapse_t;
+
+    struct collapse_greater {
+        bool operator()(const collapse_t &a, const collapse_t &b) const {
+            return a.cost > b.cost;
+        }
+    };
+
+    struct position_hash {
+        size_t operator()(const vec3_t &p) const {
+            size_t h = 0;
+            const double c[3] = {p.x, p.y, p.z};
+            for (double v : c) {
+                uint64_t bits;
+                memcpy(&bits, &v, sizeof(bits));
+                h = h * 1000003u ^ (size_t)(bits ^ (bits >> 32));
+            }
+            return h;
+        }
+    };
+
+    struct position_equal {
+        bool operator()(const vec3_t &a, const vec3_t &b) const {
+            return a.x == b.x && a.y == b.y && a.z == b.z;
+        }
+    };
+
+    class simplifier {
+        public:
+            simplifier(const vector<mesh_vertex_t> &vertices,
+                    const vector<vector<uint32_t>> &materialIndices);
+            float run(size_t targetTriangles);
+            void output(size_t materials, vector<vector<uint32_t>> &result) const;
+
+        private:
+            void build_quadrics(void);
+            void push_edge(uint32_t a, uint32_t b);
+            bool collapse_is_valid(uint32_t from, uint32_t to) const;
+            void collapse(uint32_t from, uint32_t to);
+            uint32_t closest_vertex(uint32_t vertex, uint32_t position) const;
+            bool uses(const triangle_t &t, uint32_t position) const;
+
+            const vector<mesh_vertex_t> &vertices;
+            /* Welded positions; vertices on a seam share one */
+            vector<vec3_t> points;
+            vector<uint32_t> positionOf;
+            vector<vector<uint32_t>> positionVertices;
+            /* Triangles touching each position. Collapses append without
+             * pruning, so readers skip entries that no longer match */
+            vector<vector<uint32_t>> positionTriangles;
+            vector<quadric_t> quadrics;
+            vector<uint32_t> stamps;
+            vector<bool> alive;
+            vector<triangle_t> triangles;
+            size_t liveTriangles = 0;
+            std::priority_queue<collapse_t, vector<collapse_t>,
+                collapse_greater> heap;
+    };
+
+    simplifier::simplifier(const vector<mesh_vertex_t> &vertices,
+            const vector<vector<uint32_t>> &materialIndices)
+        : vertices(vertices)
+    {
+        std::unordered_map<vec3_t, uint32_t, position_hash, position_equal> weld;
+        positionOf.resize(vertices.size());
+        for (size_t i = 0; i != vertices.size(); i++) {
+            const float *p = vertices[i].position;
+            vec3_t point = {p[0], p[1], p[2]};
+            auto it = weld.find(point);
+            if (it == weld.end()) {
+                it = weld.insert(std::make_pair(point,
+                            (uint32_t)points.size())).first;
+                points.push_back(point);
+                positionVertices.emplace_back();
+            }
+            positionOf[i] = it->second;
+            positionVertices[it->second].push_back((uint32_t)i);
+        }
+        positionTriangles.resize(points.size());
+        stamps.assign(points.size(), 0);
+        alive.assign(points.size(), true);
+
+        for (size_t m = 0; m != materialIndices.size(); m++) {
+            auto &indices = materialIndices[m];
+            for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+                triangle_t t = {{indices[i], indices[i + 1], indices[i + 2]},
+                    (uint32_t)m, false};
+                uint32_t p0 = positionOf[t.v[0]], p1 = positionOf[t.v[1]],
+                         p2 = positionOf[t.v[2]];
+                if (p0 == p1 || p1 == p2 || p2 == p0) {
+                    continue;
+                }
+                uint32_t id = (uint32_t)triangles.size();
+                triangles.push_back(t);
+                positionTriangles[p0].push_back(id);
+                positionTriangles[p1].push_back(id);
+                positionTriangles[p2].push_back(id);
+            }
+        }
+        liveTriangles = triangles.size();
+        build_quadrics();
+    }
+
+    /* Face planes at every corner, plus a perpendicular plane along every
+     * edge that has a single triangle or separates two materials */
+    void simplifier::build_quadrics(void)
+    {
+        quadrics.assign(points.size(), quadric_t());
+        typedef std::pair<uint32_t, uint32_t> edge_t;
+        struct edge_hash {
+            size_t operator()(const edge_t &e) const {
+                return (size_t)e.first * 2654435761u ^ e.second;
+            }
+        };
+        typedef struct {
+            uint32_t count;
+            uint32_t triangle;
+            bool materialBorder;
+        } edge_use_t;
+        std::unordered_map<edge_t, edge_use_t, edge_hash> edges;
+
+        for (uint32_t id = 0; id != triangles.size(); id++) {
+            const triangle_t &t = triangles[id];
+            uint32_t p[3];
+            for (int k = 0; k != 3; k++) {
+                p[k] = positionOf[t.v[k]];
+            }
+            vec3_t n = cross(sub(points[p[1]], points[p[0]]),
+                    sub(points[p[2]], points[p[0]]));
+            double len = length(n);
+            if (len > 0.0) {
+                n.x /= len; n.y /= len; n.z /= len;
+                double d = -dot(n, points[p[0]]);
+                for (int k = 0; k != 3; k++) {
+                    add_plane(quadrics[p[k]], n, d, 1.0);
+                }
+            }
+            for (int k = 0; k != 3; k++) {
+                edge_t e(std::min(p[k], p[(k + 1) % 3]),
+                        std::max(p[k], p[(k + 1) % 3]));
+                auto it = edges.find(e);
+                if (it == edges.end()) {
+                    edge_use_t use = {1, id, false};
+                    edges[e] = use;
+                } else {
+                    it->second.count++;
+                    if (triangles[it->second.triangle].material != t.material) {
+                        it->second.materialBorder = true;
+                    }
+                }
+            }
+        }
+
+        for (auto &entry : edges) {
+            const edge_use_t &use = entry.second;
+            if (use.count == 1 || use.materialBorder) {
+                uint32_t a = entry.first.first, b = entry.first.second;
+                const triangle_t &t = triangles[use.triangle];
+                vec3_t faceNormal = cross(
+                        sub(points[positionOf[t.v[1]]], points[positionOf[t.v[0]]]),
+                        sub(points[positionOf[t.v[2]]], points[positionOf[t.v[0]]]));
+                vec3_t n = cross(sub(points[b], points[a]), faceNormal);
+                double len = length(n);
+                if (len > 0.0) {
+                    n.x /= len; n.y /= len; n.z /= len;
+                    double d = -dot(n, points[a]);
+                    add_plane(quadrics[a], n, d, BORDER_WEIGHT);
+                    add_plane(quadrics[b], n, d, BORDER_WEIGHT);
+                }
+            }
+            push_edge(entry.first.first, entry.first.second);
+        }
+    }
+
+    /* Queue the cheaper direction of collapsing the edge a-b */
+    void simplifier::push_edge(uint32_t a, uint32_t b)
+    {
+        quadric_t Q = quadrics[a];
+        add_quadric(Q, quadrics[b]);
+        double toB = evaluate(Q, points[b]);
+        double toA = evaluate(Q, points[a]);
+        collapse_t c;
+        if (toB <= toA) {
+            c.cost = toB; c.from = a; c.to = b;
+        } else {
+            c.cost = toA; c.from = b; c.to = a;
+        }
+        c.fromStamp = stamps[c.from];
+        c.toStamp = stamps[c.to];
+        heap.push(c);
+    }
+
+    bool simplifier::uses(const triangle_t &t, uint32_t position) const
+    {
+        return positionOf[t.v[0]] == position || positionOf[t.v[1]] == position
+            || positionOf[t.v[2]] == position;
+    }
+
+    /* Reject collapses that would fold a surviving triangle over */
+    bool simplifier::collapse_is_valid(uint32_t from, uint32_t to) const
+    {
+        for (uint32_t id : positionTriangles[from]) {
+            const triangle_t &t = triangles[id];
+            if (t.removed || !uses(t, from) || uses(t, to)) {
+                continue;
+            }
+            vec3_t before[3], after[3];
+            for (int k = 0; k != 3; k++) {
+                uint32_t p = positionOf[t.v[k]];
+                before[k] = points[p];
+                after[k] = p == from ? points[to] : points[p];
+            }
+            vec3_t n0 = cross(sub(before[1], before[0]), sub(before[2], before[0]));
+            vec3_t n1 = cross(sub(after[1], after[0]), sub(after[2], after[0]));
+            double l0 = length(n0), l1 = length(n1);
+            if (l1 == 0.0 || (l0 > 0.0 && dot(n0, n1) < MIN_NORMAL_DOT * l0 * l1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* The vertex at `position` whose attributes best match `vertex`, so a
+     * seam keeps its sides when it moves */
+    uint32_t simplifier::closest_vertex(uint32_t vertex, uint32_t position) const
+    {
+        const mesh_vertex_t &v = vertices[vertex];
+        uint32_t best = positionVertices[position][0];
+        double bestScore = INFINITY;
+        for (uint32_t candidate : positionVertices[position]) {
+            const mesh_vertex_t &c = vertices[candidate];
+            double du = c.uv[0] - v.uv[0], dv = c.uv[1] - v.uv[1];
+            double score = 1.0 - (c.normal[0] * v.normal[0]
+                    + c.normal[1] * v.normal[1] + c.normal[2] * v.normal[2])
+                + du * du + dv * dv;
+            if (score < bestScore) {
+                best = candidate;
+                bestScore = score;
+            }
+        }
+        return best;
+    }
+
+    void simplifier::collapse(uint32_t from, uint32_t to)
+    {
+        for (uint32_t id : positionTriangles[from]) {
+            triangle_t &t = triangles[id];
+            if (t.removed || !uses(t, from)) {
+                continue;
+            }
+            if (uses(t, to)) {
+                t.removed = true;
+                liveTriangles--;
+                continue;
+            }
+            for (int k = 0; k != 3; k++) {
+                if (positionOf[t.v[k]] == from) {
+                    t.v[k] = closest_vertex(t.v[k], to);
+                }
+            }
+            positionTriangles[to].push_back(id);
+        }
+        positionTriangles[from].clear();
+        positionTriangles[from].shrink_to_fit();
+        add_quadric(quadrics[to], quadrics[from]);
+        alive[from] = false;
+        stamps[from]++;
+        stamps[to]++;
+
+        /* Drop stale entries from the survivor's list and requeue its edges */
+        auto &list = positionTriangles[to];
+        vector<uint32_t> neighbours;
+        size_t kept = 0;
+        for (uint32_t id : list) {
+            const triangle_t &t = triangles[id];
+            if (t.removed || !uses(t, to)) {
+                continue;
+            }
+            list[kept++] = id;
+            for (int k = 0; k != 3; k++) {
+                uint32_t p = positionOf[t.v[k]];
+                if (p != to) {
+                    neighbours.push_back(p);
+                }
+            }
+        }
+        list.resize(kept);
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+                neighbours.end());
+        for (uint32_t n : neighbours) {
+            push_edge(to, n);
+        }
+    }
+
+    float simplifier::run(size_t targetTriangles)
+    {
+        double maxCost = 0.0;
+        while (liveTriangles > targetTriangles && !heap.empty()) {
+            collapse_t c = heap.top();
+            heap.pop();
+            if (!alive[c.from] || !alive[c.to] || stamps[c.from] != c.fromStamp
+                    || stamps[c.to] != c.toStamp) {
+                continue;
+            }
+            if (!collapse_is_valid(c.from, c.to)) {
+                continue;
+            }
+            collapse(c.from, c.to);
+            maxCost = std::max(maxCost, c.cost);
+        }
+        return (float)std::sqrt(maxCost);
+    }
+
+    void simplifier::output(size_t materials,
+            vector<vector<uint32_t>> &result) const
+    {
+        result.assign(materials, vector<uint32_t>());
+        for (const triangle_t &t : triangles) {
+            if (!t.removed) {
+                result[t.material].insert(result[t.material].end(),
+                        {t.v[0], t.v[1], t.v[2]});
+            }
+        }
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+float simplify_mesh(
+        const vector<mesh_vertex_t> &vertices,
+        const vector<vector<uint32_t>> &materialIndices,
+        size_t targetTriangles,
+        vector<vector<uint32_t>> &result)
+{
+    simplifier s(vertices, materialIndices);
+    float error = s.run(targetTriangles);
+    s.output(materialIndices.size(), result);
+    return error;
+}
@@ -0,0 +1,26 @@
+#ifndef MESH_SIMPLIFY
+#define MESH_SIMPLIFY
+
+#include "../mesh_format.h"
+
+#include <stddef.h>
+#include <vector>
+
+/* Quadric error metric edge collapse (Garland & Heckbert 1997).
+ *
+ * Collapses always move a vertex onto one of its neighbours, so the result
+ * indexes the same vertex array as the input and every level of detail can
+ * share one vertex buffer. Positions shared by several vertices (normal or
+ * texture seams) collapse together. Open borders and borders between
+ * materials are weighted so they stay in place.
+ *
+ * materialIndices holds one triangle list per material; the output has the
+ * same layout. Returns the estimated object space deviation from the input,
+ * in the units of the positions. Stops early if no collapse is valid. */
+float simplify_mesh(
+        const std::vector<mesh_vertex_t> &vertices,
+        const std::vector<std::vector<uint32_t>> &materialIndices,
+        size_t targetTriangles,
+        std::vector<std::vector<uint32_t>> &result);
+
+#endif
@@ -0,0 +1,357 @@
+/* Offline converter from Wavefront OBJ to the binary .amesh container
+ * described in mesh_format.h.
+ *
+ * usage: meshconv [--lods N] input.obj output.amesh */
+
+#include "../mesh_format.h"
+#include "mesh_simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#include <string>
+using std::string;
+using std::vector;
+using std::cout; using std::endl;
+
+/* Each level of detail keeps this fraction of the previous one's triangles */
+const double LOD_REDUCTION = 0.5;
+/* Levels are not generated below this many triangles */
+const size_t MIN_LOD_TRIANGLES = 64;
+const uint32_t DEFAULT_LODS = 8;
+
+typedef struct {
+    vector<mesh_vertex_t> vertices;
+    /* One index list per material, in order of first use */
+    vector<vector<uint32_t>> materialIndices;
+} mesh_data_t;
+
+typedef struct {
+    vector<vector<uint32_t>> materialIndices;
+    float error;
+} lod_level_t;
+
+/* An OBJ corner: position, texcoord and normal index (0 when absent) */
+typedef struct {
+    int64_t v, vt, vn;
+} obj_corner_t;
+
+struct corner_hash {
+    size_t operator()(const obj_corner_t &c) const {
+        return (size_t)(c.v * 73856093) ^ (size_t)(c.vt * 19349663)
+            ^ (size_t)(c.vn * 83492791);
+    }
+};
+
+struct corner_equal {
+    bool operator()(const obj_corner_t &a, const obj_corner_t &b) const {
+        return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+    }
+};
+
+/* OBJ indices are 1-based and may be negative (relative to the end) */
+static int64_t resolve_index(const string &token, size_t count)
+{
+    if (token.empty()) {
+        return 0;
+    }
+    int64_t i = strtoll(token.c_str(), nullptr, 10);
+    if (i < 0) {
+        i += (int64_t)count + 1;
+    }
+    if (i <= 0 || i > (int64_t)count) {
+        throw std::runtime_error("index out of range in face: " + token);
+    }
+    return i;
+}
+
+static obj_corner_t parse_corner(const string &token, size_t positions,
+        size_t texcoords, size_t normals)
+{
+    string parts[3];
+    size_t part = 0;
+    for (char c : token) {
+        if (c == '/') {
+            if (++part == 3) {
+                break;
+            }
+        } else {
+            parts[part] += c;
+        }
+    }
+    obj_corner_t corner;
+    corner.v = resolve_index(parts[0], positions);
+    corner.vt = resolve_index(parts[1], texcoords);
+    corner.vn = resolve_index(parts[2], normals);
+    if (corner.v == 0) {
+        throw std::runtime_error("face corner without position: " + token);
+    }
+    return corner;
+}
+
+/* Area weighted vertex normals, for files that do not carry any */
+static void generate_normals(mesh_data_t &mesh)
+{
+    for (auto &v : mesh.vertices) {
+        v.normal[0] = v.normal[1] = v.normal[2] = 0.f;
+    }
+    for (auto &indices : mesh.materialIndices) {
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            mesh_vertex_t *t[3] = {&mesh.vertices[indices[i]],
+                &mesh.vertices[indices[i + 1]], &mesh.vertices[indices[i + 2]]};
+            float e1[3], e2[3], n[3];
+            for (int k = 0; k != 3; k++) {
+                e1[k] = t[1]->position[k] - t[0]->position[k];
+                e2[k] = t[2]->position[k] - t[0]->position[k];
+            }
+            n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            for (int j = 0; j != 3; j++) {
+                for (int k = 0; k != 3; k++) {
+                    t[j]->normal[k] += n[k];
+                }
+            }
+        }
+    }
+    for (auto &v : mesh.vertices) {
+        float *n = v.normal;
+        float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len > 0.f) {
+            n[0] /= len; n[1] /= len; n[2] /= len;
+        }
+    }
+}
+
+static mesh_data_t load_obj(const string &path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path);
+    }
+    vector<float> positions, texcoords, normals;
+    std::unordered_map<obj_corner_t, uint32_t, corner_hash, corner_equal> unique;
+    std::map<string, size_t> materials;
+    mesh_data_t mesh;
+    mesh.materialIndices.resize(1);
+    size_t material = 0;
+
+    string line;
+    vector<uint32_t> polygon;
+    while (std::getline(file, line)) {
+        std::istringstream in(line);
+        string tag;
+        in >> tag;
+        if (tag == "v") {
+            float x = 0.f, y = 0.f, z = 0.f;
+            in >> x >> y >> z;
+            positions.insert(positions.end(), {x, y, z});
+        } else if (tag == "vt") {
+            float u = 0.f, v = 0.f;
+            in >> u >> v;
+            /* OBJ has v pointing up, Vulkan samples top-down */
+            texcoords.insert(texcoords.end(), {u, 1.f - v});
+        } else if (tag == "vn") {
+            float x = 0.f, y = 0.f, z = 0.f;
+            in >> x >> y >> z;
+            normals.insert(normals.end(), {x, y, z});
+        } else if (tag == "usemtl") {
+            string name;
+            in >> name;
+            auto it = materials.find(name);
+            if (it == materials.end()) {
+                /* The first material reuses the default slot if unused */
+                if (materials.empty() && mesh.materialIndices[0].empty()) {
+                    material = 0;
+                } else {
+                    material = mesh.materialIndices.size();
+                    mesh.materialIndices.resize(material + 1);
+                }
+                materials[name] = material;
+            } else {
+                material = it->second;
+            }
+        } else if (tag == "f") {
+            polygon.clear();
+            string token;
+            while (in >> token) {
+                obj_corner_t c = parse_corner(token, positions.size() / 3,
+                        texcoords.size() / 2, normals.size() / 3);
+                auto it = unique.find(c);
+                if (it == unique.end()) {
+                    mesh_vertex_t v = {};
+                    memcpy(v.position, &positions[(c.v - 1) * 3], sizeof(v.position));
+                    if (c.vt != 0) {
+                        memcpy(v.uv, &texcoords[(c.vt - 1) * 2], sizeof(v.uv));
+                    }
+                    if (c.vn != 0) {
+                        memcpy(v.normal, &normals[(c.vn - 1) * 3], sizeof(v.normal));
+                    }
+                    it = unique.insert(std::make_pair(c,
+                                (uint32_t)mesh.vertices.size())).first;
+                    mesh.vertices.push_back(v);
+                }
+                polygon.push_back(it->second);
+            }
+            /* Triangulate as a fan */
+            for (size_t i = 2; i < polygon.size(); i++) {
+                auto &indices = mesh.materialIndices[material];
+                indices.insert(indices.end(),
+                        {polygon[0], polygon[i - 1], polygon[i]});
+            }
+        }
+    }
+    if (normals.empty()) {
+        generate_normals(mesh);
+    }
+    return mesh;
+}
+
+static uint64_t align_up(uint64_t value)
+{
+    return (value + MESH_CHUNK_ALIGNMENT - 1) & ~(MESH_CHUNK_ALIGNMENT - 1);
+}
+
+static size_t triangle_count(const vector<vector<uint32_t>> &materialIndices)
+{
+    size_t count = 0;
+    for (auto &list : materialIndices) {
+        count += list.size() / 3;
+    }
+    return count;
+}
+
+/* Simplify each level from the previous one until the reduction stalls or
+ * the mesh gets too small. Errors add up along the chain so they stay
+ * relative to the full detail mesh */
+static vector<lod_level_t> generate_lods(const mesh_data_t &mesh, uint32_t maxLods)
+{
+    vector<lod_level_t> lods(1);
+    lods[0].materialIndices = mesh.materialIndices;
+    lods[0].error = 0.f;
+    while (lods.size() < maxLods) {
+        const lod_level_t &previous = lods.back();
+        size_t triangles = triangle_count(previous.materialIndices);
+        size_t target = (size_t)(triangles * LOD_REDUCTION);
+        if (target < MIN_LOD_TRIANGLES) {
+            break;
+        }
+        lod_level_t level;
+        float error = simplify_mesh(mesh.vertices, previous.materialIndices,
+                target, level.materialIndices);
+        size_t reduced = triangle_count(level.materialIndices);
+        if (reduced > triangles - (triangles - target) / 2) {
+            break;
+        }
+        level.error = previous.error + error;
+        cout << "  lod " << lods.size() << ": " << reduced << " triangles, error "
+            << level.error << endl;
+        lods.push_back(level);
+    }
+    return lods;
+}
+
+static void write_mesh(const string &path, const mesh_data_t &mesh,
+        const vector<lod_level_t> &lods)
+{
+    vector<uint32_t> indices;
+    vector<mesh_submesh_t> submeshes;
+    vector<mesh_lod_t> lodTable;
+    for (auto &level : lods) {
+        mesh_lod_t lod = {(uint32_t)submeshes.size(), 0, level.error, 0};
+        for (size_t m = 0; m != level.materialIndices.size(); m++) {
+            auto &list = level.materialIndices[m];
+            if (list.empty()) {
+                continue;
+            }
+            mesh_submesh_t s = {(uint32_t)indices.size(), (uint32_t)list.size(),
+                0, (uint32_t)m};
+            submeshes.push_back(s);
+            indices.insert(indices.end(), list.begin(), list.end());
+        }
+        lod.submeshCount = (uint32_t)submeshes.size() - lod.firstSubmesh;
+        lodTable.push_back(lod);
+    }
+
+    mesh_file_header_t header = {};
+    header.magic = MESH_MAGIC;
+    header.version = MESH_VERSION;
+    header.chunkCount = 4;
+    for (int k = 0; k != 3; k++) {
+        header.boundsMin[k] = mesh.vertices.empty() ? 0.f : INFINITY;
+        header.boundsMax[k] = mesh.vertices.empty() ? 0.f : -INFINITY;
+    }
+    for (auto &v : mesh.vertices) {
+        for (int k = 0; k != 3; k++) {
+            header.boundsMin[k] = std::min(header.boundsMin[k], v.position[k]);
+            header.boundsMax[k] = std::max(header.boundsMax[k], v.position[k]);
+        }
+    }
+
+    const void *payloads[4] = {mesh.vertices.data(), indices.data(),
+        submeshes.data(), lodTable.data()};
+    mesh_chunk_t chunks[4] = {
+        {MESH_CHUNK_VERTICES, sizeof(mesh_vertex_t), 0,
+            mesh.vertices.size() * sizeof(mesh_vertex_t), mesh.vertices.size()},
+        {MESH_CHUNK_INDICES, sizeof(uint32_t), 0,
+            indices.size() * sizeof(uint32_t), indices.size()},
+        {MESH_CHUNK_SUBMESHES, sizeof(mesh_submesh_t), 0,
+            submeshes.size() * sizeof(mesh_submesh_t), submeshes.size()},
+        {MESH_CHUNK_LODS, sizeof(mesh_lod_t), 0,
+            lodTable.size() * sizeof(mesh_lod_t), lodTable.size()}};
+    uint64_t offset = align_up(sizeof(header) + sizeof(chunks));
+    for (auto &c : chunks) {
+        c.offset = offset;
+        offset = align_up(offset + c.size);
+    }
+    header.fileSize = offset;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("failed to create " + path);
+    }
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)chunks, sizeof(chunks));
+    vector<char> padding(MESH_CHUNK_ALIGNMENT, 0);
+    for (int i = 0; i != 4; i++) {
+        out.write(padding.data(), (std::streamsize)(chunks[i].offset - out.tellp()));
+        out.write((const char *)payloads[i], (std::streamsize)chunks[i].size);
+    }
+    out.write(padding.data(), (std::streamsize)(header.fileSize - out.tellp()));
+    if (!out.good()) {
+        throw std::runtime_error("failed to write " + path);
+    }
+    cout << path << ": " << mesh.vertices.size() << " vertices, "
+        << triangle_count(mesh.materialIndices) << " triangles, "
+        << lodTable.size() << " levels of detail" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t maxLods = DEFAULT_LODS;
+    int arg = 1;
+    if (argc == 5 && strcmp(argv[1], "--lods") == 0) {
+        maxLods = (uint32_t)std::max(1l, strtol(argv[2], nullptr, 10));
+        arg = 3;
+    } else if (argc != 3) {
+        std::cerr << "usage: meshconv [--lods N] input.obj output.amesh" << endl;
+        return EXIT_FAILURE;
+    }
+    try {
+        mesh_data_t mesh = load_obj(argv[arg]);
+        write_mesh(argv[arg + 1], mesh, generate_lods(mesh, maxLods));
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,455 @@
+/* Frame time regression gate. Runs every scene of a baseline file headless
+ * several times, each run writing its statistics with --stats, and compares
+ * the median of each metric over the runs against the stored baseline.
+ *
+ * A metric regresses when the lower end of the 95% confidence interval of
+ * its median (bootstrapped from the runs) is still above the baseline by
+ * more than the metric's threshold, so one noisy run cannot fail the gate
+ * and a real slowdown cannot hide behind one fast run.
+ *
+ * usage: perf_gate [--binary ./main] [--runs N] [--update] baseline.json
+ *
+ * Exits 1 when a metric regressed, 2 when a run failed and 3 when a metric
+ * has no baseline or no samples to compare, since a gate with nothing to
+ * compare against would always pass. --update rewrites the baseline with
+ * the medians just measured, leaving out metrics the runs did not report.
+ * Meant to run on lavapipe, e.g. VK_ICD_FILENAMES=.../lvp_icd.x86_64.json,
+ * see make perf */
+
+#include <algorithm>
+#include <cmath>
+#include <ctype.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <string>
+using std::string;
+using std::vector;
+using std::cout; using std::endl;
+
+/* Resamples drawn for each confidence interval */
+const uint32_t BOOTSTRAP_SAMPLES = 2000;
+const uint32_t DEFAULT_RUNS = 7;
+const uint64_t DEFAULT_FRAMES = 600;
+
+/* What is compared, as written by vk::write_run_stats. Lower is better for
+ * all of them */
+const char *METRICS[] = {"frame_ms_p50", "frame_ms_p99", "startup_ms",
+    "peak_rss_bytes", "host_peak_bytes"};
+const uint32_t METRIC_COUNT = sizeof(METRICS) / sizeof(METRICS[0]);
+
+/* Just enough JSON for the baseline and the stats files */
+typedef struct json_value {
+    enum {NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT} type = NUL;
+    double number = 0.0;
+    string text;
+    vector<json_value> items;
+    vector<string> keys;        //of items, for objects
+
+    const json_value *find(const string &key) const {
+        for (size_t i = 0; i != keys.size(); i++) {
+            if (keys[i] == key) {
+                return &items[i];
+            }
+        }
+        return nullptr;
+    }
+} json_value_t;
+
+typedef struct {
+    string name;
+    string args;
+    /* Baseline per metric, NAN where none was recorded yet */
+    double baseline[METRIC_COUNT];
+} scene_t;
+
+typedef struct {
+    uint32_t runs = DEFAULT_RUNS;
+    uint64_t frames = DEFAULT_FRAMES;
+    /* Allowed slowdown per metric, as a fraction of the baseline */
+    double threshold[METRIC_COUNT];
+    vector<scene_t> scenes;
+} baseline_t;
+
+typedef struct {
+    double median;
+    double low, high;       //95% confidence interval of the median
+} estimate_t;
+
+class json_parser {
+    public:
+        json_parser(const string &text, const string &source)
+            : text(text), source(source) {}
+
+        json_value_t parse(void)
+        {
+            json_value_t value = parse_value();
+            skip_space();
+            if (at != text.size()) {
+                fail("trailing characters");
+            }
+            return value;
+        }
+
+    private:
+        void fail(const string &what)
+        {
+            throw std::runtime_error(source + ": " + what + " at offset "
+                    + std::to_string(at));
+        }
+
+        void skip_space(void)
+        {
+            while (at != text.size() && isspace((unsigned char)text[at])) {
+                at++;
+            }
+        }
+
+        bool accept(const char *word)
+        {
+            size_t n = strlen(word);
+            if (text.compare(at, n, word) == 0) {
+                at += n;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c)
+        {
+            skip_space();
+            if (at == text.size() || text[at] != c) {
+                fail(string("expected '") + c + "'");
+            }
+            at++;
+        }
+
+        string parse_string(void)
+        {
+            expect('"');
+            string s;
+            while (at != text.size() && text[at] != '"') {
+                char c = text[at++];
+                if (c == '\\' && at != text.size()) {
+                    c = text[at++];
+                    c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+                }
+                s += c;
+            }
+            expect('"');
+            return s;
+        }
+
+        json_value_t parse_value(void)
+        {
+            json_value_t value;
+            skip_space();
+            if (at == text.size()) {
+                fail("unexpected end");
+            }
+            char c = text[at];
+            if (c == '{') {
+                value.type = json_value_t::OBJECT;
+                at++;
+                skip_space();
+                if (accept("}")) {
+                    return value;
+                }
+                do {
+                    value.keys.push_back(parse_string());
+                    expect(':');
+                    value.items.push_back(parse_value());
+                    skip_space();
+                } while (accept(","));
+                expect('}');
+            } else if (c == '[') {
+                value.type = json_value_t::ARRAY;
+                at++;
+                skip_space();
+                if (accept("]")) {
+                    return value;
+                }
+                do {
+                    value.items.push_back(parse_value());
+                    skip_space();
+                } while (accept(","));
+                expect(']');
+            } else if (c == '"') {
+                value.type = json_value_t::STRING;
+                value.text = parse_string();
+            } else if (accept("true")) {
+                value.type = json_value_t::BOOL;
+                value.number = 1.0;
+            } else if (accept("false")) {
+                value.type = json_value_t::BOOL;
+            } else if (accept("null")) {
+                value.type = json_value_t::NUL;
+            } else {
+                char *end;
+                value.type = json_value_t::NUMBER;
+                value.number = strtod(text.c_str() + at, &end);
+                if (end == text.c_str() + at) {
+                    fail("invalid value");
+                }
+                at = (size_t)(end - text.c_str());
+            }
+            return value;
+        }
+
+        const string &text;
+        const string &source;
+        size_t at = 0;
+};
+
+static json_value_t read_json(const string &path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("could not open " + path);
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    string text = contents.str();
+    return json_parser(text, path).parse();
+}
+
+static double number_or(const json_value_t *value, double fallback)
+{
+    return value != nullptr && value->type == json_value_t::NUMBER
+        ? value->number : fallback;
+}
+
+static baseline_t load_baseline(const string &path)
+{
+    json_value_t root = read_json(path);
+    baseline_t b;
+    b.runs = (uint32_t)number_or(root.find("runs"), DEFAULT_RUNS);
+    b.frames = (uint64_t)number_or(root.find("frames"), DEFAULT_FRAMES);
+    const json_value_t *thresholds = root.find("thresholds");
+    for (uint32_t m = 0; m != METRIC_COUNT; m++) {
+        b.threshold[m] = number_or(
+                thresholds ? thresholds->find(METRICS[m]) : nullptr, 0.1);
+    }
+    const json_value_t *scenes = root.find("scenes");
+    if (scenes == nullptr || scenes->type != json_value_t::ARRAY) {
+        throw std::runtime_error(path + ": no scenes");
+    }
+    for (auto &s : scenes->items) {
+        scene_t scene;
+        const json_value_t *name = s.find("name");
+        const json_value_t *args = s.find("args");
+        if (name == nullptr || name->type != json_value_t::STRING) {
+            throw std::runtime_error(path + ": scene without a name");
+        }
+        scene.name = name->text;
+        scene.args = args != nullptr ? args->text : "";
+        const json_value_t *values = s.find("baseline");
+        for (uint32_t m = 0; m != METRIC_COUNT; m++) {
+            scene.baseline[m] = number_or(
+                    values ? values->find(METRICS[m]) : nullptr, NAN);
+        }
+        b.scenes.push_back(scene);
+    }
+    return b;
+}
+
+static void write_baseline(const string &path, const baseline_t &b,
+        const vector<vector<estimate_t>> &measured)
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("could not write " + path);
+    }
+    file << std::setprecision(12);
+    file << "{\n  \"runs\": " << b.runs << ",\n  \"frames\": " << b.frames
+        << ",\n  \"thresholds\": {";
+    for (uint32_t m = 0; m != METRIC_COUNT; m++) {
+        file << (m ? ", " : "") << "\"" << METRICS[m] << "\": "
+            << b.threshold[m];
+    }
+    file << "},\n  \"scenes\": [";
+    for (size_t s = 0; s != b.scenes.size(); s++) {
+        file << (s ? "," : "") << "\n    {\"name\": \"" << b.scenes[s].name
+            << "\", \"args\": \"" << b.scenes[s].args
+            << "\",\n     \"baseline\": {";
+        const char *separator = "";
+        for (uint32_t m = 0; m != METRIC_COUNT; m++) {
+            /* A metric no run reported has no median; JSON has no nan */
+            if (std::isnan(measured[s][m].median)) {
+                continue;
+            }
+            file << separator << "\"" << METRICS[m] << "\": "
+                << measured[s][m].median;
+            separator = ", ";
+        }
+        file << "}}";
+    }
+    file << "\n  ]\n}\n";
+}
+
+static double median_of(vector<double> values)
+{
+    size_t n = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + n, values.end());
+    double m = values[n];
+    if (values.size() % 2 == 0) {
+        m = (m + *std::max_element(values.begin(), values.begin() + n)) / 2.0;
+    }
+    return m;
+}
+
+/* Percentile bootstrap of the median. The generator is seeded the same way
+ * every time so a rerun on the same samples gives the same verdict. All
+ * NAN without samples */
+static estimate_t estimate(const vector<double> &samples)
+{
+    estimate_t e;
+    if (samples.empty()) {
+        e.median = e.low = e.high = NAN;
+        return e;
+    }
+    e.median = median_of(samples);
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    vector<double> medians(BOOTSTRAP_SAMPLES);
+    vector<double> resample(samples.size());
+    for (auto &m : medians) {
+        for (auto &r : resample) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            r = samples[(state >> 33) % samples.size()];
+        }
+        m = median_of(resample);
+    }
+    std::sort(medians.begin(), medians.end());
+    e.low = medians[(size_t)(0.025 * (BOOTSTRAP_SAMPLES - 1))];
+    e.high = medians[(size_t)(0.975 * (BOOTSTRAP_SAMPLES - 1))];
+    return e;
+}
+
+/* One headless run of the application; its statistics as written by
+ * --stats */
+static json_value_t run_once(const string &binary, const baseline_t &b,
+        const scene_t &scene)
+{
+    char statsPath[] = "/tmp/perf_gate_XXXXXX";
+    int fd = mkstemp(statsPath);
+    if (fd < 0) {
+        throw std::runtime_error("could not create a temporary file");
+    }
+    close(fd);
+    string command = binary + " --headless --benchmark --frames "
+        + std::to_string(b.frames) + " --stats " + statsPath + " "
+        + scene.args + " > /dev/null";
+    int status = system(command.c_str());
+    json_value_t stats;
+    if (status == 0) {
+        stats = read_json(statsPath);
+    }
+    unlink(statsPath);
+    if (status != 0) {
+        throw std::runtime_error("run failed: " + command);
+    }
+    return stats;
+}
+
+int main(int argc, char **argv)
+{
+    string binary = "./main";
+    string baselinePath;
+    uint32_t runs = 0;
+    bool update = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--binary") == 0 && i + 1 < argc) {
+            binary = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = (uint32_t)std::max(1l, strtol(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (baselinePath.empty() && argv[i][0] != '-') {
+            baselinePath = argv[i];
+        } else {
+            baselinePath.clear();
+            break;
+        }
+    }
+    if (baselinePath.empty()) {
+        std::cerr << "usage: perf_gate [--binary ./main] [--runs N] "
+            "[--update] baseline.json" << endl;
+        return 2;
+    }
+
+    bool regressed = false;
+    bool incomplete = false;
+    cout << std::setprecision(12);
+    try {
+        baseline_t b = load_baseline(baselinePath);
+        if (runs != 0) {
+            b.runs = runs;
+        }
+        vector<vector<estimate_t>> measured;
+        for (auto &scene : b.scenes) {
+            vector<vector<double>> samples(METRIC_COUNT);
+            for (uint32_t r = 0; r != b.runs; r++) {
+                json_value_t stats = run_once(binary, b, scene);
+                for (uint32_t m = 0; m != METRIC_COUNT; m++) {
+                    double value = number_or(stats.find(METRICS[m]), NAN);
+                    if (!std::isnan(value)) {
+                        samples[m].push_back(value);
+                    }
+                }
+            }
+
+            cout << scene.name << " (" << b.runs << " runs of " << b.frames
+                << " frames)" << endl;
+            measured.push_back(vector<estimate_t>(METRIC_COUNT));
+            for (uint32_t m = 0; m != METRIC_COUNT; m++) {
+                estimate_t e = estimate(samples[m]);
+                measured.back()[m] = e;
+                double base = scene.baseline[m];
+                double limit = base * (1.0 + b.threshold[m]);
+                const char *verdict = "ok";
+                if (std::isnan(e.median)) {
+                    verdict = "NO SAMPLES";
+                    incomplete = true;
+                } else if (std::isnan(base)) {
+                    verdict = "NO BASELINE";
+                    incomplete = true;
+                } else if (e.low > limit) {
+                    verdict = "REGRESSED";
+                    regressed = true;
+                } else if (e.high < base * (1.0 - b.threshold[m])) {
+                    verdict = "improved";
+                }
+                cout << "  " << METRICS[m] << ": median " << e.median
+                    << " [" << e.low << ", " << e.high << "]";
+                if (!std::isnan(base) && !std::isnan(e.median)) {
+                    cout << " baseline " << base << " ("
+                        << (e.median / base - 1.0) * 100.0 << "%)";
+                }
+                cout << " " << verdict << endl;
+            }
+        }
+        if (update) {
+            write_baseline(baselinePath, b, measured);
+            cout << "baseline written to " << baselinePath << endl;
+            return EXIT_SUCCESS;
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << endl;
+        return 2;
+    }
+    if (incomplete) {
+        std::cerr << "perf_gate: metrics without a baseline or samples were "
+            "not compared; record the baseline with --update (make "
+            "perf-baseline) on the machine the gate runs on" << endl;
+        return regressed ? EXIT_FAILURE : 3;
+    }
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+#ifdef ENABLE_TRACE
+
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include <string>
+using std::string;
+
+/*************/
+/* INTERNALS */
+/*************/
+
+namespace {
+    /* Events kept per thread. Older events are overwritten once it fills */
+    const uint64_t RING_CAPACITY = 1 << 16;
+    const uint64_t RING_MASK = RING_CAPACITY - 1;
+
+    typedef struct {
+        const char *name;
+        uint64_t begin;
+        uint64_t end;
+        int64_t value;
+        bool instant;
+    } trace_event_t;
+
+    /* name, begin, end, value, instant */
+    const uint32_t EVENT_WORDS = 5;
+
+    /* sequence is 2 * index + 1 while the event with that index is being
+     * written and 2 * index + 2 once it is complete, so the exporter can
+     * tell an event it copied from one overwritten under it. The event is
+     * kept a word at a time in relaxed atomics: copying it while it is
+     * overwritten then reads stale words instead of racing */
+    struct trace_slot_t {
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> words[EVENT_WORDS];
+    };
+
+    /* Single producer (the owning thread), single consumer (the exporter).
+     * The producer publishes a slot by bumping head with release ordering, so
+     * recording is a few plain and atomic stores, never a lock */
+    struct thread_ring_t {
+        uint32_t tid;
+        string name;
+        std::atomic<uint64_t> head;
+        trace_slot_t slots[RING_CAPACITY];
+    };
+
+    /* Rings outlive their threads so worker zones survive until export */
+    std::mutex &registry_mutex(void)
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    std::vector<std::unique_ptr<thread_ring_t>> &registry(void)
+    {
+        static std::vector<std::unique_ptr<thread_ring_t>> rings;
+        return rings;
+    }
+
+    thread_local thread_ring_t *localRing = nullptr;
+
+    /* Only taken once per thread, on its first event */
+    thread_ring_t *get_ring(void)
+    {
+        if (localRing == nullptr) {
+            std::unique_ptr<thread_ring_t> ring(new thread_ring_t);
+            ring->head.store(0, std::memory_order_relaxed);
+            for (auto &slot : ring->slots) {
+                slot.sequence.store(0, std::memory_order_relaxed);
+                for (auto &word : slot.words) {
+                    word.store(0, std::memory_order_relaxed);
+                }
+            }
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            ring->tid = (uint32_t)registry().size();
+            ring->name = ring->tid == 0 ? "main" : "thread";
+            localRing = ring.get();
+            registry().push_back(std::move(ring));
+        }
+        return localRing;
+    }
+
+    void push_event(const trace_event_t &e)
+    {
+        thread_ring_t *ring = get_ring();
+        uint64_t h = ring->head.load(std::memory_order_relaxed);
+        trace_slot_t &slot = ring->slots[h & RING_MASK];
+        const uint64_t words[EVENT_WORDS] = {(uint64_t)(uintptr_t)e.name,
+            e.begin, e.end, (uint64_t)e.value, e.instant ? 1u : 0u};
+        slot.sequence.store(2 * h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (uint32_t w = 0; w != EVENT_WORDS; w++) {
+            slot.words[w].store(words[w], std::memory_order_relaxed);
+        }
+        slot.sequence.store(2 * h + 2, std::memory_order_release);
+        ring->head.store(h + 1, std::memory_order_release);
+    }
+
+    /* Copy the event with index i out of its slot. False when the slot
+     * does not hold it completely, because the producer has overwritten or
+     * is overwriting it */
+    bool read_event(const thread_ring_t &ring, uint64_t i, trace_event_t &e)
+    {
+        const trace_slot_t &slot = ring.slots[i & RING_MASK];
+        uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        uint64_t words[EVENT_WORDS];
+        for (uint32_t w = 0; w != EVENT_WORDS; w++) {
+            words[w] = slot.words[w].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+        if (before != 2 * i + 2 || after != before) {
+            return false;
+        }
+        e.name = (const char *)(uintptr_t)words[0];
+        e.begin = words[1];
+        e.end = words[2];
+        e.value = (int64_t)words[3];
+        e.instant = words[4] != 0;
+        return true;
+    }
+
+    /* Timestamps are exported relative to process start */
+    const uint64_t epoch = trace::now_ns();
+
+    void write_escaped(std::ofstream &out, const char *s)
+    {
+        for (; *s != '\0'; s++) {
+            if (*s == '"' || *s == '\\') {
+                out << '\\';
+            }
+            out << *s;
+        }
+    }
+
+    /* Chrome trace timestamps are in microseconds; keep the nanoseconds as
+     * the fractional part */
+    void write_us(std::ofstream &out, uint64_t ns)
+    {
+        out << ns / 1000 << '.';
+        uint64_t frac = ns % 1000;
+        out << (char)('0' + frac / 100) << (char)('0' + frac / 10 % 10)
+            << (char)('0' + frac % 10);
+    }
+}
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+uint64_t trace::now_ns(void)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace::record_zone(const char *name, uint64_t begin, uint64_t end)
+{
+    trace_event_t e = {name, begin, end, 0, false};
+    push_event(e);
+}
+
+void trace::record_instant(const char *name, int64_t value)
+{
+    uint64_t t = now_ns();
+    trace_event_t e = {name, t, t, value, true};
+    push_event(e);
+}
+
+void trace::set_thread_name(const char *name)
+{
+    thread_ring_t *ring = get_ring();
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    ring->name = name;
+}
+
+/* Export is meant to run at shutdown, once the other threads stopped
+ * recording. If one still is, events it overwrites while we copy them are
+ * dropped rather than exported torn; copying them is not a data race */
+bool trace::write_chrome_json(const string &path)
+{
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    bool first = true;
+    std::vector<trace_event_t> events;
+    for (auto &ring : registry()) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = head > RING_CAPACITY ? head - RING_CAPACITY : 0;
+        events.clear();
+        trace_event_t e;
+        for (uint64_t i = tail; i != head; i++) {
+            if (read_event(*ring, i, e)) {
+                events.push_back(e);
+            }
+        }
+
+        /* Thread name metadata */
+        out << (first ? "" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << ring->tid << ",\"args\":{\"name\":\"";
+        write_escaped(out, ring->name.c_str());
+        out << "\"}}";
+
+        for (const trace_event_t &e : events) {
+            uint64_t begin = e.begin > epoch ? e.begin - epoch : 0;
+            out << ",\n{\"name\":\"";
+            write_escaped(out, e.name);
+            out << "\",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":";
+            write_us(out, begin);
+            if (e.instant) {
+                out << ",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"value\":"
+                    << e.value << "}}";
+            } else {
+                out << ",\"ph\":\"X\",\"dur\":";
+                write_us(out, e.end - e.begin);
+                out << '}';
+            }
+        }
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef TRACE_ZONES
+#define TRACE_ZONES
+
+/* Scoped-zone tracing. Every thread records into its own ring buffer so the
+ * hot path never takes a lock or touches a stream. The buffers are exported
+ * as Chrome trace JSON, which loads in chrome://tracing and ui.perfetto.dev.
+ *
+ * Tracing is compiled in with -DENABLE_TRACE (make TRACE=1). Without it every
+ * macro below expands to nothing. */
+
+#ifdef ENABLE_TRACE
+
+#include <stdint.h>
+#include <string>
+
+namespace trace {
+    /* Monotonic timestamp in nanoseconds */
+    uint64_t now_ns(void);
+
+    /* Record a complete zone [begin, end] on the calling thread */
+    void record_zone(const char *name, uint64_t begin, uint64_t end);
+    /* Record an instant event carrying a single value, e.g. a VkResult */
+    void record_instant(const char *name, int64_t value);
+    /* Name the calling thread in the exported trace */
+    void set_thread_name(const char *name);
+    /* Write every recorded event to a Chrome trace JSON file */
+    bool write_chrome_json(const std::string &path);
+
+    /* Records the lifetime of the enclosing scope. The name must have static
+     * storage duration (string literal or __func__) */
+    class zone {
+        public:
+            explicit zone(const char *name) : name(name), begin(now_ns()) {}
+            ~zone() { record_zone(name, begin, now_ns()); }
+        private:
+            zone(const zone &);
+            zone &operator=(const zone &);
+            const char *name;
+            uint64_t begin;
+    };
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) trace::zone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_FUNC() TRACE_ZONE(__func__)
+#define TRACE_INSTANT(name, value) trace::record_instant(name, (int64_t)(value))
+#define TRACE_THREAD_NAME(name) trace::set_thread_name(name)
+#define TRACE_WRITE(path) trace::write_chrome_json(path)
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_FUNC()
+#define TRACE_INSTANT(name, value)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_WRITE(path)
+
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+#include "vk_handle.h"
+#include "trace.h"
+
+#include <vector>
+
+using std::vector;
+
+/*************/
+/* FUNCTIONS */
+/*************/
+
+void deletion_queue::push(uint64_t frame, std::function<void(void)> destroy)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    /* Pushed with a frame at least as late as the last one unless two
+     * threads raced for the lock; keep the order so collect can stop at the
+     * first entry still in use */
+    auto at = entries.end();
+    while (at != entries.begin() && (at - 1)->first > frame) {
+        --at;
+    }
+    entries.insert(at, std::make_pair(frame, std::move(destroy)));
+}
+
+/* The destroy calls run outside the lock so a slow driver call never
+ * blocks a thread retiring something else */
+size_t deletion_queue::collect(uint64_t completedFrame)
+{
+    vector<std::function<void(void)>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!entries.empty() && entries.front().first <= completedFrame) {
+            ready.push_back(std::move(entries.front().second));
+            entries.pop_front();
+        }
+    }
+    if (ready.empty()) {
+        return 0;
+    }
+    TRACE_ZONE("collect_retired");
+    for (auto &destroy : ready) {
+        destroy();
+    }
+    return ready.size();
+}
+
+size_t deletion_queue::flush(void)
+{
+    return collect((uint64_t)-1);
+}
+
+size_t deletion_queue::size(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
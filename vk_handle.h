@@ -0,0 +1,128 @@
+#ifndef VK_HANDLE
+#define VK_HANDLE
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+/* Owns one device level Vulkan object and destroys it when it goes out of
+ * scope, is reset or is overwritten. Move-only. Converts to the raw handle,
+ * so it can be passed wherever the handle itself is expected */
+template <typename T,
+         void (VKAPI_PTR *Destroy)(VkDevice, T, const VkAllocationCallbacks *)>
+class unique_handle {
+    public:
+        unique_handle(void) {}
+        unique_handle(VkDevice device, T handle,
+                const VkAllocationCallbacks *allocator)
+            : device(device), handle(handle), allocator(allocator) {}
+        unique_handle(unique_handle &&other) noexcept
+            : device(other.device), handle(other.handle),
+            allocator(other.allocator)
+        {
+            other.handle = VK_NULL_HANDLE;
+        }
+        unique_handle &operator=(unique_handle &&other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                device = other.device;
+                handle = other.handle;
+                allocator = other.allocator;
+                other.handle = VK_NULL_HANDLE;
+            }
+            return *this;
+        }
+        ~unique_handle(void) { reset(); }
+
+        operator T(void) const { return handle; }
+        T get(void) const { return handle; }
+
+        /* Destroys the current object and returns where the create call
+         * should store the next one */
+        T *replace(VkDevice device, const VkAllocationCallbacks *allocator)
+        {
+            reset();
+            this->device = device;
+            this->allocator = allocator;
+            return &handle;
+        }
+
+        void reset(void)
+        {
+            if (handle != VK_NULL_HANDLE) {
+                Destroy(device, handle, allocator);
+                handle = VK_NULL_HANDLE;
+            }
+        }
+
+        /* Gives up ownership; calling the result destroys the object. For
+         * handing it to a deletion_queue */
+        std::function<void(void)> release(void)
+        {
+            VkDevice d = device;
+            T h = handle;
+            const VkAllocationCallbacks *a = allocator;
+            handle = VK_NULL_HANDLE;
+            return [d, h, a]() {
+                if (h != VK_NULL_HANDLE) {
+                    Destroy(d, h, a);
+                }
+            };
+        }
+
+    private:
+        unique_handle(const unique_handle &);
+        unique_handle &operator=(const unique_handle &);
+
+        VkDevice device = VK_NULL_HANDLE;
+        T handle = VK_NULL_HANDLE;
+        const VkAllocationCallbacks *allocator = nullptr;
+};
+
+typedef unique_handle<VkBuffer, vkDestroyBuffer> unique_buffer;
+typedef unique_handle<VkDeviceMemory, vkFreeMemory> unique_memory;
+typedef unique_handle<VkImage, vkDestroyImage> unique_image;
+typedef unique_handle<VkImageView, vkDestroyImageView> unique_image_view;
+typedef unique_handle<VkSampler, vkDestroySampler> unique_sampler;
+typedef unique_handle<VkFramebuffer, vkDestroyFramebuffer> unique_framebuffer;
+typedef unique_handle<VkRenderPass, vkDestroyRenderPass> unique_render_pass;
+typedef unique_handle<VkShaderModule, vkDestroyShaderModule> unique_shader_module;
+typedef unique_handle<VkPipelineLayout, vkDestroyPipelineLayout>
+    unique_pipeline_layout;
+typedef unique_handle<VkPipeline, vkDestroyPipeline> unique_pipeline;
+typedef unique_handle<VkPipelineCache, vkDestroyPipelineCache>
+    unique_pipeline_cache;
+typedef unique_handle<VkDescriptorSetLayout, vkDestroyDescriptorSetLayout>
+    unique_descriptor_set_layout;
+typedef unique_handle<VkDescriptorPool, vkDestroyDescriptorPool>
+    unique_descriptor_pool;
+typedef unique_handle<VkFence, vkDestroyFence> unique_fence;
+typedef unique_handle<VkSemaphore, vkDestroySemaphore> unique_semaphore;
+
+/* Objects that were replaced while frames using them may still be in
+ * flight. Each is tagged with the serial of the frame being prepared when
+ * it was retired, and destroyed once the fence of that frame has been
+ * waited on: a later frame can no longer use it, and the queue finishes
+ * submissions in order. Safe to push from any thread */
+class deletion_queue {
+    public:
+        void push(uint64_t frame, std::function<void(void)> destroy);
+        /* Destroy everything retired up to and including completedFrame.
+         * Returns how many objects went */
+        size_t collect(uint64_t completedFrame);
+        /* Destroy everything, once the device is idle */
+        size_t flush(void);
+        size_t size(void);
+
+    private:
+        std::mutex mutex;
+        std::deque<std::pair<uint64_t, std::function<void(void)>>> entries;
+};
+
+#endif
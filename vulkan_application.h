@@ -6,9 +6,31 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h> 
 
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
 #include <vector> 
 #include <string>
 #include <iostream> 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+
+#include "config.h"
+#include "frame_pacer.h"
+#include "frame_capture.h"
+#include "resolution_scaler.h"
+#include "spsc_queue.h"
+#include "mesh_file.h"
+#include "lod.h"
+#include "cull.h"
+#include "draw_sort.h"
+#include "scene.h"
+#include "host_allocator.h"
+#include "memory_budget.h"
+#include "sync_pool.h"
+#include "vk_handle.h"
 
 typedef struct {
     //Index to use
@@ -41,22 +63,225 @@ typedef struct {
     }
 } device_holder_t;
 
+typedef struct {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    VkMemoryPropertyFlags properties = 0;
+    void *mapped = nullptr;     //persistently mapped when host visible
+    /* What memory was allocated, for the budget */
+    uint32_t heapIndex = 0;
+    VkDeviceSize allocationSize = 0;
+} device_buffer_t;
+
+/* An image in device local memory with a view of all of its levels, and
+ * of all of its layers as an array when it has more than one */
+typedef struct {
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent = {0, 0};
+    uint32_t levels = 0;
+    uint32_t layers = 1;
+    /* What memory was allocated, for the budget */
+    uint32_t heapIndex = 0;
+    VkDeviceSize allocationSize = 0;
+} device_image_t;
+
+/* Materials the mesh fragment shader reads, one per index, as laid out in
+ * its storage buffer (std430). Each instance picks one through the unused
+ * projective row of its world matrix, see write_instances */
+const uint32_t MATERIAL_COUNT = 256;
+typedef struct {
+    float color[4];
+    /* Index into the bindless texture array, or layer of the texture
+     * array without descriptor indexing */
+    uint32_t texture;
+    float uvScale;
+    uint32_t pad[2];
+} material_t;
+
+/* Occlusion culling state of one frame in flight */
+typedef struct {
+    /* Per level of detail its first instance, first draw and draw count,
+     * then the indexed indirect draws of both phases */
+    device_buffer_t draws;
+    /* Instances surviving the cull, phase 1 after phase 0 */
+    device_buffer_t instances;
+    /* Per candidate, whether phase 0 drew it */
+    device_buffer_t visible;
+    VkDescriptorSet descriptorSet;
+    /* Candidates culled, 0 until the frame has been recorded once */
+    uint32_t candidates;
+} occlusion_frame_t;
+
+/* Objects tested and drawn by occlusion culling, summed over frames */
+typedef struct {
+    uint64_t frames = 0;
+    uint64_t candidates = 0;
+    uint64_t drawn[2] = {0, 0};     //by phase
+} occlusion_stats_t;
+
+/* One slot of the ring used to stream data through host memory */
+typedef struct {
+    device_buffer_t buffer;
+    VkCommandBuffer commandBuffer;
+    uint64_t copied;    //graphicsTimeline value of its last copy
+} staging_slot_t;
+
+/* What the event thread hands the render thread after each batch of events */
+typedef struct {
+    uint64_t sequence;
+    uint64_t timestampNs;   //when the events were handled
+    bool redraw;            //the scene or the window changed
+    bool iconified;
+    bool quit;
+} frame_packet_t;
+
+/* Camera for one frame */
+typedef struct {
+    glm::mat4 viewProjection;
+    glm::vec3 eye;
+    bool perspective;
+    /* Pixels covered by one world unit; at distance 1 for perspective */
+    float pixelsPerUnit;
+} view_t;
+
+/* Compile time shader options. Option i is the bool specialization
+ * constant with constant_id i and bit i of pipeline_key_t::shaderOptions */
+enum shader_option_t {
+    SHADER_OPTION_UNLIT = 0,
+    SHADER_OPTION_NORMALS,
+    SHADER_OPTION_TOON,
+    SHADER_OPTION_COUNT
+};
+
+/* Counters collected by the pipeline statistics queries, in the order
+ * vkGetQueryPoolResults returns them (ascending flag bits) */
+enum pipeline_statistic_t {
+    STATISTIC_INPUT_VERTICES = 0,
+    STATISTIC_INPUT_PRIMITIVES,
+    STATISTIC_VERTEX_INVOCATIONS,
+    STATISTIC_CLIPPING_PRIMITIVES,
+    STATISTIC_FRAGMENT_INVOCATIONS,
+    STATISTIC_COUNT
+};
+
+/* Pipeline statistics summed over every view and every frame read back */
+typedef struct {
+    uint64_t frames = 0;
+    uint64_t counters[STATISTIC_COUNT] = {};
+} pipeline_stats_t;
+
+/* What tells graphics pipeline variants apart */
+typedef struct {
+    VkPrimitiveTopology topology;
+    VkPolygonMode polygonMode;
+    VkCullModeFlags cullMode;
+    bool blend;                 //alpha blending instead of opaque
+    uint32_t shaderOptions;     //1 << shader_option_t
+} pipeline_key_t;
+
+bool operator==(const pipeline_key_t &a, const pipeline_key_t &b);
+
+/* Everything a VkGraphicsPipelineCreateInfo points to, kept together so a
+ * description stays valid until it is passed to vkCreateGraphicsPipelines */
+typedef struct {
+    VkSpecializationMapEntry specEntries[SHADER_OPTION_COUNT];
+    VkBool32 specData[SHADER_OPTION_COUNT];
+    VkSpecializationInfo specInfo;
+    VkPipelineShaderStageCreateInfo stages[2];
+    VkVertexInputBindingDescription bindings[2];
+    VkVertexInputAttributeDescription attributes[7];
+    VkPipelineVertexInputStateCreateInfo vertexInput;
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+    VkViewport viewport;
+    VkRect2D scissor;
+    VkPipelineViewportStateCreateInfo viewportState;
+    VkPipelineRasterizationStateCreateInfo rasterization;
+    VkPipelineMultisampleStateCreateInfo multisample;
+    VkPipelineDepthStencilStateCreateInfo depthStencil;
+    VkPipelineColorBlendAttachmentState blendAttachment;
+    VkPipelineColorBlendStateCreateInfo colorBlend;
+    VkDynamicState dynamicStates[2];
+    VkPipelineDynamicStateCreateInfo dynamicState;
+    VkGraphicsPipelineCreateInfo info;
+} pipeline_desc_t;
+
 typedef struct { 
     VkSurfaceCapabilitiesKHR capabilities;
     std::vector<VkSurfaceFormatKHR> formats; 
     std::vector<VkPresentModeKHR> presentModes; 
 } swapchain_support_details_t;
 
+/* HDR post-processing (--post): the format the scene is drawn in, and how
+ * many bloom levels there are below it, each half the size of the last */
+const VkFormat HDR_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+const uint32_t BLOOM_LEVELS = 6;
+
+/* One window, or headless surface, and its swapchain. Every view shows the
+ * same scene; all of them are recorded into one submission and presented
+ * with one vkQueuePresentKHR */
+typedef struct {
+    GLFWwindow *window = nullptr;
+    bool iconified = false;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    swapchain_support_details_t supportDetails;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkPresentModeKHR presentMode;
+    VkExtent2D extent;
+    std::vector<VkImage> images;
+    std::vector<unique_image_view> imageViews;
+    std::vector<unique_framebuffer> framebuffers;
+    /* Shared by the frames in flight; the queue runs them in order. Both
+     * are the swapchain's size. With dynamic resolution or post-processing
+     * the scene is drawn into the top left renderExtent of color and
+     * blitted to the acquired image, without them straight into that
+     * image and color is unused */
+    device_image_t depth;
+    device_image_t color;
+    VkExtent2D renderExtent;
+    /* Post-processing: the bloom levels, one image view each, and the
+     * descriptor sets of the chain's dispatches */
+    device_image_t bloom;
+    std::vector<unique_image_view> bloomLevels;
+    std::vector<VkDescriptorSet> postSets;
+    /* One per frame in flight */
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    /* Acquired for the frame being drawn */
+    uint32_t imageIndex = 0;
+    glm::mat4 viewProjection;
+    /* How long each acquire blocked waiting for this view's swapchain to
+     * hand out an image, and presents that did not return VK_SUCCESS */
+    frame_stats_t acquireStats;
+    uint64_t presentErrors = 0;
+} view_target_t;
+
 
 class vk {
     public:
         /* RUN */
+        void configure(const app_config_t &config);
         void init(void); 
         void glfw_init(void);
         void run(void);
+        /* Mark the scene as changed so idle mode renders it, waking the
+         * event loop if it sleeps. Window callbacks and the scene
+         * animation go through it. Safe to call from any thread */
+        void request_redraw(void);
 
     private: 
         void main_loop(void); 
+        bool should_close(void);
+        void configure_frame_pacing(void);
+        bool wait_for_redraw(void);
+        void event_loop(void);
+        void render_loop(void);
+        void wake_render_thread(void);
+        static void window_refresh_callback(GLFWwindow *window);
+        static void window_focus_callback(GLFWwindow *window, int focused);
+        static void window_iconify_callback(GLFWwindow *window, int iconified);
         void cleanup(void);
         /* SETUP */
         void initWindow(void);
@@ -82,30 +307,137 @@ class vk {
         void load_queues(void);
         void load_swapchain_support_details(void);
         void print_swapchain_support_details(void);
-        VkSurfaceFormatKHR get_suitable_swapchain_surface_format(void);
-        VkPresentModeKHR get_suitable_swapchain_present_mode(void);
-        VkExtent2D get_swapchain_extent(void); 
+        void print_swapchain_support_details(
+                const swapchain_support_details_t &details);
+        VkSurfaceFormatKHR get_suitable_swapchain_surface_format(
+                const view_target_t &view);
+        VkPresentModeKHR get_suitable_swapchain_present_mode(
+                const view_target_t &view);
+        VkExtent2D get_swapchain_extent(const view_target_t &view);
         void create_swapchains(void); 
         void load_swapchain_image_handles(void);
         void create_swapchain_image_views(void); 
+        VkFormat find_depth_format(void);
+        void create_render_targets(void);
         void create_renderpass(void);
         void create_framebuffers(void);
         void create_graphics_pipeline_layout(void); 
         std::vector<char> read_file(const std::string& filename);
         void create_shader_module(const std::vector<char> &code,
-                VkShaderModule &shaderModule);
+                unique_shader_module &shaderModule);
         void create_graphics_pipeline(void);
+        /* PIPELINES */
+        pipeline_key_t default_pipeline_key(void);
+        void describe_pipeline(const pipeline_key_t &key, VkPipeline parent,
+                pipeline_desc_t &desc);
+        VkPipeline get_pipeline(const pipeline_key_t &key);
+        std::vector<pipeline_key_t> load_pipeline_manifest(
+                const std::string &path);
+        std::vector<pipeline_key_t> default_pipeline_manifest(void);
+        void warm_up_pipelines(void);
+        void destroy_pipeline_variants(void);
         void create_command_pool(void); 
         void allocate_command_buffers(void);
-        void record_command_buffers(void);
+        void record_command_buffer(uint32_t frame);
+        void record_view_passes(VkCommandBuffer commandBuffer, uint32_t phase,
+                uint32_t firstQuery);
+        void record_upscale(VkCommandBuffer commandBuffer);
         void create_semaphores(void);
+        void create_sync_pools(void);
+        void create_statistics_query_pool(void);
+        void read_pipeline_statistics(uint32_t frame);
+        void create_timestamp_query_pool(void);
+        void read_gpu_frame_time(uint32_t frame);
         void draw_frame(void);
+        int32_t find_memory_type(uint32_t typeBits,
+                VkMemoryPropertyFlags properties, VkDeviceSize minHeapSize = 0);
+        void create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                const std::vector<VkMemoryPropertyFlags> &preferences,
+                device_buffer_t &buffer);
+        void destroy_buffer(device_buffer_t &buffer);
+        void create_image(VkExtent2D extent, uint32_t levels, VkFormat format,
+                VkImageUsageFlags usage, VkImageAspectFlags aspect,
+                device_image_t &image, uint32_t layers = 1);
+        void upload_image(device_image_t &image, const void *pixels,
+                VkDeviceSize size,
+                const std::vector<VkDeviceSize> &levelOffsets = {});
+        void destroy_image(device_image_t &image);
+        /* Destroy once no frame in flight can use it any more */
+        void retire(std::function<void(void)> destroy);
+        void retire_buffer(device_buffer_t &buffer);
+        void init_memory_budget(void);
+        /* MESH */
+        void load_mesh(void);
+        void upload_mesh_chunk(const mapped_mesh &mesh,
+                const mesh_chunk_t &chunk, VkBufferUsageFlags usage,
+                std::vector<staging_slot_t> &staging, device_buffer_t &dst);
+        void destroy_mesh(void);
+        /* SCENE */
+        void create_scene(void);
+        void animate_scene(double seconds);
+        view_t scene_view(double seconds, VkExtent2D size);
+        void update_draw_list(void);
+        void record_mesh_draw(VkCommandBuffer commandBuffer,
+                const view_target_t &view, uint32_t phase, uint32_t binds);
+        VkDeviceSize demote_instance_buffers(uint32_t heap, VkDeviceSize bytes);
+        void destroy_scene(void);
+        /* MATERIALS */
+        void create_material_layout(void);
+        void create_materials(void);
+        uint32_t add_bindless_texture(const device_image_t &image);
+        uint32_t load_texture(const std::string &path);
+        void destroy_materials(void);
+        /* OCCLUSION */
+        void create_occlusion_culling(void);
+        void create_depth_pyramid(void);
+        void create_compute_pipeline(const std::string &path,
+                VkPipelineLayout layout, unique_pipeline &pipeline);
+        void prepare_occlusion_draws(void);
+        void record_occlusion_cull(VkCommandBuffer commandBuffer,
+                uint32_t phase);
+        void record_depth_pyramid(VkCommandBuffer commandBuffer);
+        void destroy_occlusion_culling(void);
+        /* POST */
+        void create_post_processing(void);
+        void record_post_processing(VkCommandBuffer commandBuffer);
+        void destroy_post_processing(void);
+        /* CAPTURE */
+        void create_capture(void);
+        void record_capture(VkCommandBuffer commandBuffer);
+        void collect_capture(uint32_t frame);
+        void destroy_capture(void);
+        /* PRINT */
+        void print_frame_stats(void);
+        void print_pipeline_statistics(void);
+        void print_occlusion_stats(void);
+        void print_host_memory_stats(void);
+        void print_memory_budget(void);
+        void write_run_stats(const std::string &path);
 
 
-        /* GLFW data */
-        GLFWwindow* window;
+        /* Options */
+        app_config_t config;
+
+        /* Host memory the driver allocates. allocator is what every create
+         * and destroy call passes: the callbacks of hostAllocator, or
+         * nullptr for the driver's own heap with --system-allocator */
+        host_allocator hostAllocator;
+        const VkAllocationCallbacks *allocator = nullptr;
+
+        /* When configure ran, and how long until the first frame was
+         * submitted */
+        uint64_t startNs = 0;
+        double startupMs = 0.0;
+
+        /* Windows and swapchains, config.views of them. Windows are null
+         * when headless */
+        std::vector<view_target_t> views;
         const uint32_t WIDTH = 800;
         const uint32_t HEIGHT = 600; 
+        /* Set whenever the presented image may be stale */
+        std::atomic<bool> sceneDirty{true};
+        /* Every window is iconified */
+        bool windowIconified = false;
 
         /* Layers */ 
         const std::vector<const char*> layers = {
@@ -127,29 +459,195 @@ class vk {
         VkDevice device;  //logical device
         device_holder_t chosenDevice;
 
+        /* Device memory per heap. memoryBudgetExtension: the driver
+         * reports budgets through VK_EXT_memory_budget */
+        memory_budget memoryBudget;
+        bool memoryBudgetExtension = false;
+        /* Material textures are indexed from one partially bound array,
+         * see create_material_layout */
+        bool descriptorIndexingExtension = false;
+        /* Submissions signal a timeline semaphore instead of fences, see
+         * gpu_timeline */
+        bool timelineSemaphoreExtension = false;
+        /* Frames between budget queries */
+        const uint32_t BUDGET_UPDATE_FRAMES = 16;
+
         /* Features */ 
 
         /* Layers */
         std::vector<VkLayerProperties> layerProperties; 
 
         /* Resources */ 
-        VkSurfaceKHR surface;
         VkQueue graphicsQueue; 
         VkQueue presentQueue; 
-        VkSwapchainKHR swapchain;
+        /* Shared by every view, so they share the render pass */
         VkFormat swapchainImageFormat;
-        VkExtent2D swapchainExtent;
-        swapchain_support_details_t swapchainSupportDetails;
-        std::vector<VkImage> swapchainImages;
-        std::vector<VkImageView> swapchainImageViews;
-        VkRenderPass renderPass;
-        std::vector<VkFramebuffer> swapchainFramebuffers;
-        VkPipelineLayout graphicsPipelineLayout;
-        VkPipeline graphicsPipeline;
+        VkFormat depthFormat;
+        unique_render_pass renderPass;
+        /* Occlusion culling draws every view twice: renderPass clears,
+         * reloadRenderPass continues where it left off */
+        unique_render_pass reloadRenderPass;
+        uint32_t renderPhases = 1;
+        unique_pipeline_layout graphicsPipelineLayout;
+        /* Parent of every variant, built from graphicsPipelineKey */
+        unique_pipeline graphicsPipeline;
+        pipeline_key_t graphicsPipelineKey;
+        unique_shader_module vertShaderModule;
+        unique_shader_module fragShaderModule;
+        /* Every pipeline is created through it; warm-up merges its per
+         * thread caches into it */
+        unique_pipeline_cache pipelineCache;
+        /* Variants by packed key, created on first use or at warm-up */
+        std::unordered_map<uint64_t, unique_pipeline> pipelineVariants;
+        std::mutex pipelineMutex;
+        /* What the command buffers bind */
+        VkPipeline activePipeline = VK_NULL_HANDLE;
         VkCommandPool commandPool;
+        /* One per frame in flight, drawing every view */
         std::vector<VkCommandBuffer> commandBuffers;
-        VkSemaphore imageAvailableSemaphore;
-        VkSemaphore renderFinishedSemaphore;
+        /* Mesh */
+        bool meshLoaded = false;
+        mesh_file_header_t meshHeader;
+        device_buffer_t meshVertexBuffer;
+        device_buffer_t meshIndexBuffer;
+        std::vector<mesh_submesh_t> meshSubmeshes;
+        std::vector<mesh_lod_t> meshLods;
+        /* Scene, all nodes drawing the mesh */
+        scene_graph scene;
+        std::vector<uint32_t> spinningNodes;
+        float sceneSpacing = 1.f;
+        float sceneRadius = 0.f;
+        uint64_t sceneStart = 0;
+        /* Culling output, then each object's level of detail */
+        std::vector<uint32_t> visibleObjects;
+        std::vector<uint8_t> objectLods;
+        /* Instances per level this frame, stored by level in the frame's
+         * instance buffer */
+        std::vector<uint32_t> lodInstanceCounts;
+        std::vector<uint32_t> lodFirstInstance;
+        std::vector<uint32_t> lodCursor;
+        /* Visible objects keyed by material and depth, in the order their
+         * instances are written */
+        std::vector<draw_item_t> drawItems;
+        std::vector<draw_item_t> drawScratch;
+        /* State the command buffer being recorded has bound */
+        draw_state_tracker drawState;
+        std::vector<device_buffer_t> instanceBuffers;
+        VkBufferUsageFlags instanceBufferUsage = 0;
+        /* View with the widest aspect ratio, whose frustum culling and
+         * level selection use */
+        uint32_t widestView = 0;
+
+        /* Materials of the mesh shaders, all in one descriptor set. With
+         * descriptor indexing every texture is its own image and slot of
+         * the array, otherwise they are the layers of one image */
+        unique_descriptor_set_layout materialSetLayout;
+        unique_descriptor_pool materialDescriptorPool;
+        VkDescriptorSet materialSet = VK_NULL_HANDLE;
+        unique_sampler materialSampler;
+        device_buffer_t materialBuffer;
+        std::vector<device_image_t> materialTextures;
+        uint32_t bindlessTextures = 0;  //slots written so far
+
+        /* Occlusion culling (--occlusion). Phase 0 tests the frustum
+         * culled objects against the depth pyramid of the previous frame
+         * and draws the survivors; the pyramid is then rebuilt from the
+         * widest view's depth and phase 1 tests and draws the rest */
+        device_image_t depthPyramid;
+        std::vector<unique_image_view> depthPyramidLevels;
+        bool depthPyramidValid = false;
+        glm::mat4 depthPyramidViewProjection;
+        unique_sampler depthPyramidSampler;
+        unique_descriptor_set_layout pyramidSetLayout;
+        unique_descriptor_set_layout cullSetLayout;
+        unique_descriptor_pool occlusionDescriptorPool;
+        std::vector<VkDescriptorSet> pyramidSets;
+        unique_pipeline_layout pyramidPipelineLayout;
+        unique_pipeline_layout cullPipelineLayout;
+        unique_pipeline pyramidPipeline;
+        unique_pipeline cullPipeline;
+        std::vector<occlusion_frame_t> occlusionFrames;
+        uint32_t occlusionDraws = 0;    //indirect draws per phase
+        occlusion_stats_t occlusionStats;
+
+        /* Frames the CPU may record ahead of the GPU */
+        const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+        uint32_t currentFrame = 0;
+        /* Waited on by the present of all views */
+        std::vector<VkSemaphore> renderFinishedSemaphores;
+        /* Every semaphore and fence comes from the pools. graphicsTimeline
+         * counts the submissions to the graphics queue, frames and uploads
+         * alike; frameTimelineValues holds what each frame in flight
+         * reaches */
+        fence_pool fencePool;
+        semaphore_pool semaphorePool;
+        gpu_timeline graphicsTimeline;
+        std::vector<uint64_t> frameTimelineValues;
+        /* Pipeline statistics, one query per view per frame in flight.
+         * Null when the device lacks pipelineStatisticsQuery. A frame's
+         * results are read once its fence has been waited on */
+        VkQueryPool statisticsQueryPool = VK_NULL_HANDLE;
+        std::vector<bool> statisticsPending;
+        pipeline_stats_t pipelineStats;
+        std::vector<uint64_t> statisticsResults;
+        /* GPU time of each frame: a timestamp at the start and the end of
+         * its command buffer. Null when the graphics queue has no
+         * timestamps. frameRenderScales holds the scale each frame in
+         * flight was recorded with */
+        VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+        std::vector<bool> timestampsPending;
+        std::vector<double> frameRenderScales;
+        uint64_t timestampMask = 0;
+        double timestampPeriodNs = 1.0;
+        frame_stats_t gpuFrameStats;
+        /* Dynamic resolution (--dynamic-resolution), off when the
+         * swapchains cannot be blitted to or there are no timestamps */
+        bool dynamicResolution = false;
+        resolution_scaler resolutionScaler;
+        /* Post-processing (--post), off when the device cannot render to,
+         * store to or blit from HDR_FORMAT */
+        bool postProcess = false;
+        unique_sampler postSampler;
+        unique_descriptor_set_layout downsampleSetLayout;
+        unique_descriptor_set_layout upsampleSetLayout;
+        unique_descriptor_set_layout compositeSetLayout;
+        unique_descriptor_pool postDescriptorPool;
+        unique_pipeline_layout downsamplePipelineLayout;
+        unique_pipeline_layout upsamplePipelineLayout;
+        unique_pipeline_layout compositePipelineLayout;
+        unique_pipeline downsamplePipeline;
+        unique_pipeline upsamplePipeline;
+        unique_pipeline compositePipeline;
+        /* Frame capture (--capture): readback buffers for view 0, the
+         * slot each frame in flight copies into, -1 for none */
+        bool capturing = false;
+        frame_capture frameCapture;
+        std::vector<device_buffer_t> captureBuffers;
+        std::vector<int32_t> frameCaptureSlots;
+        /* Either of the two draws the scene into each view's color image
+         * instead of the swapchain image, in sceneFormat */
+        bool sceneOffscreen = false;
+        VkFormat sceneFormat = VK_FORMAT_UNDEFINED;
+        /* Per view, rebuilt every frame; kept to avoid allocating */
+        std::vector<VkSemaphore> frameWaitSemaphores;
+        std::vector<VkPipelineStageFlags> frameWaitStages;
+        std::vector<VkSwapchainKHR> presentSwapchains;
+        std::vector<uint32_t> presentImageIndices;
+        std::vector<VkResult> presentResults;
+        /* Serial of the frame being prepared; frames before it have been
+         * submitted */
+        std::atomic<uint64_t> frameNumber{0};
+        /* Objects replaced at run time, waiting for their last frame */
+        deletion_queue deletionQueue;
+
+        /* Frame pacing */
+        frame_pacer framePacer;
+
+        /* Render thread. The queue is lock-free; the mutex and condition
+         * variable are only used to sleep while there is nothing to draw */
+        spsc_queue<frame_packet_t, 64> packetQueue;
+        std::mutex renderWakeMutex;
+        std::condition_variable renderWake;
 
 
 }; 